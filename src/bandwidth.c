@@ -0,0 +1,218 @@
+/* Bandwidth limiting shared by all transfers.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* --limit-rate and --limit-rate-per-host are enforced with token
+   buckets that every transfer of the Wget process and of its
+   --parallel and --segments workers draws from, so that the limits
+   apply to the total rate rather than to each connection.
+
+   A bucket is kept as the time at which the data received so far
+   would have finished arriving at the limited rate.  A read of N
+   bytes pushes that time N / RATE seconds further, and the reader
+   then sleeps until it is reached, with sub-millisecond accuracy.
+   Because every read pays for itself, a connection that reads more
+   waits more, which keeps the concurrent transfers fair to each
+   other.  The buckets live in memory shared with the workers and are
+   updated atomically, without locking.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
+#ifndef WINDOWS
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+#else
+# include <winsock2.h>
+# include <ws2tcpip.h>
+#endif
+
+#include "utils.h"
+#include "ptimer.h"
+#include "bandwidth.h"
+
+/* Share the buckets with the workers if memory can be shared across
+   fork and updated atomically.  Otherwise, each process meters its
+   own transfers.  */
+#if defined HAVE_MMAP && defined MAP_ANONYMOUS && defined __GNUC__
+# define SHARED_BUCKETS
+#endif
+
+/* Number of per-host buckets.  Hosts are hashed to them, so two hosts
+   rarely share a limit.  */
+#define HOST_BUCKETS 64
+
+/* How far, in nanoseconds, a bucket may fall behind the clock.  This
+   lets a transfer make up for sleeping slightly too long, at the cost
+   of an equally small burst after being idle.  */
+#define BUCKET_SLACK 10000000
+
+struct bandwidth_bucket {
+  volatile int64_t tat;         /* when the data taken so far would
+                                   have arrived, in nanoseconds on
+                                   BUCKET_CLOCK */
+};
+
+struct buckets {
+  struct bandwidth_bucket total;
+  struct bandwidth_bucket hosts[HOST_BUCKETS];
+};
+
+static struct buckets *buckets;
+
+/* The clock of the buckets.  It is created before the workers are
+   forked, so it reads the same in all processes.  */
+static struct ptimer *bucket_clock;
+
+/* Set up the buckets.  This must be called before the workers are
+   started for them to share the limits.  */
+
+void
+bandwidth_init (void)
+{
+  if (buckets)
+    return;
+#ifdef SHARED_BUCKETS
+  {
+    void *map = mmap (NULL, sizeof *buckets, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map != MAP_FAILED)
+      buckets = map;
+  }
+#endif
+  if (!buckets)
+    buckets = xnew0 (struct buckets);
+  bucket_clock = ptimer_new ();
+}
+
+/* Return the bucket limiting the rate of transfers from the peer of
+   the socket FD, or NULL if there is no per-host limit.  */
+
+struct bandwidth_bucket *
+bandwidth_host_bucket (int fd)
+{
+  struct sockaddr_storage storage;
+  struct sockaddr *sa = (struct sockaddr *) &storage;
+  socklen_t addrlen = sizeof storage;
+  const unsigned char *addr;
+  size_t len, i;
+  uint32_t h = 2166136261u;
+
+  if (!opt.limit_rate_per_host)
+    return NULL;
+  bandwidth_init ();
+  if (getpeername (fd, sa, &addrlen) < 0)
+    return &buckets->hosts[0];
+
+  switch (sa->sa_family)
+    {
+    case AF_INET:
+      addr = (unsigned char *) &((struct sockaddr_in *) sa)->sin_addr;
+      len = sizeof (struct in_addr);
+      break;
+#ifdef ENABLE_IPV6
+    case AF_INET6:
+      addr = (unsigned char *) &((struct sockaddr_in6 *) sa)->sin6_addr;
+      len = sizeof (struct in6_addr);
+      break;
+#endif
+    default:
+      return &buckets->hosts[0];
+    }
+
+  /* FNV-1a */
+  for (i = 0; i < len; i++)
+    {
+      h ^= addr[i];
+      h *= 16777619u;
+    }
+  return &buckets->hosts[h % HOST_BUCKETS];
+}
+
+/* Take BYTES out of BUCKET, which is limited to RATE bytes per second,
+   at time NOW.  Returns the time the taker should wait until.  */
+
+static int64_t
+bucket_take (struct bandwidth_bucket *bucket, wgint bytes, wgint rate,
+             int64_t now)
+{
+  int64_t cost = (double) bytes / rate * 1e9;
+  int64_t tat, new_tat;
+
+#ifdef SHARED_BUCKETS
+  do
+    {
+      tat = bucket->tat;
+      new_tat = MAX (tat, now - BUCKET_SLACK) + cost;
+    }
+  while (!__sync_bool_compare_and_swap (&bucket->tat, tat, new_tat));
+#else
+  tat = bucket->tat;
+  new_tat = MAX (tat, now - BUCKET_SLACK) + cost;
+  bucket->tat = new_tat;
+#endif
+  return new_tat;
+}
+
+/* Account for BYTES just received, from the host limited by HOST if
+   it is not NULL, and sleep as long as needed to keep the transfers
+   within --limit-rate and --limit-rate-per-host.  */
+
+void
+bandwidth_limit (struct bandwidth_bucket *host, wgint bytes)
+{
+  int64_t now, until = 0, host_until;
+
+  if (bytes <= 0)
+    return;
+  bandwidth_init ();
+  now = ptimer_measure (bucket_clock) * 1e9;
+
+  if (opt.limit_rate)
+    until = bucket_take (&buckets->total, bytes, opt.limit_rate, now);
+  if (host)
+    {
+      host_until = bucket_take (host, bytes, opt.limit_rate_per_host, now);
+      until = MAX (until, host_until);
+    }
+
+  if (until > now)
+    {
+      DEBUGP (("sleeping %.3f ms for %s bytes\n", (until - now) / 1e6,
+               number_to_static_string (bytes)));
+      xsleep ((until - now) / 1e9);
+    }
+}
@@ -38,6 +38,7 @@ as that of the covered work.  */
 
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <poll.h>
 
 #ifndef WINDOWS
 # ifdef __VMS
@@ -53,11 +54,17 @@ as that of the covered work.  */
 
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/time.h>
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
 #include "utils.h"
 #include "host.h"
 #include "connect.h"
 #include "hash.h"
+#include "ptimer.h"
+#include "uring.h"
 
 #include <stdint.h>
 
@@ -251,59 +258,55 @@ connect_with_timeout (int fd, const struct sockaddr *addr, socklen_t addrlen,
   return ctx.result;
 }
 
-/* Connect via TCP to the specified address and port.
-
-   If PRINT is non-NULL, it is the host name to print that we're
-   connecting to.  */
+/* Print the "Connecting to..." line for connecting to IP on PORT,
+   with PRINT being the host name we're connecting to.  */
 
-int
-connect_to_ip (const ip_address *ip, int port, const char *print)
+static void
+log_connecting (const ip_address *ip, int port, const char *print)
 {
-  struct sockaddr_storage ss;
-  struct sockaddr *sa = (struct sockaddr *)&ss;
-  int sock;
-
-  /* If PRINT is non-NULL, print the "Connecting to..." line, with
-     PRINT being the host name we're connecting to.  */
-  if (print)
+  const char *txt_addr = print_address (ip);
+  if (0 != strcmp (print, txt_addr))
     {
-      const char *txt_addr = print_address (ip);
-      if (0 != strcmp (print, txt_addr))
-        {
-          char *str = NULL, *name;
+      char *str = NULL, *name;
 
-          if (opt.enable_iri && (name = idn_decode ((char *) print)) != NULL)
-            {
-              int len = strlen (print) + strlen (name) + 4;
-              str = xmalloc (len);
-              snprintf (str, len, "%s (%s)", name, print);
-              str[len-1] = '\0';
-              xfree (name);
-            }
+      if (opt.enable_iri && (name = idn_decode ((char *) print)) != NULL)
+        {
+          int len = strlen (print) + strlen (name) + 4;
+          str = xmalloc (len);
+          snprintf (str, len, "%s (%s)", name, print);
+          str[len-1] = '\0';
+          xfree (name);
+        }
 
-          logprintf (LOG_VERBOSE, _("Connecting to %s|%s|:%d... "),
-                     str ? str : escnonprint_uri (print), txt_addr, port);
+      logprintf (LOG_VERBOSE, _("Connecting to %s|%s|:%d... "),
+                 str ? str : escnonprint_uri (print), txt_addr, port);
 
-          xfree (str);
-        }
-      else
-        {
-           if (ip->family == AF_INET)
-               logprintf (LOG_VERBOSE, _("Connecting to %s:%d... "), txt_addr, port);
+      xfree (str);
+    }
+  else
+    {
+       if (ip->family == AF_INET)
+           logprintf (LOG_VERBOSE, _("Connecting to %s:%d... "), txt_addr, port);
 #ifdef ENABLE_IPV6
-           else if (ip->family == AF_INET6)
-               logprintf (LOG_VERBOSE, _("Connecting to [%s]:%d... "), txt_addr, port);
+       else if (ip->family == AF_INET6)
+           logprintf (LOG_VERBOSE, _("Connecting to [%s]:%d... "), txt_addr, port);
 #endif
-        }
     }
+}
 
-  /* Store the sockaddr info to SA.  */
-  sockaddr_set_data (sa, ip, port);
+/* Create a socket suitable for connecting to SA, with the options
+   requested by the user applied to it.  Returns the socket, or -1 on
+   failure with errno set.  */
+
+static int
+make_socket (const struct sockaddr *sa)
+{
+  int sock;
 
   /* Create the socket of the family appropriate for the address.  */
   sock = socket (sa->sa_family, SOCK_STREAM, 0);
   if (sock < 0)
-    goto err;
+    return -1;
 
 #if defined(ENABLE_IPV6) && defined(IPV6_V6ONLY)
   if (opt.ipv6_only) {
@@ -342,10 +345,42 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
       if (resolve_bind_address (bind_sa))
         {
           if (bind (sock, bind_sa, sockaddr_size (bind_sa)) < 0)
-            goto err;
+            {
+              int save_errno = errno;
+              fd_close (sock);
+              errno = save_errno;
+              return -1;
+            }
         }
     }
 
+  return sock;
+}
+
+/* Connect via TCP to the specified address and port.
+
+   If PRINT is non-NULL, it is the host name to print that we're
+   connecting to.  */
+
+int
+connect_to_ip (const ip_address *ip, int port, const char *print)
+{
+  struct sockaddr_storage ss;
+  struct sockaddr *sa = (struct sockaddr *)&ss;
+  int sock = -1;
+
+  /* If PRINT is non-NULL, print the "Connecting to..." line, with
+     PRINT being the host name we're connecting to.  */
+  if (print)
+    log_connecting (ip, port, print);
+
+  /* Store the sockaddr info to SA.  */
+  sockaddr_set_data (sa, ip, port);
+
+  sock = make_socket (sa);
+  if (sock < 0)
+    goto err;
+
   /* Connect the socket to the remote endpoint.  */
   if (connect_with_timeout (sock, sa, sockaddr_size (sa),
                             opt.connect_timeout) < 0)
@@ -356,6 +391,7 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
   if (print)
     logprintf (LOG_VERBOSE, _("connected.\n"));
   DEBUGP (("Created socket %d.\n", sock));
+  uring_register (sock);
   return sock;
 
  err:
@@ -372,11 +408,266 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
   }
 }
 
+/* Convert a timeout of SECONDS to the milliseconds poll expects,
+   rounding up, so that a short timeout doesn't become a busy loop.  A
+   negative timeout means waiting indefinitely.  */
+
+static int
+poll_timeout (double seconds)
+{
+  if (seconds < 0)
+    return -1;
+  if (seconds >= INT_MAX / 1000)
+    return INT_MAX;
+  return (int) (seconds * 1000 + 0.999);
+}
+
+#ifdef F_GETFL
+
+/* How long to wait for a connection attempt before starting the next
+   one in parallel, as recommended by RFC 8305 ("Happy Eyeballs").  */
+#define CONNECTION_ATTEMPT_DELAY 0.25
+
+struct connect_attempt {
+  int index;                    /* index of the address in the list */
+  int sock;                     /* the connecting socket, or -1 */
+  int flags;                    /* the socket's original file flags */
+  double started;               /* when the attempt was started */
+};
+
+/* Order the addresses of AL between START and END in which they should
+   be tried: alternating between address families, beginning with the
+   family of the first address, and otherwise keeping the order of the
+   list (and thus the user's --prefer-family).  */
+
+static void
+order_attempts (const struct address_list *al, int start, int end,
+                struct connect_attempt *attempts)
+{
+  int family = address_list_address_at (al, start)->family;
+  int same = start, other = start, i;
+
+  for (i = 0; i < end - start; i++)
+    {
+      bool want_same = (i % 2 == 0);
+      int *pos;
+
+      /* Advance to the next unused address of the wanted family,
+         falling back to the other family when one runs out.  */
+      while (same < end && address_list_address_at (al, same)->family != family)
+        ++same;
+      while (other < end && address_list_address_at (al, other)->family == family)
+        ++other;
+      if (same >= end)
+        want_same = false;
+      else if (other >= end)
+        want_same = true;
+      pos = want_same ? &same : &other;
+
+      attempts[i].index = (*pos)++;
+      attempts[i].sock = -1;
+    }
+}
+
+/* Start connecting to the address of ATTEMPT without blocking.
+   Returns 1 if the connection was established immediately, 0 if it
+   is in progress, and -1 if it failed, with errno set.  */
+
+static int
+start_attempt (const struct address_list *al, int port,
+               struct connect_attempt *attempt, double now)
+{
+  struct sockaddr_storage ss;
+  struct sockaddr *sa = (struct sockaddr *)&ss;
+  const ip_address *ip = address_list_address_at (al, attempt->index);
+  int sock;
+
+  sockaddr_set_data (sa, ip, port);
+  sock = make_socket (sa);
+  if (sock < 0)
+    return -1;
+
+  DEBUGP (("Trying %s on socket %d.\n", print_address (ip), sock));
+  attempt->sock = sock;
+  attempt->started = now;
+  attempt->flags = fcntl (sock, F_GETFL, 0);
+  if (attempt->flags < 0
+      || fcntl (sock, F_SETFL, attempt->flags | O_NONBLOCK) < 0)
+    return -1;
+
+  if (connect (sock, sa, sockaddr_size (sa)) == 0)
+    return 1;
+  return errno == EINPROGRESS || errno == EINTR ? 0 : -1;
+}
+
+/* Report the failure of ATTEMPT with error ERR and close its socket.  */
+
+static void
+fail_attempt (const struct address_list *al, int port, const char *host,
+              struct connect_attempt *attempt, int err)
+{
+  log_connecting (address_list_address_at (al, attempt->index), port, host);
+  logprintf (LOG_VERBOSE, _("failed: %s.\n"), strerror (err));
+  if (attempt->sock >= 0)
+    fd_close (attempt->sock);
+  attempt->sock = -1;
+}
+
+/* Connect to one of the addresses of AL between START and END,
+   racing the attempts as described by RFC 8305: attempts are started
+   CONNECTION_ATTEMPT_DELAY apart, or as soon as the previous one
+   fails, and the first connection to be established wins.  This way
+   an unreachable address, typically a broken IPv6 route on a
+   dual-stack host, costs a fraction of a second instead of the whole
+   connect timeout.
+
+   Returns the connected socket and stores the index of its address
+   to *WINNER, or returns -1 with errno set if all attempts failed.  */
+
+static int
+connect_race (const struct address_list *al, int start, int end, int port,
+              const char *host, int *winner)
+{
+  int count = end - start;
+  struct connect_attempt *attempts = xnew_array (struct connect_attempt, count);
+  struct pollfd *pfds = xnew_array (struct pollfd, count);
+  struct ptimer *timer = ptimer_new ();
+  int started = 0, active = 0;
+  int sock = -1, err = ETIMEDOUT;
+  int i;
+  double next_start = 0;
+
+  order_attempts (al, start, end, attempts);
+
+  while (sock < 0 && (active || started < count))
+    {
+      double now = ptimer_measure (timer);
+      double wait = -1;
+      int nfds = 0;
+
+      /* Start the next attempt when its turn has come, or right away
+         if nothing else is in flight.  */
+      if (started < count && (!active || now >= next_start))
+        {
+          struct connect_attempt *attempt = &attempts[started++];
+          int res = start_attempt (al, port, attempt, now);
+          if (res > 0)
+            {
+              sock = attempt->sock;
+              *winner = attempt->index;
+              break;
+            }
+          else if (res < 0)
+            fail_attempt (al, port, host, attempt, err = errno);
+          else
+            ++active;
+          next_start = now + CONNECTION_ATTEMPT_DELAY;
+          continue;
+        }
+
+      /* Wait until one of the attempts completes, the next one is
+         due, or the oldest one times out.  */
+      for (i = 0; i < started; i++)
+        {
+          struct connect_attempt *attempt = &attempts[i];
+          double left;
+          if (attempt->sock < 0)
+            continue;
+          if (opt.connect_timeout)
+            {
+              left = attempt->started + opt.connect_timeout - now;
+              if (left <= 0)
+                {
+                  fail_attempt (al, port, host, attempt, err = ETIMEDOUT);
+                  --active;
+                  continue;
+                }
+              if (wait < 0 || left < wait)
+                wait = left;
+            }
+          pfds[nfds].fd = attempt->sock;
+          pfds[nfds].events = POLLOUT;
+          pfds[nfds].revents = 0;
+          ++nfds;
+        }
+      if (started < count && active && (wait < 0 || next_start - now < wait))
+        wait = MAX (0, next_start - now);
+      if (!nfds)
+        continue;
+
+      {
+        int res = poll (pfds, nfds, poll_timeout (wait));
+        if (res < 0 && errno != EINTR)
+          {
+            err = errno;
+            break;
+          }
+        if (res <= 0)
+          continue;
+      }
+
+      for (i = 0; i < started; i++)
+        {
+          struct connect_attempt *attempt = &attempts[i];
+          int sockerr = 0, j;
+          socklen_t len = sizeof (sockerr);
+
+          if (attempt->sock < 0)
+            continue;
+          for (j = 0; j < nfds; j++)
+            if (pfds[j].fd == attempt->sock)
+              break;
+          if (j == nfds || !pfds[j].revents)
+            continue;
+          if (getsockopt (attempt->sock, SOL_SOCKET, SO_ERROR,
+                          (void *) &sockerr, &len) < 0)
+            sockerr = errno;
+          if (sockerr == 0)
+            {
+              sock = attempt->sock;
+              *winner = attempt->index;
+              break;
+            }
+          fail_attempt (al, port, host, attempt, err = sockerr);
+          --active;
+        }
+    }
+
+  /* Abandon the attempts that lost the race.  */
+  for (i = 0; i < started; i++)
+    if (attempts[i].sock >= 0 && attempts[i].sock != sock)
+      {
+        DEBUGP (("Abandoning connection attempt on socket %d.\n",
+                 attempts[i].sock));
+        fd_close (attempts[i].sock);
+      }
+
+  if (sock >= 0)
+    {
+      for (i = 0; i < started; i++)
+        if (attempts[i].sock == sock)
+          fcntl (sock, F_SETFL, attempts[i].flags);
+      log_connecting (address_list_address_at (al, *winner), port, host);
+      logprintf (LOG_VERBOSE, _("connected.\n"));
+      DEBUGP (("Created socket %d.\n", sock));
+      uring_register (sock);
+    }
+
+  ptimer_destroy (timer);
+  xfree (pfds);
+  xfree (attempts);
+  errno = err;
+  return sock;
+}
+
+#endif /* F_GETFL */
+
 /* Connect via TCP to a remote host on the specified port.
 
    HOST is resolved as an Internet host name.  If HOST resolves to
-   more than one IP address, they are tried in the order returned by
-   DNS until connecting to one of them succeeds.  */
+   more than one IP address, connections to them are raced (see
+   connect_race) in the order returned by DNS, and the first one to
+   succeed is used.  */
 
 int
 connect_to_host (const char *host, int port)
@@ -396,6 +687,27 @@ connect_to_host (const char *host, int port)
     }
 
   address_list_get_bounds (al, &start, &end);
+#ifdef F_GETFL
+  if (end - start > 1)
+    {
+      int winner;
+      sock = connect_race (al, start, end, port, host, &winner);
+      if (sock >= 0)
+        {
+          /* The addresses before the winner have either failed or
+             were slower; don't make the next connection wait for
+             them again.  */
+          for (i = start; i < winner; i++)
+            address_list_set_faulty (al, i);
+          address_list_set_connected (al);
+          address_list_release (al);
+          return sock;
+        }
+      for (i = start; i < end; i++)
+        address_list_set_faulty (al, i);
+    }
+  else
+#endif /* F_GETFL */
   for (i = start; i < end; i++)
     {
       const ip_address *ip = address_list_address_at (al, i);
@@ -527,6 +839,8 @@ accept_connection (int local_sock)
     }
   sock = accept (local_sock, sa, &addrlen);
   DEBUGP (("Accepted client at socket %d.\n", sock));
+  if (sock >= 0)
+    uring_register (sock);
   return sock;
 }
 
@@ -665,33 +979,30 @@ retryable_socket_connect_error (int err)
    -1 for error.  The argument WAIT_FOR can be a combination of
    WAIT_FOR_READ and WAIT_FOR_WRITE.
 
-   This is a mere convenience wrapper around the select call, and
+   This is a mere convenience wrapper around the poll call, and
    should be taken as such (for example, it doesn't implement Wget's
-   0-timeout-means-no-timeout semantics.)  */
+   0-timeout-means-no-timeout semantics.)  Unlike select, poll works
+   with descriptors of any value, which matters in a process that
+   holds the pipes of many --parallel workers.  */
 
 int
 select_fd (int fd, double maxtime, int wait_for)
 {
-  fd_set fdset;
-  fd_set *rd = NULL, *wr = NULL;
-  struct timeval tmout;
+  struct pollfd pfd;
   int result;
 
-  FD_ZERO (&fdset);
-  FD_SET (fd, &fdset);
+  pfd.fd = fd;
+  pfd.events = 0;
   if (wait_for & WAIT_FOR_READ)
-    rd = &fdset;
+    pfd.events |= POLLIN;
   if (wait_for & WAIT_FOR_WRITE)
-    wr = &fdset;
-
-  tmout.tv_sec = (long) maxtime;
-  tmout.tv_usec = 1000000 * (maxtime - (long) maxtime);
+    pfd.events |= POLLOUT;
 
   do
   {
-    result = select (fd + 1, rd, wr, NULL, &tmout);
+    result = poll (&pfd, 1, poll_timeout (maxtime));
 #ifdef WINDOWS
-    /* gnulib select() converts blocking sockets to nonblocking in windows.
+    /* gnulib poll() converts blocking sockets to nonblocking in windows.
        wget uses blocking sockets so we must convert them back to blocking.  */
     set_windows_fd_as_blocking_socket (fd);
 #endif
@@ -712,30 +1023,47 @@ select_fd (int fd, double maxtime, int wait_for)
    this function, where such pending data can only be unwanted
    leftover from a previous request.  */
 
+static bool fd_buffered_p (int);
+
 bool
 test_socket_open (int sock)
 {
-  fd_set check_set;
-  struct timeval to;
-  int ret = 0;
+  int ret;
+
+  /* Data left over in the read buffer is pending as well.  */
+  if (fd_buffered_p (sock))
+    return false;
 
   /* Check if we still have a valid (non-EOF) connection.  From Andrew
-   * Maholski's code in the Unix Socket FAQ.  */
+   * Maholski's code in the Unix Socket FAQ.
+   *
+   * Waiting a microsecond, rather than not at all, gives the FIN of a
+   * server that closes the connection right after its response the
+   * time to arrive; otherwise the next request is sent on the closed
+   * connection and fails with "No data received".  poll can't wait
+   * less than a millisecond, so select is used where it can be.  */
+  if (sock < FD_SETSIZE)
+    {
+      fd_set check_set;
+      struct timeval to;
 
-  FD_ZERO (&check_set);
-  FD_SET (sock, &check_set);
+      FD_ZERO (&check_set);
+      FD_SET (sock, &check_set);
 
-  /* Wait one microsecond */
-  to.tv_sec = 0;
-  to.tv_usec = 1;
+      /* Wait one microsecond */
+      to.tv_sec = 0;
+      to.tv_usec = 1;
 
-  ret = select (sock + 1, &check_set, NULL, NULL, &to);
+      ret = select (sock + 1, &check_set, NULL, NULL, &to);
 #ifdef WINDOWS
 /* gnulib select() converts blocking sockets to nonblocking in windows.
 wget uses blocking sockets so we must convert them back to blocking
 */
-  set_windows_fd_as_blocking_socket ( sock );
+      set_windows_fd_as_blocking_socket ( sock );
 #endif
+    }
+  else
+    ret = select_fd (sock, 0, WAIT_FOR_READ);
 
   if ( !ret )
     /* We got a timeout, it means we're still connected. */
@@ -774,16 +1102,6 @@ sock_poll (int fd, double timeout, int wait_for)
   return select_fd (fd, timeout, wait_for);
 }
 
-static int
-sock_peek (int fd, char *buf, int bufsize)
-{
-  int res;
-  do
-    res = recv (fd, buf, bufsize, MSG_PEEK);
-  while (res == -1 && errno == EINTR);
-  return res;
-}
-
 static void
 sock_close (int fd)
 {
@@ -800,42 +1118,89 @@ sock_close (int fd)
    sockets.
 
    That way the user code can call fd_read(fd, ...) and we'll run read
-   or SSL_read or whatever is necessary.  */
+   or SSL_read or whatever is necessary.
+
+   Data is read from the transport in large blocks into a buffer kept
+   per connection, so that fd_peek and fd_read of the same bytes cost
+   a single system call, and the part of a block that follows a
+   response head or a chunk header is returned by subsequent fd_read
+   calls without touching the transport.  */
+
+/* Size of the read buffer, large enough to usually receive a whole
+   response head along with the beginning of the body.  */
+#define READ_BUFFER_SIZE 16384
 
 static struct hash_table *transport_map;
 static unsigned int transport_map_modified_tick;
 
 struct transport_info {
-  struct transport_implementation *imp;
+  struct transport_implementation *imp; /* NULL for plain sockets */
   void *ctx;
+
+  /* Data read from the transport, but not yet by the caller, is
+     between BUFFER + BUFPOS and BUFFER + BUFEND.  */
+  char *buffer;
+  int bufpos, bufend;
 };
 
+static struct transport_info *
+transport_info_new (int fd)
+{
+  struct transport_info *info = xnew0 (struct transport_info);
+
+  /* The file descriptor must be non-negative to be registered.
+     Negative values are ignored by fd_close(), and -1 cannot be used as
+     hash key.  */
+  assert (fd >= 0);
+
+  if (!transport_map)
+    transport_map = hash_table_new (0, NULL, NULL);
+  hash_table_put (transport_map, (void *)(intptr_t) fd, info);
+  ++transport_map_modified_tick;
+  return info;
+}
+
 /* Register the transport layer operations that will be used when
    reading, writing, and polling FD.
 
    This should be used for transport layers like SSL that piggyback on
    sockets.  FD should otherwise be a real socket, on which you can
-   call getpeername, etc.  */
+   call getpeername, etc.
+
+   A transport already registered for FD is replaced.  The new one is
+   then responsible for calling it, see fd_transport.  */
 
 void
 fd_register_transport (int fd, struct transport_implementation *imp, void *ctx)
 {
-  struct transport_info *info;
-
-  /* The file descriptor must be non-negative to be registered.
-     Negative values are ignored by fd_close(), and -1 cannot be used as
-     hash key.  */
-  assert (fd >= 0);
+  struct transport_info *info = NULL;
 
-  info = xnew (struct transport_info);
+  if (transport_map)
+    info = hash_table_get (transport_map, (void *)(intptr_t) fd);
+  if (!info)
+    info = transport_info_new (fd);
   info->imp = imp;
   info->ctx = ctx;
-  if (!transport_map)
-    transport_map = hash_table_new (0, NULL, NULL);
-  hash_table_put (transport_map, (void *)(intptr_t) fd, info);
   ++transport_map_modified_tick;
 }
 
+/* Return the transport implementation registered for FD and store its
+   context to *CTX, or return NULL if FD is a plain socket.  This
+   allows stacking a transport, such as HTTP/2, on top of another,
+   such as SSL.  */
+
+struct transport_implementation *
+fd_transport (int fd, void **ctx)
+{
+  struct transport_info *info = NULL;
+  if (transport_map)
+    info = hash_table_get (transport_map, (void *)(intptr_t) fd);
+  if (!info)
+    return NULL;
+  *ctx = info->ctx;
+  return info->imp;
+}
+
 /* Return context of the transport registered with
    fd_register_transport.  This assumes fd_register_transport was
    previously called on FD.  */
@@ -881,7 +1246,7 @@ poll_internal (int fd, struct transport_info *info, int wf, double timeout)
   if (timeout)
     {
       int test;
-      if (info && info->imp->poller)
+      if (info && info->imp && info->imp->poller)
         test = info->imp->poller (fd, timeout, wf, info->ctx);
       else
         test = sock_poll (fd, timeout, wf);
@@ -893,22 +1258,57 @@ poll_internal (int fd, struct transport_info *info, int wf, double timeout)
   return true;
 }
 
+static int
+transport_read (int fd, struct transport_info *info, char *buf, int bufsize)
+{
+  if (info && info->imp && info->imp->reader)
+    return info->imp->reader (fd, buf, bufsize, info->ctx);
+  else
+    return sock_read (fd, buf, bufsize);
+}
+
+/* Return the number of bytes in INFO's read buffer.  */
+
+static int
+buffered (const struct transport_info *info)
+{
+  return info ? info->bufend - info->bufpos : 0;
+}
+
+/* Return true if FD's read buffer holds data not yet read.  */
+
+static bool
+fd_buffered_p (int fd)
+{
+  struct transport_info *info = NULL;
+  if (transport_map)
+    info = hash_table_get (transport_map, (void *)(intptr_t) fd);
+  return buffered (info) > 0;
+}
+
 /* Read no more than BUFSIZE bytes of data from FD, storing them to
    BUF.  If TIMEOUT is non-zero, the operation aborts if no data is
    received after that many seconds.  If TIMEOUT is -1, the value of
-   opt.timeout is used for TIMEOUT.  */
+   opt.timeout is used for TIMEOUT.
+
+   Data remaining in FD's read buffer is returned first, without
+   waiting; otherwise the transport is read into BUF directly.  */
 
 int
 fd_read (int fd, char *buf, int bufsize, double timeout)
 {
   struct transport_info *info;
   LAZY_RETRIEVE_INFO (info);
+  if (buffered (info))
+    {
+      int size = MIN (bufsize, buffered (info));
+      memcpy (buf, info->buffer + info->bufpos, size);
+      info->bufpos += size;
+      return size;
+    }
   if (!poll_internal (fd, info, WAIT_FOR_READ, timeout))
     return -1;
-  if (info && info->imp->reader)
-    return info->imp->reader (fd, buf, bufsize, info->ctx);
-  else
-    return sock_read (fd, buf, bufsize);
+  return transport_read (fd, info, buf, bufsize);
 }
 
 /* Like fd_read, except it provides a "preview" of the data that will
@@ -917,24 +1317,106 @@ fd_read (int fd, char *buf, int bufsize, double timeout)
    returns the number of bytes copied.  Return values and timeout
    semantics are the same as those of fd_read.
 
-   CAVEAT: Do not assume that the first subsequent call to fd_read
-   will retrieve the same amount of data.  Reading can return more or
-   less data, depending on the TCP implementation and other
-   circumstances.  However, barring an error, it can be expected that
-   all the peeked data will eventually be read by fd_read.  */
+   The peeked data is what FD's read buffer holds.  Only when it is
+   empty is the transport read, filling the buffer with as much data
+   as is available.  Subsequent calls to fd_read retrieve the peeked
+   data from the buffer, without reading the transport again.  */
 
 int
 fd_peek (int fd, char *buf, int bufsize, double timeout)
 {
+  struct transport_info *info;
+  int size;
+  LAZY_RETRIEVE_INFO (info);
+  if (!info)
+    info = transport_info_new (fd);
+  if (!buffered (info))
+    {
+      if (!poll_internal (fd, info, WAIT_FOR_READ, timeout))
+        return -1;
+      if (!info->buffer)
+        info->buffer = xmalloc (READ_BUFFER_SIZE);
+      info->bufpos = info->bufend = 0;
+      size = transport_read (fd, info, info->buffer, READ_BUFFER_SIZE);
+      if (size <= 0)
+        return size;
+      info->bufend = size;
+    }
+  size = MIN (bufsize, buffered (info));
+  memcpy (buf, info->buffer + info->bufpos, size);
+  return size;
+}
+
+#ifdef HAVE_SPLICE
+/* Like fd_read, except the data is not copied to a buffer, but moved
+   from FD to the pipe PIPEFD by the kernel, without passing through
+   user space.  Return values and timeout semantics are the same as
+   those of fd_read.  If FD's data can't be spliced, e.g. because it
+   is read through SSL, -1 is returned with errno set to EINVAL before
+   any data is consumed.  Data that is already in FD's read buffer is
+   written to the pipe.  */
+
+int
+fd_splice (int fd, int pipefd, int bufsize, double timeout)
+{
+  int res;
   struct transport_info *info;
   LAZY_RETRIEVE_INFO (info);
+  if (info && info->imp && info->imp->reader)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  if (buffered (info))
+    {
+      res = sock_write (pipefd, info->buffer + info->bufpos,
+                        MIN (bufsize, buffered (info)));
+      if (res > 0)
+        info->bufpos += res;
+      return res;
+    }
   if (!poll_internal (fd, info, WAIT_FOR_READ, timeout))
     return -1;
-  if (info && info->imp->peeker)
-    return info->imp->peeker (fd, buf, bufsize, info->ctx);
-  else
-    return sock_peek (fd, buf, bufsize);
+  do
+    res = splice (fd, NULL, pipefd, NULL, bufsize,
+                  SPLICE_F_MOVE | SPLICE_F_MORE);
+  while (res == -1 && errno == EINTR);
+  return res;
+}
+#endif /* HAVE_SPLICE */
+
+#if defined HAVE_SENDFILE && defined HAVE_SYS_SENDFILE_H
+/* Send no more than COUNT bytes of the file INFD, starting at
+   *OFFSET, to FD, without passing them through user space.  *OFFSET
+   is advanced by the amount sent, which is returned.  Timeout
+   semantics are the same as those of fd_write.  If FD's data can't be
+   sent that way, e.g. because it is written through SSL, -1 is
+   returned with errno set to EINVAL before anything is sent.  */
+
+int
+fd_sendfile (int fd, int infd, wgint *offset, wgint count, double timeout)
+{
+  int res;
+  off_t off = *offset;
+  struct transport_info *info;
+  LAZY_RETRIEVE_INFO (info);
+  if (info && info->imp && info->imp->writer)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  if (!poll_internal (fd, info, WAIT_FOR_WRITE, timeout))
+    return -1;
+  /* Keep the amount representable as the return value.  */
+  count = MIN (count, 1 << 30);
+  do
+    res = sendfile (fd, infd, &off, count);
+  while (res == -1 && errno == EINTR);
+  if (res > 0)
+    *offset = off;
+  return res;
 }
+#endif /* HAVE_SENDFILE && HAVE_SYS_SENDFILE_H */
 
 /* Write the entire contents of BUF to FD.  If TIMEOUT is non-zero,
    the operation aborts if no data is received after that many
@@ -955,7 +1437,7 @@ fd_write (int fd, char *buf, int bufsize, double timeout)
     {
       if (!poll_internal (fd, info, WAIT_FOR_WRITE, timeout))
         return -1;
-      if (info && info->imp->writer)
+      if (info && info->imp && info->imp->writer)
         res = info->imp->writer (fd, buf, bufsize, info->ctx);
       else
         res = sock_write (fd, buf, bufsize);
@@ -986,7 +1468,7 @@ fd_errstr (int fd)
   if (transport_map)
     info = hash_table_get (transport_map, (void *)(intptr_t) fd);
 
-  if (info && info->imp->errstr)
+  if (info && info->imp && info->imp->errstr)
     {
       const char *err = info->imp->errstr (fd, info->ctx);
       if (err)
@@ -1011,7 +1493,7 @@ fd_close (int fd)
   if (transport_map)
     info = hash_table_get (transport_map, (void *)(intptr_t) fd);
 
-  if (info && info->imp->closer)
+  if (info && info->imp && info->imp->closer)
     info->imp->closer (fd, info->ctx);
   else
     sock_close (fd);
@@ -1019,6 +1501,7 @@ fd_close (int fd)
   if (info)
     {
       hash_table_remove (transport_map, (void *)(intptr_t) fd);
+      xfree (info->buffer);
       xfree (info);
       ++transport_map_modified_tick;
     }
@@ -67,16 +67,22 @@ struct transport_implementation {
   int (*reader) (int, char *, int, void *);
   int (*writer) (int, char *, int, void *);
   int (*poller) (int, double, int, void *);
-  int (*peeker) (int, char *, int, void *);
   const char *(*errstr) (int, void *);
   void (*closer) (int, void *);
 };
 
 void fd_register_transport (int, struct transport_implementation *, void *);
 void *fd_transport_context (int);
+struct transport_implementation *fd_transport (int, void **);
 int fd_read (int, char *, int, double);
 int fd_write (int, char *, int, double);
 int fd_peek (int, char *, int, double);
+#ifdef HAVE_SPLICE
+int fd_splice (int, int, int, double);
+#endif
+#if defined HAVE_SENDFILE && defined HAVE_SYS_SENDFILE_H
+int fd_sendfile (int, int, wgint *, wgint, double);
+#endif
 const char *fd_errstr (int);
 void fd_close (int);
 
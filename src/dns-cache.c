@@ -0,0 +1,415 @@
+/* DNS cache file shared between Wget processes.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* With --dns-cache-file, the results of DNS lookups are kept in a file
+   that all Wget processes using it map into memory, so that a run can
+   use the lookups done by earlier or concurrent runs without asking
+   the resolver.
+
+   The file is a fixed-size hash table of host names, searched with
+   linear probing within a small window.  When the window is full, the
+   entry closest to expiry is replaced, so the file never grows.
+   Access is serialized with fcntl locks: shared ones for lookups and
+   exclusive ones for updates.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
+#ifndef WINDOWS
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+#else
+# include <winsock2.h>
+# include <ws2tcpip.h>
+#endif
+
+#include "utils.h"
+#include "host.h"
+#include "dns-cache.h"
+#include "c-ctype.h"
+#include "c-strcase.h"
+
+#if defined HAVE_MMAP && defined F_SETLKW
+
+#define DNS_CACHE_MAGIC "WgetDNS1"
+
+/* Number of entries in the file, and the number of consecutive
+   entries a host may be stored in.  */
+#define DNS_CACHE_SLOTS 1024
+#define DNS_CACHE_PROBES 8
+
+/* Addresses stored per host.  Additional ones are dropped.  */
+#define DNS_CACHE_ADDRESSES 8
+
+/* The on-disk layout uses fixed-size types so that Wget builds with
+   different configurations can share the file.  */
+
+struct dns_cache_address {
+  int32_t family;               /* AF_INET or AF_INET6 */
+  int32_t scope;                /* IPv6 scope ID */
+  unsigned char data[16];       /* the address, in network order */
+};
+
+struct dns_cache_slot {
+  char host[256];               /* lower-case host name, or "" */
+  int64_t expires;              /* when the entry becomes stale */
+  int32_t count;                /* number of ADDRESSES used */
+  struct dns_cache_address addresses[DNS_CACHE_ADDRESSES];
+};
+
+struct dns_cache_header {
+  char magic[8];                /* DNS_CACHE_MAGIC */
+  uint32_t slots;               /* DNS_CACHE_SLOTS */
+  uint32_t slot_size;           /* sizeof (struct dns_cache_slot) */
+};
+
+#define DNS_CACHE_SIZE (sizeof (struct dns_cache_header)                \
+                        + DNS_CACHE_SLOTS * sizeof (struct dns_cache_slot))
+
+static int cache_fd = -1;
+static struct dns_cache_header *cache_header;
+static struct dns_cache_slot *cache_slots;
+
+/* Set when the file couldn't be used, so that we don't retry (and
+   complain) for every lookup.  */
+static bool cache_disabled;
+
+/* Lock the whole file with a lock of TYPE: F_RDLCK, F_WRLCK or
+   F_UNLCK.  */
+
+static bool
+cache_lock (int type)
+{
+  struct flock fl;
+  xzero (fl);
+  fl.l_type = type;
+  fl.l_whence = SEEK_SET;
+  while (fcntl (cache_fd, F_SETLKW, &fl) < 0)
+    if (errno != EINTR)
+      return false;
+  return true;
+}
+
+static bool
+cache_header_valid_p (void)
+{
+  return (!memcmp (cache_header->magic, DNS_CACHE_MAGIC, 8)
+          && cache_header->slots == DNS_CACHE_SLOTS
+          && cache_header->slot_size == sizeof (struct dns_cache_slot));
+}
+
+/* Open and map the file specified with --dns-cache-file, creating it
+   if necessary.  Returns false if the file can't be used.  */
+
+static bool
+cache_open (void)
+{
+  const char *file = opt.dns_cache_file;
+  struct stat st;
+  void *map;
+
+  if (cache_slots)
+    return true;
+  if (cache_disabled || !file)
+    return false;
+
+  cache_fd = open (file, O_RDWR | O_CREAT, 0644);
+  if (cache_fd < 0)
+    goto fail;
+
+  /* Initialize a new (empty) file under an exclusive lock, so that
+     concurrent processes don't see it half-written.  */
+  if (!cache_lock (F_WRLCK) || fstat (cache_fd, &st) < 0)
+    goto fail;
+  if (st.st_size == 0)
+    {
+      struct dns_cache_header header;
+      xzero (header);
+      memcpy (header.magic, DNS_CACHE_MAGIC, 8);
+      header.slots = DNS_CACHE_SLOTS;
+      header.slot_size = sizeof (struct dns_cache_slot);
+      if (ftruncate (cache_fd, DNS_CACHE_SIZE) < 0
+          || write (cache_fd, &header, sizeof header) != sizeof header)
+        goto fail;
+    }
+  else if (st.st_size != DNS_CACHE_SIZE)
+    {
+      errno = EINVAL;
+      goto fail;
+    }
+
+  map = mmap (NULL, DNS_CACHE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+              cache_fd, 0);
+  if (map == MAP_FAILED)
+    goto fail;
+  cache_header = map;
+  cache_slots = (struct dns_cache_slot *) (cache_header + 1);
+  if (!cache_header_valid_p ())
+    {
+      munmap (map, DNS_CACHE_SIZE);
+      cache_header = NULL;
+      cache_slots = NULL;
+      errno = EINVAL;
+      goto fail;
+    }
+  cache_lock (F_UNLCK);
+  DEBUGP (("Mapped DNS cache file %s.\n", file));
+  return true;
+
+ fail:
+  logprintf (LOG_NOTQUIET, _("Cannot use DNS cache file %s: %s\n"),
+             quote (file), strerror (errno));
+  if (cache_fd >= 0)
+    close (cache_fd);
+  cache_fd = -1;
+  cache_disabled = true;
+  return false;
+}
+
+/* Return the index of the first slot HOST may be stored in.  The hash
+   function must not change as long as DNS_CACHE_MAGIC doesn't.  */
+
+static unsigned int
+cache_bucket (const char *host)
+{
+  /* FNV-1a */
+  uint32_t h = 2166136261u;
+  for (; *host; host++)
+    {
+      h ^= (unsigned char) c_tolower (*host);
+      h *= 16777619u;
+    }
+  return h % DNS_CACHE_SLOTS;
+}
+
+/* Return the slot holding HOST, or NULL.  */
+
+static struct dns_cache_slot *
+cache_find (const char *host)
+{
+  unsigned int bucket = cache_bucket (host);
+  int i;
+  for (i = 0; i < DNS_CACHE_PROBES; i++)
+    {
+      struct dns_cache_slot *slot
+        = &cache_slots[(bucket + i) % DNS_CACHE_SLOTS];
+      if (!c_strcasecmp (slot->host, host))
+        return slot;
+    }
+  return NULL;
+}
+
+/* Look up HOST in the cache file.  Store up to SIZE of its addresses
+   to ADDRESSES and the time they expire to *EXPIRES, and return the
+   number of addresses stored.  Returns 0 if HOST is not in the file,
+   or its entry has expired.  */
+
+int
+dns_cache_file_lookup (const char *host, ip_address *addresses, int size,
+                       time_t *expires)
+{
+  struct dns_cache_slot *slot;
+  int count = 0, i;
+
+  if (!cache_open () || !cache_lock (F_RDLCK))
+    return 0;
+
+  slot = cache_find (host);
+  if (slot && slot->expires > time (NULL))
+    {
+      *expires = slot->expires;
+      for (i = 0; i < slot->count && count < size; i++)
+        {
+          const struct dns_cache_address *a = &slot->addresses[i];
+          ip_address *ip = &addresses[count];
+
+          xzero (*ip);
+          ip->family = a->family;
+          if (a->family == AF_INET)
+            memcpy (IP_INADDR_DATA (ip), a->data, 4);
+#ifdef ENABLE_IPV6
+          else if (a->family == AF_INET6)
+            {
+              memcpy (IP_INADDR_DATA (ip), a->data, 16);
+# ifdef HAVE_SOCKADDR_IN6_SCOPE_ID
+              ip->ipv6_scope = a->scope;
+# endif
+            }
+#endif
+          else
+            continue;
+          ++count;
+        }
+    }
+
+  cache_lock (F_UNLCK);
+  return count;
+}
+
+/* Store the COUNT addresses of HOST to the cache file, to be used
+   until EXPIRES.  */
+
+void
+dns_cache_file_store (const char *host, const ip_address *addresses,
+                      int count, time_t expires)
+{
+  struct dns_cache_slot *slot;
+  time_t now = time (NULL);
+  int i;
+
+  if (strlen (host) >= sizeof slot->host)
+    return;
+  if (!cache_open () || !cache_lock (F_WRLCK))
+    return;
+
+  /* Reuse HOST's own slot, or else the first empty or expired one, or
+     else the one that is closest to expiring.  */
+  slot = cache_find (host);
+  if (!slot)
+    {
+      unsigned int bucket = cache_bucket (host);
+      for (i = 0; i < DNS_CACHE_PROBES; i++)
+        {
+          struct dns_cache_slot *s
+            = &cache_slots[(bucket + i) % DNS_CACHE_SLOTS];
+          if (!*s->host || s->expires <= now)
+            {
+              slot = s;
+              break;
+            }
+          if (!slot || s->expires < slot->expires)
+            slot = s;
+        }
+    }
+
+  xzero (*slot);
+  for (i = 0; host[i]; i++)
+    slot->host[i] = c_tolower (host[i]);
+  slot->expires = expires;
+  for (i = 0; i < count && slot->count < DNS_CACHE_ADDRESSES; i++)
+    {
+      const ip_address *ip = &addresses[i];
+      struct dns_cache_address *a = &slot->addresses[slot->count];
+      a->family = ip->family;
+      if (ip->family == AF_INET)
+        memcpy (a->data, IP_INADDR_DATA (ip), 4);
+#ifdef ENABLE_IPV6
+      else if (ip->family == AF_INET6)
+        {
+          memcpy (a->data, IP_INADDR_DATA (ip), 16);
+# ifdef HAVE_SOCKADDR_IN6_SCOPE_ID
+          a->scope = ip->ipv6_scope;
+# endif
+        }
+#endif
+      else
+        continue;
+      ++slot->count;
+    }
+
+  cache_lock (F_UNLCK);
+  DEBUGP (("Stored %s in DNS cache file.\n", host));
+}
+
+/* Remove HOST from the cache file, e.g. because its addresses no
+   longer work.  */
+
+void
+dns_cache_file_remove (const char *host)
+{
+  struct dns_cache_slot *slot;
+
+  if (!cache_open () || !cache_lock (F_WRLCK))
+    return;
+  slot = cache_find (host);
+  if (slot)
+    xzero (*slot);
+  cache_lock (F_UNLCK);
+}
+
+/* Unmap and close the cache file.  */
+
+void
+dns_cache_file_close (void)
+{
+  if (cache_slots)
+    munmap (cache_header, DNS_CACHE_SIZE);
+  if (cache_fd >= 0)
+    close (cache_fd);
+  cache_header = NULL;
+  cache_slots = NULL;
+  cache_fd = -1;
+}
+
+#else  /* not HAVE_MMAP && F_SETLKW */
+
+/* Without mmap and fcntl locking, the cache file is not supported and
+   lookups are cached in memory only.  */
+
+int
+dns_cache_file_lookup (const char *host _GL_UNUSED,
+                       ip_address *addresses _GL_UNUSED, int size _GL_UNUSED,
+                       time_t *expires _GL_UNUSED)
+{
+  return 0;
+}
+
+void
+dns_cache_file_store (const char *host _GL_UNUSED,
+                      const ip_address *addresses _GL_UNUSED,
+                      int count _GL_UNUSED, time_t expires _GL_UNUSED)
+{
+}
+
+void
+dns_cache_file_remove (const char *host _GL_UNUSED)
+{
+}
+
+void
+dns_cache_file_close (void)
+{
+}
+
+#endif /* not HAVE_MMAP && F_SETLKW */
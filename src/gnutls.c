@@ -221,14 +221,34 @@ struct wgnutls_transport_context
   gnutls_session_t session;       /* GnuTLS session handle */
   int last_error;               /* last error returned by read/write/... */
 
-  /* Since GnuTLS doesn't support the equivalent to recv(...,
-     MSG_PEEK) or SSL_peek(), we have to do it ourselves.  Peeked data
-     is stored to PEEKBUF, and wgnutls_read checks that buffer before
-     actually reading.  */
-  char peekbuf[512];
-  int peeklen;
+  char *hostname;               /* host name the session is cached under */
+  bool session_cached;          /* whether the session has been cached */
 };
 
+/* Hand the session parameters of CTX to the session cache, so that
+   the next connection to the same host can resume the session.  TLS
+   1.3 sessions become resumable only once the server has sent a
+   ticket, which happens after the handshake; until then this does
+   nothing and is retried after each read.  */
+
+static void
+wgnutls_cache_session (struct wgnutls_transport_context *ctx)
+{
+  gnutls_datum_t data;
+
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+  if (gnutls_protocol_get_version (ctx->session) == GNUTLS_TLS1_3
+      && !(gnutls_session_get_flags (ctx->session) & GNUTLS_SFLAGS_SESSION_TICKET))
+    return;
+#endif
+  ctx->session_cached = true;
+  if (gnutls_session_get_data2 (ctx->session, &data) == GNUTLS_E_SUCCESS)
+    {
+      ssl_session_put (ctx->hostname, data.data, data.size);
+      gnutls_free (data.data);
+    }
+}
+
 static int
 wgnutls_read_timeout (int fd, char *buf, int bufsize, void *arg, double timeout)
 {
@@ -297,6 +317,9 @@ wgnutls_read_timeout (int fd, char *buf, int bufsize, void *arg, double timeout)
         errno = ETIMEDOUT;
     }
 
+  if (ret > 0 && !ctx->session_cached)
+    wgnutls_cache_session (ctx);
+
   return ret;
 }
 
@@ -306,18 +329,6 @@ wgnutls_read (int fd, char *buf, int bufsize, void *arg)
   int ret = 0;
   struct wgnutls_transport_context *ctx = arg;
 
-  if (ctx->peeklen)
-    {
-      /* If we have any peek data, simply return that. */
-      int copysize = MIN (bufsize, ctx->peeklen);
-      memcpy (buf, ctx->peekbuf, copysize);
-      ctx->peeklen -= copysize;
-      if (ctx->peeklen != 0)
-        memmove (ctx->peekbuf, ctx->peekbuf + copysize, ctx->peeklen);
-
-      return copysize;
-    }
-
   ret = wgnutls_read_timeout (fd, buf, bufsize, arg, opt.read_timeout);
   if (ret < 0)
     ctx->last_error = ret;
@@ -344,53 +355,10 @@ wgnutls_poll (int fd, double timeout, int wait_for, void *arg)
   struct wgnutls_transport_context *ctx = arg;
 
   if (timeout)
-    return ctx->peeklen || gnutls_record_check_pending (ctx->session)
+    return gnutls_record_check_pending (ctx->session)
       || select_fd (fd, timeout, wait_for);
   else
-    return ctx->peeklen || gnutls_record_check_pending (ctx->session);
-}
-
-static int
-wgnutls_peek (int fd, char *buf, int bufsize, void *arg)
-{
-  int read = 0;
-  struct wgnutls_transport_context *ctx = arg;
-  int offset = MIN (bufsize, ctx->peeklen);
-
-  if (ctx->peeklen)
-    {
-      memcpy (buf, ctx->peekbuf, offset);
-      return offset;
-    }
-
-  if (bufsize > (int) sizeof ctx->peekbuf)
-    bufsize = sizeof ctx->peekbuf;
-
-  if (bufsize > offset)
-    {
-      if (opt.read_timeout && gnutls_record_check_pending (ctx->session) == 0
-          && select_fd (fd, 0.0, WAIT_FOR_READ) <= 0)
-        read = 0;
-      else
-        read = wgnutls_read_timeout (fd, buf + offset, bufsize - offset,
-                                     ctx, opt.read_timeout);
-      if (read < 0)
-        {
-          if (offset)
-            read = 0;
-          else
-            return read;
-        }
-
-      if (read > 0)
-        {
-          memcpy (ctx->peekbuf + offset, buf + offset,
-                  read);
-          ctx->peeklen += read;
-        }
-    }
-
-  return offset + read;
+    return gnutls_record_check_pending (ctx->session);
 }
 
 static const char *
@@ -406,6 +374,7 @@ wgnutls_close (int fd, void *arg)
   struct wgnutls_transport_context *ctx = arg;
   /*gnutls_bye (ctx->session, GNUTLS_SHUT_RDWR);*/
   gnutls_deinit (ctx->session);
+  xfree (ctx->hostname);
   xfree (ctx);
   close (fd);
 }
@@ -416,7 +385,7 @@ wgnutls_close (int fd, void *arg)
 static struct transport_implementation wgnutls_transport =
 {
   wgnutls_read, wgnutls_write, wgnutls_poll,
-  wgnutls_peek, wgnutls_errstr, wgnutls_close
+  wgnutls_errstr, wgnutls_close
 };
 
 bool
@@ -429,6 +398,8 @@ ssl_connect_wget (int fd, const char *hostname)
   gnutls_session_t session;
   int err;
   const char *str;
+  const void *cached;
+  size_t cached_size;
 
   gnutls_init (&session, GNUTLS_CLIENT);
 
@@ -531,6 +502,24 @@ ssl_connect_wget (int fd, const char *hostname)
       return false;
     }
 
+  /* Offer the session from an earlier connection to this host.  If
+     the server no longer knows it, we get a full handshake.  */
+  cached = ssl_session_get (hostname, &cached_size);
+  if (cached)
+    gnutls_session_set_data (session, cached, cached_size);
+
+#if defined HAVE_NGHTTP2 && GNUTLS_VERSION_NUMBER >= 0x030200
+  /* Offer HTTP/2; see ssl_alpn_http2.  */
+  if (opt.http2)
+    {
+      static const gnutls_datum_t protocols[] = {
+        { (unsigned char *) "h2", 2 },
+        { (unsigned char *) "http/1.1", 8 }
+      };
+      gnutls_alpn_set_protocols (session, protocols, countof (protocols), 0);
+    }
+#endif
+
   if (opt.connect_timeout)
     {
 #ifdef F_GETFL
@@ -611,12 +600,46 @@ ssl_connect_wget (int fd, const char *hostname)
       return false;
     }
 
+  if (cached)
+    DEBUGP (("TLS session %s.\n",
+             gnutls_session_is_resumed (session) ? "resumed" : "not resumed"));
+
   ctx = xnew0 (struct wgnutls_transport_context);
   ctx->session = session;
+  ctx->hostname = xstrdup (hostname);
+  wgnutls_cache_session (ctx);
   fd_register_transport (fd, &wgnutls_transport, ctx);
   return true;
 }
 
+/* Return true if the server agreed to speak HTTP/2 on the SSL
+   connection FD.  */
+
+bool
+ssl_alpn_http2 (int fd)
+{
+#if defined HAVE_NGHTTP2 && GNUTLS_VERSION_NUMBER >= 0x030200
+  struct wgnutls_transport_context *ctx = fd_transport_context (fd);
+  gnutls_datum_t protocol;
+
+  if (gnutls_alpn_get_selected_protocol (ctx->session, &protocol) == 0
+      && protocol.size == 2 && !memcmp (protocol.data, "h2", 2))
+    return true;
+#endif
+  return false;
+}
+
+/* Return true if the SSL connection whose transport context is ARG
+   holds received data that hasn't been read yet, which the socket no
+   longer shows as readable.  */
+
+bool
+ssl_pending_p (void *arg)
+{
+  struct wgnutls_transport_context *ctx = arg;
+  return gnutls_record_check_pending (ctx->session) > 0;
+}
+
 #define _CHECK_CERT(flag,msg) \
   if (status & (flag))\
     {\
@@ -712,5 +735,11 @@ ssl_check_certificate (int fd, const char *host)
     }
 
  out:
+  /* Don't resume a session whose server we refused to trust.  */
+  if (opt.check_cert && !success)
+    {
+      ssl_session_remove (host);
+      ctx->session_cached = true;
+    }
   return opt.check_cert ? success : true;
 }
@@ -635,7 +635,7 @@ hash_table_count (const struct hash_table *ht)
    this one seems to perform much better, both by being faster and by
    generating less collisions.  */
 
-static unsigned long
+unsigned long
 hash_string (const void *key)
 {
   const char *p = key;
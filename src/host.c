@@ -56,11 +56,14 @@ as that of the covered work.  */
 #endif /* WINDOWS */
 
 #include <errno.h>
+#include <time.h>
 
 #include "utils.h"
 #include "host.h"
 #include "url.h"
 #include "hash.h"
+#include "ptimer.h"
+#include "dns-cache.h"
 
 #ifndef NO_ADDRESS
 # define NO_ADDRESS NO_DATA
@@ -85,6 +88,9 @@ struct address_list {
 
   int refcount;                 /* reference count; when it drops to
                                    0, the entry is freed. */
+
+  time_t expires;               /* when a cached list becomes stale,
+                                   or 0 if never */
 };
 
 /* Get the bounds of the address list.  */
@@ -261,6 +267,18 @@ cmp_prefer_ipv6 (const void *addr1, const void *addr2)
   return !IS_IPV6 (addr1) - !IS_IPV6 (addr2);
 }
 
+/* Reorder the addresses of AL so that IPv4 ones (or IPv6 ones, as per
+   --prefer-family) come first.  */
+
+static void
+address_list_sort (struct address_list *al)
+{
+  if (al->count > 1 && opt.prefer_family != prefer_none)
+    stable_sort (al->addresses, al->count, sizeof (ip_address),
+                 opt.prefer_family == prefer_ipv4
+                 ? cmp_prefer_ipv4 : cmp_prefer_ipv6);
+}
+
 #else  /* not ENABLE_IPV6 */
 
 /* Create an address_list from a NULL-terminated vector of IPv4
@@ -414,6 +432,43 @@ getaddrinfo_with_timeout (const char *node, const char *service,
   return ctx.exit_code;
 }
 
+/* Fill HINTS for looking up a host name with getaddrinfo.  FLAGS are
+   the flags passed to lookup_host.  */
+
+static void
+lookup_hints (struct addrinfo *hints, int flags)
+{
+  xzero (*hints);
+  hints->ai_socktype = SOCK_STREAM;
+  if (opt.ipv4_only)
+    hints->ai_family = AF_INET;
+  else if (opt.ipv6_only)
+    hints->ai_family = AF_INET6;
+  else
+    /* We tried using AI_ADDRCONFIG, but removed it because: it
+       misinterprets IPv6 loopbacks, it is broken on AIX 5.1, and
+       it's unneeded since we sort the addresses anyway.  */
+    hints->ai_family = AF_UNSPEC;
+
+  if (flags & LH_BIND)
+    hints->ai_flags |= AI_PASSIVE;
+}
+
+/* Create an address list from the result of getaddrinfo, reordering
+   the addresses so that IPv4 ones (or IPv6 ones, as per
+   --prefer-family) come first.  Sorting is stable so the order of
+   the addresses with the same family is undisturbed.  Returns NULL
+   if RES contains no usable addresses.  */
+
+static struct address_list *
+address_list_from_lookup (const struct addrinfo *res)
+{
+  struct address_list *al = address_list_from_addrinfo (res);
+  if (al)
+    address_list_sort (al);
+  return al;
+}
+
 #endif /* ENABLE_IPV6 */
 
 /* Return a textual representation of ADDR, i.e. the dotted quad for
@@ -578,15 +633,35 @@ is_valid_ipv6_address (const char *str, const char *end)
   return true;
 }
 
-/* Simple host cache, used by lookup_host to speed up resolving.  The
-   cache doesn't handle TTL because Wget is a fairly short-lived
-   application.  Refreshing is attempted when connect fails, though --
-   see connect_to_host.  */
+/* Simple host cache, used by lookup_host to speed up resolving.
+   Since getaddrinfo doesn't tell us the TTL of the DNS records, the
+   entries are considered valid for --dns-cache-ttl seconds.  With
+   --dns-cache-file, the cache is also kept in a file shared with other
+   Wget runs (see dns-cache.c).  Refreshing is attempted when connect
+   fails -- see connect_to_host.  */
 
 /* Mapping between known hosts and to lists of their addresses. */
 static struct hash_table *host_name_addresses_map;
 
 
+/* Remove HOST from the DNS cache.  Does nothing is HOST is not in
+   the cache.  */
+
+static void
+cache_remove (const char *host)
+{
+  char *key;
+  struct address_list *al;
+  if (!host_name_addresses_map)
+    return;
+  if (hash_table_get_pair (host_name_addresses_map, host, &key, &al))
+    {
+      hash_table_remove (host_name_addresses_map, host);
+      address_list_release (al);
+      xfree (key);
+    }
+}
+
 /* Return the host's resolved addresses from the cache, if
    available.  */
 
@@ -599,6 +674,12 @@ cache_query (const char *host)
   al = hash_table_get (host_name_addresses_map, host);
   if (al)
     {
+      if (al->expires && al->expires <= time (NULL))
+        {
+          DEBUGP (("Cached addresses of %s have expired.\n", host));
+          cache_remove (host);
+          return NULL;
+        }
       DEBUGP (("Found %s in host_name_addresses_map (%p)\n", host, (void *) al));
       ++al->refcount;
       return al;
@@ -606,16 +687,17 @@ cache_query (const char *host)
   return NULL;
 }
 
-/* Cache the DNS lookup of HOST.  Subsequent invocations of
-   lookup_host will return the cached value.  */
+/* Put AL in the cache as the addresses of HOST, valid until
+   EXPIRES.  */
 
 static void
-cache_store (const char *host, struct address_list *al)
+cache_insert (const char *host, struct address_list *al, time_t expires)
 {
   if (!host_name_addresses_map)
     host_name_addresses_map = make_nocase_string_hash_table (0);
 
   ++al->refcount;
+  al->expires = expires;
   hash_table_put (host_name_addresses_map, xstrdup_lower (host), al);
 
   IF_DEBUG
@@ -628,23 +710,297 @@ cache_store (const char *host, struct address_list *al)
     }
 }
 
-/* Remove HOST from the DNS cache.  Does nothing is HOST is not in
-   the cache.  */
+/* Cache the DNS lookup of HOST.  Subsequent invocations of
+   lookup_host will return the cached value, as will those of other
+   Wget runs using the same --dns-cache-file.  */
 
 static void
-cache_remove (const char *host)
+cache_store (const char *host, struct address_list *al)
 {
+  time_t expires = 0;
+
+  if (opt.dns_cache_ttl)
+    {
+      expires = time (NULL) + (time_t) opt.dns_cache_ttl;
+      if (opt.dns_cache_file)
+        dns_cache_file_store (host, al->addresses, al->count, expires);
+    }
+  cache_insert (host, al, expires);
+}
+
+/* Look up HOST in the file specified with --dns-cache-file.  If it is
+   found, its addresses are also put in the cache.  */
+
+static struct address_list *
+cache_file_query (const char *host)
+{
+  ip_address addresses[16];
   struct address_list *al;
-  if (!host_name_addresses_map)
+  time_t expires;
+  int count, i, n = 0;
+
+  if (!opt.dns_cache_file)
+    return NULL;
+  count = dns_cache_file_lookup (host, addresses, countof (addresses),
+                                 &expires);
+
+  /* The file may have been written by a run using different
+     --inet4-only/--inet6-only and --prefer-family settings.  */
+  for (i = 0; i < count; i++)
+    {
+#ifdef ENABLE_IPV6
+      if ((opt.ipv4_only && addresses[i].family != AF_INET)
+          || (opt.ipv6_only && addresses[i].family != AF_INET6))
+        continue;
+#else
+      if (addresses[i].family != AF_INET)
+        continue;
+#endif
+      addresses[n++] = addresses[i];
+    }
+  if (!n)
+    return NULL;
+
+  al = xnew0 (struct address_list);
+  al->addresses = xnew_array (ip_address, n);
+  memcpy (al->addresses, addresses, n * sizeof (ip_address));
+  al->count = n;
+  al->refcount = 1;
+#ifdef ENABLE_IPV6
+  address_list_sort (al);
+#endif
+  DEBUGP (("Found %s in DNS cache file.\n", host));
+  cache_insert (host, al, expires);
+  return al;
+}
+
+#if defined ENABLE_IPV6 && defined HAVE_GETADDRINFO_A
+
+/* Host name prefetching.  When links to new hosts are discovered,
+   host_prefetch starts resolving their names in the background with
+   getaddrinfo_a, so that by the time Wget connects to them the
+   addresses are usually in the host cache already.  Lookups that
+   have finished are moved to the cache by prefetch_sweep; lookup_host
+   waits for the ones still in flight with prefetch_take.  */
+
+/* The maximum number of prefetch lookups in flight at a time.  */
+#define PREFETCH_MAX 32
+
+struct prefetch {
+  struct gaicb cb;              /* the request handed to getaddrinfo_a;
+                                   cb.ar_name is also the map key */
+  struct addrinfo hints;        /* hints pointed to by cb.ar_request */
+};
+
+/* Mapping between host names and their prefetch lookups that are in
+   flight.  */
+static struct hash_table *prefetch_map;
+
+static void
+prefetch_free (struct prefetch *pf)
+{
+  if (pf->cb.ar_result)
+    freeaddrinfo (pf->cb.ar_result);
+  xfree (pf->cb.ar_name);
+  xfree (pf);
+}
+
+/* Move the results of the successfully finished prefetch lookups to
+   the host cache, drop the failed ones so that lookup_host asks the
+   resolver again, and return the number of lookups still in
+   flight.  */
+
+static int
+prefetch_sweep (void)
+{
+  hash_table_iterator iter;
+  struct prefetch **done;
+  int count = hash_table_count (prefetch_map);
+  int ndone = 0, pending = 0, i;
+
+  if (!count)
+    return 0;
+
+  done = xnew_array (struct prefetch *, count);
+  for (hash_table_iterate (prefetch_map, &iter); hash_table_iter_next (&iter); )
+    {
+      struct prefetch *pf = iter.value;
+      int err = gai_error (&pf->cb);
+      if (err == EAI_INPROGRESS)
+        ++pending;
+      else
+        done[ndone++] = pf;
+    }
+
+  for (i = 0; i < ndone; i++)
+    {
+      struct prefetch *pf = done[i];
+      hash_table_remove (prefetch_map, pf->cb.ar_name);
+      if (gai_error (&pf->cb) == 0)
+        {
+          struct address_list *al =
+            address_list_from_lookup (pf->cb.ar_result);
+          if (al)
+            {
+              cache_store (pf->cb.ar_name, al);
+              address_list_release (al);
+            }
+        }
+      prefetch_free (pf);
+    }
+
+  xfree (done);
+  return pending;
+}
+
+/* If a prefetch lookup of HOST exists, wait for it to finish, waiting
+   no more than TIMEOUT seconds, and consume it: its getaddrinfo error
+   code is stored to *ERR and its result to *RES, as
+   getaddrinfo_with_timeout would.  Returns false if HOST is not being
+   prefetched, or if its lookup failed: the failure may have been
+   transient, so it is not taken for the final answer.  */
+
+static bool
+prefetch_take (const char *host, double timeout, struct addrinfo **res,
+               int *err)
+{
+  struct prefetch *pf;
+  struct ptimer *timer = NULL;
+
+  if (!prefetch_map)
+    return false;
+  pf = hash_table_get (prefetch_map, host);
+  if (!pf)
+    return false;
+  hash_table_remove (prefetch_map, host);
+
+  DEBUGP (("Using prefetched lookup of %s.\n", host));
+  if (timeout)
+    timer = ptimer_new ();
+  while ((*err = gai_error (&pf->cb)) == EAI_INPROGRESS)
+    {
+      const struct gaicb *list[1];
+      struct timespec ts, *tsp = NULL;
+      list[0] = &pf->cb;
+      if (timer)
+        {
+          double left = timeout - ptimer_measure (timer);
+          if (left <= 0)
+            break;
+          ts.tv_sec = (time_t) left;
+          ts.tv_nsec = (long) ((left - ts.tv_sec) * 1e9);
+          tsp = &ts;
+        }
+      gai_suspend (list, 1, tsp);
+    }
+  if (timer)
+    ptimer_destroy (timer);
+
+  if (*err == EAI_INPROGRESS)
+    {
+      /* Timed out.  Unless the lookup can be canceled, the resolver
+         still owns PF and will write to it, so it must be leaked.  */
+      if (gai_cancel (&pf->cb) != EAI_NOTCANCELED)
+        prefetch_free (pf);
+      *res = NULL;
+      *err = EAI_SYSTEM;
+      errno = ETIMEDOUT;
+      return true;
+    }
+
+  if (*err != 0)
+    {
+      DEBUGP (("Prefetched lookup of %s failed, resolving again.\n", host));
+      prefetch_free (pf);
+      return false;
+    }
+
+  *res = pf->cb.ar_result;
+  pf->cb.ar_result = NULL;
+  prefetch_free (pf);
+  return true;
+}
+
+/* Start resolving HOST in the background so that a later lookup_host
+   finds it in the cache.  Does nothing if HOST is numeric, already
+   cached or being resolved, or if caching is disabled.  Returns false
+   if too many lookups are already in flight, in which case the caller
+   may try again later.  */
+
+bool
+host_prefetch (const char *host)
+{
+  const char *end = host + strlen (host);
+  struct prefetch *pf;
+  struct gaicb *list[1];
+
+  if (!opt.dns_cache
+      || is_valid_ipv4_address (host, end) || is_valid_ipv6_address (host, end))
+    return true;
+  if (host_name_addresses_map
+      && hash_table_contains (host_name_addresses_map, host))
+    return true;
+  if (!prefetch_map)
+    prefetch_map = make_nocase_string_hash_table (0);
+  else if (hash_table_contains (prefetch_map, host))
+    return true;
+  if (prefetch_sweep () >= PREFETCH_MAX)
+    return false;
+
+  pf = xnew0 (struct prefetch);
+  lookup_hints (&pf->hints, 0);
+  pf->cb.ar_name = xstrdup_lower (host);
+  pf->cb.ar_request = &pf->hints;
+  list[0] = &pf->cb;
+  if (getaddrinfo_a (GAI_NOWAIT, list, 1, NULL) != 0)
+    {
+      prefetch_free (pf);
+      return false;
+    }
+  hash_table_put (prefetch_map, pf->cb.ar_name, pf);
+  DEBUGP (("Prefetching addresses of %s.\n", host));
+  return true;
+}
+
+/* Forget the prefetch lookups that are in flight.  Called in a
+   process created by fork, which doesn't inherit the resolver threads
+   that would complete them.  The lookups that have already finished
+   are kept.  */
+
+void
+host_prefetch_forget (void)
+{
+  hash_table_iterator iter;
+
+  if (!prefetch_map)
     return;
-  al = hash_table_get (host_name_addresses_map, host);
-  if (al)
+  prefetch_sweep ();
+  for (hash_table_iterate (prefetch_map, &iter); hash_table_iter_next (&iter); )
     {
-      address_list_release (al);
-      hash_table_remove (host_name_addresses_map, host);
+      struct prefetch *pf = iter.value;
+      if (gai_error (&pf->cb) != EAI_INPROGRESS)
+        prefetch_free (pf);
+      /* Otherwise leak PF: it is still nominally owned by the
+         resolver.  */
     }
+  hash_table_clear (prefetch_map);
+}
+
+#else  /* not ENABLE_IPV6 && HAVE_GETADDRINFO_A */
+
+bool
+host_prefetch (const char *host _GL_UNUSED)
+{
+  return false;
 }
 
+void
+host_prefetch_forget (void)
+{
+}
+
+#endif /* not ENABLE_IPV6 && HAVE_GETADDRINFO_A */
+
 /* Look up HOST in DNS and return a list of IP addresses.
 
    This function caches its result so that, if the same host is passed
@@ -722,11 +1078,17 @@ lookup_host (const char *host, int flags)
       if (!(flags & LH_REFRESH))
         {
           al = cache_query (host);
+          if (!al)
+            al = cache_file_query (host);
           if (al)
             return al;
         }
       else
-        cache_remove (host);
+        {
+          cache_remove (host);
+          if (opt.dns_cache_file)
+            dns_cache_file_remove (host);
+        }
     }
 
   /* No luck with the cache; resolve HOST. */
@@ -755,20 +1117,7 @@ lookup_host (const char *host, int flags)
     int err;
     struct addrinfo hints, *res;
 
-    xzero (hints);
-    hints.ai_socktype = SOCK_STREAM;
-    if (opt.ipv4_only)
-      hints.ai_family = AF_INET;
-    else if (opt.ipv6_only)
-      hints.ai_family = AF_INET6;
-    else
-      /* We tried using AI_ADDRCONFIG, but removed it because: it
-         misinterprets IPv6 loopbacks, it is broken on AIX 5.1, and
-         it's unneeded since we sort the addresses anyway.  */
-        hints.ai_family = AF_UNSPEC;
-
-    if (flags & LH_BIND)
-      hints.ai_flags |= AI_PASSIVE;
+    lookup_hints (&hints, flags);
 
 #ifdef AI_NUMERICHOST
     if (numeric_address)
@@ -782,7 +1131,13 @@ lookup_host (const char *host, int flags)
       }
 #endif
 
-    err = getaddrinfo_with_timeout (host, NULL, &hints, &res, timeout);
+#ifdef HAVE_GETADDRINFO_A
+    /* If host_prefetch has already started looking up HOST, wait for
+       that lookup rather than starting another one.  */
+    if ((flags & (LH_BIND | LH_REFRESH))
+        || !prefetch_take (host, timeout, &res, &err))
+#endif
+      err = getaddrinfo_with_timeout (host, NULL, &hints, &res, timeout);
     if (err != 0 || res == NULL)
       {
         if (!silent)
@@ -790,7 +1145,7 @@ lookup_host (const char *host, int flags)
                      err != EAI_SYSTEM ? gai_strerror (err) : strerror (errno));
         return NULL;
       }
-    al = address_list_from_addrinfo (res);
+    al = address_list_from_lookup (res);
     freeaddrinfo (res);
     if (!al)
       {
@@ -798,14 +1153,6 @@ lookup_host (const char *host, int flags)
                    _("failed: No IPv4/IPv6 addresses for host.\n"));
         return NULL;
       }
-
-    /* Reorder addresses so that IPv4 ones (or IPv6 ones, as per
-       --prefer-family) come first.  Sorting is stable so the order of
-       the addresses with the same family is undisturbed.  */
-    if (al->count > 1 && opt.prefer_family != prefer_none)
-      stable_sort (al->addresses, al->count, sizeof (ip_address),
-                   opt.prefer_family == prefer_ipv4
-                   ? cmp_prefer_ipv4 : cmp_prefer_ipv6);
   }
 #else  /* not ENABLE_IPV6 */
   {
@@ -919,6 +1266,23 @@ host_cleanup (void)
       hash_table_destroy (host_name_addresses_map);
       host_name_addresses_map = NULL;
     }
+  dns_cache_file_close ();
+#if defined ENABLE_IPV6 && defined HAVE_GETADDRINFO_A
+  if (prefetch_map)
+    {
+      hash_table_iterator iter;
+      for (hash_table_iterate (prefetch_map, &iter);
+           hash_table_iter_next (&iter);
+           )
+        {
+          struct prefetch *pf = iter.value;
+          if (gai_cancel (&pf->cb) != EAI_NOTCANCELED)
+            prefetch_free (pf);
+        }
+      hash_table_destroy (prefetch_map);
+      prefetch_map = NULL;
+    }
+#endif
 }
 
 bool
@@ -84,6 +84,8 @@ enum {
   LH_REFRESH = 4
 };
 struct address_list *lookup_host (const char *, int);
+bool host_prefetch (const char *);
+void host_prefetch_forget (void);
 
 void address_list_get_bounds (const struct address_list *, int *, int *);
 const ip_address *address_list_address_at (const struct address_list *, int);
@@ -54,6 +54,9 @@ as that of the covered work.  */
 #ifdef ENABLE_NTLM
 # include "http-ntlm.h"
 #endif
+#ifdef HAVE_NGHTTP2
+# include "http2.h"
+#endif
 #include "cookies.h"
 #include "md5.h"
 #include "convert.h"
@@ -61,6 +64,8 @@ as that of the covered work.  */
 #include "warc.h"
 #include "c-strcase.h"
 #include "version.h"
+#include "segment.h"
+#include "validators.h"
 
 #ifdef TESTING
 #include "test.h"
@@ -75,7 +80,8 @@ as that of the covered work.  */
 struct http_stat;
 static char *create_authorization_line (const char *, const char *,
                                         const char *, const char *,
-                                        const char *, bool *, uerr_t *);
+                                        const char *, int, bool *,
+                                        uerr_t *);
 static char *basic_authentication_encode (const char *, const char *);
 static bool known_authentication_scheme_p (const char *, const char *);
 static void ensure_extension (struct http_stat *, const char *, int *);
@@ -310,15 +316,14 @@ request_remove_header (struct request *req, const char *name)
   p += A_len;                                   \
 } while (0)
 
-/* Construct the request and write it to FD using fd_write.
-   If warc_tmp is set to a file pointer, the request string will
-   also be written to that file. */
+/* Construct the text of the request, and store its length to *SIZE.
+   The returned string is allocated with malloc.  */
 
-static int
-request_send (const struct request *req, int fd, FILE *warc_tmp)
+static char *
+request_format (const struct request *req, int *size_p)
 {
   char *request_string, *p;
-  int i, size, write_error;
+  int i, size;
 
   /* Count the request size. */
   size = 0;
@@ -336,7 +341,7 @@ request_send (const struct request *req, int fd, FILE *warc_tmp)
   /* "\r\n\0" */
   size += 3;
 
-  p = request_string = alloca_array (char, size);
+  p = request_string = xmalloc (size);
 
   /* Generate the request. */
 
@@ -358,21 +363,68 @@ request_send (const struct request *req, int fd, FILE *warc_tmp)
 
 #undef APPEND
 
+  *size_p = size - 1;
+  return request_string;
+}
+
+static int body_file_send (int, const char *, int, const char *, wgint,
+                           FILE *);
+
+/* Construct the request and write it to FD using fd_write, followed
+   by the BODY_SIZE bytes of the request body given with --body-data
+   or --body-file, if BODY_SIZE is non-zero.  The beginning of the
+   body is sent in the same write as the request.
+
+   If warc_tmp is set to a file pointer, the request string and the
+   body will also be written to that file, and the offset of the body
+   in it will be stored to *WARC_PAYLOAD_OFFSET.  */
+
+static int
+request_send (const struct request *req, int fd, wgint body_size,
+              FILE *warc_tmp, off_t *warc_payload_offset)
+{
+  char *request_string;
+  int size, write_error;
+
+  request_string = request_format (req, &size);
+
   DEBUGP (("\n---request begin---\n%s---request end---\n", request_string));
 
+  /* Write a copy of the request to the WARC record, ahead of the
+     body. */
+  if (warc_tmp != NULL)
+    {
+      int warc_tmp_written = fwrite (request_string, 1, size, warc_tmp);
+      if (warc_tmp_written != size)
+        {
+          xfree (request_string);
+          return -2;
+        }
+      if (body_size)
+        *warc_payload_offset = ftello (warc_tmp);
+    }
+
   /* Send the request to the server. */
 
-  write_error = fd_write (fd, request_string, size - 1, -1);
-  if (write_error < 0)
-    logprintf (LOG_VERBOSE, _("Failed writing HTTP request: %s.\n"),
-               fd_errstr (fd));
-  else if (warc_tmp != NULL)
+  if (body_size && opt.body_data)
     {
-      /* Write a copy of the data to the WARC record. */
-      int warc_tmp_written = fwrite (request_string, 1, size - 1, warc_tmp);
-      if (warc_tmp_written != size - 1)
-        return -2;
+      DEBUGP (("[BODY data: %s]\n", opt.body_data));
+      request_string = xrealloc (request_string, size + body_size);
+      memcpy (request_string + size, opt.body_data, body_size);
+      write_error = fd_write (fd, request_string, size + body_size, -1);
+      if (write_error >= 0 && warc_tmp != NULL
+          && fwrite (opt.body_data, 1, body_size, warc_tmp) != body_size)
+        write_error = -2;
     }
+  else if (body_size && opt.body_file)
+    write_error = body_file_send (fd, request_string, size, opt.body_file,
+                                  body_size, warc_tmp);
+  else
+    write_error = fd_write (fd, request_string, size, -1);
+  if (write_error == -1)
+    logprintf (LOG_VERBOSE, _("Failed writing HTTP request: %s.\n"),
+               fd_errstr (fd));
+  xfree (request_string);
   return write_error;
 }
 
@@ -441,18 +493,30 @@ register_basic_auth_host (const char *hostname)
 }
 
 
-/* Send the contents of FILE_NAME to SOCK.  Make sure that exactly
-   PROMISED_SIZE bytes are sent over the wire -- if the file is
-   longer, read only that much; if the file is shorter, report an error.
-   If warc_tmp is set to a file pointer, the post data will
-   also be written to that file.  */
+/* Size of the blocks in which a body file is read.  */
+#define BODY_BLOCK_SIZE (64 * 1024)
+
+/* Send the request in HEAD, HEAD_SIZE bytes long, to SOCK, followed by
+   the contents of FILE_NAME.  Make sure that exactly PROMISED_SIZE
+   bytes of the file are sent over the wire -- if the file is longer,
+   read only that much; if the file is shorter, report an error.  If
+   warc_tmp is set to a file pointer, the post data will also be
+   written to that file.
+
+   The request is sent in the same write as the first block of the
+   file.  Where possible, the rest of the file is sent with sendfile,
+   so that it doesn't pass through user space at all; otherwise, e.g.
+   with SSL, it is read and written in large blocks.  */
 
 static int
-body_file_send (int sock, const char *file_name, wgint promised_size, FILE *warc_tmp)
+body_file_send (int sock, const char *head, int head_size,
+                const char *file_name, wgint promised_size, FILE *warc_tmp)
 {
-  static char chunk[8192];
+  char *block;
   wgint written = 0;
-  int write_error;
+  int fd, length, write_error = 0;
+  /* The data of the WARC record has to be read anyway.  */
+  bool use_sendfile = warc_tmp == NULL;
   FILE *fp;
 
   DEBUGP (("[writing BODY file %s ... ", file_name));
@@ -460,32 +524,67 @@ body_file_send (int sock, const char *file_name, wgint promised_size, FILE *warc
   fp = fopen (file_name, "rb");
   if (!fp)
     return -1;
-  while (!feof (fp) && written < promised_size)
+  /* Read the file without stdio's buffering, so that its position
+     stays where sendfile expects it.  */
+  fd = fileno (fp);
+  block = xmalloc (head_size + BODY_BLOCK_SIZE);
+  memcpy (block, head, head_size);
+
+  while (written < promised_size)
     {
-      int towrite;
-      int length = fread (chunk, 1, sizeof (chunk), fp);
-      if (length == 0)
-        break;
-      towrite = MIN (promised_size - written, length);
-      write_error = fd_write (sock, chunk, towrite, -1);
-      if (write_error < 0)
+#if defined HAVE_SENDFILE && defined HAVE_SYS_SENDFILE_H
+      if (use_sendfile && written > 0)
         {
-          fclose (fp);
-          return -1;
+          wgint offset = written;
+          int res = fd_sendfile (sock, fd, &offset,
+                                 promised_size - written, -1);
+          if (res > 0)
+            {
+              written += res;
+              continue;
+            }
+          if (res == 0)
+            break;
+          if (errno != EINVAL)
+            {
+              write_error = -1;
+              break;
+            }
+          /* SOCK is not a plain socket, or the file can't be sent
+             this way: fall back to reading it.  */
+          use_sendfile = false;
+        }
+#endif
+      length = read (fd, block + head_size,
+                     MIN (BODY_BLOCK_SIZE, promised_size - written));
+      if (length <= 0)
+        {
+          if (length < 0)
+            write_error = -1;
+          break;
         }
+      write_error = fd_write (sock, block, head_size + length, -1);
+      if (write_error < 0)
+        break;
       if (warc_tmp != NULL)
         {
           /* Write a copy of the data to the WARC record. */
-          int warc_tmp_written = fwrite (chunk, 1, towrite, warc_tmp);
-          if (warc_tmp_written != towrite)
+          int warc_tmp_written = fwrite (block + head_size, 1, length,
+                                         warc_tmp);
+          if (warc_tmp_written != length)
             {
-              fclose (fp);
-              return -2;
+              write_error = -2;
+              break;
             }
         }
-      written += towrite;
+      written += length;
+      /* The request has gone out with the first block.  */
+      head_size = 0;
     }
   fclose (fp);
+  xfree (block);
+  if (write_error < 0)
+    return write_error;
 
   /* If we've written less than was promised, report a (probably
      nonsensical) error rather than break the promise.  */
@@ -563,6 +662,94 @@ read_http_response_head (int fd)
                        HTTP_RESPONSE_MAX_SIZE);
 }
 
+/* The names of the headers Wget looks up in responses.  They are
+   mapped to HDR_* constants with a perfect hash, so that looking them
+   up is a matter of indexing an array.  */
+
+enum {
+  HDR_ACCEPT_RANGES, HDR_CONNECTION, HDR_CONTENT_DISPOSITION,
+  HDR_CONTENT_ENCODING, HDR_CONTENT_LENGTH, HDR_CONTENT_RANGE,
+  HDR_CONTENT_TYPE, HDR_ETAG, HDR_LAST_MODIFIED, HDR_LOCATION,
+  HDR_SET_COOKIE, HDR_TRANSFER_ENCODING, HDR_WWW_AUTHENTICATE,
+  HDR_COUNT
+};
+
+static const char *const known_headers[HDR_COUNT] = {
+  "Accept-Ranges", "Connection", "Content-Disposition",
+  "Content-Encoding", "Content-Length", "Content-Range",
+  "Content-Type", "ETag", "Last-Modified", "Location",
+  "Set-Cookie", "Transfer-Encoding", "WWW-Authenticate"
+};
+
+/* The table of known header names, indexed by their hash modulo
+   KNOWN_HEADER_SLOTS, holds HDR_* + 1, or 0 for empty slots.  The
+   hash seed is chosen so that the known names don't collide.  */
+#define KNOWN_HEADER_SLOTS 64
+static signed char known_header_slots[KNOWN_HEADER_SLOTS];
+static unsigned int header_hash_seed;
+
+/* Return the case-insensitive hash of the header name of LEN
+   characters at NAME.  */
+
+static unsigned int
+header_name_hash (const char *name, int len)
+{
+  /* FNV-1a */
+  unsigned int h = 2166136261u ^ header_hash_seed;
+  int i;
+  for (i = 0; i < len; i++)
+    {
+      h ^= (unsigned char) c_tolower (name[i]);
+      h *= 16777619u;
+    }
+  return h;
+}
+
+static void
+known_headers_init (void)
+{
+  static bool initialized;
+  int i;
+
+  if (initialized)
+    return;
+  for (;; header_hash_seed++)
+    {
+      xzero (known_header_slots);
+      for (i = 0; i < HDR_COUNT; i++)
+        {
+          const char *name = known_headers[i];
+          unsigned int slot = header_name_hash (name, strlen (name))
+            % KNOWN_HEADER_SLOTS;
+          if (known_header_slots[slot])
+            break;
+          known_header_slots[slot] = i + 1;
+        }
+      if (i == HDR_COUNT)
+        break;
+    }
+  initialized = true;
+}
+
+/* Return the HDR_* constant for the header name of LEN characters at
+   NAME whose hash is HASH, or -1 if it is not one of KNOWN_HEADERS.  */
+
+static int
+known_header (const char *name, int len, unsigned int hash)
+{
+  int id = known_header_slots[hash % KNOWN_HEADER_SLOTS] - 1;
+  if (id >= 0 && strlen (known_headers[id]) == len
+      && 0 == c_strncasecmp (known_headers[id], name, len))
+    return id;
+  return -1;
+}
+
+/* An entry of the table of headers with other names.  */
+struct other_header {
+  unsigned int hash;            /* hash of the name */
+  int first, last;              /* first and last header with the name */
+};
+
 struct response {
   /* The response data. */
   const char *data;
@@ -586,12 +773,110 @@ struct response {
      beginning of the second one, etc.  */
 
   const char **headers;
+
+  /* The index of the headers by name.  KNOWN holds the position of
+     the first header with each of the KNOWN_HEADERS names, and OTHERS
+     is an open-addressed hash table, of OTHERS_SIZE entries, of the
+     headers with other names.  NEXT holds the position of the next
+     header with the same name as the one at each position.  A
+     position of 0 (that of the status line) means there is none.  */
+
+  int known[HDR_COUNT];
+  struct other_header *others;
+  int others_size;
+  int *next;
 };
 
+/* Return the length of the name of the header at position POS in
+   RESP, or -1 if the header is malformed.  */
+
+static int
+resp_header_name_length (const struct response *resp, int pos)
+{
+  const char *b = resp->headers[pos];
+  const char *colon = memchr (b, ':', resp->headers[pos + 1] - b);
+  return colon ? colon - b : -1;
+}
+
+/* Return the entry of RESP's table of other headers for the name of
+   LEN characters at NAME whose hash is HASH.  If the name is not in
+   the table, the empty entry where it belongs is returned.  */
+
+static struct other_header *
+resp_other_header (const struct response *resp, const char *name, int len,
+                   unsigned int hash)
+{
+  int i = hash & (resp->others_size - 1);
+  for (;; i = (i + 1) & (resp->others_size - 1))
+    {
+      struct other_header *oh = &resp->others[i];
+      if (!oh->first)
+        return oh;
+      if (oh->hash == hash
+          && resp_header_name_length (resp, oh->first) == len
+          && 0 == c_strncasecmp (resp->headers[oh->first], name, len))
+        return oh;
+    }
+}
+
+/* Add the headers of RESP to its index by name.  COUNT is the number
+   of header lines, not counting the status line.  */
+
+static void
+resp_index_headers (struct response *resp, int count)
+{
+  int last_known[HDR_COUNT];
+  int pos;
+
+  known_headers_init ();
+  resp->next = xnew0_array (int, count + 2);
+  resp->others_size = 4;
+  while (resp->others_size < 2 * count)
+    resp->others_size <<= 1;
+  xzero (last_known);
+
+  for (pos = 1; pos <= count; pos++)
+    {
+      const char *name = resp->headers[pos];
+      int len = resp_header_name_length (resp, pos);
+      unsigned int hash;
+      int id;
+
+      if (len < 0)
+        continue;
+      hash = header_name_hash (name, len);
+      id = known_header (name, len, hash);
+      if (id >= 0)
+        {
+          if (last_known[id])
+            resp->next[last_known[id]] = pos;
+          else
+            resp->known[id] = pos;
+          last_known[id] = pos;
+        }
+      else
+        {
+          struct other_header *oh;
+          if (!resp->others)
+            resp->others = xnew0_array (struct other_header,
+                                        resp->others_size);
+          oh = resp_other_header (resp, name, len, hash);
+          if (oh->first)
+            resp->next[oh->last] = pos;
+          else
+            {
+              oh->hash = hash;
+              oh->first = pos;
+            }
+          oh->last = pos;
+        }
+    }
+}
+
 /* Create a new response object from the text of the HTTP response,
    available in HEAD.  That text is automatically split into
-   constituent header lines for fast retrieval using
-   resp_header_*.  */
+   constituent header lines, which are indexed by name for fast
+   retrieval using resp_header_*.  */
 
 static struct response *
 resp_new (const char *head)
@@ -638,57 +923,80 @@ resp_new (const char *head)
   DO_REALLOC (resp->headers, size, count + 1, const char *);
   resp->headers[count] = NULL;
 
+  /* The last line is the empty one ending the head, or the end of
+     the data.  */
+  if (count > 2)
+    resp_index_headers (resp, count - 2);
+
   return resp;
 }
 
-/* Locate the header named NAME in the request data, starting with
-   position START.  This allows the code to loop through the request
-   data, filtering for all requests of a given name.  Returns the
-   found position, or -1 for failure.  The code that uses this
-   function typically looks like this:
+/* Store the value of the header at position POS in RESP, without the
+   leading and trailing whitespace, to *BEGPTR and *ENDPTR, and return
+   POS.  If POS is 0, return -1.  */
+
+static int
+resp_header_value (const struct response *resp, int pos,
+                   const char **begptr, const char **endptr)
+{
+  const char *b, *e;
 
-     for (pos = 0; (pos = resp_header_locate (...)) != -1; pos++)
+  if (!pos)
+    return -1;
+  b = resp->headers[pos] + resp_header_name_length (resp, pos) + 1;
+  e = resp->headers[pos + 1];
+  while (b < e && c_isspace (*b))
+    ++b;
+  while (b < e && c_isspace (e[-1]))
+    --e;
+  *begptr = b;
+  *endptr = e;
+  return pos;
+}
+
+/* Locate the first header named NAME in the response data.  Returns
+   its position, or -1 for failure.  The headers that have the same
+   name, such as Set-Cookie, are iterated over with resp_header_next.
+   The code that uses these functions typically looks like this:
+
+     for (pos = resp_header_locate (resp, name, &b, &e); pos != -1;
+          pos = resp_header_next (resp, pos, &b, &e))
        ... do something with header ...
 
    If you only care about one header, use resp_header_get instead of
-   this function.  */
+   these functions.  */
 
 static int
-resp_header_locate (const struct response *resp, const char *name, int start,
+resp_header_locate (const struct response *resp, const char *name,
                     const char **begptr, const char **endptr)
 {
-  int i;
-  const char **headers = resp->headers;
-  int name_len;
+  int len, id;
+  unsigned int hash;
 
-  if (!headers || !headers[1])
+  if (!resp->next)
     return -1;
 
-  name_len = strlen (name);
-  if (start > 0)
-    i = start;
-  else
-    i = 1;
+  len = strlen (name);
+  hash = header_name_hash (name, len);
+  id = known_header (name, len, hash);
+  if (id >= 0)
+    return resp_header_value (resp, resp->known[id], begptr, endptr);
+  if (!resp->others)
+    return -1;
+  return resp_header_value (resp,
+                            resp_other_header (resp, name, len, hash)->first,
+                            begptr, endptr);
+}
 
-  for (; headers[i + 1]; i++)
-    {
-      const char *b = headers[i];
-      const char *e = headers[i + 1];
-      if (e - b > name_len
-          && b[name_len] == ':'
-          && 0 == c_strncasecmp (b, name, name_len))
-        {
-          b += name_len + 1;
-          while (b < e && c_isspace (*b))
-            ++b;
-          while (b < e && c_isspace (e[-1]))
-            --e;
-          *begptr = b;
-          *endptr = e;
-          return i;
-        }
-    }
-  return -1;
+/* Locate the next header with the same name as the one at position
+   POS, returned by resp_header_locate or resp_header_next.  Returns
+   its position, or -1 if there are no more such headers.  */
+
+static int
+resp_header_next (const struct response *resp, int pos,
+                  const char **begptr, const char **endptr)
+{
+  return resp_header_value (resp, resp->next[pos], begptr, endptr);
 }
 
 /* Find and retrieve the header named NAME in the request data.  If
@@ -702,7 +1010,7 @@ static bool
 resp_header_get (const struct response *resp, const char *name,
                  const char **begptr, const char **endptr)
 {
-  int pos = resp_header_locate (resp, name, 0, begptr, endptr);
+  int pos = resp_header_locate (resp, name, begptr, endptr);
   return pos != -1;
 }
 
@@ -814,6 +1122,8 @@ static void
 resp_free (struct response *resp)
 {
   xfree (resp->headers);
+  xfree (resp->next);
+  xfree (resp->others);
   xfree (resp);
 }
 
@@ -1219,50 +1529,180 @@ parse_content_disposition (const char *hdr, char **filename)
 }
 
 
-/* Persistent connections.  Currently, we cache the most recently used
-   connection as persistent, provided that the HTTP server agrees to
-   make it such.  The persistence data is stored in the variables
-   below.  Ideally, it should be possible to cache an arbitrary fixed
-   number of these connections.  */
+/* Persistent connections.  Wget keeps a small pool of connections
+   that the HTTP servers agreed to keep open, so that a recursive
+   retrieval alternating between several hosts (e.g. a site and the
+   server holding its images) doesn't have to reconnect (and redo the
+   SSL handshake) on almost every request.
 
-/* Whether a persistent connection is active. */
-static bool pconn_active;
+   A connection is identified by the host and port it was registered
+   for, by whether it is encrypted, and by whether it talks to a
+   proxy.  The pool is bounded by opt.http_keep_alive_max connections
+   in total and opt.http_keep_alive_host_max connections per host name,
+   whatever their port and encryption; when a bound is hit, the least
+   recently used connection is closed.  Connections left idle for
+   longer than opt.http_keep_alive_timeout seconds are closed as well.  */
 
-static struct {
+struct pconn {
   /* The socket of the connection.  */
   int socket;
 
-  /* Host and port of the currently active persistent connection. */
+  /* Host and port the connection was registered for. */
   char *host;
   int port;
 
   /* Whether a ssl handshake has occoured on this connection.  */
   bool ssl;
 
+  /* Whether the connection leads to a proxy (or is tunneled through
+     one, in case of SSL).  */
+  bool proxied;
+
   /* Whether the connection was authorized.  This is only done by
      NTLM, which authorizes *connections* rather than individual
      requests.  (That practice is peculiar for HTTP, but it is a
      useful optimization.)  */
   bool authorized;
 
+  /* When the connection was last used.  */
+  time_t last_used;
+
+  /* Requests sent ahead of time on the connection (see
+     pipeline_send), oldest first.  Their responses follow that of
+     the request being processed.  */
+  char **pipelined;
+  int pipelined_count, pipelined_size;
+
 #ifdef ENABLE_NTLM
-  /* NTLM data of the current connection.  */
+  /* NTLM data of the connection.  */
   struct ntlmdata ntlm;
 #endif
-} pconn;
+};
+
+/* The pool of persistent connections, ordered by the time of last
+   use: the least recently used connection is always at index 0.  */
+static struct pconn *pconn_pool;
+static int pconn_count, pconn_size;
+
+/* Return the pool entry of socket FD, or NULL if FD is not registered
+   as persistent.  */
+
+static struct pconn *
+persistent_lookup (int fd)
+{
+  int i;
+  if (fd < 0)
+    return NULL;
+  for (i = 0; i < pconn_count; i++)
+    if (pconn_pool[i].socket == fd)
+      return &pconn_pool[i];
+  return NULL;
+}
+
+/* Return true if FD is registered as a persistent connection.  */
+
+static bool
+persistent_registered_p (int fd)
+{
+  return persistent_lookup (fd) != NULL;
+}
+
+/* Remove the pool entry PC, closing its socket unless KEEP_SOCKET is
+   set.  Entries following PC are moved down, so pointers to pool
+   entries are invalid after this is called.  */
+
+static void
+persistent_remove (struct pconn *pc, bool keep_socket)
+{
+  int i = pc - pconn_pool;
+  int j;
+  if (!keep_socket)
+    {
+      DEBUGP (("Disabling further reuse of socket %d.\n", pc->socket));
+      fd_close (pc->socket);
+    }
+  xfree (pc->host);
+  for (j = 0; j < pc->pipelined_count; j++)
+    xfree (pc->pipelined[j]);
+  xfree (pc->pipelined);
+  if (i < pconn_count - 1)
+    memmove (pc, pc + 1, (pconn_count - i - 1) * sizeof (*pc));
+  --pconn_count;
+}
+
+/* Mark the persistent connection FD as invalid, close it and free the
+   resources it uses.  This is used by the CLOSE_* macros after they
+   forcefully close a registered persistent connection.  */
+
+static void
+invalidate_persistent (int fd)
+{
+  struct pconn *pc = persistent_lookup (fd);
+  if (pc)
+    persistent_remove (pc, false);
+}
+
+/* Mark the persistent connection FD as just used, making it the last
+   candidate for eviction.  */
+
+static void
+touch_persistent (int fd)
+{
+  struct pconn *pc = persistent_lookup (fd);
+  if (pc)
+    {
+      struct pconn tmp = *pc;
+      int i = pc - pconn_pool;
+      memmove (pc, pc + 1, (pconn_count - i - 1) * sizeof (*pc));
+      tmp.last_used = time (NULL);
+      pconn_pool[pconn_count - 1] = tmp;
+    }
+}
+
+/* Set the NTLM authorization flag of the persistent connection FD.  */
+
+static void
+persistent_set_authorized (int fd, bool authorized)
+{
+  struct pconn *pc = persistent_lookup (fd);
+  if (pc)
+    pc->authorized = authorized;
+}
+
+#ifdef ENABLE_NTLM
+/* Return the NTLM data of the connection FD.  Connections that are
+   not (yet) registered as persistent share a single structure.  */
+
+static struct ntlmdata *
+persistent_ntlm (int fd)
+{
+  static struct ntlmdata unregistered_ntlm;
+  struct pconn *pc = persistent_lookup (fd);
+  return pc ? &pc->ntlm : &unregistered_ntlm;
+}
+#endif
 
-/* Mark the persistent connection as invalid and free the resources it
-   uses.  This is used by the CLOSE_* macros after they forcefully
-   close a registered persistent connection.  */
+/* Close the connections that have been idle for longer than
+   opt.http_keep_alive_timeout seconds.  Servers typically close such
+   connections anyway, and there's no point in keeping the descriptors
+   around.  */
 
 static void
-invalidate_persistent (void)
+persistent_expire (void)
 {
-  DEBUGP (("Disabling further reuse of socket %d.\n", pconn.socket));
-  pconn_active = false;
-  fd_close (pconn.socket);
-  xfree (pconn.host);
-  xzero (pconn);
+  time_t now;
+  int i;
+
+  if (!opt.http_keep_alive_timeout)
+    return;
+  now = time (NULL);
+  for (i = 0; i < pconn_count; )
+    {
+      if (now - pconn_pool[i].last_used > opt.http_keep_alive_timeout)
+        persistent_remove (&pconn_pool[i], false);
+      else
+        ++i;
+    }
 }
 
 /* Register FD, which should be a TCP/IP connection to HOST:PORT, as
@@ -1271,134 +1711,236 @@ invalidate_persistent (void)
    response has been received and the server has promised that the
    connection will remain alive.
 
-   If a previous connection was persistent, it is closed. */
+   If the pool is full, the least recently used connection (to HOST,
+   on any port, if the per-host limit is reached, to any host
+   otherwise) is closed to make room.  */
 
 static void
-register_persistent (const char *host, int port, int fd, bool ssl)
+register_persistent (const char *host, int port, int fd, bool ssl,
+                     bool proxied)
 {
-  if (pconn_active)
+  struct pconn *pc;
+  int i, host_count, host_lru;
+  int max = MAX (1, opt.http_keep_alive_max);
+  int host_max = MAX (1, opt.http_keep_alive_host_max);
+
+  if (persistent_registered_p (fd))
     {
-      if (pconn.socket == fd)
-        {
-          /* The connection FD is already registered. */
-          return;
-        }
-      else
-        {
-          /* The old persistent connection is still active; close it
-             first.  This situation arises whenever a persistent
-             connection exists, but we then connect to a different
-             host, and try to register a persistent connection to that
-             one.  */
-          invalidate_persistent ();
-        }
+      /* The connection FD is already registered. */
+      touch_persistent (fd);
+      return;
     }
 
-  pconn_active = true;
-  pconn.socket = fd;
-  pconn.host = xstrdup (host);
-  pconn.port = port;
-  pconn.ssl = ssl;
-  pconn.authorized = false;
+  persistent_expire ();
 
-  DEBUGP (("Registered socket %d for persistent reuse.\n", fd));
+  host_count = 0;
+  host_lru = -1;
+  for (i = 0; i < pconn_count; i++)
+    if (0 == strcasecmp (pconn_pool[i].host, host))
+      {
+        if (host_lru == -1)
+          host_lru = i;
+        ++host_count;
+      }
+  if (host_count >= host_max)
+    persistent_remove (&pconn_pool[host_lru], false);
+  else if (pconn_count >= max)
+    persistent_remove (&pconn_pool[0], false);
+
+  DO_REALLOC (pconn_pool, pconn_size, pconn_count + 1, struct pconn);
+  pc = &pconn_pool[pconn_count++];
+  xzero (*pc);
+  pc->socket = fd;
+  pc->host = xstrdup (host);
+  pc->port = port;
+  pc->ssl = ssl;
+  pc->proxied = proxied;
+  pc->authorized = false;
+  pc->last_used = time (NULL);
+
+  DEBUGP (("Registered socket %d for persistent reuse (%d in pool).\n",
+           fd, pconn_count));
 }
 
-/* Return true if a persistent connection is available for connecting
-   to HOST:PORT.  */
+/* Return true if the idle persistent connection FD is still open.  */
 
 static bool
-persistent_available_p (const char *host, int port, bool ssl,
-                        bool *host_lookup_failed)
+persistent_open_p (int fd)
 {
-  /* First, check whether a persistent connection is active at all.  */
-  if (!pconn_active)
-    return false;
+#ifdef HAVE_NGHTTP2
+  if (http2_connection_p (fd))
+    return http2_alive (fd);
+#endif
+  return test_socket_open (fd);
+}
 
-  /* If we want SSL and the last connection wasn't or vice versa,
-     don't use it.  Checking for host and port is not enough because
-     HTTP and HTTPS can apparently coexist on the same port.  */
-  if (ssl != pconn.ssl)
-    return false;
+/* Return the socket of a persistent connection available for
+   connecting to HOST:PORT, or -1 if there is none.  */
 
-  /* If we're not connecting to the same port, we're not interested. */
-  if (port != pconn.port)
-    return false;
+static int
+persistent_available (const char *host, int port, bool ssl, bool proxied,
+                      bool *host_lookup_failed)
+{
+  struct address_list *al = NULL;
+  bool other_host = false;
+  int i;
 
-  /* If the host is the same, we're in business.  If not, there is
-     still hope -- read below.  */
-  if (0 != strcasecmp (host, pconn.host))
+  persistent_expire ();
+
+  /* Prefer the most recently used connection, which is the most
+     likely to still be open.  */
+  for (i = pconn_count - 1; i >= 0; i--)
     {
-      /* Check if pconn.socket is talking to HOST under another name.
-         This happens often when both sites are virtual hosts
-         distinguished only by name and served by the same network
-         interface, and hence the same web server (possibly set up by
-         the ISP and serving many different web sites).  This
-         admittedly unconventional optimization does not contradict
-         HTTP and works well with popular server software.  */
-
-      bool found;
-      ip_address ip;
-      struct address_list *al;
-
-      if (ssl)
-        /* Don't try to talk to two different SSL sites over the same
-           secure connection!  (Besides, it's not clear that
-           name-based virtual hosting is even possible with SSL.)  */
-        return false;
+      struct pconn *pc = &pconn_pool[i];
+
+      /* If we want SSL and the connection isn't or vice versa, don't
+         use it.  Checking for host and port is not enough because
+         HTTP and HTTPS can apparently coexist on the same port.  */
+      if (ssl != pc->ssl || proxied != pc->proxied)
+        continue;
+
+      /* The next response on a connection with pipelined requests
+         belongs to the first of them.  */
+      if (pc->pipelined_count)
+        continue;
+
+      /* If we're not connecting to the same port, we're not
+         interested. */
+      if (port != pc->port)
+        continue;
+
+      /* If the host is the same, we're in business.  If not, there
+         is still hope -- read below.  */
+      if (0 != strcasecmp (host, pc->host))
+        {
+          /* Check if pc->socket is talking to HOST under another
+             name.  This happens often when both sites are virtual
+             hosts distinguished only by name and served by the same
+             network interface, and hence the same web server
+             (possibly set up by the ISP and serving many different
+             web sites).  This admittedly unconventional optimization
+             does not contradict HTTP and works well with popular
+             server software.  */
+
+          ip_address ip;
+
+          if (ssl)
+            /* Don't try to talk to two different SSL sites over the
+               same secure connection!  (Besides, it's not clear that
+               name-based virtual hosting is even possible with
+               SSL.)  */
+            continue;
 
-      /* If pconn.socket's peer is one of the IP addresses HOST
-         resolves to, pconn.socket is for all intents and purposes
-         already talking to HOST.  */
+          /* If pc->socket's peer is one of the IP addresses HOST
+             resolves to, pc->socket is for all intents and purposes
+             already talking to HOST.  */
 
-      if (!socket_ip_address (pconn.socket, &ip, ENDPOINT_PEER))
-        {
-          /* Can't get the peer's address -- something must be very
-             wrong with the connection.  */
-          invalidate_persistent ();
-          return false;
+          if (!socket_ip_address (pc->socket, &ip, ENDPOINT_PEER))
+            {
+              /* Can't get the peer's address -- something must be
+                 very wrong with the connection.  */
+              persistent_remove (pc, false);
+              continue;
+            }
+          if (!al)
+            {
+              if (other_host)
+                /* HOST was already looked up and failed.  */
+                continue;
+              other_host = true;
+              al = lookup_host (host, 0);
+              if (!al)
+                {
+                  *host_lookup_failed = true;
+                  continue;
+                }
+            }
+
+          if (!address_list_contains (al, &ip))
+            continue;
+
+          /* The connection's peer address was found among the
+             addresses HOST resolved to; therefore, pc->socket is in
+             fact already talking to HOST -- no need to reconnect.  */
         }
-      al = lookup_host (host, 0);
-      if (!al)
+
+      /* Finally, check whether the connection is still open.  This is
+         important because most servers implement liberal (short)
+         timeout on persistent connections.  Wget can of course always
+         reconnect if the connection doesn't work out, but it's nicer
+         to know in advance.  This test is a logical followup of the
+         first test, but is "expensive" and therefore placed at the
+         end of the list.
+
+         (Current implementation of test_socket_open has a nice side
+         effect that it treats sockets with pending data as "closed".
+         This is exactly what we want: if a broken server sends
+         message body in response to HEAD, or if it sends more than
+         conent-length data, we won't reuse the corrupted
+         connection.)  */
+
+      if (!persistent_open_p (pc->socket))
         {
-          *host_lookup_failed = true;
-          return false;
+          /* Oops, the socket is no longer open.  Now that we know
+             that, let's invalidate the persistent connection and
+             look further.  */
+          persistent_remove (pc, false);
+          continue;
         }
 
-      found = address_list_contains (al, &ip);
-      address_list_release (al);
-
-      if (!found)
-        return false;
-
-      /* The persistent connection's peer address was found among the
-         addresses HOST resolved to; therefore, pconn.sock is in fact
-         already talking to HOST -- no need to reconnect.  */
+      if (al)
+        address_list_release (al);
+      *host_lookup_failed = false;
+      return pc->socket;
     }
 
-  /* Finally, check whether the connection is still open.  This is
-     important because most servers implement liberal (short) timeout
-     on persistent connections.  Wget can of course always reconnect
-     if the connection doesn't work out, but it's nicer to know in
-     advance.  This test is a logical followup of the first test, but
-     is "expensive" and therefore placed at the end of the list.
+  if (al)
+    address_list_release (al);
+  return -1;
+}
+
+/* Return the persistent connection on which REQ was sent ahead of
+   time and whose next response is therefore the one to REQ, or -1 if
+   there is none.  The request is removed from the connection's
+   pipeline.  */
 
-     (Current implementation of test_socket_open has a nice side
-     effect that it treats sockets with pending data as "closed".
-     This is exactly what we want: if a broken server sends message
-     body in response to HEAD, or if it sends more than conent-length
-     data, we won't reuse the corrupted connection.)  */
+static int
+persistent_pipelined (const struct request *req)
+{
+  char *request_string;
+  int i, size, sock = -1;
 
-  if (!test_socket_open (pconn.socket))
+  request_string = request_format (req, &size);
+  for (i = 0; i < pconn_count; i++)
     {
-      /* Oops, the socket is no longer open.  Now that we know that,
-         let's invalidate the persistent connection before returning
-         0.  */
-      invalidate_persistent ();
-      return false;
+      struct pconn *pc = &pconn_pool[i];
+      if (pc->pipelined_count
+          && 0 == strcmp (pc->pipelined[0], request_string))
+        {
+          xfree (pc->pipelined[0]);
+          memmove (pc->pipelined, pc->pipelined + 1,
+                   (pc->pipelined_count - 1) * sizeof (char *));
+          --pc->pipelined_count;
+          sock = pc->socket;
+          break;
+        }
     }
+  xfree (request_string);
+  return sock;
+}
 
-  return true;
+/* Return true if the request REQUEST_STRING was sent ahead of time on
+   any persistent connection.  */
+
+static bool
+persistent_pipelined_p (const char *request_string)
+{
+  int i, j;
+  for (i = 0; i < pconn_count; i++)
+    for (j = 0; j < pconn_pool[i].pipelined_count; j++)
+      if (0 == strcmp (pconn_pool[i].pipelined[j], request_string))
+        return true;
+  return false;
 }
 
 /* The idea behind these two CLOSE macros is to distinguish between
@@ -1413,23 +1955,25 @@ persistent_available_p (const char *host, int port, bool ssl,
    Note that the semantics of the flag `keep_alive' is "this
    connection *will* be reused (the server has promised not to close
    the connection once we're done)", while the semantics of
-   `pc_active_p && (fd) == pc_last_fd' is "we're *now* using an
-   active, registered connection".  */
+   `persistent_registered_p (fd)' is "we're *now* using an active,
+   registered connection".  */
 
 #define CLOSE_FINISH(fd) do {                   \
   if (!keep_alive)                              \
     {                                           \
-      if (pconn_active && (fd) == pconn.socket) \
-        invalidate_persistent ();               \
+      if (persistent_registered_p (fd))         \
+        invalidate_persistent (fd);             \
       else                                      \
           fd_close (fd);                        \
       fd = -1;                                  \
     }                                           \
+  else                                          \
+    touch_persistent (fd);                      \
 } while (0)
 
 #define CLOSE_INVALIDATE(fd) do {               \
-  if (pconn_active && (fd) == pconn.socket)     \
-    invalidate_persistent ();                   \
+  if (persistent_registered_p (fd))             \
+    invalidate_persistent (fd);                 \
   else                                          \
     fd_close (fd);                              \
   fd = -1;                                      \
@@ -1462,6 +2006,14 @@ struct http_stat
   wgint orig_file_size;         /* size of file to compare for time-stamping */
   time_t orig_file_tstamp;      /* time-stamp of file to compare for
                                  * time-stamping */
+  bool segment;                 /* true if retrieving bytes RESTVAL to
+                                   SEGMENT_END of a segmented download */
+  wgint segment_end;            /* last byte of the segment */
+  bool decompress;              /* true if the body is gzip or deflate
+                                   compressed and must be decompressed */
+  char *etag;                   /* ETag of the response */
+  const struct validator *validator; /* validators of the local file, if
+                                   the request is to be conditional */
 };
 
 static void
@@ -1469,6 +2021,7 @@ free_hstat (struct http_stat *hs)
 {
   xfree (hs->newloc);
   xfree (hs->remote_time);
+  xfree (hs->etag);
   xfree (hs->error);
   xfree (hs->rderrmsg);
   xfree (hs->local_file);
@@ -1567,6 +2120,8 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
     flags |= rb_skip_startpos;
   if (chunked_transfer_encoding)
     flags |= rb_chunked_transfer_encoding;
+  if (fp != NULL && hs->decompress)
+    flags |= rb_compressed;
 
   hs->len = hs->restval;
   hs->rd_size = 0;
@@ -1576,6 +2131,9 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
   hs->res = fd_read_body (hs->local_file, sock, fp, contlen != -1 ? contlen : 0,
                           hs->restval, &hs->rd_size, &hs->len, &hs->dltime,
                           flags, warc_tmp);
+  if (hs->res >= 0 && (flags & rb_compressed))
+    /* Only now do we know how large the file is.  */
+    hs->contlen = hs->len;
   if (hs->res >= 0)
     {
       if (warc_tmp != NULL)
@@ -1646,6 +2204,261 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
 } while (0)
 #endif /* def __VMS [else] */
 
+/* Find the username and password for authenticating to U, from U
+   itself, .netrc or the options, and store them to *USER and
+   *PASSWD.  */
+
+static void
+find_credentials (const struct url *u, char **user, char **passwd)
+{
+  *user = u->user;
+  *passwd = u->passwd;
+  search_netrc (u->host, (const char **)user, (const char **)passwd, 0);
+  *user = *user ? *user : (opt.http_user ? opt.http_user : opt.user);
+  *passwd = *passwd ? *passwd
+    : (opt.http_passwd ? opt.http_passwd : opt.passwd);
+}
+
+/* Generate the Host header of REQ for U, HOST:PORT.  Take into account
+   that:
+
+   - Broken server-side software often doesn't recognize the PORT
+     argument, so we must generate "Host: www.server.com" instead of
+     "Host: www.server.com:80" (and likewise for https port).
+
+   - IPv6 addresses contain ":", so "Host: 3ffe:8100:200:2::2:1234"
+     becomes ambiguous and needs to be rewritten as "Host:
+     [3ffe:8100:200:2::2]:1234".  */
+
+static void
+request_set_host (struct request *req, const struct url *u)
+{
+  /* Formats arranged for hfmt[add_port][add_squares].  */
+  static const char *hfmt[][2] = {
+    { "%s", "[%s]" }, { "%s:%d", "[%s]:%d" }
+  };
+  int add_port = u->port != scheme_default_port (u->scheme);
+  int add_squares = strchr (u->host, ':') != NULL;
+  request_set_header (req, "Host",
+                      aprintf (hfmt[add_port][add_squares], u->host, u->port),
+                      rel_value);
+}
+
+/* Add the cookies for U and the user headers to REQ.  */
+
+static void
+request_set_cookie_and_user_headers (struct request *req,
+                                     const struct url *u)
+{
+  if (opt.cookies)
+    request_set_header (req, "Cookie",
+                        cookie_header (wget_cookie_jar,
+                                       u->host, u->port, u->path,
+#ifdef HAVE_SSL
+                                       u->scheme == SCHEME_HTTPS
+#else
+                                       0
+#endif
+                                       ),
+                        rel_value);
+
+  /* Add the user headers. */
+  if (opt.user_headers)
+    {
+      int i;
+      for (i = 0; opt.user_headers[i]; i++)
+        request_set_user_header (req, opt.user_headers[i]);
+    }
+}
+
+/* Return the value of the Accept-Encoding header.  Unless RANGED, the
+   request is for the whole body, which may arrive compressed.  A byte
+   range, however, must refer to the file as it is stored locally,
+   i.e. uncompressed.  */
+
+static const char *
+accept_encoding (bool ranged)
+{
+#ifdef HAVE_LIBZ
+  if (opt.compression && !ranged)
+    return "gzip, deflate";
+#endif
+  return "identity";
+}
+
+/* HTTP/1.1 pipelining (--http-pipeline).  While a recursive retrieval
+   processes a URL, the URLs queued after it are known in advance;
+   retrieve_tree passes them here with http_pipeline_add.  Once the
+   response head of the current request shows that the connection
+   stays open, the requests for the queued URLs on the same host are
+   written to the connection right away, so that their responses
+   follow without a round trip each.
+
+   Nothing else changes: each URL is still processed by its own
+   gethttp, which builds its request as usual and uses the connection
+   on which exactly that request was sent ahead, if any.  If the
+   request has changed in the meantime (a cookie was set, say), or the
+   server closes the connection before answering, the pending
+   responses are abandoned with the connection and the requests are
+   simply sent again.
+
+   HTTP/2 connections (see http2.c) take the same route: the requests
+   written ahead become concurrent streams, up to
+   opt.http2_request_window of them.  */
+
+struct pipeline_hint {
+  char *url;
+  char *referer;
+};
+
+static struct pipeline_hint *pipeline_hints;
+static int pipeline_hint_count, pipeline_hint_size;
+
+/* Note that URL, referred to by REFERER, is to be retrieved soon.  */
+
+void
+http_pipeline_add (const char *url, const char *referer)
+{
+  struct pipeline_hint *hint;
+  DO_REALLOC (pipeline_hints, pipeline_hint_size, pipeline_hint_count + 1,
+              struct pipeline_hint);
+  hint = &pipeline_hints[pipeline_hint_count++];
+  hint->url = xstrdup (url);
+  hint->referer = referer ? xstrdup (referer) : NULL;
+}
+
+/* Return the number of requests that may be outstanding on a
+   connection, and thus how many of the URLs to be retrieved next are
+   worth passing to http_pipeline_add.  */
+
+int
+http_pipeline_depth (void)
+{
+#ifdef HAVE_NGHTTP2
+  if (opt.http2)
+    return MAX (opt.http_pipeline, opt.http2_request_window);
+#endif
+  return opt.http_pipeline;
+}
+
+/* Forget the URLs passed to http_pipeline_add.  */
+
+void
+http_pipeline_clear (void)
+{
+  int i;
+  for (i = 0; i < pipeline_hint_count; i++)
+    {
+      xfree (pipeline_hints[i].url);
+      xfree (pipeline_hints[i].referer);
+    }
+  pipeline_hint_count = 0;
+}
+
+/* Build the request gethttp would send for U on behalf of REFERER,
+   in the simple case that pipeline_send restricts itself to.  */
+
+static struct request *
+pipeline_request (const struct url *u, const char *referer)
+{
+  struct request *req = request_new ("GET", url_full_path (u));
+
+  request_set_header (req, "Referer", (char *) referer, rel_none);
+  if (!opt.allow_cache)
+    {
+      request_set_header (req, "Cache-Control", "no-cache, must-revalidate", rel_none);
+      request_set_header (req, "Pragma", "no-cache", rel_none);
+    }
+  SET_USER_AGENT (req);
+  request_set_header (req, "Accept", "*/*", rel_none);
+  request_set_header (req, "Accept-Encoding", (char *) accept_encoding (false),
+                      rel_none);
+  request_set_host (req, u);
+  request_set_header (req, "Connection", "Keep-Alive", rel_none);
+  request_set_cookie_and_user_headers (req, u);
+  return req;
+}
+
+/* Return the number of requests that may be outstanding on the
+   connection FD, whose last response head was HEAD.  */
+
+static int
+pipeline_limit (int fd, const char *head)
+{
+#ifdef HAVE_NGHTTP2
+  if (http2_connection_p (fd))
+    return opt.http2_request_window;
+#endif
+  /* Pipelining requires HTTP/1.1.  */
+  if (0 == strncmp (head, "HTTP/1.1", 8))
+    return opt.http_pipeline;
+  return 0;
+}
+
+/* Send the requests for the URLs expected to be retrieved next over
+   the persistent connection FD, as long as they are for the host FD
+   talks to, until LIMIT requests are outstanding.  */
+
+static void
+pipeline_send (int fd, int limit)
+{
+  struct pconn *pc = persistent_lookup (fd);
+  int i;
+
+  /* Requests that depend on the outcome of the previous ones, or on
+     the local files, are not sent ahead.  */
+  if (!pc || pc->proxied || pc->authorized
+      || opt.method || opt.spider || opt.timestamping || opt.always_rest
+      || opt.start_pos >= 0 || opt.warc_filename)
+    return;
+
+  for (i = 0; i < pipeline_hint_count; i++)
+    {
+      struct pipeline_hint *hint = &pipeline_hints[i];
+      struct url *u;
+      struct request *req;
+      char *request_string, *user, *passwd;
+      int size;
+
+      /* Count the request being processed as well.  */
+      if (pc->pipelined_count + 1 >= limit)
+        break;
+
+      u = url_parse (hint->url, NULL, NULL, true);
+      if (!u)
+        continue;
+      find_credentials (u, &user, &passwd);
+      if (u->port != pc->port || 0 != strcasecmp (u->host, pc->host)
+          || (u->scheme == SCHEME_HTTPS) != pc->ssl
+          || (user && passwd))
+        {
+          url_free (u);
+          continue;
+        }
+      req = pipeline_request (u, hint->referer);
+      request_string = request_format (req, &size);
+      request_free (req);
+      url_free (u);
+
+      if (persistent_pipelined_p (request_string))
+        {
+          xfree (request_string);
+          continue;
+        }
+      DEBUGP (("\n---pipelined request begin---\n%s---request end---\n",
+               request_string));
+      if (fd_write (fd, request_string, size, -1) < 0)
+        {
+          /* The error will show when the response is read.  */
+          xfree (request_string);
+          break;
+        }
+      DO_REALLOC (pc->pipelined, pc->pipelined_size, pc->pipelined_count + 1,
+                  char *);
+      pc->pipelined[pc->pipelined_count++] = request_string;
+    }
+}
+
 /* Retrieve a document through HTTP protocol.  It recognizes status
    code, and correctly handles redirections.  It closes the network
    socket.  If it receives an error from the functions below it, it
@@ -1713,6 +2526,9 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
   /* Is the server using the chunked transfer encoding?  */
   bool chunked_transfer_encoding = false;
 
+  /* Does the server announce support for byte ranges?  */
+  bool ranges_accepted = false;
+
   /* Whether keep-alive should be inhibited.  */
   bool inhibit_keep_alive =
     !opt.http_keep_alive || opt.ignore_length;
@@ -1722,6 +2538,9 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
 
   bool host_lookup_failed = false;
 
+  /* Whether the request was sent ahead of time, see pipeline_send.  */
+  bool pipelined = false;
+
 #ifdef HAVE_SSL
   if (u->scheme == SCHEME_HTTPS)
     {
@@ -1742,8 +2561,10 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
   hs->contlen = -1;
   hs->res = -1;
   hs->rderrmsg = NULL;
+  hs->decompress = false;
   hs->newloc = NULL;
   xfree(hs->remote_time);
+  xfree (hs->etag);
   hs->error = NULL;
   hs->message = NULL;
 
@@ -1783,21 +2604,35 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
       /* ... but some HTTP/1.0 caches doesn't implement Cache-Control.  */
       request_set_header (req, "Pragma", "no-cache", rel_none);
     }
-  if (hs->restval)
+  if (hs->segment)
+    request_set_header (req, "Range",
+                        aprintf ("bytes=%s-%s",
+                                 number_to_static_string (hs->restval),
+                                 number_to_static_string (hs->segment_end)),
+                        rel_value);
+  else if (hs->restval)
     request_set_header (req, "Range",
                         aprintf ("bytes=%s-",
                                  number_to_static_string (hs->restval)),
                         rel_value);
   SET_USER_AGENT (req);
   request_set_header (req, "Accept", "*/*", rel_none);
-  request_set_header (req, "Accept-Encoding", "identity", rel_none);
+  request_set_header (req, "Accept-Encoding",
+                      (char *) accept_encoding (hs->restval || hs->segment),
+                      rel_none);
+  if (hs->validator && !head_only)
+    {
+      /* Ask for the file only if it has changed, see http_loop.  */
+      if (hs->validator->etag)
+        request_set_header (req, "If-None-Match", hs->validator->etag,
+                            rel_none);
+      if (hs->validator->last_modified)
+        request_set_header (req, "If-Modified-Since",
+                            hs->validator->last_modified, rel_none);
+    }
 
   /* Find the username and password for authentication. */
-  user = u->user;
-  passwd = u->passwd;
-  search_netrc (u->host, (const char **)&user, (const char **)&passwd, 0);
-  user = user ? user : (opt.http_user ? opt.http_user : opt.user);
-  passwd = passwd ? passwd : (opt.http_passwd ? opt.http_passwd : opt.passwd);
+  find_credentials (u, &user, &passwd);
 
   /* We only do "site-wide" authentication with "global" user/password
    * values unless --auth-no-challange has been requested; URL user/password
@@ -1809,26 +2644,7 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
       basic_auth_finished = maybe_send_basic_creds(u->host, user, passwd, req);
     }
 
-  /* Generate the Host header, HOST:PORT.  Take into account that:
-
-     - Broken server-side software often doesn't recognize the PORT
-       argument, so we must generate "Host: www.server.com" instead of
-       "Host: www.server.com:80" (and likewise for https port).
-
-     - IPv6 addresses contain ":", so "Host: 3ffe:8100:200:2::2:1234"
-       becomes ambiguous and needs to be rewritten as "Host:
-       [3ffe:8100:200:2::2]:1234".  */
-  {
-    /* Formats arranged for hfmt[add_port][add_squares].  */
-    static const char *hfmt[][2] = {
-      { "%s", "[%s]" }, { "%s:%d", "[%s]:%d" }
-    };
-    int add_port = u->port != scheme_default_port (u->scheme);
-    int add_squares = strchr (u->host, ':') != NULL;
-    request_set_header (req, "Host",
-                        aprintf (hfmt[add_port][add_squares], u->host, u->port),
-                        rel_value);
-  }
+  request_set_host (req, u);
 
   if (inhibit_keep_alive)
     request_set_header (req, "Connection", "Close", rel_none);
@@ -1875,25 +2691,7 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
      without authorization header fails.  (Expected to happen at least
      for the Digest authorization scheme.)  */
 
-  if (opt.cookies)
-    request_set_header (req, "Cookie",
-                        cookie_header (wget_cookie_jar,
-                                       u->host, u->port, u->path,
-#ifdef HAVE_SSL
-                                       u->scheme == SCHEME_HTTPS
-#else
-                                       0
-#endif
-                                       ),
-                        rel_value);
-
-  /* Add the user headers. */
-  if (opt.user_headers)
-    {
-      int i;
-      for (i = 0; opt.user_headers[i]; i++)
-        request_set_user_header (req, opt.user_headers[i]);
-    }
+  request_set_cookie_and_user_headers (req, u);
 
   proxyauth = NULL;
   if (proxy)
@@ -1948,33 +2746,40 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
         relevant = u;
 #endif
 
-      if (persistent_available_p (relevant->host, relevant->port,
+      sock = -1;
+      if (http_pipeline_depth () > 1 && !proxy)
+        sock = persistent_pipelined (req);
+      pipelined = sock != -1;
+      if (sock == -1)
+        sock = persistent_available (relevant->host, relevant->port,
 #ifdef HAVE_SSL
-                                  relevant->scheme == SCHEME_HTTPS,
+                                   relevant->scheme == SCHEME_HTTPS,
 #else
-                                  0,
+                                   0,
 #endif
-                                  &host_lookup_failed))
+                                   proxy != NULL, &host_lookup_failed);
+      if (sock != -1)
         {
-          int family = socket_family (pconn.socket, ENDPOINT_PEER);
-          sock = pconn.socket;
-          using_ssl = pconn.ssl;
+          struct pconn *pc = persistent_lookup (sock);
+          int family = socket_family (sock, ENDPOINT_PEER);
+          using_ssl = pc->ssl;
 #if ENABLE_IPV6
           if (family == AF_INET6)
              logprintf (LOG_VERBOSE, _("Reusing existing connection to [%s]:%d.\n"),
-                        quotearg_style (escape_quoting_style, pconn.host),
-                         pconn.port);
+                        quotearg_style (escape_quoting_style, pc->host),
+                         pc->port);
           else
 #endif
              logprintf (LOG_VERBOSE, _("Reusing existing connection to %s:%d.\n"),
-                        quotearg_style (escape_quoting_style, pconn.host),
-                        pconn.port);
+                        quotearg_style (escape_quoting_style, pc->host),
+                        pc->port);
           DEBUGP (("Reusing fd %d.\n", sock));
-          if (pconn.authorized)
+          if (pc->authorized)
             /* If the connection is already authorized, the "Basic"
                authorization added by code above is unnecessary and
                only hurts us.  */
             request_remove_header (req, "Authorization");
+          touch_persistent (sock);
         }
       else if (host_lookup_failed)
         {
@@ -1984,10 +2789,6 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
                     exec_name, quote (relevant->host));
           return HOSTERR;
         }
-      else if (sock != -1)
-        {
-          sock = -1;
-        }
     }
 
   if (sock < 0)
@@ -2026,7 +2827,7 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
                               aprintf ("%s:%d", u->host, u->port),
                               rel_value);
 
-          write_error = request_send (connreq, sock, 0);
+          write_error = request_send (connreq, sock, 0, NULL, NULL);
           request_free (connreq);
           if (write_error < 0)
             {
@@ -2101,8 +2902,18 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
               return VERIFCERTERR;
             }
           using_ssl = true;
+#ifdef HAVE_NGHTTP2
+          if (ssl_alpn_http2 (sock))
+            http2_start (sock, true);
+#endif
         }
 #endif /* HAVE_SSL */
+
+#ifdef HAVE_NGHTTP2
+      if (conn->scheme == SCHEME_HTTP && !proxy
+          && opt.http2 && opt.http2_prior_knowledge)
+        http2_start (sock, false);
+#endif
     }
 
   /* Open the temporary file where we will write the request. */
@@ -2123,37 +2934,15 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
         }
     }
 
-  /* Send the request to server.  */
-  write_error = request_send (req, sock, warc_tmp);
-
-  if (write_error >= 0)
+  /* Send the request to server, unless it was sent ahead of time.  */
+  if (pipelined)
     {
-      if (opt.body_data)
-        {
-          DEBUGP (("[BODY data: %s]\n", opt.body_data));
-          write_error = fd_write (sock, opt.body_data, body_data_size, -1);
-          if (write_error >= 0 && warc_tmp != NULL)
-            {
-              int warc_tmp_written;
-
-              /* Remember end of headers / start of payload. */
-              warc_payload_offset = ftello (warc_tmp);
-
-              /* Write a copy of the data to the WARC record. */
-              warc_tmp_written = fwrite (opt.body_data, 1, body_data_size, warc_tmp);
-              if (warc_tmp_written != body_data_size)
-                write_error = -2;
-            }
-         }
-      else if (opt.body_file && body_data_size != 0)
-        {
-          if (warc_tmp != NULL)
-            /* Remember end of headers / start of payload */
-            warc_payload_offset = ftello (warc_tmp);
-
-          write_error = body_file_send (sock, opt.body_file, body_data_size, warc_tmp);
-        }
+      DEBUGP (("Request was sent ahead on fd %d.\n", sock));
+      write_error = 0;
     }
+  else
+    write_error = request_send (req, sock, body_data_size, warc_tmp,
+                                &warc_payload_offset);
 
   if (write_error < 0)
     {
@@ -2200,6 +2989,17 @@ gethttp (struct url *u, struct http_stat *hs, int *dt, struct url *proxy,
 
 read_header:
   head = read_http_response_head (sock);
+  if (!head && pipelined)
+    {
+      /* Servers may close a connection with requests still
+         unanswered.  Send the request again on another one.  */
+      logputs (LOG_VERBOSE, _("No response to pipelined request.\n"));
+      CLOSE_INVALIDATE (sock);
+      sock = -1;
+      pipelined = false;
+      goto retry_with_auth;
+    }
+  pipelined = false;
   if (!head)
     {
       if (errno == 0)
@@ -2298,6 +3098,10 @@ read_header:
       && 0 == c_strcasecmp (hdrval, "chunked"))
     chunked_transfer_encoding = true;
 
+  if (resp_header_copy (resp, "Accept-Ranges", hdrval, sizeof (hdrval))
+      && 0 == c_strcasecmp (hdrval, "bytes"))
+    ranges_accepted = true;
+
   /* Handle (possibly multiple instances of) the Set-Cookie header. */
   if (opt.cookies)
     {
@@ -2305,10 +3109,9 @@ read_header:
       const char *scbeg, *scend;
       /* The jar should have been created by now. */
       assert (wget_cookie_jar != NULL);
-      for (scpos = 0;
-           (scpos = resp_header_locate (resp, "Set-Cookie", scpos,
-                                        &scbeg, &scend)) != -1;
-           ++scpos)
+      for (scpos = resp_header_locate (resp, "Set-Cookie", &scbeg, &scend);
+           scpos != -1;
+           scpos = resp_header_next (resp, scpos, &scbeg, &scend))
         {
           char *set_cookie; BOUNDED_TO_ALLOCA (scbeg, scend, set_cookie);
           cookie_handle_set_cookie (wget_cookie_jar, u->host, u->port,
@@ -2319,7 +3122,8 @@ read_header:
   if (keep_alive)
     /* The server has promised that it will not close the connection
        when we're done.  This means that we can register it.  */
-    register_persistent (conn->host, conn->port, sock, using_ssl);
+    register_persistent (conn->host, conn->port, sock, using_ssl,
+                         proxy != NULL);
 
   if (statcode == HTTP_STATUS_UNAUTHORIZED)
     {
@@ -2361,7 +3165,7 @@ read_header:
             CLOSE_INVALIDATE (sock);
         }
 
-      pconn.authorized = false;
+      persistent_set_authorized (sock, false);
       if (!auth_finished && (user && passwd))
         {
           /* IIS sends multiple copies of WWW-Authenticate, one with
@@ -2372,10 +3176,10 @@ read_header:
           const char *www_authenticate = NULL;
           const char *wabeg, *waend;
           const char *digest = NULL, *basic = NULL, *ntlm = NULL;
-          for (wapos = 0; !ntlm
-               && (wapos = resp_header_locate (resp, "WWW-Authenticate", wapos,
-                                            &wabeg, &waend)) != -1;
-               ++wapos)
+          for (wapos = resp_header_locate (resp, "WWW-Authenticate",
+                                           &wabeg, &waend);
+               !ntlm && wapos != -1;
+               wapos = resp_header_next (resp, wapos, &wabeg, &waend))
             {
               param_token name, value;
 
@@ -2445,7 +3249,7 @@ read_header:
               value =  create_authorization_line (www_authenticate,
                                                   user, passwd,
                                                   request_method (req),
-                                                  pth,
+                                                  pth, sock,
                                                   &auth_finished,
                                                   auth_stat);
 
@@ -2495,9 +3299,13 @@ read_header:
     {
       /* Kludge: if NTLM is used, mark the TCP connection as authorized. */
       if (ntlm_seen)
-        pconn.authorized = true;
+        persistent_set_authorized (sock, true);
     }
 
+  /* The connection stays open; request what comes next.  */
+  if (keep_alive)
+    pipeline_send (sock, pipeline_limit (sock, head));
+
   if (statcode == HTTP_STATUS_GATEWAY_TIMEOUT)
     {
       hs->len = 0;
@@ -2663,6 +3471,7 @@ read_header:
     }
   hs->newloc = resp_header_strdup (resp, "Location");
   hs->remote_time = resp_header_strdup (resp, "Last-Modified");
+  hs->etag = resp_header_strdup (resp, "ETag");
 
   if (resp_header_copy (resp, "Content-Range", hdrval, sizeof (hdrval)))
     {
@@ -2674,6 +3483,16 @@ read_header:
           contlen = last_byte_pos - first_byte_pos + 1;
         }
     }
+#ifdef HAVE_LIBZ
+  /* Decompress the body if it's in one of the encodings we asked
+     for.  */
+  if (opt.compression && !hs->restval && !hs->segment
+      && resp_header_copy (resp, "Content-Encoding", hdrval, sizeof (hdrval))
+      && (0 == c_strcasecmp (hdrval, "gzip")
+          || 0 == c_strcasecmp (hdrval, "x-gzip")
+          || 0 == c_strcasecmp (hdrval, "deflate")))
+    hs->decompress = true;
+#endif
   resp_free (resp);
 
   /* 20x responses are counted among successful by default.  */
@@ -2696,6 +3515,45 @@ read_header:
       return RETRFINISHED;
     }
 
+  if (hs->validator)
+    {
+      /* The local file is up to date if the server says so, or if it
+         ignored the conditions but the Last-Modified and size show
+         that the file hasn't changed, as time-stamping without
+         validators would conclude.  The length of a compressed body
+         says nothing about the size of the local file, so only
+         Last-Modified is compared then.  */
+      bool unchanged = statcode == HTTP_STATUS_NOT_MODIFIED;
+      if (statcode == HTTP_STATUS_OK && hs->remote_time
+          && hs->orig_file_name
+          && (hs->decompress || contlen == hs->orig_file_size))
+        {
+          time_t tmr = http_atotm (hs->remote_time);
+          unchanged = tmr != (time_t) -1 && hs->orig_file_tstamp >= tmr;
+        }
+      if (unchanged)
+        {
+          logprintf (LOG_VERBOSE, _("\
+Server file no newer than local file %s -- not retrieving.\n\n"),
+                     quote (hs->orig_file_name
+                            ? hs->orig_file_name : hs->local_file));
+          hs->len = 0;
+          hs->res = 0;
+          /* Recursion goes on with the local file.  */
+          *dt &= ~(TEXTHTML | TEXTCSS);
+          *dt |= RETROKF | hs->validator->dt;
+          xfree (type);
+          if (statcode == HTTP_STATUS_NOT_MODIFIED)
+            CLOSE_FINISH (sock);
+          else
+            CLOSE_INVALIDATE (sock);
+          xfree (head);
+          return RETRUNNEEDED;
+        }
+      /* Whatever comes now replaces the local file.  */
+      hs->validator = NULL;
+    }
+
   /* Return if redirected.  */
   if (H_REDIRECTED (statcode) || statcode == HTTP_STATUS_MULTIPLE_CHOICES)
     {
@@ -2800,7 +3658,7 @@ read_header:
   else
     *dt &= ~TEXTCSS;
 
-  if (opt.adjust_extension)
+  if (opt.adjust_extension && !hs->segment)
     {
       if (*dt & TEXTHTML)
         /* -E / --adjust-extension / adjust_extension = on was specified,
@@ -2816,6 +3674,26 @@ read_header:
         }
     }
 
+  /* Servers often describe .tar.gz files and the like as gzip-encoded
+     ones.  Those are meant to be saved as they are.  */
+  if (hs->decompress
+      && ((type && (0 == c_strcasecmp (type, "application/x-gzip")
+                    || 0 == c_strcasecmp (type, "application/gzip")))
+          || match_tail (hs->local_file, ".gz", true)
+          || match_tail (hs->local_file, ".tgz", true)))
+    hs->decompress = false;
+
+  if (hs->segment && H_20X (statcode)
+      && (!H_PARTIAL (statcode) || contrange != hs->restval
+          || contlen != hs->segment_end - hs->restval + 1))
+    {
+      /* We must get exactly the bytes asked for, or we'd write them
+         to the wrong place.  */
+      xfree (type);
+      CLOSE_INVALIDATE (sock);
+      xfree (head);
+      return RANGEERR;
+    }
   if (statcode == HTTP_STATUS_RANGE_NOT_SATISFIABLE
       || (!opt.timestamping && statcode == HTTP_STATUS_OK
           && contrange == 0 && contlen >= 0 && hs->restval >= contlen))
@@ -2840,8 +3718,9 @@ read_header:
       xfree (head);
       return RETRUNNEEDED;
     }
-  if ((contrange != 0 && contrange != hs->restval)
-      || (H_PARTIAL (statcode) && !contrange))
+  if (!hs->segment
+      && ((contrange != 0 && contrange != hs->restval)
+          || (H_PARTIAL (statcode) && !contrange)))
     {
       /* The Range request was somehow misunderstood by the server.
          Bail out.  */
@@ -2850,7 +3729,9 @@ read_header:
       xfree (head);
       return RANGEERR;
     }
-  if (contlen == -1)
+  /* The length of a compressed body says nothing about the size of
+     the file.  */
+  if (contlen == -1 || hs->decompress)
     hs->contlen = -1;
   else
     hs->contlen = contlen + contrange;
@@ -2951,8 +3832,50 @@ read_header:
 # define FOPEN_BIN_FLAG true
 #endif /* def __VMS [else] */
 
+  /* Hand large files over to segmented retrieval, which needs to know
+     their exact length and that the server honors byte ranges.  An
+     interrupted segmented download is resumed even without
+     --segments.  */
+  if (!hs->segment && statcode == HTTP_STATUS_OK && !output_stream
+      && !warc_enabled && !opt.save_headers && hs->restval == 0
+      && ranges_accepted && !chunked_transfer_encoding && !hs->decompress
+      && contlen >= 2 * SEGMENT_MIN_SIZE
+      && (opt.segments > 1 || segments_pending_p (hs->local_file)))
+    {
+      xfree (type);
+      CLOSE_INVALIDATE (sock);
+      xfree (head);
+      mkalldirs (hs->local_file);
+      hs->restval = 0;
+      err = retrieve_segmented (u->url, proxy ? proxy->url : NULL,
+                                hs->local_file, contlen, &hs->len,
+                                &hs->rd_size, &hs->dltime);
+      hs->res = (err == RETRFINISHED) ? 0 : -1;
+      if (err != RETRFINISHED)
+        hs->len = 0;
+      return err;
+    }
+
   /* Open the local file.  */
-  if (!output_stream)
+  if (hs->segment)
+    {
+      /* Write the segment where it belongs in the file created by
+         retrieve_segmented.  */
+      fp = fopen (hs->local_file, "r+b");
+      if (fp && fseeko (fp, hs->restval, SEEK_SET) < 0)
+        {
+          fclose (fp);
+          fp = NULL;
+        }
+      if (!fp)
+        {
+          logprintf (LOG_NOTQUIET, "%s: %s\n", hs->local_file, strerror (errno));
+          CLOSE_INVALIDATE (sock);
+          xfree (head);
+          return FOPENERR;
+        }
+    }
+  else if (!output_stream)
     {
       mkalldirs (hs->local_file);
       if (opt.backups)
@@ -3042,12 +3965,100 @@ read_header:
   else
     CLOSE_INVALIDATE (sock);
 
-  if (!output_stream)
+  if (!output_stream || hs->segment)
     fclose (fp);
 
   return err;
 }
 
+/* Retrieve bytes START to END (inclusive) of URL through PROXY (which
+   may be NULL), and write them at the same offsets of FILE, which must
+   exist.  This is a single attempt; retrying is up to the caller.
+   The number of bytes written is stored to *LEN.
+
+   This is used by the segmented retrieval in segment.c, possibly in a
+   worker process.  */
+
+uerr_t
+http_retrieve_range (const char *url, const char *proxy, const char *file,
+                     wgint start, wgint end, wgint *len)
+{
+  struct http_stat hstat;
+  struct url *u, *proxy_url = NULL;
+  struct iri *iri = iri_new ();
+  int dt = 0, saved_verbose = opt.verbose;
+  bool saved_show_progress = opt.show_progress;
+  uerr_t err;
+
+  /* URL and PROXY have been parsed before; don't encode them again.  */
+  set_uri_encoding (iri, opt.locale, true);
+  iri->utf8_encode = false;
+
+  *len = 0;
+  u = url_parse (url, NULL, iri, true);
+  if (proxy)
+    proxy_url = url_parse (proxy, NULL, iri, true);
+  if (!u || (proxy && !proxy_url))
+    {
+      if (u)
+        url_free (u);
+      iri_free (iri);
+      return URLERROR;
+    }
+
+  xzero (hstat);
+  hstat.local_file = xstrdup (file);
+  hstat.restval = start;
+  /* FILE is ours; it must not be renamed or skipped.  */
+  hstat.existence_checked = true;
+  hstat.segment = true;
+  hstat.segment_end = end;
+
+  /* The progress of the whole file is reported by the caller; don't
+     report on each segment.  */
+  opt.verbose = false;
+  opt.show_progress = false;
+  err = gethttp (u, &hstat, &dt, proxy_url, iri, 1);
+  opt.verbose = saved_verbose;
+  opt.show_progress = saved_show_progress;
+
+  if (err == RETRFINISHED)
+    {
+      *len = hstat.rd_size;
+      if (!(dt & RETROKF))
+        {
+          logprintf (LOG_NOTQUIET, _("%s ERROR %d: %s.\n"),
+                     url, hstat.statcode,
+                     quotearg_style (escape_quoting_style, hstat.error));
+          err = WRONGCODE;
+        }
+      else if (hstat.res < 0)
+        err = READERR;
+      else if (hstat.rd_size != end - start + 1)
+        err = HEOF;
+      else
+        err = RETROK;
+    }
+
+  free_hstat (&hstat);
+  url_free (u);
+  if (proxy_url)
+    url_free (proxy_url);
+  iri_free (iri);
+  return err;
+}
+
+/* Record the validators of the file just downloaded as HS, so that
+   the next time-stamping run can find out whether it has changed with
+   a single request.  */
+
+static void
+remember_validators (const struct http_stat *hs, int dt)
+{
+  if (opt.timestamping && !opt.output_document && !opt.delete_after)
+    validator_put (hs->local_file, hs->etag, hs->remote_time, dt);
+}
+
 /* The genuine HTTP loop!  This is the part where the retrieval is
    retried, and retried, and retried, and...  */
 uerr_t
@@ -3144,7 +4155,15 @@ http_loop (struct url *u, struct url *original_url, char **newloc,
     file_name = xstrdup (opt.output_document);
   if (opt.timestamping && (file_exists_p (file_name)
                            || opt.content_disposition))
-    send_head_first = true;
+    {
+      /* If the local file is still the one downloaded before, a
+         single GET conditional on its validators tells whether it is
+         up to date.  */
+      if (!opt.content_disposition && !opt.output_document && !opt.spider)
+        hstat.validator = validator_get (file_name);
+      if (!hstat.validator)
+        send_head_first = true;
+    }
   xfree (file_name);
 
   /* THE loop */
@@ -3198,6 +4217,10 @@ Spider mode enabled. Check if remote file exists.\n"));
         hstat.restval = hstat.len;
       else if (opt.start_pos >= 0)
         hstat.restval = opt.start_pos;
+      else if (got_name && segments_pending_p (hstat.local_file))
+        /* The file has its full length already; segment.c knows
+           which parts of it are there.  */
+        hstat.restval = 0;
       else if (opt.always_rest
           && got_name
           && stat (hstat.local_file, &st) == 0
@@ -3535,6 +4558,8 @@ Remote file exists.\n\n"));
           ++numurls;
           total_downloaded_bytes += hstat.rd_size;
 
+          remember_validators (&hstat, *dt);
+
           /* Remember that we downloaded the file for later ".orig" code. */
           if (*dt & ADDED_HTML_EXTENSION)
             downloaded_file (FILE_DOWNLOADED_AND_HTML_EXTENSION_ADDED, hstat.local_file);
@@ -3568,6 +4593,8 @@ Remote file exists.\n\n"));
               ++numurls;
               total_downloaded_bytes += hstat.rd_size;
 
+              remember_validators (&hstat, *dt);
+
               /* Remember that we downloaded the file for later ".orig" code. */
               if (*dt & ADDED_HTML_EXTENSION)
                 downloaded_file (FILE_DOWNLOADED_AND_HTML_EXTENSION_ADDED, hstat.local_file);
@@ -4037,7 +5064,8 @@ known_authentication_scheme_p (const char *hdrbeg, const char *hdrend)
 static char *
 create_authorization_line (const char *au, const char *user,
                            const char *passwd, const char *method,
-                           const char *path, bool *finished, uerr_t *auth_err)
+                           const char *path, int sock, bool *finished,
+                           uerr_t *auth_err)
 {
   /* We are called only with known schemes, so we can dispatch on the
      first letter. */
@@ -4053,12 +5081,15 @@ create_authorization_line (const char *au, const char *user,
 #endif
 #ifdef ENABLE_NTLM
     case 'N':                   /* NTLM */
-      if (!ntlm_input (&pconn.ntlm, au))
-        {
-          *finished = true;
-          return NULL;
-        }
-      return ntlm_output (&pconn.ntlm, user, passwd, finished);
+      {
+        struct ntlmdata *ntlm = persistent_ntlm (sock);
+        if (!ntlm_input (ntlm, au))
+          {
+            *finished = true;
+            return NULL;
+          }
+        return ntlm_output (ntlm, user, passwd, finished);
+      }
 #endif
     default:
       /* We shouldn't get here -- this function should be only called
@@ -4086,10 +5117,24 @@ save_cookies (void)
     cookie_jar_save (wget_cookie_jar, opt.cookies_output);
 }
 
+/* Close all persistent connections.  */
+
+void
+http_close_persistent (void)
+{
+  while (pconn_count)
+    persistent_remove (&pconn_pool[pconn_count - 1], false);
+}
+
 void
 http_cleanup (void)
 {
-  xfree (pconn.host);
+  http_close_persistent ();
+  xfree (pconn_pool);
+  pconn_size = 0;
+  http_pipeline_clear ();
+  xfree (pipeline_hints);
+  pipeline_hint_size = 0;
   if (wget_cookie_jar)
     cookie_jar_delete (wget_cookie_jar);
 }
@@ -4168,6 +5213,69 @@ test_parse_content_disposition(void)
   return NULL;
 }
 
+const char *
+test_resp_header_locate (void)
+{
+  static const char head[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Set-Cookie: a=1\r\n"
+    "content-length:  42 \r\n"
+    "X-Cache: HIT\r\n"
+    "Broken header\r\n"
+    "set-cookie: b=2;\r\n"
+    "  path=/\r\n"
+    "X-CACHE: MISS\r\n"
+    "Set-Cookie: c=3\r\n"
+    "\r\n";
+  static const char *const cookies[] = { "a=1", "b=2;\r\n  path=/", "c=3" };
+  struct response *resp = resp_new (head);
+  const char *b, *e;
+  char buf[32];
+  int pos, i;
+
+  mu_assert ("test_resp_header_locate: wrong Content-Length",
+             resp_header_copy (resp, "Content-Length", buf, sizeof buf)
+             && 0 == strcmp (buf, "42"));
+  mu_assert ("test_resp_header_locate: found missing header",
+             !resp_header_copy (resp, "Location", buf, sizeof buf)
+             && !resp_header_copy (resp, "X-Missing", buf, sizeof buf)
+             && !resp_header_copy (resp, "Broken header", buf, sizeof buf));
+
+  for (i = 0, pos = resp_header_locate (resp, "Set-Cookie", &b, &e);
+       pos != -1; i++, pos = resp_header_next (resp, pos, &b, &e))
+    mu_assert ("test_resp_header_locate: wrong Set-Cookie",
+               i < countof (cookies)
+               && e - b == strlen (cookies[i])
+               && 0 == strncmp (b, cookies[i], e - b));
+  mu_assert ("test_resp_header_locate: wrong number of Set-Cookie",
+             i == countof (cookies));
+
+  pos = resp_header_locate (resp, "x-cache", &b, &e);
+  mu_assert ("test_resp_header_locate: wrong X-Cache",
+             pos != -1 && e - b == 3 && 0 == strncmp (b, "HIT", 3));
+  pos = resp_header_next (resp, pos, &b, &e);
+  mu_assert ("test_resp_header_locate: wrong second X-Cache",
+             pos != -1 && e - b == 4 && 0 == strncmp (b, "MISS", 4)
+             && resp_header_next (resp, pos, &b, &e) == -1);
+  resp_free (resp);
+
+  /* Every known name must be found by the perfect hash.  */
+  for (i = 0; i < HDR_COUNT; i++)
+    {
+      const char *name = known_headers[i];
+      mu_assert ("test_resp_header_locate: known header not found",
+                 known_header (name, strlen (name),
+                               header_name_hash (name, strlen (name))) == i);
+    }
+
+  resp = resp_new ("");
+  mu_assert ("test_resp_header_locate: header in HTTP/0.9 response",
+             resp_header_locate (resp, "Content-Length", &b, &e) == -1);
+  resp_free (resp);
+
+  return NULL;
+}
+
 #endif /* TESTING */
 
 /*
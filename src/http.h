@@ -36,6 +36,12 @@ struct url;
 uerr_t http_loop (struct url *, struct url *, char **, char **, const char *,
                   int *, struct url *, struct iri *);
 void save_cookies (void);
+uerr_t http_retrieve_range (const char *, const char *, const char *,
+                            wgint, wgint, wgint *);
+void http_close_persistent (void);
+void http_pipeline_add (const char *, const char *);
+int http_pipeline_depth (void);
+void http_pipeline_clear (void);
 void http_cleanup (void);
 time_t http_atotm (const char *);
 
@@ -0,0 +1,956 @@
+/* HTTP/2 transport.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* When the server agrees to HTTP/2, either through ALPN during the
+   TLS handshake or because the user said so with
+   --http2-prior-knowledge, http2_start stacks this transport on the
+   connection.  To the rest of Wget the connection still looks like
+   one speaking HTTP/1.1: the requests written to it are parsed and
+   submitted as HTTP/2 streams, and reading from it yields the
+   responses, converted back to HTTP/1.1 messages, in the order in
+   which the requests were written.
+
+   Requests written ahead of time by the pipelining code in http.c are
+   therefore sent as concurrent streams, and their responses are
+   received in parallel while the one in front is being read.  Since a
+   response is only consumed when Wget gets to it, each stream is
+   limited to a modest flow control window, except for the stream
+   being read, which gets a large one.  */
+
+#include "wget.h"
+
+#ifdef HAVE_NGHTTP2
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include <nghttp2/nghttp2.h>
+
+#include "utils.h"
+#include "connect.h"
+#include "http2.h"
+#include "c-strcase.h"
+#ifdef HAVE_SSL
+# include "ssl.h"
+#endif
+
+/* Flow control windows of streams waiting to be read, of the stream
+   being read, and of the whole connection.  */
+#define STREAM_WINDOW (256 * 1024)
+#define CURRENT_STREAM_WINDOW (8 * 1024 * 1024)
+#define CONNECTION_WINDOW (32 * 1024 * 1024)
+
+/* The amount of request body kept while the server's flow control
+   window doesn't let it be sent.  Beyond that, writing the body waits
+   for the window to open.  */
+#define BODY_BUFFER_MAX (256 * 1024)
+
+struct http2_buffer {
+  char *data;
+  int pos;                      /* start of the unread data */
+  int size;                     /* end of the data */
+  int capacity;
+};
+
+struct http2_stream {
+  int32_t id;
+  bool head_request;            /* whether this is a HEAD request */
+  struct http2_buffer body;     /* request body written but not sent */
+  wgint body_left;              /* request body yet to be written */
+  bool body_deferred;           /* whether nghttp2 waits for the body */
+
+  int status;                   /* response status code */
+  struct http2_buffer headers;  /* response header lines so far */
+  bool content_length;          /* whether Content-Length was sent */
+  bool head_done;               /* whether the response head is in DATA */
+  bool chunked;                 /* whether DATA uses chunked encoding */
+  bool ended;                   /* whether the response is complete */
+  bool closed;                  /* whether the stream is closed */
+  bool window_raised;           /* whether the window was enlarged */
+
+  struct http2_buffer data;     /* the response as HTTP/1.1 message */
+  int unconsumed;               /* body bytes received but not read */
+
+  struct http2_stream *next;
+};
+
+struct http2_connection {
+  nghttp2_session *session;
+  bool ssl;
+
+  /* The transport the connection was using before, if any.  */
+  struct transport_implementation *inner;
+  void *inner_ctx;
+
+  /* Request text written but not yet submitted.  */
+  struct http2_buffer request;
+
+  /* The stream whose request body is being written, if any.  */
+  struct http2_stream *upload;
+
+  /* Streams whose responses are yet to be read, in request order.  */
+  struct http2_stream *head, *tail;
+
+  bool eof;                     /* the server closed the connection */
+  bool goaway;                  /* the server sent GOAWAY */
+  int error;                    /* nghttp2 error code, or 0 */
+};
+
+static void
+buffer_append (struct http2_buffer *buf, const void *data, int size)
+{
+  /* Reuse the space of the data already read.  */
+  if (buf->pos && buf->pos >= buf->size - buf->pos)
+    {
+      memmove (buf->data, buf->data + buf->pos, buf->size - buf->pos);
+      buf->size -= buf->pos;
+      buf->pos = 0;
+    }
+  /* Leave room for a terminating 0.  */
+  DO_REALLOC (buf->data, buf->capacity, buf->size + size + 1, char);
+  memcpy (buf->data + buf->size, data, size);
+  buf->size += size;
+  buf->data[buf->size] = '\0';
+}
+
+static void
+buffer_append_string (struct http2_buffer *buf, const char *s)
+{
+  buffer_append (buf, s, strlen (s));
+}
+
+static void
+stream_free (struct http2_connection *conn, struct http2_stream *s)
+{
+  /* A stream may be abandoned before the server is done with it,
+     typically when the response turned out to be unwanted.  */
+  if (!s->closed && s->id > 0)
+    {
+      nghttp2_session_set_stream_user_data (conn->session, s->id, NULL);
+      nghttp2_submit_rst_stream (conn->session, NGHTTP2_FLAG_NONE, s->id,
+                                 NGHTTP2_CANCEL);
+    }
+  if (conn->upload == s)
+    conn->upload = NULL;
+  xfree (s->body.data);
+  xfree (s->headers.data);
+  xfree (s->data.data);
+  xfree (s);
+}
+
+/* Reason phrases for the status line of converted responses.  */
+
+static const char *
+status_phrase (int status)
+{
+  static const struct {
+    int status;
+    const char *phrase;
+  } phrases[] = {
+    { 200, "OK" },
+    { 201, "Created" },
+    { 204, "No Content" },
+    { 206, "Partial Content" },
+    { 301, "Moved Permanently" },
+    { 302, "Found" },
+    { 303, "See Other" },
+    { 304, "Not Modified" },
+    { 307, "Temporary Redirect" },
+    { 308, "Permanent Redirect" },
+    { 400, "Bad Request" },
+    { 401, "Unauthorized" },
+    { 403, "Forbidden" },
+    { 404, "Not Found" },
+    { 405, "Method Not Allowed" },
+    { 410, "Gone" },
+    { 416, "Requested Range Not Satisfiable" },
+    { 429, "Too Many Requests" },
+    { 500, "Internal Server Error" },
+    { 502, "Bad Gateway" },
+    { 503, "Service Unavailable" },
+    { 504, "Gateway Timeout" },
+  };
+  int i;
+  for (i = 0; i < countof (phrases); i++)
+    if (phrases[i].status == status)
+      return phrases[i].phrase;
+  return "";
+}
+
+/* Put the HTTP/1.1 head of the response to S into its data.  ENDED
+   tells whether the response ended with its HEADERS frame.  Without
+   a Content-Length the body is delimited with chunked encoding, the
+   way an HTTP/1.1 server would do it.  */
+
+static void
+stream_finish_head (struct http2_stream *s, bool ended)
+{
+  char *line = aprintf ("HTTP/2 %d %s\r\n", s->status,
+                        status_phrase (s->status));
+  buffer_append_string (&s->data, line);
+  xfree (line);
+  if (s->headers.size)
+    buffer_append (&s->data, s->headers.data, s->headers.size);
+  if (!s->content_length)
+    {
+      if (!ended)
+        {
+          buffer_append_string (&s->data, "Transfer-Encoding: chunked\r\n");
+          s->chunked = true;
+        }
+      else if (!s->head_request)
+        buffer_append_string (&s->data, "Content-Length: 0\r\n");
+    }
+  buffer_append_string (&s->data, "\r\n");
+  xfree (s->headers.data);
+  s->headers.size = s->headers.capacity = 0;
+  s->head_done = true;
+}
+
+static void
+stream_end (struct http2_stream *s)
+{
+  if (s->chunked)
+    buffer_append_string (&s->data, "0\r\n\r\n");
+  s->ended = true;
+}
+
+static int
+on_header (nghttp2_session *session, const nghttp2_frame *frame,
+           const uint8_t *name, size_t namelen,
+           const uint8_t *value, size_t valuelen,
+           uint8_t flags, void *user_data)
+{
+  struct http2_stream *s;
+
+  if (frame->hd.type != NGHTTP2_HEADERS)
+    return 0;
+  s = nghttp2_session_get_stream_user_data (session, frame->hd.stream_id);
+  /* Trailers are of no interest.  */
+  if (!s || s->head_done)
+    return 0;
+
+  if (namelen == 7 && !memcmp (name, ":status", 7))
+    {
+      s->status = 0;
+      while (valuelen-- > 0 && c_isdigit (*value))
+        s->status = 10 * s->status + (*value++ - '0');
+    }
+  else if (*name != ':')
+    {
+      buffer_append (&s->headers, name, namelen);
+      buffer_append (&s->headers, ": ", 2);
+      buffer_append (&s->headers, value, valuelen);
+      buffer_append (&s->headers, "\r\n", 2);
+      if (namelen == 14 && !memcmp (name, "content-length", 14))
+        s->content_length = true;
+    }
+  return 0;
+}
+
+static int
+on_frame_recv (nghttp2_session *session, const nghttp2_frame *frame,
+               void *user_data)
+{
+  struct http2_connection *conn = user_data;
+  struct http2_stream *s;
+  bool ended = frame->hd.flags & NGHTTP2_FLAG_END_STREAM;
+
+  switch (frame->hd.type)
+    {
+    case NGHTTP2_HEADERS:
+      s = nghttp2_session_get_stream_user_data (session, frame->hd.stream_id);
+      if (!s)
+        break;
+      if (!s->head_done)
+        {
+          /* Interim responses are dropped, as Wget doesn't ask for
+             them.  */
+          if (s->status / 100 == 1)
+            {
+              s->status = 0;
+              s->headers.size = 0;
+              s->content_length = false;
+              break;
+            }
+          stream_finish_head (s, ended);
+        }
+      if (ended)
+        stream_end (s);
+      break;
+    case NGHTTP2_DATA:
+      s = nghttp2_session_get_stream_user_data (session, frame->hd.stream_id);
+      if (s && ended)
+        stream_end (s);
+      break;
+    case NGHTTP2_GOAWAY:
+      DEBUGP (("Received HTTP/2 GOAWAY.\n"));
+      conn->goaway = true;
+      break;
+    }
+  return 0;
+}
+
+static int
+on_data_chunk_recv (nghttp2_session *session, uint8_t flags,
+                    int32_t stream_id, const uint8_t *data, size_t len,
+                    void *user_data)
+{
+  struct http2_stream *s;
+
+  /* Only the streams are flow-controlled by the reading; the
+     connection window is always given back right away.  */
+  nghttp2_session_consume_connection (session, len);
+
+  s = nghttp2_session_get_stream_user_data (session, stream_id);
+  if (!s)
+    return 0;
+  if (s->chunked)
+    {
+      char size[32];
+      snprintf (size, sizeof size, "%lx\r\n", (unsigned long) len);
+      buffer_append_string (&s->data, size);
+    }
+  buffer_append (&s->data, data, len);
+  if (s->chunked)
+    buffer_append (&s->data, "\r\n", 2);
+  s->unconsumed += len;
+  return 0;
+}
+
+static int
+on_stream_close (nghttp2_session *session, int32_t stream_id,
+                 uint32_t error_code, void *user_data)
+{
+  struct http2_stream *s
+    = nghttp2_session_get_stream_user_data (session, stream_id);
+  if (s)
+    {
+      if (!s->ended)
+        DEBUGP (("HTTP/2 stream %d closed: %s.\n", (int) stream_id,
+                 nghttp2_http2_strerror (error_code)));
+      s->closed = true;
+    }
+  return 0;
+}
+
+/* Provide the request body of a stream to nghttp2, as it is written.
+   When all that was written has been sent, defer the stream until
+   http2_write resumes it with more.  */
+
+static ssize_t
+read_request_body (nghttp2_session *session, int32_t stream_id,
+                   uint8_t *buf, size_t length, uint32_t *data_flags,
+                   nghttp2_data_source *source, void *user_data)
+{
+  struct http2_stream *s
+    = nghttp2_session_get_stream_user_data (session, stream_id);
+  int size;
+
+  if (!s)
+    return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+  size = MIN ((size_t) (s->body.size - s->body.pos), length);
+  if (!size && s->body_left)
+    {
+      s->body_deferred = true;
+      return NGHTTP2_ERR_DEFERRED;
+    }
+  memcpy (buf, s->body.data + s->body.pos, size);
+  s->body.pos += size;
+  if (!s->body_left && s->body.pos == s->body.size)
+    *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+  return size;
+}
+
+static int
+inner_read (int fd, struct http2_connection *conn, char *buf, int bufsize)
+{
+  int res;
+  if (conn->inner && conn->inner->reader)
+    return conn->inner->reader (fd, buf, bufsize, conn->inner_ctx);
+  do
+    res = read (fd, buf, bufsize);
+  while (res == -1 && errno == EINTR);
+  return res;
+}
+
+static int
+inner_write (int fd, struct http2_connection *conn, char *buf, int bufsize)
+{
+  int res;
+  if (conn->inner && conn->inner->writer)
+    return conn->inner->writer (fd, buf, bufsize, conn->inner_ctx);
+  do
+    res = write (fd, buf, bufsize);
+  while (res == -1 && errno == EINTR);
+  return res;
+}
+
+static int
+inner_poll (int fd, struct http2_connection *conn, double timeout)
+{
+  if (conn->inner && conn->inner->poller)
+    return conn->inner->poller (fd, timeout, WAIT_FOR_READ, conn->inner_ctx);
+  return select_fd (fd, timeout, WAIT_FOR_READ);
+}
+
+/* Return true if data from the server can be read without blocking,
+   either from the socket or, on SSL connections, from the data the
+   SSL library has already received.  Unlike inner_poll with a zero
+   timeout, this never waits.  */
+
+static bool
+inner_readable_p (int fd, struct http2_connection *conn)
+{
+#ifdef HAVE_SSL
+  if (conn->ssl && ssl_pending_p (conn->inner_ctx))
+    return true;
+#endif
+  return select_fd (fd, 0, WAIT_FOR_READ) > 0;
+}
+
+/* Send the frames queued in the session.  Returns false on error.  */
+
+static bool
+flush_session (int fd, struct http2_connection *conn)
+{
+  for (;;)
+    {
+      const uint8_t *data;
+      ssize_t size = nghttp2_session_mem_send (conn->session, &data);
+      if (size < 0)
+        {
+          conn->error = size;
+          errno = EPROTO;
+          return false;
+        }
+      if (size == 0)
+        return true;
+      while (size > 0)
+        {
+          int res = inner_write (fd, conn, (char *) data, size);
+          if (res <= 0)
+            return false;
+          data += res;
+          size -= res;
+        }
+    }
+}
+
+/* Send the queued frames, then wait for data from the server for up
+   to TIMEOUT seconds, or indefinitely if TIMEOUT is 0, and process
+   it.  Returns 1 if data has been processed, 0 on timeout and -1 on
+   error.  */
+
+static int
+receive_frames (int fd, struct http2_connection *conn, double timeout)
+{
+  char buf[16 * 1024];
+  ssize_t res;
+
+  if (!flush_session (fd, conn))
+    return -1;
+  if (timeout)
+    {
+      int test = inner_poll (fd, conn, timeout);
+      if (test == 0)
+        errno = ETIMEDOUT;
+      if (test <= 0)
+        return test;
+    }
+
+  res = inner_read (fd, conn, buf, sizeof buf);
+  if (res < 0)
+    return -1;
+  if (res == 0)
+    {
+      conn->eof = true;
+      return 1;
+    }
+  res = nghttp2_session_mem_recv (conn->session, (uint8_t *) buf, res);
+  if (res < 0)
+    {
+      conn->error = res;
+      errno = EPROTO;
+      return -1;
+    }
+  return flush_session (fd, conn) ? 1 : -1;
+}
+
+/* Return the stream whose response is to be read, dropping those
+   that have been read completely, or NULL if there is none.  */
+
+static struct http2_stream *
+current_stream (struct http2_connection *conn)
+{
+  struct http2_stream *s;
+
+  while ((s = conn->head) && s->ended && s->data.pos == s->data.size)
+    {
+      conn->head = s->next;
+      if (!conn->head)
+        conn->tail = NULL;
+      stream_free (conn, s);
+    }
+
+  /* The stream being read is the one that needs a large window.  */
+  if (s && !s->window_raised && s->id > 0
+      && nghttp2_session_find_stream (conn->session, s->id))
+    {
+      nghttp2_session_set_local_window_size (conn->session,
+                                             NGHTTP2_FLAG_NONE, s->id,
+                                             CURRENT_STREAM_WINDOW);
+      s->window_raised = true;
+    }
+  return s;
+}
+
+/* Return true if reading from the connection will not block.  */
+
+static bool
+connection_readable_p (struct http2_connection *conn)
+{
+  struct http2_stream *s = current_stream (conn);
+  return (!s || s->data.pos < s->data.size || s->closed
+          || conn->eof || conn->error);
+}
+
+/* Receive frames until the response to be read next has data
+   available, and return its stream.  When there is nothing left to
+   read, return NULL and store the value the read should return to
+   *RESULT: 0 for the end of the connection, -1 for an error.  */
+
+static struct http2_stream *
+readable_stream (int fd, struct http2_connection *conn, int *result)
+{
+  for (;;)
+    {
+      struct http2_stream *s = current_stream (conn);
+
+      *result = 0;
+      if (!s)
+        return NULL;
+      if (s->data.pos < s->data.size)
+        return s;
+      if (s->closed)
+        {
+          /* The stream was reset.  If the server didn't get to
+             answer, behave as if it had closed the connection, so
+             that the request is simply repeated.  */
+          if (s->head_done)
+            {
+              errno = ECONNRESET;
+              *result = -1;
+            }
+          return NULL;
+        }
+      if (conn->eof)
+        return NULL;
+      if (conn->error)
+        {
+          errno = EPROTO;
+          *result = -1;
+          return NULL;
+        }
+      if (receive_frames (fd, conn, 0) < 0)
+        {
+          *result = -1;
+          return NULL;
+        }
+    }
+}
+
+static int
+http2_read (int fd, char *buf, int bufsize, void *arg)
+{
+  struct http2_connection *conn = arg;
+  struct http2_stream *s;
+  int result, size, consumed;
+
+  s = readable_stream (fd, conn, &result);
+  if (!s)
+    return result;
+
+  size = MIN (bufsize, s->data.size - s->data.pos);
+  memcpy (buf, s->data.data + s->data.pos, size);
+  s->data.pos += size;
+
+  /* Let the server send as much as has been read.  Some of what was
+     read may be the head or chunk sizes, but that only makes the
+     window open slightly sooner.  */
+  consumed = MIN (size, s->unconsumed);
+  if (consumed && !s->closed)
+    {
+      nghttp2_session_consume_stream (conn->session, s->id, consumed);
+      s->unconsumed -= consumed;
+    }
+  return size;
+}
+
+/* Submit the request at the start of CONN->request, if its head has
+   been written.  Its body, if any, is passed on as it is written, see
+   feed_body.  Returns 1 if a request was submitted, 0 if more is to
+   be written, and -1 on error.  */
+
+static int
+submit_request (struct http2_connection *conn)
+{
+  char *text = conn->request.data + conn->request.pos, *head, *p, *end;
+  nghttp2_nv *nva;
+  int nvlen = 0, lines = 0, head_size;
+  wgint body_size = 0;
+  nghttp2_data_provider provider;
+  struct http2_stream *s;
+
+  if (!conn->request.data || !(end = strstr (text, "\r\n\r\n")))
+    return 0;
+  head_size = end + 4 - text;
+  for (p = text; p < end; p++)
+    if (*p == '\n')
+      ++lines;
+
+  /* Work on a copy, which holds the header names lower-cased as
+     HTTP/2 requires.  */
+  head = strdupdelim (text, end + 2);
+  end = head + (end + 2 - text);
+  nva = xnew_array (nghttp2_nv, lines + 4);
+  s = xnew0 (struct http2_stream);
+
+#define ADD_NV(n, nlen, v, vlen) do {                   \
+  nva[nvlen].name = (uint8_t *) (n);                    \
+  nva[nvlen].namelen = (nlen);                          \
+  nva[nvlen].value = (uint8_t *) (v);                   \
+  nva[nvlen].valuelen = (vlen);                         \
+  nva[nvlen].flags = NGHTTP2_NV_FLAG_NONE;              \
+  ++nvlen;                                              \
+} while (0)
+
+  /* The request line: METHOD PATH HTTP/1.1 */
+  {
+    char *method = head, *path, *eol = strstr (head, "\r\n");
+    path = memchr (method, ' ', eol - method);
+    if (!path)
+      goto malformed;
+    *path++ = '\0';
+    p = memchr (path, ' ', eol - path);
+    if (!p)
+      goto malformed;
+    s->head_request = !strcmp (method, "HEAD");
+    ADD_NV (":method", 7, method, strlen (method));
+    ADD_NV (":scheme", 7, conn->ssl ? "https" : "http",
+            conn->ssl ? 5 : 4);
+    ADD_NV (":path", 5, path, p - path);
+    /* Pseudo-headers come first; the slot after :path is kept for
+       the :authority derived from Host.  */
+    ADD_NV (":authority", 10, "", 0);
+    p = eol + 2;
+  }
+
+  while (p < end)
+    {
+      char *name = p, *colon, *value, *eol = strstr (p, "\r\n");
+      p = eol + 2;
+      colon = memchr (name, ':', eol - name);
+      if (!colon)
+        continue;
+      for (value = colon + 1; value < eol && c_isspace (*value); value++)
+        ;
+      *colon = '\0';
+      *eol = '\0';
+      if (!c_strcasecmp (name, "Host"))
+        {
+          nva[3].value = (uint8_t *) value;
+          nva[3].valuelen = eol - value;
+          continue;
+        }
+      /* Connection-specific headers are not allowed in HTTP/2.  */
+      if (!c_strcasecmp (name, "Connection")
+          || !c_strcasecmp (name, "Keep-Alive")
+          || !c_strcasecmp (name, "Proxy-Connection")
+          || !c_strcasecmp (name, "Transfer-Encoding")
+          || !c_strcasecmp (name, "Upgrade")
+          || !c_strcasecmp (name, "TE"))
+        continue;
+      if (!c_strcasecmp (name, "Content-Length"))
+        body_size = str_to_wgint (value, NULL, 10);
+      for (colon = name; *colon; colon++)
+        *colon = c_tolower (*colon);
+      ADD_NV (name, colon - name, value, eol - value);
+    }
+#undef ADD_NV
+
+  if (body_size > 0)
+    {
+      s->body_left = body_size;
+      provider.source.ptr = s;
+      provider.read_callback = read_request_body;
+    }
+
+  s->id = nghttp2_submit_request (conn->session, NULL, nva, nvlen,
+                                  s->body_left ? &provider : NULL, s);
+  xfree (head);
+  xfree (nva);
+  if (s->id < 0)
+    {
+      conn->error = s->id;
+      errno = EPROTO;
+      stream_free (conn, s);
+      return -1;
+    }
+  DEBUGP (("Submitted request as HTTP/2 stream %d.\n", (int) s->id));
+
+  if (conn->tail)
+    conn->tail->next = s;
+  else
+    conn->head = s;
+  conn->tail = s;
+
+  conn->request.pos += head_size;
+  if (s->body_left)
+    conn->upload = s;
+  return 1;
+
+ malformed:
+  xfree (head);
+  xfree (nva);
+  xfree (s);
+  errno = EINVAL;
+  return -1;
+}
+
+/* Pass the request body at the start of CONN->request on to the
+   stream being uploaded.  */
+
+static void
+feed_body (struct http2_connection *conn)
+{
+  struct http2_stream *s = conn->upload;
+  int size = MIN (conn->request.size - conn->request.pos, s->body_left);
+
+  /* The body of a stream the server has closed is dropped.  */
+  if (!s->closed)
+    buffer_append (&s->body, conn->request.data + conn->request.pos, size);
+  conn->request.pos += size;
+  s->body_left -= size;
+  if (!s->body_left)
+    conn->upload = NULL;
+  if (s->body_deferred && !s->closed)
+    {
+      s->body_deferred = false;
+      nghttp2_session_resume_data (conn->session, s->id);
+    }
+}
+
+static int
+http2_write (int fd, char *buf, int bufsize, void *arg)
+{
+  struct http2_connection *conn = arg;
+  struct http2_stream *s;
+  int res;
+
+  /* No new streams can be started after GOAWAY.  */
+  if (conn->eof || conn->goaway)
+    {
+      errno = EPIPE;
+      return -1;
+    }
+  if (conn->error)
+    {
+      errno = EPROTO;
+      return -1;
+    }
+
+  buffer_append (&conn->request, buf, bufsize);
+  for (;;)
+    {
+      if (conn->upload)
+        feed_body (conn);
+      if (conn->upload || (res = submit_request (conn)) == 0)
+        break;
+      if (res < 0)
+        return -1;
+    }
+  current_stream (conn);
+  if (!flush_session (fd, conn))
+    return -1;
+
+  /* Rather than keep a large body in memory, wait for the server to
+     take it.  */
+  s = conn->upload;
+  while (s && !s->closed && s->body.size - s->body.pos > BODY_BUFFER_MAX)
+    {
+      res = receive_frames (fd, conn, opt.read_timeout);
+      if (res <= 0)
+        return -1;
+      if (conn->eof || conn->error)
+        {
+          errno = conn->error ? EPROTO : EPIPE;
+          return -1;
+        }
+    }
+  return bufsize;
+}
+
+static int
+http2_poll (int fd, double timeout, int wait_for, void *arg)
+{
+  struct http2_connection *conn = arg;
+
+  /* Writes only queue the data, so they never block.  */
+  if (wait_for & WAIT_FOR_WRITE)
+    return 1;
+
+  while (!connection_readable_p (conn))
+    {
+      int res = receive_frames (fd, conn, timeout);
+      if (res <= 0)
+        return res;
+    }
+  return 1;
+}
+
+static const char *
+http2_errstr (int fd, void *arg)
+{
+  struct http2_connection *conn = arg;
+  if (conn->error)
+    return nghttp2_strerror (conn->error);
+  if (conn->inner && conn->inner->errstr)
+    return conn->inner->errstr (fd, conn->inner_ctx);
+  return NULL;
+}
+
+static void
+http2_close (int fd, void *arg)
+{
+  struct http2_connection *conn = arg;
+
+  if (!conn->eof && !conn->error)
+    {
+      nghttp2_session_terminate_session (conn->session, NGHTTP2_NO_ERROR);
+      flush_session (fd, conn);
+    }
+  while (conn->head)
+    {
+      struct http2_stream *s = conn->head;
+      conn->head = s->next;
+      stream_free (conn, s);
+    }
+  nghttp2_session_del (conn->session);
+  xfree (conn->request.data);
+
+  if (conn->inner && conn->inner->closer)
+    conn->inner->closer (fd, conn->inner_ctx);
+  else
+    close (fd);
+  DEBUGP (("Closed HTTP/2 connection %d.\n", fd));
+  xfree (conn);
+}
+
+static struct transport_implementation http2_transport = {
+  http2_read, http2_write, http2_poll,
+  http2_errstr, http2_close
+};
+
+/* Start speaking HTTP/2 on the connection FD, which is an SSL
+   connection if SSL is set.  */
+
+void
+http2_start (int fd, bool ssl)
+{
+  struct http2_connection *conn = xnew0 (struct http2_connection);
+  nghttp2_session_callbacks *callbacks;
+  nghttp2_option *option;
+  nghttp2_settings_entry settings[] = {
+    { NGHTTP2_SETTINGS_ENABLE_PUSH, 0 },
+    { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, STREAM_WINDOW }
+  };
+
+  conn->ssl = ssl;
+  conn->inner = fd_transport (fd, &conn->inner_ctx);
+
+  if (nghttp2_session_callbacks_new (&callbacks) != 0
+      || nghttp2_option_new (&option) != 0)
+    xalloc_die ();
+  nghttp2_session_callbacks_set_on_header_callback (callbacks, on_header);
+  nghttp2_session_callbacks_set_on_frame_recv_callback (callbacks,
+                                                        on_frame_recv);
+  nghttp2_session_callbacks_set_on_data_chunk_recv_callback
+    (callbacks, on_data_chunk_recv);
+  nghttp2_session_callbacks_set_on_stream_close_callback (callbacks,
+                                                          on_stream_close);
+  /* Window updates are sent as the responses are read.  */
+  nghttp2_option_set_no_auto_window_update (option, 1);
+
+  if (nghttp2_session_client_new2 (&conn->session, callbacks, conn,
+                                   option) != 0)
+    xalloc_die ();
+  nghttp2_session_callbacks_del (callbacks);
+  nghttp2_option_del (option);
+
+  nghttp2_submit_settings (conn->session, NGHTTP2_FLAG_NONE, settings,
+                           countof (settings));
+  nghttp2_session_set_local_window_size (conn->session, NGHTTP2_FLAG_NONE,
+                                         0, CONNECTION_WINDOW);
+
+  fd_register_transport (fd, &http2_transport, conn);
+  DEBUGP (("Using HTTP/2 on fd %d.\n", fd));
+}
+
+/* Return true if the connection FD speaks HTTP/2.  */
+
+bool
+http2_connection_p (int fd)
+{
+  void *ctx;
+  return fd_transport (fd, &ctx) == &http2_transport;
+}
+
+/* Return true if the idle HTTP/2 connection FD can take further
+   requests.  Unlike HTTP/1.1 connections, these regularly receive
+   frames while idle, which are processed here.  */
+
+bool
+http2_alive (int fd)
+{
+  struct http2_connection *conn = fd_transport_context (fd);
+
+  while (!conn->eof && !conn->error && inner_readable_p (fd, conn))
+    if (receive_frames (fd, conn, 0) < 0)
+      return false;
+  return !conn->eof && !conn->error && !conn->goaway
+    && !current_stream (conn);
+}
+
+#endif /* HAVE_NGHTTP2 */
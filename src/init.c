@@ -68,8 +68,12 @@ as that of the covered work.  */
 #include "http.h"               /* for http_cleanup */
 #include "retr.h"               /* for output_stream */
 #include "warc.h"               /* for warc_close */
+#ifdef HAVE_SSL
+# include "ssl.h"               /* for ssl_sessions_cleanup */
+#endif
 #include "spider.h"             /* for spider_cleanup */
 #include "html-url.h"           /* for cleanup_html_url */
+#include "validators.h"         /* for validators_cleanup */
 #include "c-strcase.h"
 
 #ifdef TESTING
@@ -154,6 +158,9 @@ static const struct {
   { "checkcertificate", &opt.check_cert,        cmd_boolean },
 #endif
   { "chooseconfig",     &opt.choose_config,     cmd_file },
+#ifdef HAVE_LIBZ
+  { "compression",      &opt.compression,       cmd_boolean },
+#endif
   { "connecttimeout",   &opt.connect_timeout,   cmd_time },
   { "contentdisposition", &opt.content_disposition, cmd_boolean },
   { "contentonerror",   &opt.content_on_error,  cmd_boolean },
@@ -170,6 +177,8 @@ static const struct {
   { "dirprefix",        &opt.dir_prefix,        cmd_directory },
   { "dirstruct",        NULL,                   cmd_spec_dirstruct },
   { "dnscache",         &opt.dns_cache,         cmd_boolean },
+  { "dnscachefile",     &opt.dns_cache_file,    cmd_file },
+  { "dnscachettl",      &opt.dns_cache_ttl,     cmd_time },
   { "dnstimeout",       &opt.dns_timeout,       cmd_time },
   { "domains",          &opt.domains,           cmd_vector },
   { "dotbytes",         &opt.dot_bytes,         cmd_bytes },
@@ -195,9 +204,18 @@ static const struct {
   { "header",           NULL,                   cmd_spec_header },
   { "htmlextension",    &opt.adjust_extension,  cmd_boolean }, /* deprecated */
   { "htmlify",          NULL,                   cmd_spec_htmlify },
+#ifdef HAVE_NGHTTP2
+  { "http2",            &opt.http2,             cmd_boolean },
+  { "http2priorknowledge", &opt.http2_prior_knowledge, cmd_boolean },
+  { "http2requestwindow", &opt.http2_request_window, cmd_number },
+#endif
   { "httpkeepalive",    &opt.http_keep_alive,   cmd_boolean },
+  { "httpkeepalivehostmax", &opt.http_keep_alive_host_max, cmd_number },
+  { "httpkeepalivemax", &opt.http_keep_alive_max, cmd_number },
+  { "httpkeepalivetimeout", &opt.http_keep_alive_timeout, cmd_time },
   { "httppasswd",       &opt.http_passwd,       cmd_string }, /* deprecated */
   { "httppassword",     &opt.http_passwd,       cmd_string },
+  { "httppipeline",     &opt.http_pipeline,     cmd_number },
   { "httpproxy",        &opt.http_proxy,        cmd_string },
 #ifdef HAVE_SSL
   { "httpsonly",        &opt.https_only,        cmd_boolean },
@@ -213,9 +231,11 @@ static const struct {
   { "inet6only",        &opt.ipv6_only,         cmd_boolean },
 #endif
   { "input",            &opt.input_filename,    cmd_file },
+  { "iouring",          &opt.io_uring,          cmd_boolean },
   { "iri",              &opt.enable_iri,        cmd_boolean },
   { "keepsessioncookies", &opt.keep_session_cookies, cmd_boolean },
   { "limitrate",        &opt.limit_rate,        cmd_bytes },
+  { "limitrateperhost", &opt.limit_rate_per_host, cmd_bytes },
   { "loadcookies",      &opt.cookies_input,     cmd_file },
   { "localencoding",    &opt.locale,            cmd_string },
   { "logfile",          &opt.lfilename,         cmd_file },
@@ -231,6 +251,8 @@ static const struct {
   { "numtries",         &opt.ntry,              cmd_number_inf },/* deprecated*/
   { "outputdocument",   &opt.output_document,   cmd_file },
   { "pagerequisites",   &opt.page_requisites,   cmd_boolean },
+  { "parallel",         &opt.parallel,          cmd_number },
+  { "parallelperhost",  &opt.parallel_per_host, cmd_number },
   { "passiveftp",       &opt.ftp_pasv,          cmd_boolean },
   { "passwd",           &opt.ftp_passwd,        cmd_string },/* deprecated*/
   { "password",         &opt.passwd,            cmd_string },
@@ -247,6 +269,7 @@ static const struct {
   { "proxypasswd",      &opt.proxy_passwd,      cmd_string }, /* deprecated */
   { "proxypassword",    &opt.proxy_passwd,      cmd_string },
   { "proxyuser",        &opt.proxy_user,        cmd_string },
+  { "queuewindow",      &opt.queue_window,      cmd_number_inf },
   { "quiet",            &opt.quiet,             cmd_boolean },
   { "quota",            &opt.quota,             cmd_bytes_sum },
 #ifdef HAVE_SSL
@@ -273,6 +296,7 @@ static const struct {
 #ifdef HAVE_SSL
   { "secureprotocol",   &opt.secure_protocol,   cmd_spec_secure_protocol },
 #endif
+  { "segments",         &opt.segments,          cmd_number },
   { "serverresponse",   &opt.server_response,   cmd_boolean },
   { "showalldnsentries", &opt.show_all_dns_entries, cmd_boolean },
   { "showprogress",     &opt.show_progress,      cmd_boolean },
@@ -282,6 +306,9 @@ static const struct {
   { "strictcomments",   &opt.strict_comments,   cmd_boolean },
   { "timeout",          NULL,                   cmd_spec_timeout },
   { "timestamping",     &opt.timestamping,      cmd_boolean },
+#ifdef HAVE_SSL
+  { "tlssessionfile",   &opt.tls_session_file,  cmd_file },
+#endif
   { "tries",            &opt.ntry,              cmd_number_inf },
   { "trustservernames", &opt.trustservernames,  cmd_boolean },
   { "unlink",           &opt.unlink,            cmd_boolean },
@@ -289,6 +316,7 @@ static const struct {
   { "user",             &opt.user,              cmd_string },
   { "useragent",        NULL,                   cmd_spec_useragent },
   { "useservertimestamps", &opt.useservertimestamps, cmd_boolean },
+  { "validatorfile",    &opt.validator_file,    cmd_file },
   { "verbose",          NULL,                   cmd_spec_verbose },
   { "wait",             &opt.wait,              cmd_time },
   { "waitretry",        &opt.waitretry,         cmd_time },
@@ -306,6 +334,7 @@ static const struct {
 #ifdef USE_WATT32
   { "wdebug",           &opt.wdebug,            cmd_boolean },
 #endif
+  { "writebuffer",      &opt.write_buffer,      cmd_bytes },
 };
 
 /* Look up CMDNAME in the commands[] and return its position in the
@@ -348,12 +377,18 @@ defaults (void)
   opt.cookies = true;
   opt.verbose = -1;
   opt.ntry = 20;
+  opt.parallel = 1;
+  opt.segments = 1;
   opt.reclevel = 5;
+  opt.queue_window = 10000;
   opt.add_hostdir = true;
   opt.netrc = true;
   opt.ftp_glob = true;
   opt.htmlify = true;
   opt.http_keep_alive = true;
+  opt.http_keep_alive_max = 8;
+  opt.http_keep_alive_host_max = 2;
+  opt.http_keep_alive_timeout = 30;
   opt.use_proxy = true;
   tmp = getenv ("no_proxy");
   if (tmp)
@@ -371,6 +406,7 @@ defaults (void)
   opt.dots_in_line = 50;
 
   opt.dns_cache = true;
+  opt.dns_cache_ttl = 300;
   opt.ftp_pasv = true;
   /* 2014-09-07  Darshit Shah  <darnir@gmail.com>
    * opt.retr_symlinks is set to true by default. Creating symbolic links on the
@@ -420,8 +456,14 @@ defaults (void)
   opt.useservertimestamps = true;
   opt.show_all_dns_entries = false;
 
+#ifdef HAVE_NGHTTP2
+  opt.http2 = true;
+  opt.http2_request_window = 30;
+#endif
+
   opt.warc_maxsize = 0; /* 1024 * 1024 * 1024; */
 #ifdef HAVE_LIBZ
+  opt.compression = true;
   opt.warc_compression_enabled = true;
 #else
   opt.warc_compression_enabled = false;
@@ -1761,8 +1803,12 @@ cleanup (void)
   convert_cleanup ();
   res_cleanup ();
   http_cleanup ();
+#ifdef HAVE_SSL
+  ssl_sessions_cleanup ();
+#endif
   cleanup_html_url ();
   spider_cleanup ();
+  validators_cleanup ();
   host_cleanup ();
   log_cleanup ();
   netrc_cleanup ();
@@ -1800,8 +1846,11 @@ cleanup (void)
   xfree (opt.crl_file);
   xfree (opt.random_file);
   xfree (opt.egd_file);
+  xfree (opt.tls_session_file);
 # endif
   xfree (opt.bind_address);
+  xfree (opt.dns_cache_file);
+  xfree (opt.validator_file);
   xfree (opt.cookies_input);
   xfree (opt.cookies_output);
   xfree (opt.user);
@@ -56,6 +56,11 @@ as that of the covered work.  */
 #include "warc.h"
 #include "version.h"
 #include "c-strcase.h"
+#include "validators.h"
+#include "bandwidth.h"
+#ifdef HAVE_SSL
+# include "ssl.h"
+#endif
 #include <getopt.h>
 #include <getpass.h>
 #include <quote.h>
@@ -186,6 +191,9 @@ static struct cmdline_option option_data[] =
     { IF_SSL ("certificate-type"), 0, OPT_VALUE, "certificatetype", -1 },
     { IF_SSL ("check-certificate"), 0, OPT_BOOLEAN, "checkcertificate", -1 },
     { "clobber", 0, OPT__CLOBBER, NULL, optional_argument },
+#ifdef HAVE_LIBZ
+    { "compression", 0, OPT_BOOLEAN, "compression", -1 },
+#endif
     { "config", 0, OPT_VALUE, "chooseconfig", -1 },
     { "connect-timeout", 0, OPT_VALUE, "connecttimeout", -1 },
     { "continue", 'c', OPT_BOOLEAN, "continue", -1 },
@@ -201,6 +209,8 @@ static struct cmdline_option option_data[] =
     { "directories", 0, OPT_BOOLEAN, "dirstruct", -1 },
     { "directory-prefix", 'P', OPT_VALUE, "dirprefix", -1 },
     { "dns-cache", 0, OPT_BOOLEAN, "dnscache", -1 },
+    { "dns-cache-file", 0, OPT_VALUE, "dnscachefile", -1 },
+    { "dns-cache-ttl", 0, OPT_VALUE, "dnscachettl", -1 },
     { "dns-timeout", 0, OPT_VALUE, "dnstimeout", -1 },
     { "domains", 'D', OPT_VALUE, "domains", -1 },
     { "dont-remove-listing", 0, OPT__DONT_REMOVE_LISTING, NULL, no_argument },
@@ -225,9 +235,18 @@ static struct cmdline_option option_data[] =
     { "html-extension", 'E', OPT_BOOLEAN, "adjustextension", -1 }, /* deprecated */
     { "htmlify", 0, OPT_BOOLEAN, "htmlify", -1 },
     { "http-keep-alive", 0, OPT_BOOLEAN, "httpkeepalive", -1 },
+    { "http-keep-alive-host-max", 0, OPT_VALUE, "httpkeepalivehostmax", -1 },
+    { "http-keep-alive-max", 0, OPT_VALUE, "httpkeepalivemax", -1 },
+    { "http-keep-alive-timeout", 0, OPT_VALUE, "httpkeepalivetimeout", -1 },
     { "http-passwd", 0, OPT_VALUE, "httppassword", -1 }, /* deprecated */
     { "http-password", 0, OPT_VALUE, "httppassword", -1 },
+    { "http-pipeline", 0, OPT_VALUE, "httppipeline", -1 },
     { "http-user", 0, OPT_VALUE, "httpuser", -1 },
+#ifdef HAVE_NGHTTP2
+    { "http2", 0, OPT_BOOLEAN, "http2", -1 },
+    { "http2-prior-knowledge", 0, OPT_BOOLEAN, "http2priorknowledge", -1 },
+    { "http2-request-window", 0, OPT_VALUE, "http2requestwindow", -1 },
+#endif
     { IF_SSL ("https-only"), 0, OPT_BOOLEAN, "httpsonly", -1 },
     { "ignore-case", 0, OPT_BOOLEAN, "ignorecase", -1 },
     { "ignore-length", 0, OPT_BOOLEAN, "ignorelength", -1 },
@@ -238,10 +257,12 @@ static struct cmdline_option option_data[] =
     { "inet6-only", '6', OPT_BOOLEAN, "inet6only", -1 },
 #endif
     { "input-file", 'i', OPT_VALUE, "input", -1 },
+    { "io-uring", 0, OPT_BOOLEAN, "iouring", -1 },
     { "iri", 0, OPT_BOOLEAN, "iri", -1 },
     { "keep-session-cookies", 0, OPT_BOOLEAN, "keepsessioncookies", -1 },
     { "level", 'l', OPT_VALUE, "reclevel", -1 },
     { "limit-rate", 0, OPT_VALUE, "limitrate", -1 },
+    { "limit-rate-per-host", 0, OPT_VALUE, "limitrateperhost", -1 },
     { "load-cookies", 0, OPT_VALUE, "loadcookies", -1 },
     { "local-encoding", 0, OPT_VALUE, "localencoding", -1 },
     { "max-redirect", 0, OPT_VALUE, "maxredirect", -1 },
@@ -254,6 +275,8 @@ static struct cmdline_option option_data[] =
     { "output-document", 'O', OPT_VALUE, "outputdocument", -1 },
     { "output-file", 'o', OPT_VALUE, "logfile", -1 },
     { "page-requisites", 'p', OPT_BOOLEAN, "pagerequisites", -1 },
+    { "parallel", 0, OPT_VALUE, "parallel", -1 },
+    { "parallel-per-host", 0, OPT_VALUE, "parallelperhost", -1 },
     { "parent", 0, OPT__PARENT, NULL, optional_argument },
     { "passive-ftp", 0, OPT_BOOLEAN, "passiveftp", -1 },
     { "password", 0, OPT_VALUE, "password", -1 },
@@ -271,6 +294,7 @@ static struct cmdline_option option_data[] =
     { "proxy-passwd", 0, OPT_VALUE, "proxypassword", -1 }, /* deprecated */
     { "proxy-password", 0, OPT_VALUE, "proxypassword", -1 },
     { "proxy-user", 0, OPT_VALUE, "proxyuser", -1 },
+    { "queue-window", 0, OPT_VALUE, "queuewindow", -1 },
     { "quiet", 'q', OPT_BOOLEAN, "quiet", -1 },
     { "quota", 'Q', OPT_VALUE, "quota", -1 },
     { "random-file", 0, OPT_VALUE, "randomfile", -1 },
@@ -291,6 +315,7 @@ static struct cmdline_option option_data[] =
     { "save-cookies", 0, OPT_VALUE, "savecookies", -1 },
     { "save-headers", 0, OPT_BOOLEAN, "saveheaders", -1 },
     { IF_SSL ("secure-protocol"), 0, OPT_VALUE, "secureprotocol", -1 },
+    { "segments", 0, OPT_VALUE, "segments", -1 },
     { "server-response", 'S', OPT_BOOLEAN, "serverresponse", -1 },
     { "span-hosts", 'H', OPT_BOOLEAN, "spanhosts", -1 },
     { "spider", 0, OPT_BOOLEAN, "spider", -1 },
@@ -298,12 +323,14 @@ static struct cmdline_option option_data[] =
     { "strict-comments", 0, OPT_BOOLEAN, "strictcomments", -1 },
     { "timeout", 'T', OPT_VALUE, "timeout", -1 },
     { "timestamping", 'N', OPT_BOOLEAN, "timestamping", -1 },
+    { IF_SSL ("tls-session-file"), 0, OPT_VALUE, "tlssessionfile", -1 },
     { "tries", 't', OPT_VALUE, "tries", -1 },
     { "unlink", 0, OPT_BOOLEAN, "unlink", -1 },
     { "trust-server-names", 0, OPT_BOOLEAN, "trustservernames", -1 },
     { "use-server-timestamps", 0, OPT_BOOLEAN, "useservertimestamps", -1 },
     { "user", 0, OPT_VALUE, "user", -1 },
     { "user-agent", 'U', OPT_VALUE, "useragent", -1 },
+    { "validator-file", 0, OPT_VALUE, "validatorfile", -1 },
     { "verbose", 'v', OPT_BOOLEAN, "verbose", -1 },
     { "verbose", 0, OPT_BOOLEAN, "verbose", -1 },
     { "version", 'V', OPT_FUNCALL, (void *) print_version, no_argument },
@@ -323,6 +350,7 @@ static struct cmdline_option option_data[] =
 #ifdef USE_WATT32
     { "wdebug", 0, OPT_BOOLEAN, "wdebug", -1 },
 #endif
+    { "write-buffer", 0, OPT_VALUE, "writebuffer", -1 },
   };
 
 #undef IF_SSL
@@ -516,6 +544,9 @@ Download:\n"),
     N_("\
   --no-use-server-timestamps       don't set the local file's timestamp by\n\
                                    the one on the server.\n"),
+    N_("\
+       --validator-file=FILE       let -N check files with one request, keeping\n\
+                                   their validators in FILE.\n"),
     N_("\
   -S,  --server-response           print server response.\n"),
     N_("\
@@ -542,8 +573,26 @@ Download:\n"),
        --bind-address=ADDRESS      bind to ADDRESS (hostname or IP) on local host.\n"),
     N_("\
        --limit-rate=RATE           limit download rate to RATE.\n"),
+    N_("\
+       --limit-rate-per-host=RATE  limit download rate from each host to RATE.\n"),
+    N_("\
+       --parallel=NUMBER           retrieve up to NUMBER files at the same time.\n"),
+    N_("\
+       --parallel-per-host=NUMBER  ... but only NUMBER from the same host.\n"),
+    N_("\
+       --segments=NUMBER           retrieve large files over NUMBER connections.\n"),
+    N_("\
+       --write-buffer=SIZE         write downloaded data in the background,\n\
+                                   queueing up to SIZE bytes.\n"),
+    N_("\
+       --io-uring                  read and write sockets through io_uring.\n"),
     N_("\
        --no-dns-cache              disable caching DNS lookups.\n"),
+    N_("\
+       --dns-cache-ttl=SECS        reuse cached DNS lookups for SECS seconds.\n"),
+    N_("\
+       --dns-cache-file=FILE       share cached DNS lookups with other runs\n\
+                                   through FILE.\n"),
     N_("\
        --restrict-file-names=OS    restrict chars in file names to ones OS allows.\n"),
     N_("\
@@ -604,6 +653,11 @@ HTTP options:\n"),
   -E,  --adjust-extension          save HTML/CSS documents with proper extensions.\n"),
     N_("\
        --ignore-length             ignore `Content-Length' header field.\n"),
+#ifdef HAVE_LIBZ
+    N_("\
+       --no-compression            don't ask for compressed (gzip, deflate)\n\
+                                   responses.\n"),
+#endif
     N_("\
        --header=STRING             insert STRING among the headers.\n"),
     N_("\
@@ -620,6 +674,29 @@ HTTP options:\n"),
   -U,  --user-agent=AGENT          identify as AGENT instead of Wget/VERSION.\n"),
     N_("\
        --no-http-keep-alive        disable HTTP keep-alive (persistent connections).\n"),
+    N_("\
+       --http-keep-alive-max=NUMBER\n\
+                                   keep at most NUMBER persistent connections.\n"),
+    N_("\
+       --http-keep-alive-host-max=NUMBER\n\
+                                   keep at most NUMBER persistent connections\n\
+                                   to each host.\n"),
+    N_("\
+       --http-keep-alive-timeout=SECS\n\
+                                   close persistent connections idle for more\n\
+                                   than SECS seconds.\n"),
+    N_("\
+       --http-pipeline=NUMBER      send up to NUMBER requests at a time on a\n\
+                                   connection when downloading recursively.\n"),
+#ifdef HAVE_NGHTTP2
+    N_("\
+       --no-http2                  don't offer HTTP/2 to HTTPS servers.\n"),
+    N_("\
+       --http2-prior-knowledge     speak HTTP/2 to HTTP servers right away.\n"),
+    N_("\
+       --http2-request-window=NUMBER  send up to NUMBER concurrent requests\n\
+                                   on an HTTP/2 connection.\n"),
+#endif
     N_("\
        --no-cookies                don't use cookies.\n"),
     N_("\
@@ -677,6 +754,8 @@ HTTPS (SSL/TLS) options:\n"),
        --random-file=FILE          file with random data for seeding the SSL PRNG.\n"),
     N_("\
        --egd-file=FILE             file naming the EGD socket with random data.\n"),
+    N_("\
+       --tls-session-file=FILE     keep TLS sessions in FILE to resume them later.\n"),
     "\n",
 #endif /* HAVE_SSL */
 
@@ -733,6 +812,9 @@ Recursive download:\n"),
   -r,  --recursive                 specify recursive download.\n"),
     N_("\
   -l,  --level=NUMBER              maximum recursion depth (inf or 0 for infinite).\n"),
+    N_("\
+       --queue-window=NUMBER       keep NUMBER queued URLs in memory, the rest in\n\
+                                   a temporary file (inf or 0 for all in memory).\n"),
     N_("\
        --delete-after              delete files locally after downloading them.\n"),
     N_("\
@@ -1362,6 +1444,17 @@ for details.\n\n"));
           opt.always_rest = false;
           opt.start_pos = -1;
         }
+#ifdef HAVE_NGHTTP2
+      if (opt.http2_prior_knowledge)
+        {
+          fprintf (stderr,
+                   _("WARC output does not work with HTTP/2, "
+                     "--http2-prior-knowledge will be disabled.\n"));
+          opt.http2_prior_knowledge = false;
+        }
+      /* The records hold the HTTP/1.1 messages as exchanged.  */
+      opt.http2 = false;
+#endif
       if (opt.warc_cdx_dedup_filename != 0 && !opt.warc_digests_enabled)
         {
           fprintf (stderr,
@@ -1647,6 +1740,11 @@ outputting to a regular file.\n"));
   signal (SIGWINCH, progress_handle_sigwinch);
 #endif
 
+  /* The rate limits must be set up before the workers of --parallel
+     and --segments are started, for them to share the limits.  */
+  if (opt.limit_rate || opt.limit_rate_per_host)
+    bandwidth_init ();
+
   /* Retrieve the URLs from argument list.  */
   for (t = url; *t; t++)
     {
@@ -1754,6 +1852,14 @@ outputting to a regular file.\n"));
   if (opt.cookies_output)
     save_cookies ();
 
+#ifdef HAVE_SSL
+  if (opt.tls_session_file)
+    ssl_sessions_save ();
+#endif
+
+  if (opt.validator_file)
+    validators_save ();
+
   if (opt.convert_links && !opt.delete_after)
     convert_all_links ();
 
@@ -161,6 +161,32 @@ key_type_to_ssl_type (enum keyfile_type type)
 /* SSL has been initialized */
 static int ssl_true_initialized = 0;
 
+/* Called by OpenSSL when the server has established a new session
+   with us, either during the handshake or, with TLS 1.3, when a
+   session ticket arrives afterwards.  The host name the session
+   belongs to is stored as the connection's application data.  */
+
+static int
+ssl_new_session_callback (SSL *conn, SSL_SESSION *session)
+{
+  const char *hostname = SSL_get_app_data (conn);
+  unsigned char *data, *p;
+  int size;
+
+  if (!hostname)
+    return 0;
+  size = i2d_SSL_SESSION (session, NULL);
+  if (size <= 0)
+    return 0;
+  data = p = xmalloc (size);
+  if (i2d_SSL_SESSION (session, &p) == size)
+    ssl_session_put (hostname, data, size);
+  xfree (data);
+
+  /* We keep our own serialized copy, so OpenSSL may free SESSION.  */
+  return 0;
+}
+
 /* Create an SSL Context and set default paths etc.  Called the first
    time an HTTP download is attempted.
 
@@ -313,6 +339,13 @@ ssl_init (void)
      tell it to do so.  */
   SSL_CTX_set_mode (ssl_ctx, SSL_MODE_AUTO_RETRY);
 
+  /* Sessions are cached per host in ssl-session.c, which can also
+     keep them across invocations, rather than in OpenSSL's internal
+     cache.  */
+  SSL_CTX_set_session_cache_mode (ssl_ctx, SSL_SESS_CACHE_CLIENT
+                                  | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb (ssl_ctx, ssl_new_session_callback);
+
   return true;
 
  error:
@@ -394,22 +427,6 @@ openssl_poll (int fd, double timeout, int wait_for, void *arg)
   return select_fd (fd, timeout, wait_for);
 }
 
-static int
-openssl_peek (int fd, char *buf, int bufsize, void *arg)
-{
-  int ret;
-  struct openssl_transport_context *ctx = arg;
-  SSL *conn = ctx->conn;
-  if (! openssl_poll (fd, 0.0, WAIT_FOR_READ, arg))
-    return 0;
-  do
-    ret = SSL_peek (conn, buf, bufsize);
-  while (ret == -1
-         && SSL_get_error (conn, ret) == SSL_ERROR_SYSCALL
-         && errno == EINTR);
-  return ret;
-}
-
 static const char *
 openssl_errstr (int fd _GL_UNUSED, void *arg)
 {
@@ -466,6 +483,7 @@ openssl_close (int fd, void *arg)
   SSL *conn = ctx->conn;
 
   SSL_shutdown (conn);
+  free (SSL_get_app_data (conn));
   SSL_free (conn);
   xfree (ctx->last_error);
   xfree (ctx);
@@ -480,7 +498,7 @@ openssl_close (int fd, void *arg)
 
 static struct transport_implementation openssl_transport = {
   openssl_read, openssl_write, openssl_poll,
-  openssl_peek, openssl_errstr, openssl_close
+  openssl_errstr, openssl_close
 };
 
 struct scwt_context
@@ -510,6 +528,8 @@ ssl_connect_wget (int fd, const char *hostname)
   SSL *conn;
   struct scwt_context scwt_ctx;
   struct openssl_transport_context *ctx;
+  const unsigned char *cached;
+  size_t cached_size;
 
   DEBUGP (("Initiating SSL handshake.\n"));
 
@@ -537,6 +557,27 @@ ssl_connect_wget (int fd, const char *hostname)
     goto error;
   SSL_set_connect_state (conn);
 
+#if defined HAVE_NGHTTP2 && OPENSSL_VERSION_NUMBER >= 0x10002000L
+  /* Offer HTTP/2; see ssl_alpn_http2.  */
+  if (opt.http2)
+    SSL_set_alpn_protos (conn, (const unsigned char *) "\x02h2\x08http/1.1",
+                         12);
+#endif
+
+  /* Offer the session from an earlier connection to this host.  If
+     the server no longer knows it, we get a full handshake.  */
+  SSL_set_app_data (conn, xstrdup (hostname));
+  cached = ssl_session_get (hostname, &cached_size);
+  if (cached)
+    {
+      SSL_SESSION *session = d2i_SSL_SESSION (NULL, &cached, cached_size);
+      if (session)
+        {
+          SSL_set_session (conn, session);
+          SSL_SESSION_free (session);
+        }
+    }
+
   scwt_ctx.ssl = conn;
   if (run_with_timeout(opt.read_timeout, ssl_connect_with_timeout_callback,
                        &scwt_ctx)) {
@@ -546,6 +587,10 @@ ssl_connect_wget (int fd, const char *hostname)
   if (scwt_ctx.result <= 0 || conn->state != SSL_ST_OK)
     goto error;
 
+  if (cached)
+    DEBUGP (("TLS session %s.\n",
+             SSL_session_reused (conn) ? "resumed" : "not resumed"));
+
   ctx = xnew0 (struct openssl_transport_context);
   ctx->conn = conn;
 
@@ -561,7 +606,10 @@ ssl_connect_wget (int fd, const char *hostname)
   print_errors ();
  timeout:
   if (conn)
-    SSL_free (conn);
+    {
+      free (SSL_get_app_data (conn));
+      SSL_free (conn);
+    }
   return false;
 }
 
@@ -629,6 +677,35 @@ static char *_get_rfc2253_formatted (X509_NAME *name)
   return out ? out : xstrdup("");
 }
 
+/* Return true if the server agreed to speak HTTP/2 on the SSL
+   connection FD.  */
+
+bool
+ssl_alpn_http2 (int fd)
+{
+#if defined HAVE_NGHTTP2 && OPENSSL_VERSION_NUMBER >= 0x10002000L
+  struct openssl_transport_context *ctx = fd_transport_context (fd);
+  const unsigned char *protocol;
+  unsigned int size;
+
+  SSL_get0_alpn_selected (ctx->conn, &protocol, &size);
+  if (size == 2 && !memcmp (protocol, "h2", 2))
+    return true;
+#endif
+  return false;
+}
+
+/* Return true if the SSL connection whose transport context is ARG
+   holds received data that hasn't been read yet, which the socket no
+   longer shows as readable.  */
+
+bool
+ssl_pending_p (void *arg)
+{
+  struct openssl_transport_context *ctx = arg;
+  return SSL_pending (ctx->conn) > 0;
+}
+
 /* Verify the validity of the certificate presented by the server.
    Also check that the "common name" of the server, as presented by
    its certificate, corresponds to HOST.  (HOST typically comes from
@@ -859,6 +936,15 @@ ssl_check_certificate (int fd, const char *host)
   X509_free (cert);
 
  no_cert:
+  /* Don't resume a session whose server we refused to trust, and
+     don't cache the tickets it may still send on this connection.  */
+  if (opt.check_cert && !success)
+    {
+      ssl_session_remove (host);
+      free (SSL_get_app_data (conn));
+      SSL_set_app_data (conn, NULL);
+    }
+
   if (opt.check_cert && !success)
     logprintf (LOG_NOTQUIET, _("\
 To connect to %s insecurely, use `--no-check-certificate'.\n"),
@@ -35,6 +35,10 @@ struct options
                                    hence not boolean.) */
   bool quiet;                   /* Are we quiet? */
   int ntry;                     /* Number of tries per URL */
+  int parallel;                 /* Number of parallel retrievals */
+  int parallel_per_host;        /* ... of which from the same server */
+  int segments;                 /* Number of connections a large file
+                                   is retrieved over */
   bool retry_connrefused;       /* Treat CONNREFUSED as non-fatal. */
   bool background;              /* Whether we should work in background. */
   bool ignore_length;           /* Do we heed content-length at all?  */
@@ -47,6 +51,8 @@ struct options
   bool no_parent;               /* Restrict access to the parent
                                    directory.  */
   int reclevel;                 /* Maximum level of recursion */
+  int queue_window;             /* URLs of the recursion queue kept in
+                                   memory, 0 for all */
   bool dirstruct;               /* Do we build the directory structure
                                    as we go along? */
   bool no_dirstruct;            /* Do we hate dirstruct? */
@@ -90,6 +96,9 @@ struct options
   char **domains;               /* See host.c */
   char **exclude_domains;
   bool dns_cache;               /* whether we cache DNS lookups. */
+  double dns_cache_ttl;         /* how long cached lookups are valid */
+  char *dns_cache_file;         /* file shared by Wget runs to cache
+                                   DNS lookups in */
 
   char **follow_tags;           /* List of HTML tags to recursively follow. */
   char **ignore_tags;           /* List of HTML tags to ignore if recursing. */
@@ -126,6 +135,15 @@ struct options
   char *http_passwd;            /* HTTP password. */
   char **user_headers;          /* User-defined header(s). */
   bool http_keep_alive;         /* whether we use keep-alive */
+  int http_keep_alive_max;      /* max. number of kept-alive connections */
+  int http_keep_alive_host_max; /* max. kept-alive connections per host */
+  double http_keep_alive_timeout; /* max. idle time of such connections */
+  int http_pipeline;            /* max. number of requests outstanding
+                                   on a connection */
+  bool http2;                   /* Offer HTTP/2 to HTTPS servers. */
+  bool http2_prior_knowledge;   /* Speak HTTP/2 to HTTP servers. */
+  int http2_request_window;     /* max. number of concurrent streams
+                                   on an HTTP/2 connection */
 
   bool use_proxy;               /* Do we use proxy? */
   bool allow_cache;             /* Do we allow server-side caching? */
@@ -149,6 +167,10 @@ struct options
 
   wgint limit_rate;             /* Limit the download rate to this
                                    many bps. */
+  wgint limit_rate_per_host;    /* Limit the download rate from each
+                                   host to this many bps. */
+  wgint write_buffer;           /* Queue this much downloaded data for
+                                   writing in the background. */
   SUM_SIZE_INT quota;           /* Maximum file size to download and
                                    store. */
 
@@ -165,6 +187,8 @@ struct options
 #endif
 
   bool timestamping;            /* Whether to use time-stamping. */
+  char *validator_file;         /* file to record validators of
+                                   downloaded files in */
 
   bool backup_converted;        /* Do we save pre-converted files as *.orig? */
   int backups;                  /* Are numeric backups made? */
@@ -223,6 +247,7 @@ struct options
   char *random_file;            /* file with random data to seed the PRNG */
   char *egd_file;               /* file name of the egd daemon socket */
   bool https_only;              /* whether to follow HTTPS only */
+  char *tls_session_file;       /* file to keep TLS sessions in */
 #endif /* HAVE_SSL */
 
   bool cookies;                 /* whether cookies are used. */
@@ -269,7 +294,12 @@ struct options
   } prefer_family;              /* preferred address family when more
                                    than one type is available */
 
+  bool io_uring;                /* Read and write sockets through
+                                   io_uring. */
+
   bool content_disposition;     /* Honor HTTP Content-Disposition header. */
+  bool compression;             /* Ask for compressed HTTP bodies and
+                                   decompress them. */
   bool auth_without_challenge;  /* Issue Basic authentication creds without
                                    waiting for a challenge. */
 
@@ -37,12 +37,16 @@ as that of the covered work.  */
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <tmpdir.h>
 
 #include "url.h"
 #include "recur.h"
 #include "utils.h"
 #include "retr.h"
 #include "ftp.h"
+#include "http.h"
 #include "host.h"
 #include "hash.h"
 #include "res.h"
@@ -50,8 +54,31 @@ as that of the covered work.  */
 #include "html-url.h"
 #include "css-url.h"
 #include "spider.h"
+#include "workers.h"
+#include "ptimer.h"
+#include "exits.h"
+#include "url-set.h"
 
-/* Functions for maintaining the URL queue.  */
+#ifndef O_TEMPORARY
+#define O_TEMPORARY 0
+#endif
+
+/* Functions for maintaining the URL queue.
+
+   The queue is kept per server, so that the wait asked for with
+   --wait or by the Crawl-delay of robots.txt, and the limit on the
+   retrievals from one server at a time set with --parallel-per-host,
+   only hold back the URLs of that server.  URLs are otherwise taken
+   in the order they were queued, which makes the retrieval
+   breadth-first.
+
+   At most opt.queue_window URLs are kept in memory.  Once the window
+   is full, the URLs queued after it are appended to a temporary file,
+   the "spill" file, and read back in the same order as the window
+   empties, so that memory use doesn't grow with the size of the site.
+   Each URL there is stored as the length of its common prefix with
+   the previous one, followed by the rest of it, which makes the file
+   a fraction of the size of the URLs.  */
 
 struct queue_element {
   const char *url;              /* the URL to download */
@@ -62,13 +89,60 @@ struct queue_element {
   struct iri *iri;                /* sXXXav */
   bool css_allowed;             /* whether the document is allowed to
                                    be treated as CSS. */
+  unsigned long serial;         /* the order of queueing */
+  struct host_queue *host;      /* the server of URL */
   struct queue_element *next;   /* next element in queue */
 };
 
-struct url_queue {
+/* The URLs queued for a server, told apart by host name and port as
+   for robots.txt, and the state of the retrievals from it.  */
+
+struct host_queue {
+  char *host;
+  int port;
+  int number;                   /* the index in the queue's host_list */
   struct queue_element *head;
   struct queue_element *tail;
+  double ready_time;            /* when the server may be sent the next
+                                   request, on the queue's timer */
+  double delay;                 /* the wait after the last retrieval */
+  int active;                   /* retrievals in progress */
+  bool pending;                 /* whether on the queue's pending list */
+  struct host_queue *next_pending;
+};
+
+/* The last string written to or read from the spill file in a field
+   of the elements, which the next one is coded against.  */
+
+struct front_coder {
+  char *last;
+  int len, size;
+};
+
+/* The fields of the elements stored as strings.  */
+
+struct spill_coders {
+  struct front_coder url, referer;
+  struct front_coder uri_encoding, content_encoding, orig_url;
+};
+
+struct url_queue {
+  struct hash_table *hosts;     /* "host:port" -> struct host_queue */
+  struct host_queue **host_list; /* the servers by number */
+  int host_count, host_size;
+  struct host_queue *pending;   /* the servers with queued URLs */
+  struct ptimer *timer;
+  unsigned long serial;
   int count, maxcount;
+  int memory;                   /* elements in the servers' queues */
+
+  FILE *spill;                  /* the elements beyond the window */
+  int spilled;                  /* ... and their number */
+  bool spill_failed;            /* whether the file couldn't be made */
+  bool spill_writing;           /* whether the file was last written */
+  off_t spill_read;             /* where the next element is read */
+  unsigned long spill_serial;   /* the serial of that element */
+  struct spill_coders out, in;
 };
 
 /* Create a URL queue. */
@@ -77,33 +151,406 @@ static struct url_queue *
 url_queue_new (void)
 {
   struct url_queue *queue = xnew0 (struct url_queue);
+  queue->hosts = make_nocase_string_hash_table (0);
+  queue->timer = ptimer_new ();
   return queue;
 }
 
-/* Delete a URL queue. */
+static void
+spill_coders_free (struct spill_coders *coders)
+{
+  xfree (coders->url.last);
+  xfree (coders->referer.last);
+  xfree (coders->uri_encoding.last);
+  xfree (coders->content_encoding.last);
+  xfree (coders->orig_url.last);
+}
+
+/* Delete a URL queue, along with the URLs left in it.  The elements
+   in the spill file go with the file.  */
 
 static void
 url_queue_delete (struct url_queue *queue)
 {
+  hash_table_iterator iter;
+
+  for (hash_table_iterate (queue->hosts, &iter); hash_table_iter_next (&iter); )
+    {
+      struct host_queue *host = iter.value;
+      struct queue_element *qel, *next;
+      for (qel = host->head; qel; qel = next)
+        {
+          next = qel->next;
+          iri_free (qel->iri);
+          xfree (qel->url);
+          xfree (qel->referer);
+          xfree (qel);
+        }
+      xfree (iter.key);
+      xfree (host->host);
+      xfree (host);
+    }
+  hash_table_destroy (queue->hosts);
+  xfree (queue->host_list);
+  ptimer_destroy (queue->timer);
+  if (queue->spill)
+    fclose (queue->spill);
+  spill_coders_free (&queue->out);
+  spill_coders_free (&queue->in);
   xfree (queue);
 }
 
+/* Return the queue of the server HOST:PORT, creating it if needed.  */
+
+static struct host_queue *
+url_queue_host (struct url_queue *queue, const char *host, int port)
+{
+  char *key = aprintf ("%s:%d", host, port);
+  struct host_queue *hq = hash_table_get (queue->hosts, key);
+
+  if (hq)
+    xfree (key);
+  else
+    {
+      hq = xnew0 (struct host_queue);
+      hq->host = xstrdup (host);
+      hq->port = port;
+      hq->number = queue->host_count;
+      hash_table_put (queue->hosts, key, hq);
+      DO_REALLOC (queue->host_list, queue->host_size, queue->host_count + 1,
+                  struct host_queue *);
+      queue->host_list[queue->host_count++] = hq;
+    }
+  return hq;
+}
+
+/* Append QEL to the queue of its server.  */
+
+static void
+host_queue_append (struct url_queue *queue, struct queue_element *qel)
+{
+  struct host_queue *host = qel->host;
+
+  if (host->tail)
+    host->tail->next = qel;
+  host->tail = qel;
+
+  if (!host->head)
+    host->head = host->tail;
+
+  if (!host->pending)
+    {
+      host->pending = true;
+      host->next_pending = queue->pending;
+      queue->pending = host;
+    }
+  ++queue->memory;
+}
+
+/* Create the spill file, in the directory given by $TMPDIR or the
+   system's default.  The file is removed right away, and goes away
+   with Wget.  */
+
+static FILE *
+spill_tempfile (void)
+{
+  char filename[1024];
+  int fd;
+  FILE *fp;
+
+  if (path_search (filename, sizeof filename, NULL, "wget", true) == -1)
+    return NULL;
+  fd = mkostemp (filename, O_TEMPORARY);
+  if (fd < 0)
+    return NULL;
+#if !O_TEMPORARY
+  if (unlink (filename) < 0)
+    {
+      close (fd);
+      return NULL;
+    }
+#endif
+  fp = fdopen (fd, "wb+");
+  if (!fp)
+    close (fd);
+  return fp;
+}
+
+/* Write N to FP in as many bytes as it needs, seven bits a byte, the
+   lowest ones first.  */
+
+static void
+spill_number (FILE *fp, unsigned long n)
+{
+  while (n >= 0x80)
+    {
+      putc ((n & 0x7f) | 0x80, fp);
+      n >>= 7;
+    }
+  putc (n, fp);
+}
+
+static bool
+fill_number (FILE *fp, unsigned long *n)
+{
+  unsigned int shift = 0;
+  int c;
+
+  *n = 0;
+  do
+    {
+      c = getc (fp);
+      if (c == EOF || shift >= sizeof *n * CHAR_BIT)
+        return false;
+      *n |= (unsigned long) (c & 0x7f) << shift;
+      shift += 7;
+    }
+  while (c & 0x80);
+  return true;
+}
+
+/* Write S to FP as the length of the prefix it shares with the last
+   string written with CODER, and the bytes that follow.  */
+
+static void
+spill_string (FILE *fp, struct front_coder *coder, const char *s)
+{
+  int len = strlen (s), common = 0;
+
+  while (common < coder->len && common < len
+         && coder->last[common] == s[common])
+    ++common;
+  spill_number (fp, common);
+  spill_number (fp, len - common);
+  fwrite (s + common, 1, len - common, fp);
+
+  DO_REALLOC (coder->last, coder->size, len + 1, char);
+  memcpy (coder->last + common, s + common, len - common + 1);
+  coder->len = len;
+}
+
+/* Read a string written by spill_string.  Returns a copy of it, or
+   NULL on error.  */
+
+static char *
+fill_string (FILE *fp, struct front_coder *coder)
+{
+  unsigned long common, rest;
+
+  if (!fill_number (fp, &common) || !fill_number (fp, &rest)
+      || common > (unsigned long) coder->len || rest > INT_MAX - common - 1)
+    return NULL;
+  DO_REALLOC (coder->last, coder->size, common + rest + 1, char);
+  if (fread (coder->last + common, 1, rest, fp) != rest)
+    return NULL;
+  coder->len = common + rest;
+  coder->last[coder->len] = '\0';
+  return xstrdup (coder->last);
+}
+
+/* The flags stored with an element in the spill file, telling which
+   of its optional fields follow.  */
+
+enum {
+  SPILL_HTML = 1,
+  SPILL_CSS = 2,
+  SPILL_REFERER = 4,
+  SPILL_UTF8 = 8,
+  SPILL_URI_ENCODING = 16,
+  SPILL_CONTENT_ENCODING = 32,
+  SPILL_ORIG_URL = 64
+};
+
+/* Append QEL to the spill file, and free it.  */
+
+static void
+url_queue_spill (struct url_queue *queue, struct queue_element *qel)
+{
+  FILE *fp = queue->spill;
+  struct iri *i = qel->iri;
+  int flags = 0;
+
+  if (!queue->spill_writing)
+    {
+      if (fseeko (fp, 0, SEEK_END) < 0)
+        goto fail;
+      queue->spill_writing = true;
+    }
+  if (!queue->spilled)
+    queue->spill_serial = qel->serial;
+
+  if (qel->html_allowed)
+    flags |= SPILL_HTML;
+  if (qel->css_allowed)
+    flags |= SPILL_CSS;
+  if (qel->referer)
+    flags |= SPILL_REFERER;
+#ifdef ENABLE_IRI
+  if (i->utf8_encode)
+    flags |= SPILL_UTF8;
+  if (i->uri_encoding)
+    flags |= SPILL_URI_ENCODING;
+  if (i->content_encoding)
+    flags |= SPILL_CONTENT_ENCODING;
+  if (i->orig_url)
+    flags |= SPILL_ORIG_URL;
+#endif
+
+  spill_number (fp, flags);
+  spill_number (fp, qel->depth);
+  spill_number (fp, qel->host->number);
+  spill_string (fp, &queue->out.url, qel->url);
+  if (flags & SPILL_REFERER)
+    spill_string (fp, &queue->out.referer, qel->referer);
+  if (flags & SPILL_URI_ENCODING)
+    spill_string (fp, &queue->out.uri_encoding, i->uri_encoding);
+  if (flags & SPILL_CONTENT_ENCODING)
+    spill_string (fp, &queue->out.content_encoding, i->content_encoding);
+  if (flags & SPILL_ORIG_URL)
+    spill_string (fp, &queue->out.orig_url, i->orig_url);
+  if (ferror (fp))
+    goto fail;
+
+  ++queue->spilled;
+  iri_free (qel->iri);
+  xfree (qel->url);
+  xfree (qel->referer);
+  xfree (qel);
+  return;
+
+ fail:
+  logprintf (LOG_NOTQUIET, _("Cannot write queued URLs to a temporary file: %s\n"),
+             strerror (errno));
+  exit (WGET_EXIT_IO_FAIL);
+}
+
+/* Read an element back from the spill file.  Returns NULL on error.  */
+
+static struct queue_element *
+url_queue_fill_one (struct url_queue *queue)
+{
+  FILE *fp = queue->spill;
+  struct queue_element *qel = xnew0 (struct queue_element);
+  unsigned long flags, depth, number;
+
+  qel->iri = iri_new ();
+  if (!fill_number (fp, &flags) || !fill_number (fp, &depth)
+      || !fill_number (fp, &number)
+      || number >= (unsigned long) queue->host_count
+      || !(qel->url = fill_string (fp, &queue->in.url)))
+    goto fail;
+  if ((flags & SPILL_REFERER)
+      && !(qel->referer = fill_string (fp, &queue->in.referer)))
+    goto fail;
+#ifdef ENABLE_IRI
+  {
+    struct iri *i = qel->iri;
+    xfree (i->uri_encoding);
+    i->utf8_encode = !!(flags & SPILL_UTF8);
+    if ((flags & SPILL_URI_ENCODING)
+        && !(i->uri_encoding = fill_string (fp, &queue->in.uri_encoding)))
+      goto fail;
+    if ((flags & SPILL_CONTENT_ENCODING)
+        && !(i->content_encoding = fill_string (fp,
+                                                &queue->in.content_encoding)))
+      goto fail;
+    if ((flags & SPILL_ORIG_URL)
+        && !(i->orig_url = fill_string (fp, &queue->in.orig_url)))
+      goto fail;
+  }
+#endif
+
+  qel->depth = depth;
+  qel->html_allowed = !!(flags & SPILL_HTML);
+  qel->css_allowed = !!(flags & SPILL_CSS);
+  qel->host = queue->host_list[number];
+  qel->serial = queue->spill_serial++;
+  return qel;
+
+ fail:
+  iri_free (qel->iri);
+  xfree (qel->url);
+  xfree (qel->referer);
+  xfree (qel);
+  return NULL;
+}
+
+/* Move elements from the spill file back to the servers' queues once
+   half of the window is free, until it is full again.  */
+
+static void
+url_queue_fill (struct url_queue *queue)
+{
+  FILE *fp = queue->spill;
+  int n = 0;
+
+  if (!queue->spilled || queue->memory > opt.queue_window / 2)
+    return;
+
+  if (queue->spill_writing)
+    {
+      if (fflush (fp) != 0 || fseeko (fp, queue->spill_read, SEEK_SET) < 0)
+        goto fail;
+      queue->spill_writing = false;
+    }
+  while (queue->spilled && queue->memory < opt.queue_window)
+    {
+      struct queue_element *qel = url_queue_fill_one (queue);
+      if (!qel)
+        {
+          if (!ferror (fp))
+            errno = EINVAL;
+          goto fail;
+        }
+      host_queue_append (queue, qel);
+      --queue->spilled;
+      ++n;
+    }
+  DEBUGP (("Read %d queued URLs back from the temporary file, %d left.\n",
+           n, queue->spilled));
+
+  if (queue->spilled)
+    queue->spill_read = ftello (fp);
+  else
+    {
+      /* Start over with an empty file.  */
+      if (ftruncate (fileno (fp), 0) < 0)
+        goto fail;
+      rewind (fp);
+      queue->spill_read = 0;
+      spill_coders_free (&queue->out);
+      spill_coders_free (&queue->in);
+      xzero (queue->out);
+      xzero (queue->in);
+    }
+  return;
+
+ fail:
+  logprintf (LOG_NOTQUIET, _("Cannot read queued URLs from a temporary file: %s\n"),
+             strerror (errno));
+  exit (WGET_EXIT_IO_FAIL);
+}
+
 /* Enqueue a URL in the queue.  The queue is FIFO: the items will be
    retrieved ("dequeued") from the queue in the order they were placed
-   into it.  */
+   into it, except for those held back by their server.  U is the
+   parsed URL.  */
 
 static void
 url_enqueue (struct url_queue *queue, struct iri *i,
              const char *url, const char *referer, int depth,
-             bool html_allowed, bool css_allowed)
+             bool html_allowed, bool css_allowed, const struct url *u)
 {
   struct queue_element *qel = xnew (struct queue_element);
+  struct host_queue *host = url_queue_host (queue, u->host, u->port);
   qel->iri = i;
   qel->url = url;
   qel->referer = referer;
   qel->depth = depth;
   qel->html_allowed = html_allowed;
   qel->css_allowed = css_allowed;
+  qel->serial = queue->serial++;
+  qel->host = host;
   qel->next = NULL;
 
   ++queue->count;
@@ -118,30 +565,72 @@ url_enqueue (struct url_queue *queue, struct iri *i,
     DEBUGP (("[IRI Enqueuing %s with %s\n", quote_n (0, url),
              i->uri_encoding ? quote_n (1, i->uri_encoding) : "None"));
 
-  if (queue->tail)
-    queue->tail->next = qel;
-  queue->tail = qel;
+  /* Once an element has gone to the spill file, the ones after it
+     must too, to be read back in order.  */
+  if (opt.queue_window && queue->memory >= opt.queue_window
+      && !queue->spill && !queue->spill_failed)
+    {
+      queue->spill = spill_tempfile ();
+      if (!queue->spill)
+        {
+          logprintf (LOG_NOTQUIET, _("\
+Cannot create a temporary file for queued URLs: %s\n\
+Keeping them all in memory.\n"), strerror (errno));
+          queue->spill_failed = true;
+        }
+    }
+  if (queue->spill
+      && (queue->spilled || queue->memory >= opt.queue_window))
+    url_queue_spill (queue, qel);
+  else
+    host_queue_append (queue, qel);
+}
+
+/* Whether another retrieval from HOST may be started at time NOW.  */
 
-  if (!queue->head)
-    queue->head = queue->tail;
+static bool
+host_ready_p (const struct host_queue *host, double now)
+{
+  return (host->ready_time <= now
+          && (!opt.parallel_per_host || host->active < opt.parallel_per_host));
 }
 
-/* Take a URL out of the queue.  Return true if this operation
-   succeeded, or false if the queue is empty.  */
+/* Take a URL out of the queue, the earliest queued one whose server
+   may be sent a request now, and store its server to *HOST.  Return
+   true if this operation succeeded, or false if no URL is ready.  */
 
 static bool
 url_dequeue (struct url_queue *queue, struct iri **i,
              const char **url, const char **referer, int *depth,
-             bool *html_allowed, bool *css_allowed)
+             bool *html_allowed, bool *css_allowed,
+             struct host_queue **host)
 {
-  struct queue_element *qel = queue->head;
+  struct host_queue *hq, **prev, *best = NULL;
+  struct queue_element *qel;
+  double now = ptimer_measure (queue->timer);
 
-  if (!qel)
+  url_queue_fill (queue);
+  for (prev = &queue->pending; (hq = *prev) != NULL; )
+    {
+      if (!hq->head)
+        {
+          /* Drop the servers whose URLs have all been taken.  */
+          hq->pending = false;
+          *prev = hq->next_pending;
+          continue;
+        }
+      if (host_ready_p (hq, now)
+          && (!best || hq->head->serial < best->head->serial))
+        best = hq;
+      prev = &hq->next_pending;
+    }
+  if (!best)
     return false;
 
-  queue->head = queue->head->next;
-  if (!queue->head)
-    queue->tail = NULL;
+  qel = best->head;
+  best->head = qel->next;
+  if (!best->head)
+    best->tail = NULL;
 
   *i = qel->iri;
   *url = qel->url;
@@ -149,8 +638,10 @@ url_dequeue (struct url_queue *queue, struct iri **i,
   *depth = qel->depth;
   *html_allowed = qel->html_allowed;
   *css_allowed = qel->css_allowed;
+  *host = best;
 
   --queue->count;
+  --queue->memory;
 
   DEBUGP (("Dequeuing %s at depth %d\n",
            quotearg_n_style (0, escape_quoting_style, qel->url), qel->depth));
@@ -160,32 +651,161 @@ url_dequeue (struct url_queue *queue, struct iri **i,
   return true;
 }
 
-static void blacklist_add (struct hash_table *blacklist, const char *url)
+/* Return the number of seconds until a URL in the queue may be
+   dequeued, 0 if one may be dequeued now, or -1 if none will be
+   before a retrieval finishes.  */
+
+static double
+url_queue_wait (struct url_queue *queue)
+{
+  struct host_queue *hq;
+  double now = ptimer_measure (queue->timer), wait = -1;
+
+  url_queue_fill (queue);
+  for (hq = queue->pending; hq; hq = hq->next_pending)
+    if (hq->head
+        && (!opt.parallel_per_host || hq->active < opt.parallel_per_host))
+      {
+        double w = MAX (hq->ready_time - now, 0);
+        if (wait < 0 || w < wait)
+          wait = w;
+      }
+  return wait;
+}
+
+/* Note that a retrieval from HOST starts (if START is true) or has
+   finished, and hold the server back for the wait asked for with
+   --wait or by its robots.txt, whichever is longer.  */
+
+static void
+host_retrieval (struct url_queue *queue, struct host_queue *host, bool start)
+{
+  double now = ptimer_measure (queue->timer);
+
+  if (start)
+    {
+      ++host->active;
+      host->delay = opt.wait;
+      if (opt.random_wait && host->delay)
+        /* Average the wait to opt.wait, as sleep_between_retrievals
+           does.  */
+        host->delay *= 0.5 + random_float ();
+      if (opt.use_robots)
+        {
+          struct robot_specs *specs = res_get_specs (host->host, host->port);
+          if (specs && res_crawl_delay (specs) > host->delay)
+            host->delay = res_crawl_delay (specs);
+        }
+    }
+  else
+    --host->active;
+
+  if (host->delay)
+    host->ready_time = MAX (host->ready_time, now + host->delay);
+}
+
+static void blacklist_add (struct url_set *blacklist, const char *url)
 {
   char *url_unescaped = xstrdup (url);
 
   url_unescape (url_unescaped);
-  string_set_add (blacklist, url_unescaped);
+  url_set_add (blacklist, url_unescaped);
   xfree (url_unescaped);
 }
 
-static int blacklist_contains (struct hash_table *blacklist, const char *url)
+static int blacklist_contains (struct url_set *blacklist, const char *url)
 {
   char *url_unescaped = xstrdup(url);
   int ret;
 
   url_unescape (url_unescaped);
-  ret = string_set_contains (blacklist, url_unescaped);
+  ret = url_set_contains (blacklist, url_unescaped);
   xfree (url_unescaped);
 
   return ret;
 }
 
 static bool download_child_p (const struct urlpos *, struct url *, int,
-                              struct url *, struct hash_table *, struct iri *);
+                              struct url *, struct url_set *, struct iri *);
 static bool descend_redirect_p (const char *, struct url *, int,
-                                struct url *, struct hash_table *, struct iri *);
+                                struct url *, struct url_set *, struct iri *);
 
+/* Decide whether to look for links in the document retrieved from
+   *URL, with STATUS, DT, FILE and REDIRECTED as returned by
+   retrieve_url, and set *IS_CSS to whether it is to be parsed as CSS.
+   *URL is replaced with the URL the document was actually retrieved
+   from, which takes ownership of REDIRECTED.  */
+
+static bool
+descend_retrieved_p (char **url, struct url *url_parsed, char *redirected,
+                     uerr_t status, int dt, const char *file,
+                     bool html_allowed, bool css_allowed, int depth,
+                     struct url *start_url_parsed,
+                     struct url_set *blacklist, struct iri *i,
+                     bool *is_css)
+{
+  bool descend = false;
+
+  if (html_allowed && file && status == RETROK
+      && (dt & RETROKF) && (dt & TEXTHTML))
+    {
+      descend = true;
+      *is_css = false;
+    }
+
+  /* a little different, css_allowed can override content type
+     lots of web servers serve css with an incorrect content type
+  */
+  if (file && status == RETROK
+      && (dt & RETROKF) &&
+      ((dt & TEXTCSS) || css_allowed))
+    {
+      descend = true;
+      *is_css = true;
+    }
+
+  if (redirected)
+    {
+      /* We have been redirected, possibly to another host, or
+         different path, or wherever.  Check whether we really
+         want to follow it.  */
+      if (descend)
+        {
+          if (!descend_redirect_p (redirected, url_parsed, depth,
+                                   start_url_parsed, blacklist, i))
+            descend = false;
+          else
+            /* Make sure that the old pre-redirect form gets
+               blacklisted. */
+            blacklist_add (blacklist, *url);
+        }
+
+      xfree (*url);
+      *url = redirected;
+    }
+  else
+    {
+      xfree (*url);
+      *url = xstrdup (url_parsed->url);
+    }
+
+  return descend;
+}
+
+
+/* Start background lookups of the hosts of CHILDREN that pass the
+   domain restrictions.  */
+
+static void
+prefetch_hosts (struct urlpos *children)
+{
+  struct urlpos *child;
+  for (child = children; child; child = child->next)
+    if (!child->ignore_when_downloading && accept_domain (child->url)
+        && !url_uses_proxy (child->url)
+        && !host_prefetch (child->url->host))
+      break;
+}
 
 /* Retrieve a part of the web beginning with START_URL.  This used to
    be called "recursive retrieval", because the old function was
@@ -218,10 +838,13 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 
   /* The URLs we do not wish to enqueue, because they are already in
      the queue, but haven't been downloaded yet.  */
-  struct hash_table *blacklist;
+  struct url_set *blacklist;
 
   struct iri *i = iri_new ();
 
+  /* Whether the retrievals are done by worker processes.  */
+  bool parallel;
+
 #define COPYSTR(x)  (x) ? xstrdup(x) : NULL;
   /* Duplicate pi struct if not NULL */
   if (pi)
@@ -235,14 +858,18 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 #undef COPYSTR
 
   queue = url_queue_new ();
-  blacklist = make_string_hash_table (0);
+  blacklist = url_set_new ();
 
   /* Enqueue the starting URL.  Use start_url_parsed->url rather than
      just URL so we enqueue the canonical form of the URL.  */
   url_enqueue (queue, i, xstrdup (start_url_parsed->url), NULL, 0, true,
-               false);
+               false, start_url_parsed);
   blacklist_add (blacklist, start_url_parsed->url);
 
+  /* The wait between retrievals is done per server by the queue.  */
+  wait_per_host = true;
+  parallel = workers_start (opt.parallel);
+
   while (1)
     {
       bool descend = false;
@@ -251,99 +878,149 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
       bool html_allowed, css_allowed;
       bool is_css = false;
       bool dash_p_leaf_HTML = false;
+      struct host_queue *host;
+      bool stop = ((opt.quota && total_downloaded_bytes > opt.quota)
+                   || status == FWRITEERR);
+      double wait = stop ? -1 : url_queue_wait (queue);
 
-      if (opt.quota && total_downloaded_bytes > opt.quota)
-        break;
-      if (status == FWRITEERR)
-        break;
-
-      /* Get the next URL from the queue... */
-
-      if (!url_dequeue (queue, (struct iri **) &i,
-                        (const char **)&url, (const char **)&referer,
-                        &depth, &html_allowed, &css_allowed))
-        break;
-
-      /* ...and download it.  Note that this download is in most cases
-         unconditional, as download_child_p already makes sure a file
-         doesn't get enqueued twice -- and yet this check is here, and
-         not in download_child_p.  This is so that if you run `wget -r
-         URL1 URL2', and a random URL is encountered once under URL1
-         and again under URL2, but at a different (possibly smaller)
-         depth, we want the URL's children to be taken into account
-         the second time.  */
-      if (dl_url_file_map && hash_table_contains (dl_url_file_map, url))
+      if (parallel && workers_pending_p ()
+          && (stop || wait != 0 || workers_busy_p (-1)))
         {
-          bool is_css_bool;
-
-          file = xstrdup (hash_table_get (dl_url_file_map, url));
-
-          DEBUGP (("Already downloaded \"%s\", reusing it from \"%s\".\n",
-                   url, file));
-
-          if ((is_css_bool = (css_allowed
-                  && downloaded_css_set
-                  && string_set_contains (downloaded_css_set, file)))
-              || (html_allowed
-                && downloaded_html_set
-                && string_set_contains (downloaded_html_set, file)))
+          /* Nothing more can be handed to the workers; wait for one
+             of them to finish and process the document it got, or
+             until the queue has a URL for an idle worker.  */
+          struct worker_result res;
+          struct queue_element *job;
+          struct url *url_parsed;
+
+          if (wait > 0 && !workers_busy_p (-1))
             {
-              descend = true;
-              is_css = is_css_bool;
+              if (!workers_wait_timeout (&res, wait))
+                continue;
             }
+          else
+            workers_wait (&res);
+          job = res.data;
+          host_retrieval (queue, job->host, false);
+          url = (char *) job->url;
+          referer = (char *) job->referer;
+          depth = job->depth;
+          html_allowed = job->html_allowed;
+          css_allowed = job->css_allowed;
+          i = job->iri;
+          xfree (job);
+
+          if (status != FWRITEERR)
+            status = res.status;
+          file = res.file;
+          url_parsed = url_parse (url, NULL, i, true);
+          descend = descend_retrieved_p (&url, url_parsed, res.newloc,
+                                         res.status, res.dt, file,
+                                         html_allowed, css_allowed, depth,
+                                         start_url_parsed, blacklist, i,
+                                         &is_css);
+          url_free (url_parsed);
         }
       else
         {
-          int dt = 0, url_err;
-          char *redirected = NULL;
-          struct url *url_parsed = url_parse (url, &url_err, i, true);
+          if (stop)
+            break;
 
-          status = retrieve_url (url_parsed, url, &file, &redirected, referer,
-                                 &dt, false, i, true);
+          /* Get the next URL from the queue... */
 
-          if (html_allowed && file && status == RETROK
-              && (dt & RETROKF) && (dt & TEXTHTML))
+          if (!url_dequeue (queue, (struct iri **) &i,
+                            (const char **)&url, (const char **)&referer,
+                            &depth, &html_allowed, &css_allowed, &host))
             {
-              descend = true;
-              is_css = false;
+              if (wait < 0)
+                break;
+              /* Every server with URLs in the queue has to be waited
+                 for.  */
+              DEBUGP (("Waiting %.2f seconds for the next server.\n",
+                       wait));
+              xsleep (wait);
+              continue;
             }
 
-          /* a little different, css_allowed can override content type
-             lots of web servers serve css with an incorrect content type
-          */
-          if (file && status == RETROK
-              && (dt & RETROKF) &&
-              ((dt & TEXTCSS) || css_allowed))
+          /* ...and download it.  Note that this download is in most
+             cases unconditional, as download_child_p already makes
+             sure a file doesn't get enqueued twice -- and yet this
+             check is here, and not in download_child_p.  This is so
+             that if you run `wget -r URL1 URL2', and a random URL is
+             encountered once under URL1 and again under URL2, but at
+             a different (possibly smaller) depth, we want the URL's
+             children to be taken into account the second time.  */
+          if (dl_url_file_map && hash_table_contains (dl_url_file_map, url))
             {
-              descend = true;
-              is_css = true;
-            }
+              bool is_css_bool;
 
-          if (redirected)
-            {
-              /* We have been redirected, possibly to another host, or
-                 different path, or wherever.  Check whether we really
-                 want to follow it.  */
-              if (descend)
+              file = xstrdup (hash_table_get (dl_url_file_map, url));
+
+              DEBUGP (("Already downloaded \"%s\", reusing it from \"%s\".\n",
+                       url, file));
+
+              if ((is_css_bool = (css_allowed
+                      && downloaded_css_set
+                      && string_set_contains (downloaded_css_set, file)))
+                  || (html_allowed
+                    && downloaded_html_set
+                    && string_set_contains (downloaded_html_set, file)))
                 {
-                  if (!descend_redirect_p (redirected, url_parsed, depth,
-                                           start_url_parsed, blacklist, i))
-                    descend = false;
-                  else
-                    /* Make sure that the old pre-redirect form gets
-                       blacklisted. */
-                    blacklist_add (blacklist, url);
+                  descend = true;
+                  is_css = is_css_bool;
                 }
-
-              xfree (url);
-              url = redirected;
+            }
+          else if (parallel && workers_running ())
+            {
+              /* Hand the URL to a worker; the document is processed
+                 when the worker is done with it.  Should all the
+                 workers have died, go on retrieving here.  */
+              struct queue_element *job = xnew0 (struct queue_element);
+              job->url = url;
+              job->referer = referer;
+              job->depth = depth;
+              job->html_allowed = html_allowed;
+              job->css_allowed = css_allowed;
+              job->iri = i;
+              job->host = host;
+              host_retrieval (queue, host, true);
+              workers_submit (-1, url, referer, i, false, job);
+              continue;
             }
           else
             {
-              xfree (url);
-              url = xstrdup (url_parsed->url);
+              int dt = 0, url_err;
+              char *redirected = NULL;
+              struct url *url_parsed = url_parse (url, &url_err, i, true);
+
+              host_retrieval (queue, host, true);
+
+              /* Let the URLs queued next for the same server be
+                 requested ahead of time on the connection used for
+                 this one, unless the server is to be waited for.  */
+              if (http_pipeline_depth () > 1 && !host->delay)
+                {
+                  struct queue_element *qel;
+                  int n;
+                  http_pipeline_clear ();
+                  for (qel = host->head, n = 1;
+                       qel && n < http_pipeline_depth ();
+                       qel = qel->next, n++)
+                    if (!dl_url_file_map
+                        || !hash_table_contains (dl_url_file_map, qel->url))
+                      http_pipeline_add (qel->url, qel->referer);
+                }
+
+              status = retrieve_url (url_parsed, url, &file, &redirected,
+                                     referer, &dt, false, i, true);
+              host_retrieval (queue, host, false);
+              descend = descend_retrieved_p (&url, url_parsed, redirected,
+                                             status, dt, file,
+                                             html_allowed, css_allowed,
+                                             depth, start_url_parsed,
+                                             blacklist, i, &is_css);
+              url_free (url_parsed);
             }
-          url_free (url_parsed);
         }
 
       if (opt.spider)
@@ -407,6 +1084,13 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
               if (strip_auth)
                 referer_url = url_string (url_parsed, URL_AUTH_HIDE);
 
+              /* Start resolving the hosts we may span to right away,
+                 before download_child_p fetches their robots.txt one
+                 by one, so that their addresses are known by the time
+                 they are needed.  Workers do their own lookups.  */
+              if (opt.spanhost && !parallel)
+                prefetch_hosts (children);
+
               for (; child; child = child->next)
                 {
                   if (child->ignore_when_downloading)
@@ -421,7 +1105,7 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
                       url_enqueue (queue, ci, xstrdup (child->url->url),
                                    xstrdup (referer_url), depth + 1,
                                    child->link_expect_html,
-                                   child->link_expect_css);
+                                   child->link_expect_css, child->url);
                       /* We blacklist the URL we have enqueued, because we
                          don't want to enqueue (and hence download) the
                          same URL twice.  */
@@ -466,24 +1150,17 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
       iri_free (i);
     }
 
-  /* If anything is left of the queue due to a premature exit, free it
-     now.  */
-  {
-    char *d1, *d2;
-    int d3;
-    bool d4, d5;
-    struct iri *d6;
-    while (url_dequeue (queue, (struct iri **)&d6,
-                        (const char **)&d1, (const char **)&d2, &d3, &d4, &d5))
-      {
-        iri_free (d6);
-        xfree (d1);
-        xfree (d2);
-      }
-  }
+  if (parallel)
+    workers_stop ();
+  http_pipeline_clear ();
+
+  wait_per_host = false;
+
+  /* Free the queue, along with anything left of it due to a premature
+     exit.  */
   url_queue_delete (queue);
 
-  string_set_free (blacklist);
+  url_set_free (blacklist);
 
   if (opt.quota && total_downloaded_bytes > opt.quota)
     return QUOTEXC;
@@ -503,7 +1180,7 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 
 static bool
 download_child_p (const struct urlpos *upos, struct url *parent, int depth,
-                  struct url *start_url_parsed, struct hash_table *blacklist,
+                  struct url *start_url_parsed, struct url_set *blacklist,
                   struct iri *iri)
 {
   struct url *u = upos->url;
@@ -715,7 +1392,7 @@ download_child_p (const struct urlpos *upos, struct url *parent, int depth,
 
 static bool
 descend_redirect_p (const char *redirected, struct url *orig_parsed, int depth,
-                    struct url *start_url_parsed, struct hash_table *blacklist,
+                    struct url *start_url_parsed, struct url_set *blacklist,
                     struct iri *iri)
 {
   struct url *new_parsed;
@@ -64,9 +64,13 @@ as that of the covered work.  */
      whether anyone deploys the recommended expiry scheme for
      robots.txt.
 
+   * The non-standard "Crawl-delay" field is recognized and can be
+     queried with res_crawl_delay; the recursive retrieval waits that
+     long between requests to the server.
+
    Entry points are functions res_parse, res_parse_from_file,
-   res_match_path, res_register_specs, res_get_specs, and
-   res_retrieve_file.  */
+   res_match_path, res_crawl_delay, res_register_specs, res_get_specs,
+   and res_retrieve_file.  */
 
 #include "wget.h"
 
@@ -75,6 +79,7 @@ as that of the covered work.  */
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <math.h>
 
 #include "utils.h"
 #include "hash.h"
@@ -97,8 +102,16 @@ struct robot_specs {
   int count;
   int size;
   struct path_info *paths;
+  double crawl_delay;           /* seconds to wait between requests */
+  bool crawl_delay_exact_p;     /* whether CRAWL_DELAY was given to
+                                   "wget" rather than to "*" */
 };
 
+/* The longest Crawl-delay honored, in seconds.  Longer delays are
+   cut down to it, so that a remote robots.txt can't stall the
+   retrieval indefinitely.  */
+#define CRAWL_DELAY_MAX 3600
+
 /* Parsing the robot spec. */
 
 /* Check whether AGENT (a string of length LENGTH) equals "wget" or
@@ -350,6 +363,34 @@ res_parse (const char *source, int length)
             }
           ++record_count;
         }
+      else if (FIELD_IS ("crawl-delay"))
+        {
+          /* Not part of the original standard, but widely used to
+             ask for a number of seconds between requests.  */
+          if (user_agent_applies
+              && (user_agent_exact || !specs->crawl_delay_exact_p))
+            {
+              char *value = strdupdelim (value_b, value_e);
+              char *end;
+              double delay = strtod (value, &end);
+              if (*end || !isfinite (delay) || delay < 0)
+                DEBUGP (("Ignoring malformed Crawl-delay at line %d\n",
+                         line_count));
+              else
+                {
+                  if (delay > CRAWL_DELAY_MAX)
+                    {
+                      DEBUGP (("Limiting Crawl-delay at line %d to %d\n",
+                               line_count, CRAWL_DELAY_MAX));
+                      delay = CRAWL_DELAY_MAX;
+                    }
+                  specs->crawl_delay = delay;
+                  specs->crawl_delay_exact_p = user_agent_exact;
+                }
+              xfree (value);
+            }
+          ++record_count;
+        }
       else
         {
           DEBUGP (("Ignoring unknown field at line %d\n", line_count));
@@ -366,6 +407,8 @@ res_parse (const char *source, int length)
       /* We've encountered an exactly matching user-agent.  Throw out
          all the stuff with user-agent: *.  */
       prune_non_exact (specs);
+      if (!specs->crawl_delay_exact_p)
+        specs->crawl_delay = 0;
     }
   else if (specs->size > specs->count)
     {
@@ -473,6 +516,15 @@ res_match_path (const struct robot_specs *specs, const char *path)
   return true;
 }
 
+/* Return the number of seconds SPECS ask to wait between requests,
+   or 0.  */
+
+double
+res_crawl_delay (const struct robot_specs *specs)
+{
+  return specs->crawl_delay;
+}
+
 /* Registering the specs. */
 
 static struct hash_table *registered_specs;
@@ -636,6 +688,41 @@ test_is_robots_txt_url(void)
   return NULL;
 }
 
+const char *
+test_res_crawl_delay (void)
+{
+  unsigned i;
+  static const struct {
+    const char *robots;
+    double expected_delay;
+  } test_array[] = {
+    { "User-agent: *\nCrawl-delay: 5\n", 5 },
+    { "User-agent: *\nDisallow: /cgi-bin\nCrawl-delay: 0.5\n", 0.5 },
+    { "User-agent: google\nCrawl-delay: 5\n", 0 },
+    { "User-agent: *\nCrawl-delay: 5\n\n"
+      "User-agent: wget\nCrawl-delay: 2\n", 2 },
+    { "User-agent: wget\nCrawl-delay: 2\n\n"
+      "User-agent: *\nCrawl-delay: 5\n", 2 },
+    { "User-agent: *\nCrawl-delay: 5\n\n"
+      "User-agent: wget\nDisallow: /tmp\n", 0 },
+    { "User-agent: *\nCrawl-delay: soon\n", 0 },
+    { "User-agent: *\nCrawl-delay: inf\n", 0 },
+    { "User-agent: *\nCrawl-delay: nan\n", 0 },
+    { "User-agent: *\nCrawl-delay: 1e300\n", CRAWL_DELAY_MAX },
+  };
+
+  for (i = 0; i < countof(test_array); ++i)
+    {
+      const char *robots = test_array[i].robots;
+      struct robot_specs *specs = res_parse (robots, strlen (robots));
+      mu_assert ("test_res_crawl_delay: wrong delay",
+                 res_crawl_delay (specs) == test_array[i].expected_delay);
+      free_specs (specs);
+    }
+
+  return NULL;
+}
+
 #endif /* TESTING */
 
 /*
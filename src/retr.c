@@ -37,6 +37,13 @@ as that of the covered work.  */
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
+#ifdef HAVE_SPLICE
+# include <fcntl.h>
+# include <sys/stat.h>
+#endif
+#ifdef HAVE_LIBZ
+# include <zlib.h>
+#endif
 #ifdef VMS
 # include <unixio.h>            /* For delete(). */
 #endif
@@ -56,6 +63,13 @@ as that of the covered work.  */
 #include "ptimer.h"
 #include "html-url.h"
 #include "iri.h"
+#include "workers.h"
+#include "bandwidth.h"
+#include "writer.h"
+
+#ifdef TESTING
+#include "test.h"
+#endif
 
 /* Total size of downloaded files.  Used to enforce quota.  */
 SUM_SIZE_INT total_downloaded_bytes;
@@ -63,6 +77,11 @@ SUM_SIZE_INT total_downloaded_bytes;
 /* Total download time in seconds. */
 double total_download_time;
 
+/* Whether the wait between retrievals is done by the caller for each
+   server, as retrieve_tree does, rather than by
+   sleep_between_retrievals.  Retries are still waited for there.  */
+bool wait_per_host;
+
 /* If non-NULL, the stream to which output should be written.  This
    stream is initialized when `-O' is used.  */
 FILE *output_stream;
@@ -71,70 +90,9 @@ FILE *output_stream;
    i.e. not `-' or a device file. */
 bool output_stream_regular;
 
-static struct {
-  wgint chunk_bytes;
-  double chunk_start;
-  double sleep_adjust;
-} limit_data;
-
-static void
-limit_bandwidth_reset (void)
-{
-  xzero (limit_data);
-}
-
-/* Limit the bandwidth by pausing the download for an amount of time.
-   BYTES is the number of bytes received from the network, and TIMER
-   is the timer that started at the beginning of download.  */
-
-static void
-limit_bandwidth (wgint bytes, struct ptimer *timer)
-{
-  double delta_t = ptimer_read (timer) - limit_data.chunk_start;
-  double expected;
-
-  limit_data.chunk_bytes += bytes;
-
-  /* Calculate the amount of time we expect downloading the chunk
-     should take.  If in reality it took less time, sleep to
-     compensate for the difference.  */
-  expected = (double) limit_data.chunk_bytes / opt.limit_rate;
-
-  if (expected > delta_t)
-    {
-      double slp = expected - delta_t + limit_data.sleep_adjust;
-      double t0, t1;
-      if (slp < 0.2)
-        {
-          DEBUGP (("deferring a %.2f ms sleep (%s/%.2f).\n",
-                   slp * 1000, number_to_static_string (limit_data.chunk_bytes),
-                   delta_t));
-          return;
-        }
-      DEBUGP (("\nsleeping %.2f ms for %s bytes, adjust %.2f ms\n",
-               slp * 1000, number_to_static_string (limit_data.chunk_bytes),
-               limit_data.sleep_adjust));
-
-      t0 = ptimer_read (timer);
-      xsleep (slp);
-      t1 = ptimer_measure (timer);
-
-      /* Due to scheduling, we probably slept slightly longer (or
-         shorter) than desired.  Calculate the difference between the
-         desired and the actual sleep, and adjust the next sleep by
-         that amount.  */
-      limit_data.sleep_adjust = slp - (t1 - t0);
-      /* If sleep_adjust is very large, it's likely due to suspension
-         and not clock inaccuracy.  Don't enforce those.  */
-      if (limit_data.sleep_adjust > 0.5)
-        limit_data.sleep_adjust = 0.5;
-      else if (limit_data.sleep_adjust < -0.5)
-        limit_data.sleep_adjust = -0.5;
-    }
-
-  limit_data.chunk_bytes = 0;
-  limit_data.chunk_start = ptimer_read (timer);
-}
+/* Whether the data for OUT is handed to the background writer, see
+   writer.c.  */
+static bool write_in_background;
 
 /* Write data in BUF to OUT.  However, if *SKIP is non-zero, skip that
    amount of data and decrease SKIP.  Increment *TOTAL by the amount
@@ -163,6 +121,12 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
         return 1;
     }
 
+  if (out != NULL && write_in_background)
+    {
+      if (writer_write (buf, bufsize) < 0)
+        return -1;
+      out = NULL;               /* nothing to write or flush here */
+    }
   if (out != NULL)
     fwrite (buf, 1, bufsize, out);
   if (out2 != NULL)
@@ -196,10 +160,379 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
     return 0;
 }
 
+/* Size of the first read of a download, and the largest size reads
+   are allowed to grow to.  */
+#define DLBUF_INITIAL_SIZE (BUFSIZ > 8 * 1024 ? BUFSIZ : 8 * 1024)
+#define DLBUF_MAX_SIZE (1024 * 1024)
+
+/* The download buffer kept from the previous download, so that it
+   needn't be reallocated for each file.  */
+static char *dlbuf_pool;
+static int dlbuf_pool_size;
+
+/* Return a download buffer of at least SIZE bytes, reusing the pooled
+   one if possible.  The actual size is stored to *BUFSIZE.  */
+
+static char *
+dlbuf_get (int size, int *bufsize)
+{
+  char *buf = dlbuf_pool;
+  *bufsize = dlbuf_pool_size;
+  dlbuf_pool = NULL;
+  dlbuf_pool_size = 0;
+  if (*bufsize < size)
+    {
+      xfree (buf);
+      buf = xmalloc (size);
+      *bufsize = size;
+    }
+  return buf;
+}
+
+/* Return BUF of BUFSIZE bytes to the pool.  */
+
+static void
+dlbuf_put (char *buf, int bufsize)
+{
+  if (dlbuf_pool)
+    {
+      /* Keep the larger buffer.  */
+      if (dlbuf_pool_size >= bufsize)
+        {
+          xfree (buf);
+          return;
+        }
+      xfree (dlbuf_pool);
+    }
+  dlbuf_pool = buf;
+  dlbuf_pool_size = bufsize;
+}
+
+#ifdef HAVE_SPLICE
+/* The pipe through which fd_read_body moves data from the network to
+   the output file with splice, or -1s if the data is being copied
+   through the download buffer.  */
+static int splice_pipe[2] = { -1, -1 };
+
+static void
+splice_pipe_close (void)
+{
+  if (splice_pipe[0] >= 0)
+    {
+      close (splice_pipe[0]);
+      close (splice_pipe[1]);
+    }
+  splice_pipe[0] = splice_pipe[1] = -1;
+}
+
+/* Open the splice pipe if the data written to OUT can bypass the
+   stdio buffer, which requires a regular file not opened for
+   appending -- Linux refuses to splice to those.  */
+
+static void
+splice_pipe_open (FILE *out)
+{
+  struct_fstat st;
+  int fd = fileno (out);
+  int flags = fcntl (fd, F_GETFL);
+
+  if (flags < 0 || (flags & O_APPEND)
+      || fstat (fd, &st) < 0 || !S_ISREG (st.st_mode))
+    return;
+  if (pipe (splice_pipe) < 0)
+    {
+      splice_pipe[0] = splice_pipe[1] = -1;
+      return;
+    }
+#ifdef F_SETPIPE_SZ
+  /* The default pipe size would limit each splice to 64K.  */
+  fcntl (splice_pipe[1], F_SETPIPE_SZ, DLBUF_MAX_SIZE);
+#endif
+  /* Whatever was written to OUT so far must precede the spliced
+     data.  */
+  fflush (out);
+}
+
+/* Move the SIZE bytes waiting in the splice pipe to OUT, and add them
+   to *WRITTEN.  If OUT's file system doesn't support splicing, the
+   data is written through BUF, which must hold SIZE bytes, and
+   splicing is turned off.  Returns 0 on success and -2 on error, like
+   write_data.  */
+
+static int
+splice_data (FILE *out, char *buf, int size, wgint *written)
+{
+  int left = size;
+
+  while (left > 0)
+    {
+      ssize_t res = splice (splice_pipe[0], NULL, fileno (out), NULL, left,
+                            SPLICE_F_MOVE);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res < 0 && errno == EINVAL && left == size)
+        {
+          wgint skip = 0;
+          res = read (splice_pipe[0], buf, size);
+          splice_pipe_close ();
+          if (res != size)
+            return -2;
+          DEBUGP (("Output file doesn't support splice, copying data.\n"));
+          return write_data (out, NULL, buf, size, &skip, written);
+        }
+      if (res <= 0)
+        return -2;
+      left -= res;
+    }
+  *written += size;
+  return 0;
+}
+#endif /* HAVE_SPLICE */
+
+#ifdef HAVE_LIBZ
+/* The state of decompressing a body that arrives with the gzip or
+   deflate Content-Encoding.  */
+struct inflater {
+  z_stream zs;
+  bool raw_tried;               /* whether raw deflate was tried */
+  bool finished;                /* whether the end of the data was seen */
+  char buf[64 * 1024];          /* decompressed data */
+};
+
+static struct inflater *
+inflater_new (void)
+{
+  struct inflater *inf = xnew0 (struct inflater);
+  /* Adding 32 to the window bits makes zlib recognize both the gzip
+     and the zlib format.  */
+  if (inflateInit2 (&inf->zs, 32 + MAX_WBITS) != Z_OK)
+    xalloc_die ();
+  return inf;
+}
+
+static void
+inflater_free (struct inflater *inf)
+{
+  inflateEnd (&inf->zs);
+  xfree (inf);
+}
+
+/* Decompress the BUFSIZE bytes of compressed data in BUF and write
+   the result to OUT.  OUT2 gets the compressed data as it arrived.
+   SKIP and WRITTEN refer to the decompressed data and are handled as
+   in write_data.  Returns 0 on success, -1 if the data can't be
+   decompressed, -2 on error writing to OUT, and -3 on error writing
+   to OUT2.  */
+
+static int
+inflate_data (struct inflater *inf, FILE *out, FILE *out2,
+              const char *buf, int bufsize, wgint *skip, wgint *written)
+{
+  z_stream *zs = &inf->zs;
+  uLong consumed = zs->total_in;
+  wgint no_skip = 0, raw_written = 0;
+
+  if (out2 != NULL
+      && write_data (NULL, out2, buf, bufsize, &no_skip, &raw_written) < 0)
+    return -3;
+  if (inf->finished)
+    {
+      DEBUGP (("Ignoring %d bytes after the compressed data.\n", bufsize));
+      return 0;
+    }
+
+  zs->next_in = (Bytef *) buf;
+  zs->avail_in = bufsize;
+  do
+    {
+      int err, size;
+
+      zs->next_out = (Bytef *) inf->buf;
+      zs->avail_out = sizeof inf->buf;
+      err = inflate (zs, Z_NO_FLUSH);
+      if (err == Z_DATA_ERROR && consumed == 0 && !inf->raw_tried)
+        {
+          /* Some servers send "deflate" bodies without the zlib
+             header and checksum.  */
+          inf->raw_tried = true;
+          if (inflateReset2 (zs, -MAX_WBITS) == Z_OK)
+            {
+              zs->next_in = (Bytef *) buf;
+              zs->avail_in = bufsize;
+              continue;
+            }
+        }
+      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+        {
+          logprintf (LOG_NOTQUIET, _("Cannot decompress data: %s\n"),
+                     zs->msg ? zs->msg : zError (err));
+          return -1;
+        }
+
+      size = sizeof inf->buf - zs->avail_out;
+      if (size > 0 && write_data (out, NULL, inf->buf, size, skip, written) < 0)
+        return -2;
+      if (err == Z_STREAM_END)
+        {
+          inf->finished = true;
+          break;
+        }
+      if (err == Z_BUF_ERROR)
+        break;
+    }
+  while (zs->avail_in > 0 || zs->avail_out == 0);
+  return 0;
+}
+#endif /* HAVE_LIBZ */
+
+/* The state of decoding a body that arrives with the chunked
+   Transfer-Encoding.  The chunk framing is parsed a byte at a time,
+   so that it may be split across reads in any way.  */
+struct chunk_decoder {
+  enum {
+    CHUNK_SIZE,                 /* in the hex digits of the chunk size */
+    CHUNK_EXTENSION,            /* in the rest of the chunk size line */
+    CHUNK_DATA,                 /* in the data of the chunk */
+    CHUNK_DATA_END,             /* in the CRLF following the data */
+    CHUNK_TRAILER,              /* at the start of a trailer line */
+    CHUNK_TRAILER_FIELD,        /* in a trailer field */
+    CHUNK_DONE                  /* after the empty line ending the body */
+  } state;
+  wgint remaining;              /* size of the rest of the chunk */
+  bool digits;                  /* whether the size has any digits */
+};
+
+/* Parse the SIZE bytes of chunked data in BUF, up to and including
+   the first span of chunk data.  The span is stored to *DATA and its
+   size to *DATASIZE, which is 0 if BUF ends before a span begins.
+   Nothing is consumed once the end of the body has been seen.
+
+   Returns the number of bytes consumed, or -1 if the framing is
+   malformed.  */
+
+static int
+chunk_decode (struct chunk_decoder *dec, const char *buf, int size,
+              const char **data, int *datasize)
+{
+  const char *p = buf, *end = buf + size;
+
+  *data = buf;
+  *datasize = 0;
+  while (p < end && dec->state != CHUNK_DONE)
+    {
+      char c;
+
+      if (dec->state == CHUNK_DATA)
+        {
+          int n = MIN (dec->remaining, end - p);
+          *data = p;
+          *datasize = n;
+          p += n;
+          dec->remaining -= n;
+          if (dec->remaining == 0)
+            dec->state = CHUNK_DATA_END;
+          break;
+        }
+
+      c = *p++;
+      switch (dec->state)
+        {
+        case CHUNK_SIZE:
+          if (c_isxdigit (c))
+            {
+              if (dec->remaining > WGINT_MAX / 16)
+                return -1;
+              dec->remaining = dec->remaining * 16 + XDIGIT_TO_NUM (c);
+              dec->digits = true;
+              break;
+            }
+          if (!dec->digits)
+            {
+              if (c == ' ' || c == '\t')
+                break;
+              return -1;
+            }
+          /* The size is followed by optional extensions, which we
+             ignore, and the end of the line.  */
+          dec->state = CHUNK_EXTENSION;
+          /* fall through */
+        case CHUNK_EXTENSION:
+          if (c == '\n')
+            {
+              dec->digits = false;
+              /* The last chunk, of size 0, is followed by the
+                 trailer.  */
+              dec->state = dec->remaining ? CHUNK_DATA : CHUNK_TRAILER;
+            }
+          break;
+        case CHUNK_DATA_END:
+          if (c == '\n')
+            dec->state = CHUNK_SIZE;
+          break;
+        case CHUNK_TRAILER:
+          if (c == '\n')
+            dec->state = CHUNK_DONE;
+          else if (c != '\r')
+            dec->state = CHUNK_TRAILER_FIELD;
+          break;
+        case CHUNK_TRAILER_FIELD:
+          if (c == '\n')
+            dec->state = CHUNK_TRAILER;
+          break;
+        default:
+          abort ();
+        }
+    }
+  return p - buf;
+}
+
+/* Decode the SIZE bytes of chunked data in BUF in place, moving the
+   chunk data to the beginning of BUF and storing its size to
+   *DATASIZE.  OUT2, if non-NULL, gets the bytes as they arrived,
+   chunk framing included.
+
+   Returns the number of bytes consumed, which is less than SIZE if
+   the body ends within BUF, -1 if the framing is malformed, or -3 on
+   error writing to OUT2.  */
+
+static int
+dechunk_data (struct chunk_decoder *dec, char *buf, int size, int *datasize,
+              FILE *out2)
+{
+  int pos = 0;
+
+  *datasize = 0;
+  while (pos < size && dec->state != CHUNK_DONE)
+    {
+      const char *data;
+      int n, count;
+
+      n = chunk_decode (dec, buf + pos, size - pos, &data, &count);
+      if (n < 0)
+        return -1;
+      /* The data is moved over framing that precedes it, so the raw
+         bytes must be written out first.  */
+      if (out2 != NULL && fwrite (buf + pos, 1, n, out2) < (size_t) n)
+        return -3;
+      memmove (buf + *datasize, data, count);
+      *datasize += count;
+      pos += n;
+    }
+  return pos;
+}
+
 /* Read the contents of file descriptor FD until it the connection
    terminates or a read error occurs.  The data is read in portions of
-   up to 16K and written to OUT as it arrives.  If opt.verbose is set,
-   the progress is shown.
+   8K at first, growing up to 1M while the connection keeps delivering
+   full buffers, and written to OUT as it arrives.  Where possible, the
+   data is moved from FD to OUT by the kernel without being copied to
+   user space.  With --write-buffer, the data is instead written to OUT
+   by a background thread, see writer.c.  If opt.verbose is set, the
+   progress is shown.
+
+   If FLAGS includes rb_compressed, the data is decompressed before
+   being written to OUT; OUT2 and the amount read still refer to the
+   data as it arrived.
 
    TOREAD is the amount of data expected to arrive, normally only used
    by the progress gauge.
@@ -216,6 +549,11 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
    response, everything -- including the chunk headers -- is written
    to OUT2.  (OUT will only get the unchunked response.)
 
+   A chunked body is peeked at rather than read, and only the part
+   belonging to the body is then drained from the connection, so that
+   data following it stays there for the next response.  The amount
+   read counts only the data of the chunks.
+
    The function exits and returns the amount of data read.  In case of
    error while reading data, -1 is returned.  In case of error while
    writing data to OUT, -2 is returned.  In case of error while writing
@@ -228,10 +566,11 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
               FILE *out2)
 {
   int ret = 0;
-#undef max
-#define max(a,b) ((a) > (b) ? (a) : (b))
-  int dlbufsize = max (BUFSIZ, 8 * 1024);
-  char *dlbuf = xmalloc (dlbufsize);
+  /* DLBUFSIZE is the size of the current read, at most the allocated
+     size of DLBUF, DLBUF_ALLOCATED.  */
+  int dlbufsize = DLBUF_INITIAL_SIZE, dlbuf_allocated;
+  int dlbufmax = DLBUF_MAX_SIZE;
+  char *dlbuf = dlbuf_get (dlbufsize, &dlbuf_allocated);
 
   struct ptimer *timer = NULL;
   double last_successful_read_tm = 0;
@@ -245,17 +584,25 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
      data arrives slowly. */
   bool progress_interactive = false;
 
+  /* The bucket of the per-host rate limit, if any.  */
+  struct bandwidth_bucket *host_bucket = NULL;
+
   bool exact = !!(flags & rb_read_exactly);
 
   /* Used only by HTTP/HTTPS chunked transfer encoding.  */
   bool chunked = flags & rb_chunked_transfer_encoding;
+  struct chunk_decoder decoder;
+
+#ifdef HAVE_LIBZ
+  struct inflater *inflater = NULL;
+#endif
   wgint skip = 0;
 
   /* How much data we've read/written.  */
   wgint sum_read = 0;
   wgint sum_written = 0;
-  wgint remaining_chunk_size = 0;
 
+  xzero (decoder);
   if (flags & rb_skip_startpos)
     skip = startpos;
 
@@ -274,13 +621,12 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
       progress_interactive = progress_interactive_p (progress);
     }
 
-  if (opt.limit_rate)
-    limit_bandwidth_reset ();
+  if (opt.limit_rate_per_host)
+    host_bucket = bandwidth_host_bucket (fd);
 
-  /* A timer is needed for tracking progress, for throttling, and for
-     tracking elapsed time.  If either of these are requested, start
-     the timer.  */
-  if (progress || opt.limit_rate || elapsed)
+  /* A timer is needed for tracking progress and for tracking elapsed
+     time.  If either of these are requested, start the timer.  */
+  if (progress || elapsed)
     {
       timer = ptimer_new ();
       last_successful_read_tm = 0;
@@ -288,10 +634,33 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
 
   /* Use a smaller buffer for low requested bandwidths.  For example,
      with --limit-rate=2k, it doesn't make sense to slurp in 16K of
-     data and then sleep for 8s.  With buffer size equal to the limit,
-     we never have to sleep for more than one second.  */
-  if (opt.limit_rate && opt.limit_rate < dlbufsize)
-    dlbufsize = opt.limit_rate;
+     data and then sleep for 8s.  Reading at most a tenth of a
+     second's worth at a time also keeps concurrent transfers from
+     taking the bandwidth from each other in large bursts.  */
+  if (opt.limit_rate || opt.limit_rate_per_host)
+    {
+      wgint rate = opt.limit_rate;
+      if (!rate || (opt.limit_rate_per_host
+                    && opt.limit_rate_per_host < rate))
+        rate = opt.limit_rate_per_host;
+      dlbufmax = MIN (dlbufmax, MAX (rate / 10, 512));
+    }
+  if (dlbufsize > dlbufmax)
+    dlbufsize = dlbufmax;
+
+#ifdef HAVE_LIBZ
+  if (flags & rb_compressed)
+    inflater = inflater_new ();
+#endif
+  if (out)
+    write_in_background = writer_start (out);
+#ifdef HAVE_SPLICE
+  /* Splicing skips the buffer, so it's only possible when the data
+     goes to OUT as is.  */
+  if (out && !out2 && !chunked && !(flags & rb_compressed)
+      && !write_in_background)
+    splice_pipe_open (out);
+#endif
 
   /* Read from FD while there is data to read.  Normally toread==0
      means that it is unknown how much data is to arrive.  However, if
@@ -301,41 +670,26 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
     {
       int rdsize;
       double tmout = opt.read_timeout;
+#ifdef HAVE_SPLICE
+      bool spliced = false;
+#endif
+      /* The amount of data peeked at rather than read, and the
+         amount of body data in DLBUF, which is less than what was
+         read if chunk framing has been removed.  */
+      int peeked = 0, size = 0;
 
       if (chunked)
         {
-          if (remaining_chunk_size == 0)
+          if (decoder.state == CHUNK_DONE)
             {
-              char *line = fd_read_line (fd);
-              char *endl;
-              if (line == NULL)
-                {
-                  ret = -1;
-                  break;
-                }
-              else if (out2 != NULL)
-                fwrite (line, 1, strlen (line), out2);
-
-              remaining_chunk_size = strtol (line, &endl, 16);
-              xfree (line);
-
-              if (remaining_chunk_size == 0)
-                {
-                  ret = 0;
-                  line = fd_read_line (fd);
-                  if (line == NULL)
-                    ret = -1;
-                  else
-                    {
-                      if (out2 != NULL)
-                        fwrite (line, 1, strlen (line), out2);
-                      xfree (line);
-                    }
-                  break;
-                }
+              ret = 0;
+              break;
             }
-
-          rdsize = MIN (remaining_chunk_size, dlbufsize);
+          /* Within a chunk, its data is read as is.  */
+          if (decoder.state == CHUNK_DATA)
+            rdsize = MIN (decoder.remaining, dlbufsize);
+          else
+            rdsize = dlbufsize;
         }
       else
         rdsize = exact ? MIN (toread - sum_read, dlbufsize) : dlbufsize;
@@ -363,14 +717,39 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
                 }
             }
         }
-      ret = fd_read (fd, dlbuf, rdsize, tmout);
+#ifdef HAVE_SPLICE
+      /* Bytes skipped due to rb_skip_startpos are read normally.  */
+      if (splice_pipe[0] >= 0 && !skip)
+        {
+          ret = fd_splice (fd, splice_pipe[1], rdsize, tmout);
+          if (ret < 0 && errno == EINVAL)
+            splice_pipe_close ();
+          else
+            spliced = true;
+        }
+      if (!spliced)
+#endif
+        {
+          /* Chunk framing is peeked at, because the body may end
+             before the data that arrived does.  */
+          if (chunked && decoder.state != CHUNK_DATA)
+            ret = peeked = fd_peek (fd, dlbuf, rdsize, tmout);
+          else
+            ret = fd_read (fd, dlbuf, rdsize, tmout);
+        }
 
       if (progress_interactive && ret < 0 && errno == ETIMEDOUT)
         ret = 0;                /* interactive timeout, handled above */
+      else if (ret == 0 && chunked)
+        {
+          /* EOF before the end of the chunked body.  */
+          ret = -1, errno = 0;
+          break;
+        }
       else if (ret <= 0)
         break;                  /* EOF or read error */
 
-      if (progress || opt.limit_rate || elapsed)
+      if (progress || elapsed)
         {
           ptimer_measure (timer);
           if (ret > 0)
@@ -380,40 +759,86 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
       if (ret > 0)
         {
           int write_res;
+          FILE *raw_out = out2;
 
-          sum_read += ret;
-          write_res = write_data (out, out2, dlbuf, ret, &skip, &sum_written);
+          size = ret;
+          if (chunked)
+            {
+              int consumed = dechunk_data (&decoder, dlbuf, ret, &size, out2);
+              if (consumed == -3)
+                {
+                  ret = -3;
+                  goto out;
+                }
+              if (consumed < 0)
+                {
+                  logprintf (LOG_NOTQUIET, _("Malformed chunked encoding.\n"));
+                  ret = -1, errno = EIO;
+                  break;
+                }
+              if (peeked)
+                peeked = consumed;
+              raw_out = NULL;   /* already written by dechunk_data */
+            }
+
+          sum_read += size;
+#ifdef HAVE_SPLICE
+          if (spliced)
+            write_res = splice_data (out, dlbuf, size, &sum_written);
+          else
+#endif
+#ifdef HAVE_LIBZ
+          if (inflater)
+            {
+              write_res = inflate_data (inflater, out, raw_out, dlbuf, size,
+                                        &skip, &sum_written);
+              if (write_res == -1)
+                {
+                  ret = -1, errno = EIO;
+                  break;
+                }
+            }
+          else
+#endif
+            write_res = write_data (out, raw_out, dlbuf, size, &skip,
+                                    &sum_written);
           if (write_res < 0)
             {
               ret = (write_res == -3) ? -3 : -2;
               goto out;
             }
-          if (chunked)
+
+          /* Now that the peeked data is written, drain the part of it
+             that belongs to the body from the connection.  */
+          if (peeked && fd_read (fd, dlbuf, peeked, 0) != peeked)
+            {
+              ret = -1;
+              break;
+            }
+
+          /* A read that filled the whole buffer means more data was
+             already waiting, so the connection is faster than we
+             drain it.  Double the read size to cut down on system
+             calls; the buffer stays at the size the connection
+             sustains.  */
+          if (ret == rdsize && rdsize == dlbufsize && dlbufsize < dlbufmax)
             {
-              remaining_chunk_size -= ret;
-              if (remaining_chunk_size == 0)
+              dlbufsize = MIN (dlbufsize * 2, dlbufmax);
+              if (dlbufsize > dlbuf_allocated)
                 {
-                  char *line = fd_read_line (fd);
-                  if (line == NULL)
-                    {
-                      ret = -1;
-                      break;
-                    }
-                  else
-                    {
-                      if (out2 != NULL)
-                        fwrite (line, 1, strlen (line), out2);
-                      xfree (line);
-                    }
+                  xfree (dlbuf);
+                  dlbuf = xmalloc (dlbufsize);
+                  dlbuf_allocated = dlbufsize;
                 }
+              DEBUGP (("Increased read size to %d.\n", dlbufsize));
             }
         }
 
-      if (opt.limit_rate)
-        limit_bandwidth (ret, timer);
+      if (opt.limit_rate || host_bucket)
+        bandwidth_limit (host_bucket, ret);
 
       if (progress)
-        progress_update (progress, ret, ptimer_read (timer));
+        progress_update (progress, size, ptimer_read (timer));
 #ifdef WINDOWS
       if (toread > 0 && opt.show_progress)
         ws_percenttitle (100.0 *
@@ -422,8 +847,22 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
     }
   if (ret < -1)
     ret = -1;
+#ifdef HAVE_LIBZ
+  /* The connection may have ended cleanly in the middle of the
+     compressed data.  */
+  if (inflater && ret >= 0 && sum_read > 0 && !inflater->finished)
+    ret = -1, errno = EIO;
+#endif
 
  out:
+  /* The download isn't done until the data is on disk.  */
+  if (write_in_background)
+    {
+      write_in_background = false;
+      if (writer_finish () < 0 && ret >= 0)
+        ret = -2;
+    }
+
   if (progress)
     progress_finish (progress, ptimer_read (timer));
 
@@ -437,7 +876,14 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
   if (qtywritten)
     *qtywritten += sum_written;
 
-  xfree (dlbuf);
+  dlbuf_put (dlbuf, dlbuf_allocated);
+#ifdef HAVE_SPLICE
+  splice_pipe_close ();
+#endif
+#ifdef HAVE_LIBZ
+  if (inflater)
+    inflater_free (inflater);
+#endif
 
   return ret;
 }
@@ -480,10 +926,13 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
 
       2b. If no, read the peeked data and goto 1.
 
-   The function is careful to assume as little as possible about the
-   implementation of peeking.  For example, every peek is followed by
-   a read.  If the read returns a different amount of data, the
-   process is retried until all data arrives safely.
+   Peeking and reading are both served from the connection's read
+   buffer (see fd_peek), so the transport is read only when the
+   buffer runs empty, and the data following the hunk stays in the
+   buffer for the next reader, such as fd_read_body.  Still, every
+   peek is followed by a read, and if the read returns a different
+   amount of data, the process is retried until all data arrives
+   safely.
 
    SIZEHINT is the buffer size sufficient to hold all the data in the
    typical case (it is used as the initial buffer size).  MAXSIZE is
@@ -539,9 +988,9 @@ fd_read_hunk (int fd, hunk_terminator_t terminator, long sizehint, long maxsize)
            be) available.  */
         remain = pklen;
 
-      /* Now, read the data.  Note that we make no assumptions about
-         how much data we'll get.  (Some TCP stacks are notorious for
-         read returning less data than the previous MSG_PEEK.)  */
+      /* Now, read the data.  This only consumes the peeked data from
+         the read buffer, but we still make no assumptions about how
+         much data we'll get.  */
 
       rdlen = fd_read (fd, hunk + tail, remain, 0);
       if (rdlen < 0)
@@ -941,19 +1390,9 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
           DEBUGP (("[Couldn't fallback to non-utf8 for %s\n", quote (url)));
     }
 
-  if (local_file && u && *dt & RETROKF)
-    {
-      register_download (u->url, local_file);
-
-      if (!opt.spider && redirection_count && 0 != strcmp (origurl, u->url))
-        register_redirection (origurl, u->url);
-
-      if (*dt & TEXTHTML)
-        register_html (local_file);
-
-      if (*dt & TEXTCSS)
-        register_css (local_file);
-    }
+  if (u)
+    register_retrieval (origurl, u->url, local_file, *dt,
+                        redirection_count != 0);
 
   if (file)
     *file = local_file ? local_file : NULL;
@@ -987,21 +1426,97 @@ bail:
   return result;
 }
 
+/* Delete FILE retrieved by retrieve_from_file if --delete-after was
+   specified.  */
+
+static void
+delete_after_retrieval (const char *file)
+{
+  if (file && opt.delete_after && file_exists_p (file))
+    {
+      DEBUGP (("\
+Removing file due to --delete-after in retrieve_from_file():\n"));
+      logprintf (LOG_VERBOSE, _("Removing %s.\n"), file);
+      if (unlink (file))
+        logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
+    }
+}
+
+/* Wait for a retrieval started by retrieve_from_file to finish, and
+   return its status.  */
+
+static uerr_t
+retrieve_from_file_collect (void)
+{
+  struct worker_result res;
+
+  workers_wait (&res);
+  delete_after_retrieval (res.file);
+  xfree (res.file);
+  xfree (res.newloc);
+  iri_free ((struct iri *) res.data);
+  return res.status;
+}
+
+/* Start background lookups of the hosts of the URLs in LIST, as many
+   as host_prefetch accepts at this time, and return the first URL
+   whose host still needs to be prefetched.  */
+
+static struct urlpos *
+prefetch_hosts (struct urlpos *list)
+{
+  for (; list; list = list->next)
+    if (!list->ignore_when_downloading && !url_uses_proxy (list->url)
+        && !host_prefetch (list->url->host))
+      break;
+  return list;
+}
+
+/* Record for link conversion that ORIGURL was retrieved from URL into
+   FILE, with the flags in DT.  REDIRECTED is true if the server
+   redirected ORIGURL to URL.  Nothing is recorded unless the retrieval
+   succeeded.  */
+
+void
+register_retrieval (const char *origurl, const char *url, const char *file,
+                    int dt, bool redirected)
+{
+  if (!file || !(dt & RETROKF))
+    return;
+
+  register_download (url, file);
+
+  if (!opt.spider && redirected && 0 != strcmp (origurl, url))
+    register_redirection (origurl, url);
+
+  if (dt & TEXTHTML)
+    register_html (file);
+
+  if (dt & TEXTCSS)
+    register_css (file);
+}
+
 /* Find the URLs in the file and call retrieve_url() for each of them.
    If HTML is true, treat the file as HTML, and construct the URLs
    accordingly.
 
-   If opt.recursive is set, call retrieve_tree() for each file.  */
+   If opt.recursive is set, call retrieve_tree() for each file.
+
+   With --parallel, the URLs are retrieved by worker processes.  URLs
+   that would be saved under the same name go to the same worker, in
+   the order they appear in the file, so that the choice of file names
+   (e.g. the numbering of duplicates) doesn't depend on timing.  */
 
 uerr_t
 retrieve_from_file (const char *file, bool html, int *count)
 {
   uerr_t status;
-  struct urlpos *url_list, *cur_url;
+  struct urlpos *url_list, *cur_url, *prefetch_url;
   struct iri *iri = iri_new();
 
   char *input_file, *url_file = NULL;
   const char *url = file;
+  bool parallel;
 
   status = RETROK;             /* Suppose everything is OK.  */
   *count = 0;                  /* Reset the URL count.  */
@@ -1054,6 +1569,11 @@ retrieve_from_file (const char *file, bool html, int *count)
 
   xfree (url_file);
 
+  /* Recursive retrievals are parallelized by retrieve_tree.  */
+  parallel = (!opt.recursive && !opt.page_requisites
+              && workers_start (opt.parallel));
+  prefetch_url = parallel ? NULL : url_list;
+
   for (cur_url = url_list; cur_url; cur_url = cur_url->next, ++*count)
     {
       char *filename = NULL, *new_file = NULL, *proxy;
@@ -1064,6 +1584,10 @@ retrieve_from_file (const char *file, bool html, int *count)
       if (cur_url->ignore_when_downloading)
         continue;
 
+      /* Resolve the hosts of the following URLs in the background
+         while this one is being retrieved.  */
+      prefetch_url = prefetch_hosts (prefetch_url);
+
       if (opt.quota && total_downloaded_bytes > opt.quota)
         {
           status = QUOTEXC;
@@ -1072,6 +1596,28 @@ retrieve_from_file (const char *file, bool html, int *count)
 
       parsed_url = url_parse (cur_url->url->url, NULL, tmpiri, true);
 
+      if (parallel)
+        {
+          /* Files can only end up under the same name if their URLs
+             have the same file (or path, when directories are
+             created) component.  */
+          struct url *u = parsed_url ? parsed_url : cur_url->url;
+          const char *key = opt.dirstruct ? u->path : u->file;
+          int slot;
+
+          while ((slot = workers_slot (key)) >= 0 && workers_busy_p (slot))
+            status = retrieve_from_file_collect ();
+          if (slot >= 0)
+            {
+              workers_submit (slot, cur_url->url->url, NULL, tmpiri, false,
+                              tmpiri);
+              if (parsed_url)
+                url_free (parsed_url);
+              continue;
+            }
+          /* All the workers died; retrieve the rest here.  */
+        }
+
       proxy = getproxy (cur_url->url);
       if ((opt.recursive || opt.page_requisites)
           && (cur_url->url->scheme != SCHEME_FTP || proxy))
@@ -1088,29 +1634,50 @@ retrieve_from_file (const char *file, bool html, int *count)
           opt.follow_ftp = old_follow_ftp;
         }
       else
-        status = retrieve_url (parsed_url ? parsed_url : cur_url->url,
-                               cur_url->url->url, &filename,
-                               &new_file, NULL, &dt, opt.recursive, tmpiri,
-                               true);
+        {
+          /* Let the URLs that follow be requested ahead of time on
+             the connection used for this one.  */
+          if (http_pipeline_depth () > 1)
+            {
+              struct urlpos *next;
+              int n = 1;
+              http_pipeline_clear ();
+              for (next = cur_url->next; next && n < http_pipeline_depth ();
+                   next = next->next)
+                if (!next->ignore_when_downloading)
+                  {
+                    http_pipeline_add (next->url->url, NULL);
+                    ++n;
+                  }
+            }
+          status = retrieve_url (parsed_url ? parsed_url : cur_url->url,
+                                 cur_url->url->url, &filename,
+                                 &new_file, NULL, &dt, opt.recursive, tmpiri,
+                                 true);
+        }
       xfree (proxy);
 
       if (parsed_url)
           url_free (parsed_url);
 
-      if (filename && opt.delete_after && file_exists_p (filename))
-        {
-          DEBUGP (("\
-Removing file due to --delete-after in retrieve_from_file():\n"));
-          logprintf (LOG_VERBOSE, _("Removing %s.\n"), filename);
-          if (unlink (filename))
-            logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
-          dt &= ~RETROKF;
-        }
+      delete_after_retrieval (filename);
 
       xfree (new_file);
       xfree (filename);
       iri_free (tmpiri);
     }
+  http_pipeline_clear ();
+
+  if (parallel)
+    {
+      while (workers_pending_p ())
+        {
+          uerr_t res = retrieve_from_file_collect ();
+          if (status != QUOTEXC)
+            status = res;
+        }
+      workers_stop ();
+    }
 
   /* Free the linked list of URL-s.  */
   free_urlpos (url_list);
@@ -1155,7 +1722,7 @@ sleep_between_retrievals (int count)
       else
         xsleep (opt.waitretry);
     }
-  else if (opt.wait)
+  else if (opt.wait && (!wait_per_host || count > 1))
     {
       if (!opt.random_wait || count > 1)
         /* If random-wait is not specified, or if we are sleeping
@@ -1334,3 +1901,77 @@ input_file_url (const char *input_file)
   else
     return false;
 }
+
+#ifdef TESTING
+
+const char *
+test_chunk_decode (void)
+{
+  unsigned i;
+  static const struct {
+    const char *input;
+    const char *expected_data;
+    int expected_consumed;      /* -1 for malformed input */
+  } test_array[] = {
+    { "5\r\nhello\r\n0\r\n\r\n", "hello", 15 },
+    { "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\nHTTP/1.1",
+      "hello world", 26 },
+    { "A;name=value\r\n0123456789\r\n0\r\n\r\n", "0123456789", 31 },
+    { "3\nabc\n0\nExpires: never\nX: y\n\nrest", "abc", 29 },
+    { " 1\r\nx\r\n000\r\nTrailer: t\r\n\r\n", "x", 26 },
+    { "\r\n", "", -1 },
+    { "zz\r\n", "", -1 },
+    { "fffffffffffffffff\r\n", "", -1 },
+  };
+
+  for (i = 0; i < countof (test_array); ++i)
+    {
+      const char *input = test_array[i].input;
+      int size = strlen (input);
+      int consumed = 0, datasize = 0, pos;
+      char data[64], *buf = xstrdup (input);
+      struct chunk_decoder dec;
+
+      /* Feed the input both at once and byte by byte, as it may be
+         split across reads anywhere.  */
+      xzero (dec);
+      consumed = dechunk_data (&dec, buf, size, &datasize, NULL);
+      if (consumed >= 0)
+        {
+          mu_assert ("test_chunk_decode: wrong data",
+                     datasize == strlen (test_array[i].expected_data)
+                     && !memcmp (buf, test_array[i].expected_data,
+                                 datasize));
+          mu_assert ("test_chunk_decode: body not finished",
+                     dec.state == CHUNK_DONE);
+        }
+      mu_assert ("test_chunk_decode: wrong size consumed",
+                 consumed == test_array[i].expected_consumed);
+
+      xzero (dec);
+      datasize = 0;
+      for (pos = 0, consumed = 0; pos < size && consumed >= 0; pos++)
+        {
+          int count;
+          strcpy (buf, input);
+          consumed = dechunk_data (&dec, buf + pos, 1, &count, NULL);
+          if (count)
+            data[datasize++] = buf[pos];
+          if (dec.state == CHUNK_DONE)
+            break;
+        }
+      if (consumed >= 0)
+        mu_assert ("test_chunk_decode: wrong data when split",
+                   datasize == strlen (test_array[i].expected_data)
+                   && !memcmp (data, test_array[i].expected_data, datasize)
+                   && pos + 1 == test_array[i].expected_consumed);
+      else
+        mu_assert ("test_chunk_decode: malformed input accepted when split",
+                   test_array[i].expected_consumed == -1);
+      xfree (buf);
+    }
+
+  return NULL;
+}
+
+#endif /* TESTING */
@@ -42,6 +42,7 @@ extern SUM_SIZE_INT total_downloaded_bytes;
 extern double total_download_time;
 extern FILE *output_stream;
 extern bool output_stream_regular;
+extern bool wait_per_host;
 
 /* Flags for fd_read_body. */
 enum {
@@ -49,7 +50,8 @@ enum {
   rb_skip_startpos = 2,
 
   /* Used by HTTP/HTTPS*/
-  rb_chunked_transfer_encoding = 4
+  rb_chunked_transfer_encoding = 4,
+  rb_compressed = 8
 };
 
 int fd_read_body (const char *, int, FILE *, wgint, wgint, wgint *, wgint *, double *, int, FILE *);
@@ -62,6 +64,7 @@ char *fd_read_line (int);
 uerr_t retrieve_url (struct url *, const char *, char **, char **,
                      const char *, int *, bool, struct iri *, bool);
 uerr_t retrieve_from_file (const char *, bool, int *);
+void register_retrieval (const char *, const char *, const char *, int, bool);
 
 const char *retr_rate (wgint, double);
 double calc_rate (wgint, double, int *);
@@ -0,0 +1,506 @@
+/* Segmented retrieval of large files.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+OpenSSL or SSLeay licenses, the Free Software Foundation grants you
+additional permission to convey the resulting work.  Corresponding
+Source for a non-source form of such a combination shall include the
+source code for the parts of OpenSSL used as well as that of the
+covered work.  */
+
+/* With --segments=N, a file whose length is known and whose server
+   accepts byte ranges is retrieved over N connections at once.  The
+   file is created at its full length and cut into chunks, many more
+   than N, which the worker processes of workers.c fetch with
+   http_retrieve_range and write in place.  Handing out small chunks
+   as workers become free keeps fast connections busy while a slow one
+   works on a single chunk; once no chunk is left, a chunk that takes
+   much longer than the others is fetched again by an idle worker, and
+   whichever copy finishes first wins.  Both copies write the same
+   bytes, so the loser does no harm.
+
+   The chunks already retrieved are recorded in a control file next to
+   the file, FILE.wget-segments, which looks like this:
+
+       # Wget segmented download control file.
+       length 104857600 chunk 1048576
+       done 0
+       done 3
+       ...
+
+   An interrupted download whose control file is found is resumed
+   exactly where it stopped, and the control file is removed once the
+   whole file is there.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "segment.h"
+#include "utils.h"
+#include "retr.h"
+#include "http.h"
+#include "progress.h"
+#include "ptimer.h"
+#include "workers.h"
+
+/* The suffix of the control file.  */
+#define CONTROL_SUFFIX ".wget-segments"
+
+/* The first line of the control file.  */
+#define CONTROL_HEADER "# Wget segmented download control file.\n"
+
+/* How many chunks per segment a file is cut into, if it is large
+   enough for chunks of SEGMENT_MIN_SIZE.  */
+#define CHUNKS_PER_SEGMENT 16
+
+/* A chunk taking more than this many times the average chunk time is
+   considered stalled and is fetched again by an idle worker.  */
+#define STALL_FACTOR 2
+
+enum chunk_state {
+  CHUNK_TODO,                   /* not retrieved yet */
+  CHUNK_ACTIVE,                 /* being retrieved */
+  CHUNK_DONE                    /* retrieved and written */
+};
+
+struct chunk {
+  wgint start, end;             /* the bytes of the chunk, inclusive */
+  enum chunk_state state;
+  int copies;                   /* number of retrievals in progress */
+  int tries;                    /* number of failed retrievals */
+  double started;               /* when the oldest retrieval started */
+};
+
+struct segmented {
+  const char *url, *proxy, *file;
+  struct chunk *chunks;
+  int count;                    /* number of chunks */
+  int done;                     /* number of chunks done */
+  int active;                   /* number of retrievals in progress */
+  wgint chunk_size;
+  double chunk_time;            /* total time of the chunks done */
+  int timed;                    /* number of chunks in CHUNK_TIME */
+  struct ptimer *timer;
+  FILE *control;
+  void *progress;
+};
+
+static char *
+control_file_name (const char *file)
+{
+  return concat_strings (file, CONTROL_SUFFIX, (char *) 0);
+}
+
+/* Return true if FILE is the partial result of a segmented download
+   that can be resumed.  */
+
+bool
+segments_pending_p (const char *file)
+{
+  char *control;
+  bool res;
+
+  if (!file)
+    return false;
+  control = control_file_name (file);
+  res = file_exists_p (control) && file_exists_p (file);
+  xfree (control);
+  return res;
+}
+
+/* Read the control file CONTROL of a download of TOTAL bytes into SEG.
+   Return false if it doesn't exist or doesn't describe such a
+   download, in which case the download starts afresh.  */
+
+static bool
+read_control_file (const char *control, wgint total, struct segmented *seg)
+{
+  FILE *fp = fopen (control, "r");
+  char *line = NULL, *end;
+  size_t bufsize = 0;
+  wgint chunk_size;
+
+  if (!fp)
+    return false;
+  if (getline (&line, &bufsize, fp) <= 0
+      || 0 != strcmp (line, CONTROL_HEADER)
+      || getline (&line, &bufsize, fp) <= 0
+      || 0 != strncmp (line, "length ", 7)
+      || str_to_wgint (line + 7, &end, 10) != total
+      || 0 != strncmp (end, " chunk ", 7)
+      || (chunk_size = str_to_wgint (end + 7, &end, 10)) <= 0
+      || *end != '\n')
+    {
+      xfree (line);
+      fclose (fp);
+      return false;
+    }
+
+  seg->chunk_size = chunk_size;
+  seg->count = (total + chunk_size - 1) / chunk_size;
+  seg->chunks = xnew0_array (struct chunk, seg->count);
+
+  /* A line cut short by an interruption fails to parse and is
+     ignored; that chunk is simply retrieved again.  */
+  while (getline (&line, &bufsize, fp) > 0)
+    {
+      long i;
+      if (0 == strncmp (line, "done ", 5)
+          && (i = strtol (line + 5, &end, 10)) >= 0
+          && i < seg->count && *end == '\n'
+          && seg->chunks[i].state != CHUNK_DONE)
+        {
+          seg->chunks[i].state = CHUNK_DONE;
+          ++seg->done;
+        }
+    }
+  xfree (line);
+  fclose (fp);
+  return true;
+}
+
+/* Set up the download of TOTAL bytes into FILE, resuming the one
+   described by its control file if possible.  */
+
+static uerr_t
+segmented_open (struct segmented *seg, wgint total)
+{
+  char *control = control_file_name (seg->file);
+  bool resume = file_exists_p (seg->file)
+    && read_control_file (control, total, seg);
+  FILE *fp;
+  int i;
+
+  if (!resume)
+    {
+      int n = MAX (1, opt.segments);
+      seg->chunk_size = MAX (SEGMENT_MIN_SIZE,
+                             total / (n * CHUNKS_PER_SEGMENT));
+      seg->count = (total + seg->chunk_size - 1) / seg->chunk_size;
+      seg->chunks = xnew0_array (struct chunk, seg->count);
+    }
+
+  /* Make room for the whole file, so that each chunk can be written
+     where it belongs.  */
+  fp = fopen (seg->file, resume ? "r+b" : "wb");
+  if (!fp || ftruncate (fileno (fp), total) < 0)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", seg->file, strerror (errno));
+      if (fp)
+        fclose (fp);
+      xfree (control);
+      return FOPENERR;
+    }
+  fclose (fp);
+
+  seg->control = fopen (control, resume ? "a" : "w");
+  if (!seg->control)
+    {
+      logprintf (LOG_NOTQUIET, "%s: %s\n", control, strerror (errno));
+      xfree (control);
+      return FOPENERR;
+    }
+  if (!resume)
+    {
+      fputs (CONTROL_HEADER, seg->control);
+      fprintf (seg->control, "length %s", number_to_static_string (total));
+      fprintf (seg->control, " chunk %s\n",
+               number_to_static_string (seg->chunk_size));
+      fflush (seg->control);
+    }
+  xfree (control);
+
+  for (i = 0; i < seg->count; i++)
+    {
+      seg->chunks[i].start = i * seg->chunk_size;
+      seg->chunks[i].end = MIN (total, seg->chunks[i].start
+                                + seg->chunk_size) - 1;
+    }
+
+  if (resume)
+    logprintf (LOG_VERBOSE,
+               _("Resuming segmented download, %d of %d chunks retrieved.\n"),
+               seg->done, seg->count);
+  else
+    logprintf (LOG_VERBOSE, _("Retrieving in %d chunks of %s bytes.\n"),
+               seg->count, number_to_static_string (seg->chunk_size));
+  return RETROK;
+}
+
+/* Return the chunk to retrieve next, or -1 if there is none.  If
+   REBALANCE, a chunk that seems stalled is returned for another copy
+   to be retrieved once no chunk is left to start.  */
+
+static int
+next_chunk (struct segmented *seg, bool rebalance)
+{
+  int i, stalled = -1;
+  double now, limit;
+
+  for (i = 0; i < seg->count; i++)
+    if (seg->chunks[i].state == CHUNK_TODO)
+      return i;
+
+  if (!rebalance || !seg->timed)
+    return -1;
+  now = ptimer_measure (seg->timer);
+  limit = STALL_FACTOR * seg->chunk_time / seg->timed;
+  for (i = 0; i < seg->count; i++)
+    {
+      struct chunk *c = &seg->chunks[i];
+      if (c->state == CHUNK_ACTIVE && c->copies == 1
+          && now - c->started > limit
+          && (stalled < 0 || c->started < seg->chunks[stalled].started))
+        stalled = i;
+    }
+  if (stalled >= 0)
+    DEBUGP (("Chunk %d seems stalled, retrieving it again.\n", stalled));
+  return stalled;
+}
+
+/* Return how long to wait for a chunk to finish before one of those
+   being retrieved seems stalled, or -1 if no chunk can stall yet.  */
+
+static double
+stall_timeout (struct segmented *seg)
+{
+  int i;
+  double now, limit, timeout = -1;
+
+  if (!seg->timed)
+    return -1;
+  now = ptimer_measure (seg->timer);
+  limit = STALL_FACTOR * seg->chunk_time / seg->timed;
+  for (i = 0; i < seg->count; i++)
+    {
+      struct chunk *c = &seg->chunks[i];
+      if (c->state == CHUNK_ACTIVE && c->copies == 1)
+        {
+          double left = MAX (0, c->started + limit - now);
+          if (timeout < 0 || left < timeout)
+            timeout = left;
+        }
+    }
+  return timeout;
+}
+
+/* Mark chunk I as being retrieved.  */
+
+static void
+chunk_start (struct segmented *seg, int i)
+{
+  struct chunk *c = &seg->chunks[i];
+  if (!c->copies)
+    c->started = ptimer_measure (seg->timer);
+  c->state = CHUNK_ACTIVE;
+  ++c->copies;
+  ++seg->active;
+}
+
+/* Whether a chunk whose retrieval failed with STATUS is worth
+   retrying.  These are the errors http_loop retries on.  */
+
+static bool
+retryable_p (uerr_t status)
+{
+  switch (status)
+    {
+    case HERR: case HEOF: case CONSOCKERR: case CONERROR: case READERR:
+    case WRITEFAILED: case RANGEERR: case GATEWAYTIMEOUT:
+      return true;
+    default:
+      return false;
+    }
+}
+
+/* Record that a retrieval of chunk I finished with STATUS after
+   writing LEN bytes.  Return RETROK, or the error that makes the
+   whole download fail.  */
+
+static uerr_t
+chunk_finish (struct segmented *seg, int i, uerr_t status, wgint len)
+{
+  struct chunk *c = &seg->chunks[i];
+
+  --c->copies;
+  --seg->active;
+  if (c->state == CHUNK_DONE)
+    /* Another copy was faster.  */
+    return RETROK;
+
+  if (status == RETROK)
+    {
+      c->state = CHUNK_DONE;
+      ++seg->done;
+      seg->chunk_time += ptimer_measure (seg->timer) - c->started;
+      ++seg->timed;
+      fprintf (seg->control, "done %d\n", i);
+      fflush (seg->control);
+      if (seg->progress)
+        progress_update (seg->progress, len, ptimer_measure (seg->timer));
+      return RETROK;
+    }
+
+  /* If another copy is still being retrieved, let it carry on.  */
+  if (c->copies)
+    return RETROK;
+  ++c->tries;
+  if (!retryable_p (status) || (opt.ntry && c->tries >= opt.ntry))
+    {
+      logprintf (LOG_NOTQUIET, _("Giving up on bytes %s-%s.\n"),
+                 number_to_static_string (c->start),
+                 number_to_static_string (c->end));
+      return status;
+    }
+  DEBUGP (("Chunk %d failed, retrying.\n", i));
+  c->state = CHUNK_TODO;
+  return RETROK;
+}
+
+/* Retrieve the TOTAL bytes of URL through PROXY (which may be NULL)
+   into FILE in segments, with as many worker processes as asked for
+   with --segments.  Store the number of bytes the file holds when
+   done to *LEN, the number of bytes retrieved to *RD_SIZE and the
+   time it took to *DLTIME.
+
+   The server must be known to accept byte ranges.  If the retrieval
+   fails, the control file is left behind so that it can be resumed
+   later.  */
+
+uerr_t
+retrieve_segmented (const char *url, const char *proxy, const char *file,
+                    wgint total, wgint *len, wgint *rd_size, double *dltime)
+{
+  struct segmented seg;
+  uerr_t err;
+  wgint initial;
+  bool parallel;
+  int i;
+
+  *len = *rd_size = 0;
+  *dltime = 0;
+
+  xzero (seg);
+  seg.url = url;
+  seg.proxy = proxy;
+  seg.file = file;
+  err = segmented_open (&seg, total);
+  if (err != RETROK)
+    {
+      xfree (seg.chunks);
+      return err;
+    }
+
+  for (i = 0, initial = 0; i < seg.count; i++)
+    if (seg.chunks[i].state == CHUNK_DONE)
+      initial += seg.chunks[i].end - seg.chunks[i].start + 1;
+
+  /* Workers already running belong to --parallel, whose jobs must not
+     be mixed with ours.  */
+  parallel = !workers_count () && workers_start (opt.segments);
+
+  seg.timer = ptimer_new ();
+  if (opt.show_progress)
+    seg.progress = progress_create (file, initial, total);
+
+  while (seg.done < seg.count && err == RETROK)
+    {
+      /* Once the workers have all died and their chunks have been
+         failed back to us, fetch the rest sequentially.  */
+      if (parallel && (workers_running () || seg.active))
+        {
+          struct worker_result res;
+          double timeout;
+
+          /* Give each worker a single chunk at a time, so that a slow
+             connection holds up no more than the chunk it is on.  */
+          while (seg.active < workers_running ()
+                 && (i = next_chunk (&seg, true)) >= 0)
+            {
+              chunk_start (&seg, i);
+              workers_submit_range (-1, url, proxy, file,
+                                    seg.chunks[i].start, seg.chunks[i].end,
+                                    (void *) (intptr_t) i);
+            }
+          /* With a worker idle and no chunk left to start, wake up
+             when a chunk would seem stalled, to hand it to that worker
+             as well.  */
+          timeout = -1;
+          if (seg.active < workers_running ())
+            timeout = stall_timeout (&seg);
+          if (!workers_wait_timeout (&res, timeout))
+            {
+              if (timeout >= 0)
+                continue;
+              err = READERR;
+              break;
+            }
+          xfree (res.file);
+          xfree (res.newloc);
+          err = chunk_finish (&seg, (intptr_t) res.data, res.status, res.len);
+        }
+      else
+        {
+          uerr_t status;
+          wgint chunk_len;
+
+          i = next_chunk (&seg, false);
+          chunk_start (&seg, i);
+          status = http_retrieve_range (url, proxy, file, seg.chunks[i].start,
+                                        seg.chunks[i].end, &chunk_len);
+          err = chunk_finish (&seg, i, status, chunk_len);
+        }
+    }
+
+  /* This also gets rid of the workers still busy with a copy of a
+     chunk that is already done.  */
+  if (parallel)
+    workers_stop ();
+
+  *dltime = ptimer_measure (seg.timer);
+  if (seg.progress)
+    progress_finish (seg.progress, *dltime);
+  ptimer_destroy (seg.timer);
+  fclose (seg.control);
+
+  for (i = 0; i < seg.count; i++)
+    if (seg.chunks[i].state == CHUNK_DONE)
+      *len += seg.chunks[i].end - seg.chunks[i].start + 1;
+  *rd_size = *len - initial;
+  xfree (seg.chunks);
+
+  if (err != RETROK)
+    return err;
+
+  {
+    char *control = control_file_name (file);
+    if (unlink (control) < 0)
+      logprintf (LOG_NOTQUIET, "%s: %s\n", control, strerror (errno));
+    xfree (control);
+  }
+  return RETRFINISHED;
+}
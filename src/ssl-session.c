@@ -0,0 +1,388 @@
+/* TLS session cache shared by the SSL backends.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* Both SSL backends hand us their serialized session state after a
+   successful handshake and ask for it again before the next handshake
+   with the same host, which lets the server skip the expensive key
+   exchange.  The data is opaque to us; we only keep it per host and
+   optionally carry it across invocations in a file given with
+   --tls-session-file.  Sessions cached by worker processes are passed
+   to the parent with the results of their jobs, in the format of the
+   file's lines, so that the parent saves them too.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "utils.h"
+#include "hash.h"
+#include "ssl.h"
+
+/* How long a cached session is considered usable.  Servers commonly
+   expire session IDs and tickets well before this, in which case the
+   handshake simply falls back to a full one.  */
+#define SESSION_LIFETIME (24 * 60 * 60)
+
+struct ssl_session {
+  time_t expires;               /* when to stop offering the session */
+  size_t size;                  /* size of DATA */
+  unsigned char *data;          /* serialized session, backend-specific */
+  bool fresh;                   /* whether it was cached since the last
+                                   ssl_sessions_take_fresh */
+};
+
+/* Host name -> struct ssl_session.  */
+static struct hash_table *sessions;
+
+/* Whether the table has changed since it was loaded.  */
+static bool sessions_modified;
+
+static void
+session_free (struct ssl_session *session)
+{
+  xfree (session->data);
+  xfree (session);
+}
+
+/* Store SESSION for HOST, replacing the previous entry, if any.  */
+
+static void
+session_store (const char *host, struct ssl_session *session)
+{
+  char *old_key;
+  struct ssl_session *old;
+
+  if (hash_table_get_pair (sessions, host, &old_key, &old))
+    {
+      hash_table_put (sessions, old_key, session);
+      session_free (old);
+    }
+  else
+    hash_table_put (sessions, xstrdup (host), session);
+}
+
+/* Parse LINE, which holds the host name, the expiry time and the
+   base64-encoded session data, separated by blanks, and store the
+   session.  LINE is modified.  Return false if LINE is a comment,
+   malformed, or holds an expired session.  */
+
+static bool
+session_parse (char *line, time_t now)
+{
+  char *host, *expires, *encoded, *end;
+  struct ssl_session *session;
+  ssize_t size;
+  double expiry;
+
+  if (*line == '#')
+    return false;
+  host = strtok (line, " \t\r\n");
+  expires = strtok (NULL, " \t\r\n");
+  encoded = strtok (NULL, " \t\r\n");
+  if (!host || !expires || !encoded)
+    return false;
+
+  expiry = strtod (expires, &end);
+  if (*end || expiry <= now)
+    return false;
+
+  session = xnew0 (struct ssl_session);
+  session->data = xmalloc (strlen (encoded) / 4 * 3 + 3);
+  size = base64_decode (encoded, session->data);
+  if (size <= 0)
+    {
+      session_free (session);
+      return false;
+    }
+  session->size = size;
+  session->expires = expiry;
+  session_store (host, session);
+  return true;
+}
+
+/* Return the line describing the SESSION of HOST, as parsed by
+   session_parse.  */
+
+static char *
+session_line (const char *host, const struct ssl_session *session)
+{
+  char *encoded, *line;
+
+  encoded = xmalloc (BASE64_LENGTH (session->size) + 1);
+  base64_encode (session->data, session->size, encoded);
+  line = aprintf ("%s %.0f %s\n", host, (double) session->expires, encoded);
+  xfree (encoded);
+  return line;
+}
+
+/* Read the sessions saved by a previous run from FILE.  */
+
+static void
+sessions_load (const char *file)
+{
+  char *line = NULL;
+  size_t bufsize = 0;
+  time_t now = time (NULL);
+  int count = 0;
+
+  FILE *fp = fopen (file, "r");
+  if (!fp)
+    {
+      /* A missing file is not an error: it will be created on exit.  */
+      if (errno != ENOENT)
+        logprintf (LOG_NOTQUIET, _("Cannot open TLS session file %s: %s\n"),
+                   quote (file), strerror (errno));
+      return;
+    }
+
+  while (getline (&line, &bufsize, fp) > 0)
+    if (session_parse (line, now))
+      ++count;
+
+  DEBUGP (("Loaded %d TLS session%s from %s.\n", count,
+           count == 1 ? "" : "s", file));
+  xfree (line);
+  fclose (fp);
+}
+
+static void
+sessions_init (void)
+{
+  if (sessions)
+    return;
+  sessions = make_nocase_string_hash_table (0);
+  if (opt.tls_session_file)
+    sessions_load (opt.tls_session_file);
+}
+
+/* Return the session data cached for HOST and store its size to
+   *SIZE, or return NULL if there is no usable session.  The data
+   remains owned by the cache.  */
+
+const void *
+ssl_session_get (const char *host, size_t *size)
+{
+  struct ssl_session *session;
+
+  sessions_init ();
+  session = hash_table_get (sessions, host);
+  if (!session)
+    return NULL;
+  if (session->expires <= time (NULL))
+    {
+      ssl_session_remove (host);
+      return NULL;
+    }
+  *size = session->size;
+  return session->data;
+}
+
+/* Remember the SIZE bytes of session data in DATA for resuming later
+   connections to HOST.  */
+
+void
+ssl_session_put (const char *host, const void *data, size_t size)
+{
+  struct ssl_session *session;
+
+  if (!size)
+    return;
+  sessions_init ();
+
+  /* Servers usually re-issue the same session on resumption; don't
+     bother rewriting the file for that.  */
+  session = hash_table_get (sessions, host);
+  if (session && session->size == size && !memcmp (session->data, data, size))
+    return;
+
+  session = xnew0 (struct ssl_session);
+  session->data = xmalloc (size);
+  memcpy (session->data, data, size);
+  session->size = size;
+  session->expires = time (NULL) + SESSION_LIFETIME;
+  session->fresh = true;
+  session_store (host, session);
+  sessions_modified = true;
+  DEBUGP (("Cached TLS session for %s.\n", host));
+}
+
+/* Forget the session cached for HOST, e.g. because the server's
+   certificate failed verification.  */
+
+void
+ssl_session_remove (const char *host)
+{
+  char *key;
+  struct ssl_session *session;
+
+  if (!sessions || !hash_table_get_pair (sessions, host, &key, &session))
+    return;
+  hash_table_remove (sessions, host);
+  xfree (key);
+  session_free (session);
+  sessions_modified = true;
+}
+
+/* Return the lines describing the sessions cached since the last
+   call, or NULL if there are none.  Workers pass these to the parent,
+   which stores them with ssl_sessions_merge.  */
+
+char *
+ssl_sessions_take_fresh (void)
+{
+  hash_table_iterator iter;
+  char *lines = NULL;
+
+  if (!sessions)
+    return NULL;
+  for (hash_table_iterate (sessions, &iter); hash_table_iter_next (&iter); )
+    {
+      struct ssl_session *session = iter.value;
+      char *line, *joined;
+
+      if (!session->fresh)
+        continue;
+      session->fresh = false;
+      line = session_line (iter.key, session);
+      joined = concat_strings (lines ? lines : "", line, (char *) 0);
+      xfree (line);
+      xfree (lines);
+      lines = joined;
+    }
+  return lines;
+}
+
+/* Store the sessions described by LINES, as returned by
+   ssl_sessions_take_fresh in a worker.  */
+
+void
+ssl_sessions_merge (const char *lines)
+{
+  char *copy = xstrdup (lines), *line, *next;
+  time_t now = time (NULL);
+
+  sessions_init ();
+  for (line = copy; *line; line = next)
+    {
+      next = strchr (line, '\n');
+      if (next)
+        *next++ = '\0';
+      else
+        next = line + strlen (line);
+      if (session_parse (line, now))
+        sessions_modified = true;
+    }
+  xfree (copy);
+}
+
+/* Write the cached sessions to the file specified with
+   --tls-session-file.  Session data is as good as a key to the
+   connection, so the file is created readable only by the user.  It
+   is written under a temporary name and renamed, so that other runs
+   never read it half-written.  */
+
+void
+ssl_sessions_save (void)
+{
+  const char *file = opt.tls_session_file;
+  hash_table_iterator iter;
+  time_t now = time (NULL);
+  char *tmp;
+  FILE *fp;
+  int fd;
+
+  if (!file || !sessions || !sessions_modified)
+    return;
+
+  DEBUGP (("Saving TLS sessions to %s.\n", file));
+
+  tmp = concat_strings (file, ".tmp", (char *) 0);
+  fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0 || !(fp = fdopen (fd, "w")))
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot open TLS session file %s: %s\n"),
+                 quote (tmp), strerror (errno));
+      if (fd >= 0)
+        close (fd);
+      xfree (tmp);
+      return;
+    }
+
+  fputs ("# TLS session file.\n", fp);
+  fprintf (fp, "# Generated by Wget on %s.\n", datetime_str (now));
+  fputs ("# Keep this file private, it allows resuming your sessions.\n\n",
+         fp);
+
+  for (hash_table_iterate (sessions, &iter); hash_table_iter_next (&iter); )
+    {
+      struct ssl_session *session = iter.value;
+      char *line;
+
+      if (session->expires <= now)
+        continue;
+      line = session_line (iter.key, session);
+      fputs (line, fp);
+      xfree (line);
+    }
+
+  if (fclose (fp) < 0 || rename (tmp, file) < 0)
+    {
+      logprintf (LOG_NOTQUIET, _("Error writing to %s: %s\n"),
+                 quote (file), strerror (errno));
+      unlink (tmp);
+    }
+  xfree (tmp);
+  sessions_modified = false;
+}
+
+/* Free the memory held by the session cache.  */
+
+void
+ssl_sessions_cleanup (void)
+{
+  hash_table_iterator iter;
+
+  if (!sessions)
+    return;
+  for (hash_table_iterate (sessions, &iter); hash_table_iter_next (&iter); )
+    {
+      xfree (iter.key);
+      session_free (iter.value);
+    }
+  hash_table_destroy (sessions);
+  sessions = NULL;
+}
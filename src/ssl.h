@@ -35,5 +35,16 @@ as that of the covered work.  */
 bool ssl_init (void);
 bool ssl_connect_wget (int, const char *);
 bool ssl_check_certificate (int, const char *);
+bool ssl_alpn_http2 (int);
+bool ssl_pending_p (void *);
+
+/* Defined in ssl-session.c. */
+const void *ssl_session_get (const char *, size_t *);
+void ssl_session_put (const char *, const void *, size_t);
+void ssl_session_remove (const char *);
+char *ssl_sessions_take_fresh (void);
+void ssl_sessions_merge (const char *);
+void ssl_sessions_save (void);
+void ssl_sessions_cleanup (void);
 
 #endif /* GEN_SSLFUNC_H */
@@ -42,6 +42,7 @@ as that of the covered work.  */
 #endif
 
 const char *test_parse_content_disposition(void);
+const char *test_resp_header_locate(void);
 const char *test_subdir_p(void);
 const char *test_dir_matches_p(void);
 const char *test_commands_sorted(void);
@@ -50,6 +51,8 @@ const char *test_path_simplify (void);
 const char *test_append_uri_pathel(void);
 const char *test_are_urls_equal(void);
 const char *test_is_robots_txt_url(void);
+const char *test_res_crawl_delay(void);
+const char *test_chunk_decode(void);
 
 const char *program_argstring = "TEST";
 
@@ -59,6 +62,7 @@ static const char *
 all_tests(void)
 {
   mu_run_test (test_parse_content_disposition);
+  mu_run_test (test_resp_header_locate);
   mu_run_test (test_subdir_p);
   mu_run_test (test_dir_matches_p);
   mu_run_test (test_commands_sorted);
@@ -67,6 +71,9 @@ all_tests(void)
   mu_run_test (test_append_uri_pathel);
   mu_run_test (test_are_urls_equal);
   mu_run_test (test_is_robots_txt_url);
+  mu_run_test (test_res_crawl_delay);
+  mu_run_test (test_chunk_decode);
+  mu_run_test (test_url_set);
 
   return NULL;
 }
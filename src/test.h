@@ -46,14 +46,18 @@ do { \
 extern int tests_run;
 
 const char *test_parse_content_disposition(void);
+const char *test_resp_header_locate(void);
 const char *test_commands_sorted(void);
 const char *test_cmd_spec_restrict_file_names(void);
 const char *test_is_robots_txt_url(void);
+const char *test_res_crawl_delay(void);
+const char *test_chunk_decode(void);
 const char *test_path_simplify (void);
 const char *test_append_uri_pathel(void);
 const char *test_are_urls_equal(void);
 const char *test_subdir_p(void);
 const char *test_dir_matches_p(void);
+const char *test_url_set(void);
 
 #endif /* TEST_H */
 
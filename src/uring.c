@@ -0,0 +1,413 @@
+/* Socket transport based on Linux io_uring.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* With --io-uring, reads and writes on plain sockets are submitted to
+   an io_uring instead of being issued as system calls of their own.
+
+   The point is to fold the wait into the transfer.  Normally each
+   fd_read and fd_write first waits for the socket with select, so
+   that the read timeout can be enforced, and then reads or writes it,
+   which costs two system calls.  Here the poller merely notes the
+   timeout, and the receive or send that follows is submitted together
+   with a linked timeout, so that submitting, waiting and transferring
+   take a single io_uring_enter.
+
+   Wget has a single operation in flight at any time, so one small
+   ring per process is enough.  It is created on first use, and again
+   in workers of --parallel, which must not share their parent's.  If
+   the kernel doesn't support io_uring, or the operations we need, or
+   if it is disabled, sockets are used directly.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+# include <stdint.h>
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+#endif
+
+#include "utils.h"
+#include "connect.h"
+#include "uring.h"
+
+#if defined HAVE_LINUX_IO_URING_H && defined __NR_io_uring_setup
+
+/* An operation and its linked timeout.  */
+#define RING_ENTRIES 4
+
+/* The user_data of the operation's completion, as opposed to the
+   timeout's.  */
+#define OPERATION_TAG 1
+
+struct ring {
+  int fd;                       /* the ring, or -1 */
+  pid_t pid;                    /* the process that set it up */
+
+  /* The rings shared with the kernel, and the parts of them that we
+     use.  */
+  void *sq_map, *cq_map;
+  size_t sq_map_size, cq_map_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+static struct ring ring = { -1 };
+
+/* Set when the ring couldn't be set up, so that we don't retry.  */
+static bool ring_unavailable;
+
+/* The context of a socket read and written through the ring.  */
+struct uring_context {
+  double timeout;               /* noted by uring_poll for the following
+                                   read or write, or 0 */
+};
+
+/* The contexts, indexed by socket.  A transport registered on the
+   socket later, such as SSL, replaces ours without closing it, so
+   rather than being freed, the context of a socket is reused for the
+   next socket with the same descriptor.  */
+static struct uring_context **contexts;
+static int contexts_size;
+
+static void
+ring_close (void)
+{
+  if (ring.sqes)
+    munmap (ring.sqes, ring.sqes_size);
+  if (ring.cq_map && ring.cq_map != ring.sq_map)
+    munmap (ring.cq_map, ring.cq_map_size);
+  if (ring.sq_map)
+    munmap (ring.sq_map, ring.sq_map_size);
+  if (ring.fd >= 0)
+    close (ring.fd);
+  xzero (ring);
+  ring.fd = -1;
+}
+
+/* Return true if the kernel supports the operations we need.  */
+
+static bool
+ring_probe (void)
+{
+  static const int needed[] = {
+    IORING_OP_RECV, IORING_OP_SEND, IORING_OP_LINK_TIMEOUT
+  };
+  size_t size = sizeof (struct io_uring_probe)
+    + IORING_OP_LAST * sizeof (struct io_uring_probe_op);
+  struct io_uring_probe *probe = xmalloc (size);
+  bool ok = true;
+  size_t i;
+
+  memset (probe, 0, size);
+  if (syscall (__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE,
+               probe, IORING_OP_LAST) < 0)
+    ok = false;
+  for (i = 0; ok && i < countof (needed); i++)
+    if (needed[i] > probe->last_op
+        || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+      ok = false;
+  xfree (probe);
+  return ok;
+}
+
+/* Set up the ring of this process, if that hasn't been done yet.
+   Returns false if io_uring can't be used.  */
+
+static bool
+ring_open (void)
+{
+  struct io_uring_params p;
+  char *sq, *cq;
+
+  if (ring.fd >= 0)
+    {
+      if (ring.pid == getpid ())
+        return true;
+      /* Inherited from the parent process.  */
+      ring_close ();
+    }
+  if (ring_unavailable)
+    return false;
+
+  xzero (p);
+  ring.fd = syscall (__NR_io_uring_setup, RING_ENTRIES, &p);
+  if (ring.fd < 0)
+    goto fail;
+  ring.pid = getpid ();
+
+  ring.sq_map_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+  ring.cq_map_size = p.cq_off.cqes
+    + p.cq_entries * sizeof (struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ring.sq_map_size = ring.cq_map_size
+      = MAX (ring.sq_map_size, ring.cq_map_size);
+
+  ring.sq_map = mmap (NULL, ring.sq_map_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+  if (ring.sq_map == MAP_FAILED)
+    {
+      ring.sq_map = NULL;
+      goto fail;
+    }
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ring.cq_map = ring.sq_map;
+  else
+    {
+      ring.cq_map = mmap (NULL, ring.cq_map_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring.fd,
+                          IORING_OFF_CQ_RING);
+      if (ring.cq_map == MAP_FAILED)
+        {
+          ring.cq_map = NULL;
+          goto fail;
+        }
+    }
+  ring.sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+  ring.sqes = mmap (NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+  if (ring.sqes == MAP_FAILED)
+    {
+      ring.sqes = NULL;
+      goto fail;
+    }
+
+  sq = ring.sq_map;
+  ring.sq_head = (unsigned *) (sq + p.sq_off.head);
+  ring.sq_tail = (unsigned *) (sq + p.sq_off.tail);
+  ring.sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+  ring.sq_array = (unsigned *) (sq + p.sq_off.array);
+  cq = ring.cq_map;
+  ring.cq_head = (unsigned *) (cq + p.cq_off.head);
+  ring.cq_tail = (unsigned *) (cq + p.cq_off.tail);
+  ring.cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+  if (!ring_probe ())
+    {
+      errno = EOPNOTSUPP;
+      goto fail;
+    }
+  DEBUGP (("Set up io_uring %d.\n", ring.fd));
+  return true;
+
+ fail:
+  logprintf (LOG_VERBOSE,
+             _("Cannot use io_uring: %s; using sockets directly.\n"),
+             strerror (errno));
+  ring_close ();
+  ring_unavailable = true;
+  return false;
+}
+
+/* Queue a submission and return it, cleared.  It is submitted by the
+   next ring_enter.  */
+
+static struct io_uring_sqe *
+ring_queue (void)
+{
+  unsigned tail = *ring.sq_tail;
+  unsigned index = tail & *ring.sq_mask;
+  struct io_uring_sqe *sqe = &ring.sqes[index];
+
+  xzero (*sqe);
+  ring.sq_array[index] = index;
+  /* The kernel must see the entry before the new tail.  */
+  __atomic_store_n (ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+  return sqe;
+}
+
+/* Perform OPCODE, IORING_OP_RECV or IORING_OP_SEND, on the socket FD
+   with the SIZE bytes at BUF.  If TIMEOUT is non-zero, the operation
+   is canceled after that many seconds.  Returns what recv or send
+   would, with errno set to ETIMEDOUT on timeout.  */
+
+static int
+ring_transfer (int opcode, int fd, char *buf, int size, double timeout)
+{
+  struct __kernel_timespec ts;
+  struct io_uring_sqe *sqe;
+  int expected, completed = 0, res = 0;
+
+  sqe = ring_queue ();
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t) buf;
+  sqe->len = size;
+  if (opcode == IORING_OP_SEND)
+    sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = OPERATION_TAG;
+  expected = 1;
+
+  if (timeout)
+    {
+      sqe->flags |= IOSQE_IO_LINK;
+      ts.tv_sec = (long long) timeout;
+      ts.tv_nsec = (timeout - ts.tv_sec) * 1e9;
+      sqe = ring_queue ();
+      sqe->opcode = IORING_OP_LINK_TIMEOUT;
+      sqe->addr = (uintptr_t) &ts;
+      sqe->len = 1;
+      /* The timeout completes as well, successfully or canceled.  */
+      expected = 2;
+    }
+
+  while (completed < expected)
+    {
+      unsigned head, to_submit;
+
+      to_submit = *ring.sq_tail
+        - __atomic_load_n (ring.sq_head, __ATOMIC_ACQUIRE);
+      if (syscall (__NR_io_uring_enter, ring.fd, to_submit, 1,
+                   IORING_ENTER_GETEVENTS, NULL, 0) < 0
+          && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        return -1;
+
+      head = *ring.cq_head;
+      while (head != __atomic_load_n (ring.cq_tail, __ATOMIC_ACQUIRE))
+        {
+          struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+          if (cqe->user_data == OPERATION_TAG)
+            res = cqe->res;
+          ++completed;
+          ++head;
+        }
+      __atomic_store_n (ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+  if (res < 0)
+    {
+      /* The operation is canceled when its timeout expires.  */
+      errno = (res == -ECANCELED && timeout) ? ETIMEDOUT : -res;
+      return -1;
+    }
+  return res;
+}
+
+/* The transport.  The data is passed on as it is; only the way the
+   socket is read and written differs.  */
+
+static int
+uring_read (int fd, char *buf, int bufsize, void *arg)
+{
+  struct uring_context *ctx = arg;
+  double timeout = ctx->timeout;
+  int res;
+
+  ctx->timeout = 0;
+  do
+    res = ring_transfer (IORING_OP_RECV, fd, buf, bufsize, timeout);
+  while (res == -1 && errno == EINTR);
+  return res;
+}
+
+static int
+uring_write (int fd, char *buf, int bufsize, void *arg)
+{
+  struct uring_context *ctx = arg;
+  double timeout = ctx->timeout;
+  int res;
+
+  ctx->timeout = 0;
+  do
+    res = ring_transfer (IORING_OP_SEND, fd, buf, bufsize, timeout);
+  while (res == -1 && errno == EINTR);
+  return res;
+}
+
+/* Rather than waiting for FD, note TIMEOUT for the read or write that
+   follows.  Checks that mustn't wait are done right away.  */
+
+static int
+uring_poll (int fd, double timeout, int wait_for, void *arg)
+{
+  struct uring_context *ctx = arg;
+
+  if (timeout <= 0)
+    return select_fd (fd, timeout, wait_for);
+  ctx->timeout = timeout;
+  return 1;
+}
+
+static void
+uring_close (int fd, void *ctx _GL_UNUSED)
+{
+  close (fd);
+  DEBUGP (("Closed fd %d\n", fd));
+}
+
+static struct transport_implementation uring_transport = {
+  uring_read, uring_write, uring_poll, NULL, uring_close
+};
+
+/* Read and write the socket FD through the ring, if --io-uring was
+   given and the ring can be used.  Transports layered on FD later,
+   such as SSL, replace this one.  */
+
+void
+uring_register (int fd)
+{
+  if (!opt.io_uring || !ring_open ())
+    return;
+  if (fd >= contexts_size)
+    {
+      int size = contexts_size;
+      contexts_size = MAX (fd + 1, 2 * contexts_size);
+      contexts = xrealloc (contexts, contexts_size * sizeof *contexts);
+      memset (contexts + size, 0, (contexts_size - size) * sizeof *contexts);
+    }
+  if (!contexts[fd])
+    contexts[fd] = xnew (struct uring_context);
+  contexts[fd]->timeout = 0;
+  fd_register_transport (fd, &uring_transport, contexts[fd]);
+}
+
+#else  /* not HAVE_LINUX_IO_URING_H */
+
+/* Without io_uring, sockets are always used directly.  */
+
+void
+uring_register (int fd _GL_UNUSED)
+{
+}
+
+#endif /* not HAVE_LINUX_IO_URING_H */
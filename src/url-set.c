@@ -0,0 +1,190 @@
+/* Sets of URLs kept as fingerprints.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* The URLs Wget has queued during recursive retrieval are remembered
+   so that none is queued twice.  Keeping a copy of each one costs
+   well over a hundred bytes per URL with the hash table entry and the
+   malloc overhead, which adds up in a crawl of millions of URLs.
+
+   A url_set keeps only a 128-bit fingerprint of each URL, its MD5
+   digest, in an open-addressed table with linear probing.  That is 16
+   bytes per slot, and the table is kept at most three quarters full.
+   Two different URLs would have to have the same digest to be
+   confused, which even among billions of URLs is far less likely than
+   a memory error.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "utils.h"
+#include "url-set.h"
+#include "md5.h"
+
+#ifdef TESTING
+#include "test.h"
+#endif
+
+/* A fingerprint of all zeros marks an empty slot.  */
+
+struct url_fingerprint {
+  uint64_t hi, lo;
+};
+
+struct url_set {
+  struct url_fingerprint *slots;
+  unsigned long size;           /* number of slots, a power of two */
+  unsigned long count;          /* number of URLs */
+};
+
+#define URL_SET_INITIAL_SIZE 1024
+
+static void
+url_fingerprint (const char *url, struct url_fingerprint *fp)
+{
+  unsigned char digest[MD5_DIGEST_SIZE];
+
+  md5_buffer (url, strlen (url), digest);
+  memcpy (&fp->hi, digest, sizeof fp->hi);
+  memcpy (&fp->lo, digest + sizeof fp->hi, sizeof fp->lo);
+  if (!fp->hi && !fp->lo)
+    fp->lo = 1;
+}
+
+/* Return the slot holding FP, or the empty slot where it belongs.  */
+
+static struct url_fingerprint *
+url_set_slot (const struct url_set *set, const struct url_fingerprint *fp)
+{
+  unsigned long mask = set->size - 1;
+  unsigned long i = fp->hi & mask;
+
+  while (set->slots[i].hi || set->slots[i].lo)
+    {
+      if (set->slots[i].hi == fp->hi && set->slots[i].lo == fp->lo)
+        break;
+      i = (i + 1) & mask;
+    }
+  return &set->slots[i];
+}
+
+static void
+url_set_resize (struct url_set *set, unsigned long size)
+{
+  struct url_fingerprint *old = set->slots;
+  unsigned long old_size = set->size, i;
+
+  set->slots = xnew0_array (struct url_fingerprint, size);
+  set->size = size;
+  for (i = 0; i < old_size; i++)
+    if (old[i].hi || old[i].lo)
+      *url_set_slot (set, &old[i]) = old[i];
+  xfree (old);
+}
+
+/* Create an empty set of URLs.  */
+
+struct url_set *
+url_set_new (void)
+{
+  struct url_set *set = xnew0 (struct url_set);
+  url_set_resize (set, URL_SET_INITIAL_SIZE);
+  return set;
+}
+
+/* Add URL to SET.  Returns true if it wasn't in the set yet.  */
+
+bool
+url_set_add (struct url_set *set, const char *url)
+{
+  struct url_fingerprint fp, *slot;
+
+  url_fingerprint (url, &fp);
+  slot = url_set_slot (set, &fp);
+  if (slot->hi || slot->lo)
+    return false;
+
+  *slot = fp;
+  if (++set->count > set->size / 4 * 3)
+    url_set_resize (set, set->size * 2);
+  return true;
+}
+
+/* Whether URL has been added to SET.  */
+
+bool
+url_set_contains (const struct url_set *set, const char *url)
+{
+  struct url_fingerprint fp, *slot;
+
+  url_fingerprint (url, &fp);
+  slot = url_set_slot (set, &fp);
+  return slot->hi || slot->lo;
+}
+
+void
+url_set_free (struct url_set *set)
+{
+  xfree (set->slots);
+  xfree (set);
+}
+
+#ifdef TESTING
+
+const char *
+test_url_set (void)
+{
+  struct url_set *set = url_set_new ();
+  char url[64];
+  int i;
+
+  for (i = 0; i < 10000; i++)
+    {
+      snprintf (url, sizeof url, "http://www.example.com/page%d.html", i);
+      mu_assert ("test_url_set: new URL not added", url_set_add (set, url));
+      mu_assert ("test_url_set: URL added twice", !url_set_add (set, url));
+    }
+  for (i = 0; i < 20000; i++)
+    {
+      snprintf (url, sizeof url, "http://www.example.com/page%d.html", i);
+      mu_assert ("test_url_set: wrong result",
+                 url_set_contains (set, url) == (i < 10000));
+    }
+  mu_assert ("test_url_set: similar URL found",
+             !url_set_contains (set, "http://www.example.com/page1.htm"));
+
+  url_set_free (set);
+  return NULL;
+}
+
+#endif /* TESTING */
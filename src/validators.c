@@ -0,0 +1,366 @@
+/* Validators of downloaded files, for time-stamping.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+
+/* To find out whether a file it has downloaded before has changed on
+   the server, -N used to send a HEAD request and compare the
+   Last-Modified and Content-Length of the response with the local
+   file, and then a GET if it had.  With --validator-file, the ETag
+   and Last-Modified of each file downloaded with -N are recorded in
+   an index, and as long as the local file is still the one that was
+   downloaded, a single GET with If-None-Match and If-Modified-Since
+   tells whether it's up to date (see http_loop).
+
+   The index is a journal: every download appends a line, so that
+   concurrent Wget processes, such as --parallel workers, don't get in
+   each other's way, and the last line for a file wins.  It is
+   rewritten without the stale lines when Wget exits.  A record that
+   gets lost only costs a HEAD request the next time.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "utils.h"
+#include "hash.h"
+#include "validators.h"
+
+/* Local file name -> struct validator.  */
+static struct hash_table *validators;
+
+/* The number of lines in the index file and the descriptor used for
+   appending to it.  */
+static int index_lines;
+static int index_fd = -1;
+
+/* Set when the index can't be written to, so that we don't complain
+   for every download.  */
+static bool index_disabled;
+
+static void
+validator_free (struct validator *v)
+{
+  xfree (v->etag);
+  xfree (v->last_modified);
+  xfree (v);
+}
+
+/* Store V as the record of FILE, replacing the previous one, if any.
+   If V is NULL, the record is removed.  */
+
+static void
+validator_store (const char *file, struct validator *v)
+{
+  char *old_key;
+  struct validator *old;
+
+  if (hash_table_get_pair (validators, file, &old_key, &old))
+    {
+      validator_free (old);
+      if (v)
+        {
+          hash_table_put (validators, old_key, v);
+          return;
+        }
+      hash_table_remove (validators, file);
+      xfree (old_key);
+    }
+  else if (v)
+    hash_table_put (validators, xstrdup (file), v);
+}
+
+/* Read the index.  Each line holds the size and modification time of
+   the local file, its type ("html", "css" or "-"), the ETag and
+   Last-Modified of the response (possibly empty) and the file name,
+   separated by tabs.  */
+
+static void
+validators_load (void)
+{
+  char *line = NULL;
+  size_t bufsize = 0;
+  ssize_t len;
+
+  FILE *fp = fopen (opt.validator_file, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        logprintf (LOG_NOTQUIET, _("Cannot open validator file %s: %s\n"),
+                   quote (opt.validator_file), strerror (errno));
+      return;
+    }
+
+  while ((len = getline (&line, &bufsize, fp)) > 0)
+    {
+      char *field[6], *p = line;
+      struct validator *v;
+      int i;
+
+      ++index_lines;
+      if (*line == '#')
+        continue;
+      if (line[len - 1] == '\n')
+        line[len - 1] = '\0';
+      for (i = 0; i < countof (field) - 1 && p; i++)
+        {
+          field[i] = p;
+          p = strchr (p, '\t');
+          if (p)
+            *p++ = '\0';
+        }
+      if (!p || !*p)
+        continue;
+      field[i] = p;
+
+      v = xnew0 (struct validator);
+      v->size = str_to_wgint (field[0], NULL, 10);
+      v->mtime = strtod (field[1], NULL);
+      if (!strcmp (field[2], "html"))
+        v->dt = TEXTHTML;
+      else if (!strcmp (field[2], "css"))
+        v->dt = TEXTCSS;
+      if (*field[3])
+        v->etag = xstrdup (field[3]);
+      if (*field[4])
+        v->last_modified = xstrdup (field[4]);
+      if (!v->etag && !v->last_modified)
+        {
+          validator_free (v);
+          v = NULL;
+        }
+      validator_store (field[5], v);
+    }
+
+  DEBUGP (("Loaded %d validator%s from %s.\n", hash_table_count (validators),
+           hash_table_count (validators) == 1 ? "" : "s",
+           opt.validator_file));
+  xfree (line);
+  fclose (fp);
+}
+
+/* Return the line of the index recording V for FILE.  */
+
+static char *
+validator_line (const char *file, const struct validator *v)
+{
+  return aprintf ("%s\t%.0f\t%s\t%s\t%s\t%s\n",
+                  number_to_static_string (v->size), (double) v->mtime,
+                  (v->dt & TEXTHTML) ? "html"
+                  : (v->dt & TEXTCSS) ? "css" : "-",
+                  v->etag ? v->etag : "",
+                  v->last_modified ? v->last_modified : "", file);
+}
+
+static void
+validators_init (void)
+{
+  if (validators)
+    return;
+  validators = make_string_hash_table (0);
+  validators_load ();
+}
+
+/* Return the validators recorded for the local file FILE, or NULL if
+   there are none, or the file has changed since.  With -K, the file
+   that was downloaded is FILE.orig, if it exists.  */
+
+const struct validator *
+validator_get (const char *file)
+{
+  struct validator *v;
+  struct_stat st;
+  bool ok;
+
+  if (!opt.validator_file)
+    return NULL;
+  validators_init ();
+  v = hash_table_get (validators, file);
+  if (!v)
+    return NULL;
+
+  if (opt.backup_converted)
+    {
+      char *orig = concat_strings (file, ORIG_SFX, (char *) 0);
+      ok = stat (orig, &st) == 0 || stat (file, &st) == 0;
+      xfree (orig);
+    }
+  else
+    ok = stat (file, &st) == 0;
+  if (!ok || st.st_size != v->size || st.st_mtime != v->mtime)
+    return NULL;
+  return v;
+}
+
+/* Record ETAG and LAST_MODIFIED, either of which may be NULL, as the
+   validators of the local file FILE, which was just downloaded.  DT
+   holds its type flags.  */
+
+void
+validator_put (const char *file, const char *etag, const char *last_modified,
+               int dt)
+{
+  struct validator *v;
+  struct_stat st;
+  char *line;
+
+  if (!opt.validator_file)
+    return;
+  validators_init ();
+  /* Tabs and newlines would break the index, and no sane file name or
+     header has them.  */
+  if (strpbrk (file, "\t\n")
+      || (etag && strpbrk (etag, "\t\n"))
+      || (last_modified && strpbrk (last_modified, "\t\n")))
+    return;
+  if (stat (file, &st) != 0)
+    return;
+
+  v = xnew0 (struct validator);
+  v->size = st.st_size;
+  v->mtime = st.st_mtime;
+  v->dt = dt & (TEXTHTML | TEXTCSS);
+  v->etag = etag ? xstrdup (etag) : NULL;
+  v->last_modified = last_modified ? xstrdup (last_modified) : NULL;
+
+  if (index_fd < 0 && !index_disabled)
+    {
+      index_fd = open (opt.validator_file, O_WRONLY | O_APPEND | O_CREAT, 0644);
+      if (index_fd < 0)
+        {
+          logprintf (LOG_NOTQUIET, _("Cannot open validator file %s: %s\n"),
+                     quote (opt.validator_file), strerror (errno));
+          index_disabled = true;
+        }
+    }
+  if (index_fd >= 0)
+    {
+      /* A single write keeps the lines of concurrent processes
+         apart.  */
+      line = validator_line (file, v);
+      if (write (index_fd, line, strlen (line)) > 0)
+        ++index_lines;
+      xfree (line);
+    }
+
+  if (!v->etag && !v->last_modified)
+    {
+      validator_free (v);
+      v = NULL;
+    }
+  validator_store (file, v);
+}
+
+static void
+validators_free (void)
+{
+  hash_table_iterator iter;
+
+  for (hash_table_iterate (validators, &iter); hash_table_iter_next (&iter); )
+    {
+      xfree (iter.key);
+      validator_free (iter.value);
+    }
+  hash_table_destroy (validators);
+  validators = NULL;
+}
+
+/* Rewrite the index without its stale lines, if they are the
+   majority.  The index is read anew, to include the lines appended
+   by other processes in the meantime.  */
+
+void
+validators_save (void)
+{
+  hash_table_iterator iter;
+  char *tmp;
+  FILE *fp;
+  int count;
+
+  if (!validators || index_fd < 0)
+    return;
+
+  close (index_fd);
+  index_fd = -1;
+  validators_free ();
+  validators = make_string_hash_table (0);
+  index_lines = 0;
+  validators_load ();
+
+  count = hash_table_count (validators);
+  if (index_lines - count <= count)
+    return;
+
+  DEBUGP (("Rewriting validator file %s.\n", opt.validator_file));
+  tmp = concat_strings (opt.validator_file, ".tmp", (char *) 0);
+  fp = fopen (tmp, "w");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot open validator file %s: %s\n"),
+                 quote (tmp), strerror (errno));
+      xfree (tmp);
+      return;
+    }
+
+  fputs ("# Validators of the files downloaded by Wget with -N.\n", fp);
+  for (hash_table_iterate (validators, &iter); hash_table_iter_next (&iter); )
+    {
+      char *line = validator_line (iter.key, iter.value);
+      fputs (line, fp);
+      xfree (line);
+    }
+
+  if (fclose (fp) < 0 || rename (tmp, opt.validator_file) < 0)
+    {
+      logprintf (LOG_NOTQUIET, _("Error writing to %s: %s\n"),
+                 quote (opt.validator_file), strerror (errno));
+      unlink (tmp);
+    }
+  xfree (tmp);
+}
+
+/* Free the memory held by the validators.  */
+
+void
+validators_cleanup (void)
+{
+  if (index_fd >= 0)
+    close (index_fd);
+  index_fd = -1;
+  if (validators)
+    validators_free ();
+}
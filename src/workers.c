@@ -0,0 +1,1002 @@
+/* Parallel retrieval by worker processes.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+OpenSSL or SSLeay licenses, the Free Software Foundation grants you
+additional permission to convey the resulting work.  Corresponding
+Source for a non-source form of such a combination shall include the
+source code for the parts of OpenSSL used as well as that of the
+covered work.  */
+
+/* Wget keeps most of its state (options, the log, cookies, the DNS
+   cache, connections) in global variables, so it cannot simply run
+   several retrievals in threads.  Instead, --parallel=N forks N
+   worker processes, each of which runs retrieve_url on the URLs it is
+   sent over a pipe and sends back what retrieve_url returned.
+
+   Everything that decides *what* gets downloaded stays in the parent:
+   the recursion queue, the blacklist, robots.txt handling, link
+   conversion bookkeeping and the exit status.  The parent replays the
+   bookkeeping retrieve_url would have done (register_retrieval,
+   download statistics) when a result arrives.  Should all the workers
+   die, the callers go on retrieving sequentially.
+
+   The same workers fetch the byte ranges of a segmented download
+   (--segments), see segment.c.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#if !defined(WINDOWS) && !defined(MSDOS)
+# include <sys/types.h>
+# include <sys/wait.h>
+# include <signal.h>
+# include <poll.h>
+# ifdef HAVE_SYS_EPOLL_H
+#  include <sys/epoll.h>
+# endif
+#endif
+
+#include "workers.h"
+#include "utils.h"
+#include "url.h"
+#include "retr.h"
+#include "host.h"
+#include "http.h"
+#include "hash.h"
+#include "progress.h"
+#include "exits.h"
+#include "iri.h"
+#ifdef HAVE_SSL
+# include "ssl.h"
+#endif
+
+#if !defined(WINDOWS) && !defined(MSDOS)
+
+/* How many jobs may be sent to a worker before its results are
+   collected.  Queueing a few jobs per worker hides the round trip
+   through the parent; the results of a worker arrive in the order
+   its jobs were sent.  */
+#define WORKER_DEPTH 4
+
+/* The kinds of jobs a worker can do.  */
+enum {
+  JOB_RETRIEVE,                 /* retrieve_url */
+  JOB_RANGE                     /* http_retrieve_range */
+};
+
+struct worker_job {
+  char *url;                    /* the URL as sent to the worker */
+  struct iri *iri;              /* the caller's IRI for the URL, or NULL
+                                   for a range job */
+  void *data;                   /* caller's data */
+};
+
+struct worker {
+  pid_t pid;                    /* the worker process, or 0 if it died */
+  int to_fd;                    /* jobs are written here */
+  int from_fd;                  /* results are read from here */
+  int pending;                  /* number of jobs sent, but not done */
+  int head;                     /* index of the oldest pending job */
+  struct worker_job jobs[WORKER_DEPTH];
+};
+
+static struct worker *workers;
+static int worker_count;
+
+/* The number of jobs pending over all workers, and the number of
+   workers that have died.  */
+static int jobs_pending;
+static int workers_lost;
+
+/* The parent waits for results on the pipes of all workers at once.
+   With epoll, the pipes are registered once, when the workers are
+   started, and a wait costs the same however many workers there are.
+   The events returned by a wait but not yet handled are kept for the
+   following calls.  Elsewhere, poll is used, with the array of
+   POLL_FDS indexed like WORKERS.  Unlike select, neither is limited
+   to descriptors below FD_SETSIZE, so --parallel can run more than a
+   few hundred workers.  */
+#ifdef HAVE_SYS_EPOLL_H
+static int epoll_fd = -1;
+static struct epoll_event ready_events[64];
+static int ready_count, ready_next;
+#endif
+static struct pollfd *poll_fds;
+
+/* Whether this process is a worker.  Workers don't start workers of
+   their own.  */
+static bool in_worker;
+
+/* Messages are a sequence of integers, doubles and strings in host
+   representation -- both ends of the pipe are the same binary.  They
+   are assembled in a growable buffer so that each message is sent
+   with a single write.  */
+
+struct message {
+  char *data;
+  int size, len;
+};
+
+static void
+msg_put (struct message *msg, const void *buf, int len)
+{
+  DO_REALLOC (msg->data, msg->size, msg->len + len, char);
+  memcpy (msg->data + msg->len, buf, len);
+  msg->len += len;
+}
+
+static void
+msg_put_int (struct message *msg, int value)
+{
+  msg_put (msg, &value, sizeof (value));
+}
+
+/* Store S, which may be NULL, in MSG.  */
+
+static void
+msg_put_str (struct message *msg, const char *s)
+{
+  msg_put_int (msg, s ? (int) strlen (s) : -1);
+  if (s)
+    msg_put (msg, s, strlen (s));
+}
+
+static bool
+msg_send (int fd, struct message *msg)
+{
+  const char *p = msg->data;
+  int left = msg->len;
+  msg->len = 0;
+  while (left > 0)
+    {
+      int res = write (fd, p, left);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res <= 0)
+        return false;
+      p += res;
+      left -= res;
+    }
+  return true;
+}
+
+/* Read exactly LEN bytes from FD into BUF.  Return false on error or
+   end of file.  */
+
+static bool
+read_exactly (int fd, void *buf, int len)
+{
+  char *p = buf;
+  while (len > 0)
+    {
+      int res = read (fd, p, len);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res <= 0)
+        return false;
+      p += res;
+      len -= res;
+    }
+  return true;
+}
+
+static bool
+read_int (int fd, int *value)
+{
+  return read_exactly (fd, value, sizeof (*value));
+}
+
+static bool
+read_wgint (int fd, wgint *value)
+{
+  return read_exactly (fd, value, sizeof (*value));
+}
+
+/* Read a string stored by msg_put_str into a freshly allocated
+   buffer, or set *S to NULL if a NULL string was stored.  */
+
+static bool
+read_str (int fd, char **s)
+{
+  int len;
+  *s = NULL;
+  if (!read_int (fd, &len))
+    return false;
+  if (len < 0)
+    return true;
+  *s = xmalloc (len + 1);
+  if (!read_exactly (fd, *s, len))
+    {
+      xfree (*s);
+      return false;
+    }
+  (*s)[len] = '\0';
+  return true;
+}
+
+/* Read a JOB_RETRIEVE job from IN, do it, and store the result in
+   MSG.  Return false if the job could not be read.  */
+
+static bool
+worker_do_retrieve (int in, struct message *msg)
+{
+  char *url, *referer, *uri_encoding, *content_encoding;
+  int utf8_encode, recursive, dt = 0, url_err;
+  char *file = NULL, *newloc = NULL;
+  struct url *url_parsed;
+  struct iri *iri;
+  uerr_t status;
+  SUM_SIZE_INT bytes = total_downloaded_bytes;
+  double dltime = total_download_time;
+  int urls = numurls;
+  wgint len = 0;
+
+  if (!read_str (in, &url))
+    return false;
+  if (!read_str (in, &referer)
+      || !read_str (in, &uri_encoding)
+      || !read_str (in, &content_encoding)
+      || !read_int (in, &utf8_encode)
+      || !read_int (in, &recursive))
+    return false;
+
+  iri = iri_new ();
+#ifdef ENABLE_IRI
+  iri->uri_encoding = uri_encoding;
+  iri->content_encoding = content_encoding;
+  iri->utf8_encode = utf8_encode;
+#else
+  xfree (uri_encoding);
+  xfree (content_encoding);
+#endif
+
+  url_parsed = url_parse (url, &url_err, iri, true);
+  if (url_parsed)
+    status = retrieve_url (url_parsed, url, &file, &newloc, referer,
+                           &dt, recursive, iri, false);
+  else
+    {
+      char *error = url_error (url, url_err);
+      logprintf (LOG_NOTQUIET, "%s: %s.\n", url, error);
+      xfree (error);
+      status = URLERROR;
+    }
+
+  msg_put_int (msg, status);
+  msg_put_int (msg, dt);
+  msg_put_str (msg, file);
+  msg_put_str (msg, newloc);
+  msg_put_str (msg, url_parsed ? url_parsed->url : url);
+  msg_put_str (msg, iri->content_encoding);
+  bytes = total_downloaded_bytes - bytes;
+  dltime = total_download_time - dltime;
+  urls = numurls - urls;
+  msg_put (msg, &bytes, sizeof (bytes));
+  msg_put (msg, &dltime, sizeof (dltime));
+  msg_put_int (msg, urls);
+  msg_put (msg, &len, sizeof (len));
+
+  if (url_parsed)
+    url_free (url_parsed);
+  iri_free (iri);
+  xfree (file);
+  xfree (newloc);
+  xfree (url);
+  xfree (referer);
+  return true;
+}
+
+/* Read a JOB_RANGE job from IN, do it, and store the result in MSG.
+   Return false if the job could not be read.  */
+
+static bool
+worker_do_range (int in, struct message *msg)
+{
+  char *url, *proxy, *file;
+  wgint start, end, len = 0;
+  SUM_SIZE_INT bytes = 0;
+  double dltime = 0;
+  uerr_t status;
+
+  if (!read_str (in, &url))
+    return false;
+  if (!read_str (in, &proxy)
+      || !read_str (in, &file)
+      || !read_wgint (in, &start)
+      || !read_wgint (in, &end))
+    return false;
+
+  status = http_retrieve_range (url, proxy, file, start, end, &len);
+
+  msg_put_int (msg, status);
+  msg_put_int (msg, 0);
+  msg_put_str (msg, NULL);
+  msg_put_str (msg, NULL);
+  msg_put_str (msg, url);
+  msg_put_str (msg, NULL);
+  msg_put (msg, &bytes, sizeof (bytes));
+  msg_put (msg, &dltime, sizeof (dltime));
+  msg_put_int (msg, 0);
+  msg_put (msg, &len, sizeof (len));
+
+  xfree (url);
+  xfree (proxy);
+  xfree (file);
+  return true;
+}
+
+/* The main loop of a worker process: read jobs from IN, do them, and
+   write the results to OUT, until the parent closes the pipe.  Each
+   result ends with the TLS sessions cached while doing the job, which
+   the parent saves with its own.  */
+
+static void
+worker_loop (int in, int out)
+{
+  struct message msg;
+  xzero (msg);
+
+  while (1)
+    {
+      int kind;
+      char *sessions = NULL;
+
+      if (!read_int (in, &kind))
+        break;
+      if (kind == JOB_RANGE)
+        {
+          if (!worker_do_range (in, &msg))
+            break;
+        }
+      else if (!worker_do_retrieve (in, &msg))
+        break;
+#ifdef HAVE_SSL
+      sessions = ssl_sessions_take_fresh ();
+#endif
+      msg_put_str (&msg, sessions);
+      xfree (sessions);
+
+      logflush ();
+      if (!msg_send (out, &msg))
+        break;
+    }
+
+  logflush ();
+  fflush (NULL);
+  _exit (0);
+}
+
+/* Set up waiting for the results of the workers, see POLL_FDS.  */
+
+static void
+workers_watch (void)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  int i;
+
+  epoll_fd = epoll_create (worker_count);
+  for (i = 0; epoll_fd >= 0 && i < worker_count; i++)
+    {
+      struct epoll_event ev;
+      xzero (ev);
+      ev.events = EPOLLIN;
+      ev.data.u32 = i;
+      if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, workers[i].from_fd, &ev) < 0)
+        {
+          close (epoll_fd);
+          epoll_fd = -1;
+        }
+    }
+  ready_count = ready_next = 0;
+  if (epoll_fd >= 0)
+    return;
+  DEBUGP (("Cannot use epoll: %s; using poll.\n", strerror (errno)));
+#endif
+  poll_fds = xnew_array (struct pollfd, worker_count);
+}
+
+/* Start N worker processes for parallel retrieval.  Return false if
+   retrievals should be done sequentially instead, either because N
+   is 1 or because the options in use don't allow parallel
+   retrieval.  */
+
+bool
+workers_start (int n)
+{
+  int i;
+
+  if (workers)
+    return true;
+  if (n <= 1 || in_worker)
+    return false;
+  /* These write to a single output stream that the workers would
+     trample over, or need a coherent view of all the responses.  */
+  if (opt.output_document || opt.warc_filename || opt.spider)
+    {
+      DEBUGP (("Parallel retrieval disabled by -O, --warc-file or --spider.\n"));
+      return false;
+    }
+
+  /* The workers must not inherit connections the parent may still
+     use, nor pending output that both would then flush.  */
+  http_close_persistent ();
+  logflush ();
+  fflush (NULL);
+
+  workers = xnew_array (struct worker, n);
+  for (i = 0; i < n; i++)
+    {
+      int to[2], from[2];
+      pid_t pid;
+
+      if (pipe (to) < 0)
+        break;
+      if (pipe (from) < 0)
+        {
+          close (to[0]);
+          close (to[1]);
+          break;
+        }
+      pid = fork ();
+      if (pid < 0)
+        {
+          logprintf (LOG_NOTQUIET, "fork: %s\n", strerror (errno));
+          close (to[0]);
+          close (to[1]);
+          close (from[0]);
+          close (from[1]);
+          break;
+        }
+      if (pid == 0)
+        {
+          int j;
+          /* The worker must not hold the pipes of its siblings open,
+             or the parent would never see them close.  */
+          for (j = 0; j < i; j++)
+            {
+              close (workers[j].to_fd);
+              close (workers[j].from_fd);
+            }
+          close (to[1]);
+          close (from[0]);
+          /* A worker does its own retrievals sequentially.  */
+          xfree (workers);
+          worker_count = 0;
+          in_worker = true;
+          /* The resolver threads of the parent's host name
+             prefetches don't exist here.  */
+          host_prefetch_forget ();
+          /* Several progress bars can't share a terminal line.  */
+          if (opt.show_progress)
+            set_progress_implementation ("dot");
+          worker_loop (to[0], from[1]);
+        }
+      close (to[0]);
+      close (from[1]);
+      xzero (workers[i]);
+      workers[i].pid = pid;
+      workers[i].to_fd = to[1];
+      workers[i].from_fd = from[0];
+      DEBUGP (("Started worker %d, pid %ld.\n", i, (long) pid));
+    }
+  worker_count = i;
+
+  if (!worker_count)
+    {
+      xfree (workers);
+      return false;
+    }
+  workers_watch ();
+  return true;
+}
+
+/* Return the number of workers started, or 0 if retrieval is
+   sequential.  */
+
+int
+workers_count (void)
+{
+  return worker_count;
+}
+
+/* Return the number of workers that are still alive.  When it drops
+   to 0, retrieval has to go on sequentially.  */
+
+int
+workers_running (void)
+{
+  return worker_count - workers_lost;
+}
+
+/* Return true if worker I cannot take another job, which a dead
+   worker never can.  If I is negative, return true if no worker can
+   take another job.  */
+
+bool
+workers_busy_p (int i)
+{
+  if (i >= 0)
+    return !workers[i].pid || workers[i].pending >= WORKER_DEPTH;
+  for (i = 0; i < worker_count; i++)
+    if (workers[i].pid && workers[i].pending < WORKER_DEPTH)
+      return false;
+  return true;
+}
+
+/* Return true if results of some jobs are yet to be collected.  */
+
+bool
+workers_pending_p (void)
+{
+  return jobs_pending > 0;
+}
+
+/* Return the worker that retrievals identified by KEY should be sent
+   to.  Retrievals sent to the same worker are done in the order they
+   were submitted, so giving the same KEY to retrievals that may end
+   up in the same file keeps the choice of file names deterministic.
+   Keys of a dead worker go to the next live one, so keys of live
+   workers never move.  Return -1 if no worker is alive.  */
+
+int
+workers_slot (const char *key)
+{
+  int i, n;
+
+  i = hash_string (key) % worker_count;
+  for (n = 0; n < worker_count; n++, i = (i + 1) % worker_count)
+    if (workers[i].pid)
+      return i;
+  return -1;
+}
+
+/* Record a job for URL to be sent to worker I, or to the least loaded
+   live worker if I is negative, and return the worker chosen.  */
+
+static int
+worker_add_job (int i, const char *url, struct iri *iri, void *data)
+{
+  struct worker *w;
+  struct worker_job *job;
+
+  if (i < 0)
+    {
+      int j;
+      for (i = -1, j = 0; j < worker_count; j++)
+        if (workers[j].pid
+            && (i < 0 || workers[j].pending < workers[i].pending))
+          i = j;
+    }
+  assert (i >= 0);
+  w = &workers[i];
+  assert (w->pid && w->pending < WORKER_DEPTH);
+
+  job = &w->jobs[(w->head + w->pending) % WORKER_DEPTH];
+  job->url = xstrdup (url);
+  job->iri = iri;
+  job->data = data;
+  ++w->pending;
+  ++jobs_pending;
+  return i;
+}
+
+/* Send the job in MSG to worker I.  */
+
+static void
+worker_send (int i, struct message *msg)
+{
+  struct worker *w = &workers[i];
+
+  /* If the worker died, this fails and the job is reported as failed
+     by workers_wait.  */
+  if (w->pid && !msg_send (w->to_fd, msg))
+    DEBUGP (("Sending job to worker %d failed: %s\n", i, strerror (errno)));
+  xfree (msg->data);
+
+  DEBUGP (("Sent job for %s to worker %d (%d pending).\n",
+           w->jobs[(w->head + w->pending - 1) % WORKER_DEPTH].url, i,
+           w->pending));
+}
+
+/* Send the retrieval of URL to worker I, or to the least loaded
+   worker if I is negative, and return the worker used.  The worker
+   must not be busy.  The other arguments are those of retrieve_url;
+   IRI will receive the content encoding found by the worker and must
+   be kept until the result is collected, along with DATA, by
+   workers_wait.  */
+
+int
+workers_submit (int i, const char *url, const char *referer,
+                struct iri *iri, bool recursive, void *data)
+{
+  struct message msg;
+
+  i = worker_add_job (i, url, iri, data);
+
+  xzero (msg);
+  msg_put_int (&msg, JOB_RETRIEVE);
+  msg_put_str (&msg, url);
+  msg_put_str (&msg, referer);
+  msg_put_str (&msg, iri->uri_encoding);
+  msg_put_str (&msg, iri->content_encoding);
+  msg_put_int (&msg, iri->utf8_encode);
+  msg_put_int (&msg, recursive);
+  worker_send (i, &msg);
+  return i;
+}
+
+/* Send the retrieval of bytes START to END of URL, to be written at
+   the same offsets of FILE, to worker I, or to the least loaded worker
+   if I is negative, and return the worker used.  PROXY is the URL of
+   the proxy to use, or NULL.  The number of bytes retrieved is
+   returned in the len field of the result, along with DATA.  */
+
+int
+workers_submit_range (int i, const char *url, const char *proxy,
+                      const char *file, wgint start, wgint end, void *data)
+{
+  struct message msg;
+
+  i = worker_add_job (i, url, NULL, data);
+
+  xzero (msg);
+  msg_put_int (&msg, JOB_RANGE);
+  msg_put_str (&msg, url);
+  msg_put_str (&msg, proxy);
+  msg_put_str (&msg, file);
+  msg_put (&msg, &start, sizeof (start));
+  msg_put (&msg, &end, sizeof (end));
+  worker_send (i, &msg);
+  return i;
+}
+
+/* Forget about the dead worker W.  */
+
+static void
+worker_lost (struct worker *w)
+{
+  logprintf (LOG_NOTQUIET, _("Worker process %ld exited unexpectedly.\n"),
+             (long) w->pid);
+#ifdef HAVE_SYS_EPOLL_H
+  if (epoll_fd >= 0)
+    epoll_ctl (epoll_fd, EPOLL_CTL_DEL, w->from_fd, NULL);
+#endif
+  close (w->to_fd);
+  close (w->from_fd);
+  waitpid (w->pid, NULL, 0);
+  w->pid = 0;
+  ++workers_lost;
+}
+
+/* Read the result of W's oldest job into RES.  */
+
+static bool
+worker_read_result (struct worker *w, struct worker_result *res)
+{
+  int status, dt, urls;
+  char *url, *content_encoding, *sessions;
+  SUM_SIZE_INT bytes;
+  double dltime;
+  wgint len;
+  struct worker_job *job = &w->jobs[w->head];
+
+  if (!read_int (w->from_fd, &status))
+    return false;
+  res->file = res->newloc = url = content_encoding = sessions = NULL;
+  if (!read_int (w->from_fd, &dt)
+      || !read_str (w->from_fd, &res->file)
+      || !read_str (w->from_fd, &res->newloc)
+      || !read_str (w->from_fd, &url)
+      || !read_str (w->from_fd, &content_encoding)
+      || !read_exactly (w->from_fd, &bytes, sizeof (bytes))
+      || !read_exactly (w->from_fd, &dltime, sizeof (dltime))
+      || !read_int (w->from_fd, &urls)
+      || !read_wgint (w->from_fd, &len)
+      || !read_str (w->from_fd, &sessions))
+    {
+      xfree (res->file);
+      xfree (res->newloc);
+      xfree (url);
+      xfree (content_encoding);
+      return false;
+    }
+  res->status = status;
+  res->dt = dt;
+  res->len = len;
+
+  /* Do the bookkeeping of retrieve_url in the parent, which is the
+     process that converts links and reports statistics.  */
+  register_retrieval (job->url, res->newloc ? res->newloc : url, res->file,
+                      dt, res->newloc != NULL);
+  total_downloaded_bytes += bytes;
+  total_download_time += dltime;
+  numurls += urls;
+#ifdef HAVE_SSL
+  if (sessions)
+    ssl_sessions_merge (sessions);
+#endif
+  xfree (sessions);
+
+#ifdef ENABLE_IRI
+  if (job->iri)
+    set_content_encoding (job->iri, content_encoding);
+#endif
+  xfree (content_encoding);
+  xfree (url);
+  return true;
+}
+
+/* Wait until the result pipe of a worker is readable, for up to
+   TIMEOUT seconds or indefinitely if TIMEOUT is negative, and return
+   the worker's index.  Return -1 on timeout, and -2 if interrupted by
+   a signal.  */
+
+static int
+worker_ready (double timeout)
+{
+  int i, n, ms;
+
+  if (timeout < 0)
+    ms = -1;
+  else if (timeout >= INT_MAX / 1000)
+    ms = INT_MAX;
+  else
+    ms = timeout * 1000 + 0.999;
+
+#ifdef HAVE_SYS_EPOLL_H
+  if (epoll_fd >= 0)
+    {
+      for (;;)
+        {
+          while (ready_next < ready_count)
+            {
+              i = ready_events[ready_next++].data.u32;
+              if (workers[i].pid)
+                return i;
+            }
+          ready_next = 0;
+          ready_count = epoll_wait (epoll_fd, ready_events,
+                                    countof (ready_events), ms);
+          if (ready_count > 0)
+            continue;
+          n = ready_count;
+          ready_count = 0;
+          if (n == 0)
+            return -1;
+          if (errno == EINTR)
+            return -2;
+          logprintf (LOG_NOTQUIET, "epoll_wait: %s\n", strerror (errno));
+          abort ();
+        }
+    }
+#endif
+
+  /* Negative descriptors are ignored by poll.  */
+  for (i = 0; i < worker_count; i++)
+    {
+      struct worker *w = &workers[i];
+      poll_fds[i].fd = (w->pending && w->pid) ? w->from_fd : -1;
+      poll_fds[i].events = POLLIN;
+      poll_fds[i].revents = 0;
+    }
+  n = poll (poll_fds, worker_count, ms);
+  if (n == 0)
+    return -1;
+  if (n < 0 && errno == EINTR)
+    return -2;
+  if (n < 0)
+    {
+      logprintf (LOG_NOTQUIET, "poll: %s\n", strerror (errno));
+      abort ();
+    }
+  for (i = 0; i < worker_count; i++)
+    if (poll_fds[i].revents)
+      return i;
+  return -2;
+}
+
+/* Wait for the next retrieval to finish and store its outcome in
+   RES.  The caller is responsible for freeing RES->file and
+   RES->newloc.  Return false if there are no retrievals pending.  */
+
+bool
+workers_wait (struct worker_result *res)
+{
+  return workers_wait_timeout (res, -1);
+}
+
+/* Like workers_wait, but also return false if no retrieval finishes
+   within TIMEOUT seconds.  A negative TIMEOUT means no limit.  */
+
+bool
+workers_wait_timeout (struct worker_result *res, double timeout)
+{
+  while (jobs_pending)
+    {
+      struct worker_job *job;
+      struct worker *w;
+      int i;
+
+      /* Fail the jobs of the workers that are gone.  */
+      for (i = 0; workers_lost && i < worker_count; i++)
+        {
+          w = &workers[i];
+          if (!w->pending || w->pid)
+            continue;
+          job = &w->jobs[w->head];
+          res->status = READERR;
+          res->dt = 0;
+          res->len = 0;
+          res->file = res->newloc = NULL;
+          res->data = job->data;
+          xfree (job->url);
+          w->head = (w->head + 1) % WORKER_DEPTH;
+          --w->pending;
+          --jobs_pending;
+          if (job->iri)
+            inform_exit_status (res->status);
+          return true;
+        }
+
+      i = worker_ready (timeout);
+      if (i == -1)
+        return false;
+      if (i < 0)
+        continue;
+      w = &workers[i];
+      if (!w->pending || !worker_read_result (w, res))
+        {
+          /* There is nothing to read from an idle worker but the end
+             of the pipe.  */
+          worker_lost (w);
+          continue;
+        }
+      job = &w->jobs[w->head];
+      res->data = job->data;
+      xfree (job->url);
+      w->head = (w->head + 1) % WORKER_DEPTH;
+      --w->pending;
+      --jobs_pending;
+      /* A failed range is retried by segment.c, which reports the
+         outcome of the whole file.  */
+      if (job->iri)
+        inform_exit_status (res->status);
+      return true;
+    }
+  return false;
+}
+
+/* Stop the workers.  Workers that still have jobs pending are killed
+   and their jobs abandoned.  */
+
+void
+workers_stop (void)
+{
+  int i;
+
+  for (i = 0; i < worker_count; i++)
+    {
+      struct worker *w = &workers[i];
+      int j;
+      if (!w->pid)
+        continue;
+      close (w->to_fd);
+      close (w->from_fd);
+      if (w->pending)
+        kill (w->pid, SIGTERM);
+      waitpid (w->pid, NULL, 0);
+      for (j = 0; j < w->pending; j++)
+        xfree (w->jobs[(w->head + j) % WORKER_DEPTH].url);
+    }
+#ifdef HAVE_SYS_EPOLL_H
+  if (epoll_fd >= 0)
+    close (epoll_fd);
+  epoll_fd = -1;
+#endif
+  xfree (poll_fds);
+  xfree (workers);
+  worker_count = 0;
+  jobs_pending = workers_lost = 0;
+}
+
+#else  /* WINDOWS || MSDOS */
+
+/* Without fork, retrievals are always sequential.  */
+
+bool
+workers_start (int n _GL_UNUSED)
+{
+  return false;
+}
+
+int
+workers_count (void)
+{
+  return 0;
+}
+
+int
+workers_running (void)
+{
+  return 0;
+}
+
+bool
+workers_busy_p (int i _GL_UNUSED)
+{
+  return true;
+}
+
+bool
+workers_pending_p (void)
+{
+  return false;
+}
+
+int
+workers_slot (const char *key _GL_UNUSED)
+{
+  return 0;
+}
+
+int
+workers_submit (int i _GL_UNUSED, const char *url _GL_UNUSED,
+                const char *referer _GL_UNUSED, struct iri *iri _GL_UNUSED,
+                bool recursive _GL_UNUSED, void *data _GL_UNUSED)
+{
+  abort ();
+}
+
+int
+workers_submit_range (int i _GL_UNUSED, const char *url _GL_UNUSED,
+                      const char *proxy _GL_UNUSED,
+                      const char *file _GL_UNUSED, wgint start _GL_UNUSED,
+                      wgint end _GL_UNUSED, void *data _GL_UNUSED)
+{
+  abort ();
+}
+
+bool
+workers_wait (struct worker_result *res _GL_UNUSED)
+{
+  return false;
+}
+
+bool
+workers_wait_timeout (struct worker_result *res _GL_UNUSED,
+                      double timeout _GL_UNUSED)
+{
+  return false;
+}
+
+void
+workers_stop (void)
+{
+}
+
+#endif /* WINDOWS || MSDOS */
@@ -0,0 +1,61 @@
+/* Declarations for workers.c.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+OpenSSL or SSLeay licenses, the Free Software Foundation grants you
+additional permission to convey the resulting work.  Corresponding
+Source for a non-source form of such a combination shall include the
+source code for the parts of OpenSSL used as well as that of the
+covered work.  */
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+struct url;
+struct iri;
+
+/* The outcome of a retrieval performed by a worker, as it would have
+   been returned by retrieve_url.  */
+struct worker_result {
+  uerr_t status;                /* the status returned by retrieve_url */
+  int dt;                       /* the document type flags */
+  char *file;                   /* the local file, or NULL */
+  char *newloc;                 /* the URL redirected to, or NULL */
+  wgint len;                    /* bytes retrieved by a range job */
+  void *data;                   /* the data passed to workers_submit */
+};
+
+bool workers_start (int);
+int workers_count (void);
+int workers_running (void);
+bool workers_busy_p (int);
+bool workers_pending_p (void);
+int workers_slot (const char *);
+int workers_submit (int, const char *, const char *, struct iri *, bool,
+                    void *);
+int workers_submit_range (int, const char *, const char *, const char *,
+                          wgint, wgint, void *);
+bool workers_wait (struct worker_result *);
+bool workers_wait_timeout (struct worker_result *, double);
+void workers_stop (void);
+
+#endif /* WORKERS_H */
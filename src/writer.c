@@ -0,0 +1,254 @@
+/* Writing downloaded data in the background.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* With --write-buffer, fd_read_body hands the data it reads to a
+   thread that writes it to the output file, so that a slow disk or
+   network file system doesn't keep Wget from reading the connection.
+   Data is queued in a ring buffer of the given size.  When the buffer
+   is full, the reader waits for the writer, so a disk that is slower
+   than the network still limits the download, but its stalls are
+   absorbed.
+
+   The thread only calls write on the file descriptor; it touches none
+   of Wget's global state.  It is started for each download and joined
+   before fd_read_body returns, so no thread is running when the
+   workers of --parallel are forked.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "utils.h"
+#include "writer.h"
+
+#ifdef HAVE_PTHREAD
+
+static pthread_t writer_thread;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Signalled whenever data is queued or written, and when the queue is
+   closed.  */
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+
+/* The file descriptor written to, or -1 if no writer is running.  */
+static int writer_fd = -1;
+
+/* The ring buffer.  It is kept from one download to the next.  */
+static char *ring;
+static size_t ring_size;
+
+/* Total amounts of data queued and written since the writer was
+   started.  The data between them is in the ring buffer, at offsets
+   modulo RING_SIZE.  */
+static wgint queued, written;
+
+/* Set when no more data will be queued.  */
+static bool closing;
+
+/* The errno of the write that failed, or 0.  */
+static int write_errno;
+
+static void *
+writer_run (void *arg)
+{
+  (void) arg;
+  pthread_mutex_lock (&writer_lock);
+  for (;;)
+    {
+      size_t pos, size;
+      ssize_t res;
+
+      while (queued == written && !closing)
+        pthread_cond_wait (&writer_cond, &writer_lock);
+      if (queued == written)
+        break;
+
+      /* Write as much as is contiguous in the ring.  The reader only
+         fills the free part, so the lock needn't be held.  */
+      pos = written % ring_size;
+      size = MIN ((size_t) (queued - written), ring_size - pos);
+      pthread_mutex_unlock (&writer_lock);
+      do
+        res = write (writer_fd, ring + pos, size);
+      while (res < 0 && errno == EINTR);
+      pthread_mutex_lock (&writer_lock);
+
+      if (res < 0)
+        {
+          write_errno = errno;
+          pthread_cond_signal (&writer_cond);
+          break;
+        }
+      written += res;
+      pthread_cond_signal (&writer_cond);
+    }
+  pthread_mutex_unlock (&writer_lock);
+  return NULL;
+}
+
+/* Start writing the data passed to writer_write to OUT in the
+   background, if --write-buffer is in effect and OUT is a regular
+   file.  Returns false if the data should be written to OUT
+   directly.  */
+
+bool
+writer_start (FILE *out)
+{
+  struct_fstat st;
+
+  if (opt.write_buffer <= 0 || writer_fd >= 0)
+    return false;
+  if (fstat (fileno (out), &st) < 0 || !S_ISREG (st.st_mode))
+    return false;
+  /* Whatever was written to OUT so far must precede the queued
+     data.  */
+  if (fflush (out) != 0)
+    return false;
+
+  if (!ring || ring_size != (size_t) opt.write_buffer)
+    {
+      xfree (ring);
+      ring_size = opt.write_buffer;
+      ring = xmalloc (ring_size);
+    }
+  queued = written = 0;
+  closing = false;
+  write_errno = 0;
+  writer_fd = fileno (out);
+  if (pthread_create (&writer_thread, NULL, writer_run, NULL) != 0)
+    {
+      writer_fd = -1;
+      return false;
+    }
+  return true;
+}
+
+/* Queue the SIZE bytes in BUF for writing, waiting for room in the
+   buffer if necessary.  Returns 0 on success, or -1 with errno set if
+   an earlier write has failed.  */
+
+int
+writer_write (const char *buf, int size)
+{
+  int err;
+
+  pthread_mutex_lock (&writer_lock);
+  while (size > 0 && !write_errno)
+    {
+      size_t pos, room;
+
+      while (queued - written == (wgint) ring_size && !write_errno)
+        pthread_cond_wait (&writer_cond, &writer_lock);
+      if (write_errno)
+        break;
+
+      pos = queued % ring_size;
+      room = MIN (ring_size - (size_t) (queued - written), ring_size - pos);
+      room = MIN (room, (size_t) size);
+      pthread_mutex_unlock (&writer_lock);
+      memcpy (ring + pos, buf, room);
+      pthread_mutex_lock (&writer_lock);
+
+      queued += room;
+      buf += room;
+      size -= room;
+      pthread_cond_signal (&writer_cond);
+    }
+  err = write_errno;
+  pthread_mutex_unlock (&writer_lock);
+
+  if (err)
+    {
+      errno = err;
+      return -1;
+    }
+  return 0;
+}
+
+/* Wait until the queued data is written and stop the writer.  Returns
+   0 on success, or -1 with errno set if a write failed.  */
+
+int
+writer_finish (void)
+{
+  int err;
+
+  pthread_mutex_lock (&writer_lock);
+  closing = true;
+  pthread_cond_signal (&writer_cond);
+  pthread_mutex_unlock (&writer_lock);
+  pthread_join (writer_thread, NULL);
+
+  err = write_errno;
+  writer_fd = -1;
+  if (err)
+    {
+      DEBUGP (("Writing in the background failed after %s bytes.\n",
+               number_to_static_string (written)));
+      errno = err;
+      return -1;
+    }
+  return 0;
+}
+
+#else  /* not HAVE_PTHREAD */
+
+/* Without threads, downloaded data is always written directly.  */
+
+bool
+writer_start (FILE *out)
+{
+  return false;
+}
+
+int
+writer_write (const char *buf, int size)
+{
+  errno = EINVAL;
+  return -1;
+}
+
+int
+writer_finish (void)
+{
+  return 0;
+}
+
+#endif /* not HAVE_PTHREAD */
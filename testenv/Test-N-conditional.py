@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+from sys import exit
+import gzip
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that with --validator-file, Wget time-stamps files it
+    downloaded before with a single conditional GET, keeps the local file on
+    304 Not Modified and records the validators of the files it downloads.
+    When the server ignores the conditions, an unchanged Last-Modified keeps
+    the local file, even if the body is compressed and so differs in size.
+"""
+TEST_NAME = "Time-stamping with Conditional GET"
+############# File Definitions ###############################################
+old_page = """
+<html>
+<head>
+  <title>Main Page</title>
+</head>
+<body>
+  <p>
+    The page as it was downloaded before.
+  </p>
+</body>
+</html>
+"""
+old_data = "Old data.\n"
+new_data = "New data, which is longer.\n"
+packed_data = "Packed data, which compresses well, compresses well.\n"
+
+lm_old = "Sat, 09 Oct 2004 08:30:00 GMT"
+lm_new = "Sun, 10 Oct 2004 08:30:00 GMT"
+
+index_rules = {
+    "ExpectHeader"  : {
+        "If-None-Match"     : '"page-1"',
+        "If-Modified-Since" : lm_old
+    },
+    "Response"      : 304
+}
+data_rules = {
+    "ExpectHeader"  : {
+        "If-None-Match"     : '"data-1"'
+    },
+    "SendHeader"    : {
+        "ETag"              : '"data-2"',
+        "Last-Modified"     : lm_new
+    }
+}
+
+packed_rules = {
+    "SendHeader"    : {
+        "Content-Encoding"  : "gzip",
+        "ETag"              : '"packed-1"',
+        "Last-Modified"     : lm_old
+    }
+}
+
+validators = ("# Validators of the files downloaded by Wget with -N.\n"
+              "%d\t1097310600\thtml\t\"page-1\"\t%s\tindex.html\n"
+              "%d\t1097310600\t-\t\"data-1\"\t%s\tdata.txt\n"
+              "%d\t1097310600\t-\t\"packed-0\"\t%s\tpacked.txt\n"
+              % (len (old_page), lm_old, len (old_data), lm_old,
+                 len (packed_data), lm_old))
+new_record = ("%d\t1097397000\t-\t\"data-2\"\t%s\tdata.txt\n"
+              % (len (new_data), lm_new))
+
+index_server = WgetFile ("index.html", "Not to be downloaded.",
+                         rules=index_rules)
+data_server = WgetFile ("data.txt", new_data, rules=data_rules)
+# Were it downloaded again, the local file would end up with these contents.
+packed_server = WgetFile ("packed.txt",
+                          gzip.compress (b"Not to be downloaded.\n"),
+                          rules=packed_rules)
+
+index_local = WgetFile ("index.html", old_page, timestamp=1097310600)
+data_local = WgetFile ("data.txt", old_data, timestamp=1097310600)
+packed_local = WgetFile ("packed.txt", packed_data, timestamp=1097310600)
+validators_local = WgetFile ("validators", validators)
+
+data_txt = WgetFile ("data.txt", new_data)
+validators_txt = WgetFile ("validators", validators + new_record)
+
+WGET_OPTIONS = "-N --validator-file=validators"
+WGET_URLS = [["index.html", "data.txt", "packed.txt"]]
+
+Files = [[index_server, data_server, packed_server]]
+Existing_Files = [index_local, data_local, packed_local, validators_local]
+
+ExpectedReturnCode = 0
+ExpectedDownloadedFiles = [index_local, data_txt, packed_local, validators_txt]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files,
+    "LocalFiles"        : Existing_Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode
+}
+
+err = HTTPTest (
+                name=TEST_NAME,
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+from sys import exit
+import gzip
+import zlib
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that Wget asks for compressed bodies and decompresses
+    the gzip and deflate encodings, including raw deflate, while leaving
+    .gz files alone and asking for byte ranges uncompressed.
+"""
+TEST_NAME = "Content-Encoding Decompression"
+############# File Definitions ###############################################
+mainpage = """
+<html>
+<head>
+  <title>Main Page</title>
+</head>
+<body>
+  <p>
+    Some text that compresses rather well, rather well, rather well.
+  </p>
+</body>
+</html>
+"""
+datafile = "Deflated data.\n" * 50
+rawfile = "Raw deflated data.\n" * 50
+archive = gzip.compress (b"An archive, not an encoded body.\n")
+partialfile = "The beginning of a file, and its end.\n"
+
+raw_deflate = zlib.compressobj (9, zlib.DEFLATED, -zlib.MAX_WBITS)
+raw_data = raw_deflate.compress (rawfile.encode ()) + raw_deflate.flush ()
+
+compressed_rules = lambda encoding: {
+    "SendHeader"    : {
+        "Content-Encoding"  : encoding
+    },
+    "ExpectHeader"  : {
+        "Accept-Encoding"   : "gzip, deflate"
+    }
+}
+identity_rules = {
+    "ExpectHeader"  : {
+        "Accept-Encoding"   : "identity"
+    }
+}
+
+index_gz = WgetFile ("index.html", gzip.compress (mainpage.encode ()),
+                     rules=compressed_rules ("gzip"))
+data_deflate = WgetFile ("data.txt", zlib.compress (datafile.encode ()),
+                         rules=compressed_rules ("deflate"))
+raw_deflate = WgetFile ("raw.txt", raw_data, rules=compressed_rules ("deflate"))
+archive_gz = WgetFile ("archive.tar.gz", archive,
+                       rules=compressed_rules ("gzip"))
+partial_server = WgetFile ("partial.txt", partialfile, rules=identity_rules)
+
+index_html = WgetFile ("index.html", mainpage)
+data_txt = WgetFile ("data.txt", datafile)
+raw_txt = WgetFile ("raw.txt", rawfile)
+partial_local = WgetFile ("partial.txt", partialfile[:10])
+partial_txt = WgetFile ("partial.txt", partialfile)
+
+WGET_OPTIONS = "-c"
+WGET_URLS = [["index.html", "data.txt", "raw.txt", "archive.tar.gz",
+              "partial.txt"]]
+
+Files = [[index_gz, data_deflate, raw_deflate, archive_gz, partial_server]]
+Existing_Files = [partial_local]
+
+ExpectedReturnCode = 0
+ExpectedDownloadedFiles = [index_html, data_txt, raw_txt, archive_gz,
+                           partial_txt]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files,
+    "LocalFiles"        : Existing_Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode
+}
+
+err = HTTPTest (
+                name=TEST_NAME,
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+from sys import exit
+
+try:
+    import h2
+except ImportError:
+    exit (77)
+
+from test.http_test import HTTPTest
+from test.base_test import H2C
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that Wget sends request bodies over HTTP/2, here one
+    larger than the flow control window of the server, so that it has to
+    be sent as the window opens, and that it reuses the connection for the
+    next request.  It is skipped where the h2 Python package is not
+    installed.
+"""
+TEST_NAME = "HTTP2 POST with Prior Knowledge"
+############# File Definitions ###############################################
+File1 = "The first file."
+File2 = "The second file."
+Body = "".join ("Line %06d of a body larger than the window.\n" % i
+                for i in range (20000))
+
+A_File = WgetFile ("File1", File1)
+B_File = WgetFile ("File2", File2)
+Body_File = WgetFile ("body.txt", Body)
+
+WGET_OPTIONS = "--http2-prior-knowledge --method=post --body-file=body.txt"
+WGET_URLS = [["File1", "File2"]]
+
+Files = [[A_File, B_File]]
+Existing_Files = [Body_File]
+
+Request_List = [
+    [
+        "POST /File1",
+        "POST /File2"
+    ]
+]
+
+ExpectedReturnCode = 0
+ExpectedDownloadedFiles = [WgetFile ("File1", File1 + "\n" + Body),
+                           WgetFile ("File2", File2 + "\n" + Body),
+                           Body_File]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files,
+    "LocalFiles"        : Existing_Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode,
+    "FilesCrawled"      : Request_List,
+    "ExpectedConnections" : [1]
+}
+
+err = HTTPTest (
+                name=TEST_NAME,
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test,
+                protocols=(H2C,)
+).begin ()
+
+exit (err)
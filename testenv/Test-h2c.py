@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+from sys import exit
+
+try:
+    import h2
+except ImportError:
+    exit (77)
+
+from test.http_test import HTTPTest
+from test.base_test import H2C
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that Wget speaks HTTP/2 right away to a server it is
+    told supports it, retrieving several files over a single connection
+    and reporting a missing one.  It is skipped where the h2 Python
+    package is not installed.
+"""
+TEST_NAME = "HTTP2 with Prior Knowledge"
+############# File Definitions ###############################################
+File1 = "Some text sent in a single DATA frame.\n"
+File2 = "".join ("Line %06d of a file sent in many DATA frames.\n" % i
+                 for i in range (5000))
+
+A_File = WgetFile ("File1", File1)
+B_File = WgetFile ("File2", File2)
+
+WGET_OPTIONS = "--http2-prior-knowledge"
+WGET_URLS = [["File1", "File2", "File3"]]
+
+Files = [[A_File, B_File]]
+
+Request_List = [
+    [
+        "GET /File1",
+        "GET /File2",
+        "GET /File3"
+    ]
+]
+
+ExpectedReturnCode = 8
+ExpectedDownloadedFiles = [A_File, B_File]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode,
+    "FilesCrawled"      : Request_List,
+    "ExpectedConnections" : [1]
+}
+
+err = HTTPTest (
+                name=TEST_NAME,
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test,
+                protocols=(H2C,)
+).begin ()
+
+exit (err)
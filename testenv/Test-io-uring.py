@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+import ctypes
+import os
+import platform
+from sys import exit
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that Wget retrieves files over a persistent
+    connection with --io-uring.  It is skipped where io_uring is not
+    available.
+"""
+
+def io_uring_available ():
+    # io_uring_setup has the same number on all architectures but Alpha.
+    if platform.system () != "Linux":
+        return False
+    try:
+        libc = ctypes.CDLL (None, use_errno=True)
+    except OSError:
+        return False
+    params = ctypes.create_string_buffer (120)
+    fd = libc.syscall (425, 1, params)
+    if fd < 0:
+        return False
+    os.close (fd)
+    return True
+
+if not io_uring_available ():
+    exit (77)
+
+TEST_NAME = "Retrieval through io_uring"
+############# File Definitions ###############################################
+Small = "A small file, read in a single receive.\n"
+Big = "".join ("Line %06d of a file read in many receives.\n" % i
+               for i in range (20000))
+
+Small_File = WgetFile ("small.txt", Small)
+Big_File = WgetFile ("big.txt", Big)
+
+WGET_OPTIONS = "--io-uring --read-timeout=10"
+WGET_URLS = [["small.txt", "big.txt"]]
+
+Files = [[Small_File, Big_File]]
+
+ExpectedReturnCode = 0
+ExpectedDownloadedFiles = [Small_File, Big_File]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode
+}
+
+err = HTTPTest (
+                name=TEST_NAME,
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that Wget retrieves the URLs of an input file with
+    several worker processes, numbering files that are retrieved twice
+    in the order the URLs appear in the file, and reporting the exit
+    status of failed retrievals.  Keep-alive is turned off, since the
+    test server handles one connection at a time.
+"""
+TEST_NAME = "Input File Parallel"
+############# File Definitions ###############################################
+File1 = "Would you like some Tea?"
+File2 = "With lemon or cream?"
+File3 = "Sure you're joking Mr. Feynman"
+File1_again = "Would you like some Tea?"
+
+input_list = """File1
+File2
+File3
+File1
+nonexistent
+"""
+
+File1_File = WgetFile ("File1", File1)
+File2_File = WgetFile ("File2", File2)
+File3_File = WgetFile ("File3", File3)
+File1_Dup = WgetFile ("File1.1", File1_again)
+List_File = WgetFile ("list.txt", input_list)
+
+WGET_OPTIONS = "--parallel=3 --no-http-keep-alive -i list.txt " \
+               "-B http://127.0.0.1:{{port}}/"
+WGET_URLS = [[]]
+
+Files = [[File1_File, File2_File, File3_File]]
+Existing_Files = [List_File]
+
+ExpectedReturnCode = 8
+ExpectedDownloadedFiles = [File1_File, File2_File, File3_File, File1_Dup,
+                           List_File]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files,
+    "LocalFiles"        : Existing_Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode
+}
+
+err = HTTPTest (
+                name=TEST_NAME,
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
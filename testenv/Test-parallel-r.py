@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that Wget retrieves the same set of files when
+    recursing with several worker processes, and that the exit status
+    of a failed retrieval done by a worker is reported.  Keep-alive is
+    turned off, since the test server handles one connection at a time.
+"""
+TEST_NAME = "Recursive Parallel"
+############# File Definitions ###############################################
+mainpage = """
+<html>
+<head>
+  <title>Main Page</title>
+</head>
+<body>
+  <p>
+    Links to a <a href="secondpage.html">second page</a>,
+    a <a href="thirdpage.html">third page</a>,
+    a <a href="dummy.txt">text file</a>
+    and a <a href="nonexistent">broken link</a>.
+  </p>
+</body>
+</html>
+"""
+
+secondpage = """
+<html>
+<head>
+  <title>Second Page</title>
+</head>
+<body>
+  <p>
+    Back to the <a href="index.html">main page</a>, and a
+    <a href="other.txt">text file</a>.
+  </p>
+</body>
+</html>
+"""
+
+thirdpage = """
+<html>
+<head>
+  <title>Third Page</title>
+</head>
+<body>
+  <p>
+    Another link to the <a href="other.txt">text file</a>.
+  </p>
+</body>
+</html>
+"""
+
+dummyfile = "Don't care."
+otherfile = "Don't care either."
+
+
+index_html = WgetFile ("index.html", mainpage)
+secondpage_html = WgetFile ("secondpage.html", secondpage)
+thirdpage_html = WgetFile ("thirdpage.html", thirdpage)
+dummy_txt = WgetFile ("dummy.txt", dummyfile)
+other_txt = WgetFile ("other.txt", otherfile)
+
+Request_List = [
+    [
+        "GET /",
+        "GET /robots.txt",
+        "GET /secondpage.html",
+        "GET /thirdpage.html",
+        "GET /dummy.txt",
+        "GET /nonexistent",
+        "GET /index.html",
+        "GET /other.txt"
+    ]
+]
+
+WGET_OPTIONS = "-r -nH --parallel=3 --no-http-keep-alive"
+WGET_URLS = [[""]]
+
+Files = [[index_html, secondpage_html, thirdpage_html, dummy_txt, other_txt]]
+
+ExpectedReturnCode = 8
+ExpectedDownloadedFiles = [index_html, secondpage_html, thirdpage_html,
+                           dummy_txt, other_txt]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode,
+    "FilesCrawled"      : Request_List
+}
+
+err = HTTPTest (
+                name=TEST_NAME,
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
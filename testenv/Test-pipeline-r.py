@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that Wget retrieves the same set of files when
+    recursing with several requests pipelined on a connection, that the
+    requests are indeed sent ahead of the responses, and that a broken
+    link in the middle of a pipeline is reported.
+"""
+TEST_NAME = "Recursive Pipelined"
+############# File Definitions ###############################################
+mainpage = """
+<html>
+<head>
+  <title>Main Page</title>
+</head>
+<body>
+  <p>
+    Links to a <a href="secondpage.html">second page</a>,
+    a <a href="thirdpage.html">third page</a>,
+    a <a href="dummy.txt">text file</a>
+    and a <a href="nonexistent">broken link</a>.
+  </p>
+</body>
+</html>
+"""
+
+secondpage = """
+<html>
+<head>
+  <title>Second Page</title>
+</head>
+<body>
+  <p>
+    Back to the <a href="index.html">main page</a>, and a
+    <a href="other.txt">text file</a>.
+  </p>
+</body>
+</html>
+"""
+
+thirdpage = """
+<html>
+<head>
+  <title>Third Page</title>
+</head>
+<body>
+  <p>
+    Another link to the <a href="other.txt">text file</a>.
+  </p>
+</body>
+</html>
+"""
+
+dummyfile = "Don't care."
+otherfile = "Don't care either."
+
+
+index_html = WgetFile ("index.html", mainpage)
+secondpage_html = WgetFile ("secondpage.html", secondpage)
+thirdpage_html = WgetFile ("thirdpage.html", thirdpage)
+# The response for the text file is held until the next request arrives, so
+# that a request pipelined after it is seen as such however slowly it is
+# written.
+dummy_rules = {
+    "WaitForNextRequest" : 5
+}
+
+dummy_txt = WgetFile ("dummy.txt", dummyfile, rules=dummy_rules)
+other_txt = WgetFile ("other.txt", otherfile)
+
+Request_List = [
+    [
+        "GET /",
+        "GET /robots.txt",
+        "GET /secondpage.html",
+        "GET /thirdpage.html",
+        "GET /dummy.txt",
+        "GET /nonexistent",
+        "GET /index.html",
+        "GET /other.txt"
+    ]
+]
+
+# Once the head of the response for the second page arrives, the requests
+# for the third page, the text file and the broken link are written at once,
+# so the last of them is there before the server answers the one before it.
+Pipelined_List = [["GET /nonexistent"]]
+
+WGET_OPTIONS = "-r -nH --http-pipeline=4"
+WGET_URLS = [[""]]
+
+Files = [[index_html, secondpage_html, thirdpage_html, dummy_txt, other_txt]]
+
+ExpectedReturnCode = 8
+ExpectedDownloadedFiles = [index_html, secondpage_html, thirdpage_html,
+                           dummy_txt, other_txt]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode,
+    "FilesCrawled"      : Request_List,
+    "RequestsPipelined" : Pipelined_List
+}
+
+err = HTTPTest (
+                name=TEST_NAME,
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that Wget recurses breadth-first, and keeps to the
+    maximum depth, when most of the queued URLs are kept in a temporary
+    file because of a small --queue-window.
+"""
+TEST_NAME = "Recursive Queue Window"
+############# File Definitions ###############################################
+page = lambda title, links: """
+<html>
+<head>
+  <title>%s</title>
+</head>
+<body>
+  <p>
+    %s
+  </p>
+</body>
+</html>
+""" % (title, "\n    ".join ('<a href="%s">%s</a>' % (l, l) for l in links))
+
+index_html = WgetFile ("index.html", page ("Main Page", ["a.html", "b.html"]))
+a_html = WgetFile ("a.html", page ("Page A", ["a1.txt", "a2.html"]))
+b_html = WgetFile ("b.html", page ("Page B", ["b1.txt", "a1.txt"]))
+a2_html = WgetFile ("a2.html", page ("Page A2", ["deep.txt"]))
+a1_txt = WgetFile ("a1.txt", "A1.")
+b1_txt = WgetFile ("b1.txt", "B1.")
+deep_txt = WgetFile ("deep.txt", "Too deep.")
+
+Request_List = [
+    [
+        "GET /",
+        "GET /robots.txt",
+        "GET /a.html",
+        "GET /b.html",
+        "GET /a1.txt",
+        "GET /a2.html",
+        "GET /b1.txt"
+    ]
+]
+
+WGET_OPTIONS = "-r -l 2 -nH --queue-window=1"
+WGET_URLS = [[""]]
+
+Files = [[index_html, a_html, b_html, a2_html, a1_txt, b1_txt, deep_txt]]
+
+ExpectedReturnCode = 0
+ExpectedDownloadedFiles = [index_html, a_html, b_html, a1_txt, a2_html,
+                           b1_txt]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode,
+    "FilesCrawled"      : Request_List
+}
+
+err = HTTPTest (
+                name=TEST_NAME,
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that Wget retrieves a large file in segments over
+    several connections, resuming an interrupted segmented download
+    from its control file with -c, and that the control file is removed
+    once the file is complete.  Keep-alive is turned off, since the test
+    server handles one connection at a time.
+"""
+TEST_NAME = "Segmented Retrieval"
+############# File Definitions ###############################################
+Big = "".join ("Line %07d of a file long enough to be split.\n" % i
+               for i in range (60000))
+Half = len (Big) // 2
+
+File_rules = {
+    "SendHeader"        : {
+        "Accept-Ranges" : "bytes"
+    }
+}
+
+Big_File = WgetFile ("bigfile", Big, rules=File_rules)
+Resumed_File = WgetFile ("resumed", Big, rules=File_rules)
+
+# The first chunk of "resumed" is on disk already; the rest is garbage
+# that must be overwritten.
+Partial_File = WgetFile ("resumed", Big[:1048576] + "x" * (len (Big) - 1048576))
+Control_File = WgetFile ("resumed.wget-segments",
+                         "# Wget segmented download control file.\n"
+                         "length %d chunk 1048576\n"
+                         "done 0\n" % len (Big))
+
+WGET_OPTIONS = "-c --segments=3 --no-http-keep-alive"
+WGET_URLS = [["bigfile", "resumed"]]
+
+Files = [[Big_File, Resumed_File]]
+Existing_Files = [Partial_File, Control_File]
+
+ExpectedReturnCode = 0
+ExpectedDownloadedFiles = [Big_File, Resumed_File]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files,
+    "LocalFiles"        : Existing_Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode
+}
+
+err = HTTPTest (
+                name=TEST_NAME,
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+from sys import exit
+import gzip
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that Wget writes downloaded files correctly when
+    the data is written in the background with --write-buffer.  The
+    buffer is much smaller than the files, so the download has to wait
+    for the writer, and resuming a file with -c appends to it.
+"""
+TEST_NAME = "Background Writing"
+############# File Definitions ###############################################
+Big = "".join ("Line %06d of a file written in the background.\n" % i
+               for i in range (20000))
+Text = "Compressed data, written in the background.\n" * 2000
+Partial = Big[:100000]
+
+Compressed_rules = {
+    "SendHeader"        : {
+        "Content-Encoding"  : "gzip"
+    }
+}
+
+Big_File = WgetFile ("bigfile", Big)
+Compressed_Server = WgetFile ("text.txt", gzip.compress (Text.encode ()),
+                              rules=Compressed_rules)
+Resumed_Server = WgetFile ("resumed", Big)
+
+Compressed_File = WgetFile ("text.txt", Text)
+Partial_File = WgetFile ("resumed", Partial)
+Resumed_File = WgetFile ("resumed", Big)
+
+WGET_OPTIONS = "-c --write-buffer=4k"
+WGET_URLS = [["bigfile", "text.txt", "resumed"]]
+
+Files = [[Big_File, Compressed_Server, Resumed_Server]]
+Existing_Files = [Partial_File]
+
+ExpectedReturnCode = 0
+ExpectedDownloadedFiles = [Big_File, Compressed_File, Resumed_File]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files,
+    "LocalFiles"        : Existing_Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode
+}
+
+err = HTTPTest (
+                name=TEST_NAME,
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
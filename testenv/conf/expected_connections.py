@@ -0,0 +1,22 @@
+from misc.colour_terminal import print_red
+from conf import hook
+from exc.test_failed import TestFailed
+
+""" Post-Test Hook: ExpectedConnections
+This is a post test hook that checks the number of connections Wget opened to
+each server, in tests that check the reuse of persistent connections. It
+expects a list with the number for each server.
+"""
+
+
+@hook()
+class ExpectedConnections:
+    def __init__(self, connections):
+        self.connections = connections
+
+    def __call__(self, test_obj):
+        for expected, count in zip(self.connections,
+                                   test_obj.connection_counts()):
+            if count != expected:
+                print_red ("%d connections instead of %d." % (count, expected))
+                raise TestFailed('Connections were not reused as expected.')
@@ -26,8 +26,12 @@ class ExpectedFiles:
             for name in files:
                 f = {'content': ''}
                 file_path = os.path.join(parent, name)
-                with open(file_path) as fp:
-                    f['content'] = fp.read()
+                with open(file_path, 'rb') as fp:
+                    content = fp.read()
+                try:
+                    f['content'] = content.decode('utf-8')
+                except UnicodeDecodeError:
+                    f['content'] = content
                 snapshot[file_path[2:]] = f
 
         return snapshot
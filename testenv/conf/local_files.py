@@ -1,3 +1,4 @@
+import os
 from conf import hook
 
 """ Pre-Test Hook: LocalFiles
@@ -16,3 +17,5 @@ class LocalFiles:
         for f in self.local_files:
             with open(f.name, 'w') as fp:
                 fp.write(f.content)
+            if f.timestamp is not None:
+                os.utime(f.name, (f.timestamp, f.timestamp))
@@ -0,0 +1,26 @@
+from misc.colour_terminal import print_red
+from conf import hook
+from exc.test_failed import TestFailed
+
+""" Post-Test Hook: RequestsPipelined
+This is a post test hook that is invoked in tests that check the pipelining of
+HTTP requests. It expects a list of the request lines that Wget must have sent
+before the response to the preceding request on the same connection was
+started. If the server did not receive any of them that early, it raises a
+TestFailed exception.
+"""
+
+
+@hook()
+class RequestsPipelined:
+    def __init__(self, requests):
+        self.requests = requests
+
+    def __call__(self, test_obj):
+        for requests, pipelined in zip(map(set, self.requests),
+                                       test_obj.requests_pipelined()):
+            missing = requests.difference(pipelined)
+
+            if missing:
+                print_red (str(missing))
+                raise TestFailed('Not all requests were pipelined.')
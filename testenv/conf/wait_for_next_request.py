@@ -0,0 +1,14 @@
+from conf import rule
+
+""" Rule: WaitForNextRequest
+When this rule is set against a certain file, the server holds its response to
+a request for the said file until the client has sent its next request on the
+connection, but for no more than the given number of seconds. This lets a
+client that pipelines its requests be told apart from one that does not,
+however slowly it writes them. """
+
+
+@rule()
+class WaitForNextRequest:
+    def __init__(self, timeout):
+        self.timeout = timeout
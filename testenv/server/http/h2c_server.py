@@ -0,0 +1,144 @@
+from socketserver import ThreadingMixIn, TCPServer, BaseRequestHandler
+import threading
+
+import h2.config
+import h2.connection
+import h2.events
+
+
+class H2CServer (ThreadingMixIn, TCPServer):
+    """ This class implements a server that speaks HTTP/2 over cleartext TCP
+    right away, as to clients with prior knowledge of its support for HTTP/2.
+    It serves the same virtual set of files made by the WgetFile class as the
+    HTTP server, but doesn't apply any rules to them. It also counts the
+    connections it accepts, so that tests can check their reuse. """
+
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__ (self, address, handler):
+        TCPServer.__init__ (self, address, handler)
+        self.request_headers = list ()
+        self.connections = 0
+        self.lock = threading.Lock ()
+
+    def server_conf (self, filelist, conf_dict):
+        self.server_configs = conf_dict
+        self.fileSys = filelist
+
+    def get_req_headers (self):
+        return self.request_headers
+
+    def get_connection_count (self):
+        return self.connections
+
+
+class _H2CHandler (BaseRequestHandler):
+    """ Handle an HTTP/2 connection: answer each request when its stream
+    ends, sending the responses as the flow control windows allow. """
+
+    def handle (self):
+        with self.server.lock:
+            self.server.connections += 1
+        config = h2.config.H2Configuration (client_side=False,
+                                            header_encoding='utf-8')
+        self.conn = h2.connection.H2Connection (config=config)
+        self.conn.initiate_connection ()
+        self.request.sendall (self.conn.data_to_send ())
+
+        # Request heads and bodies of the open streams, and the response
+        # data waiting for the window to open.
+        self.heads = dict ()
+        self.bodies = dict ()
+        self.pending = dict ()
+
+        while True:
+            data = self.request.recv (65536)
+            if not data:
+                break
+            for event in self.conn.receive_data (data):
+                self.handle_event (event)
+            self.send_pending ()
+            self.request.sendall (self.conn.data_to_send ())
+            if self.conn.state_machine.state == \
+               h2.connection.ConnectionState.CLOSED:
+                break
+
+    def handle_event (self, event):
+        if isinstance (event, h2.events.RequestReceived):
+            self.heads[event.stream_id] = dict (event.headers)
+            self.bodies[event.stream_id] = list ()
+        elif isinstance (event, h2.events.DataReceived):
+            self.bodies[event.stream_id].append (event.data)
+            self.conn.acknowledge_received_data (
+                event.flow_controlled_length, event.stream_id)
+        elif isinstance (event, h2.events.StreamEnded):
+            self.respond (event.stream_id,
+                          self.heads.pop (event.stream_id),
+                          b''.join (self.bodies.pop (event.stream_id)))
+        elif isinstance (event, h2.events.StreamReset):
+            self.pending.pop (event.stream_id, None)
+
+    def respond (self, stream_id, head, body):
+        method = head[':method']
+        path = head[':path'][1:] or "index.html"
+        with self.server.lock:
+            self.server.request_headers.append (method + " " + head[':path'])
+
+        fileSys = self.server.fileSys
+        if method == "POST" and path in fileSys:
+            # Append the body to the file, like the HTTP server does.
+            fileSys[path] = fileSys[path] + "\n" + body.decode ('utf-8')
+            status = 200
+        elif method == "POST":
+            fileSys[path] = body.decode ('utf-8')
+            status = 201
+        elif path in fileSys:
+            status = 200
+        else:
+            status = 404
+
+        content = fileSys.get (path, "") if status == 200 else ""
+        if isinstance (content, str):
+            content = content.encode ('utf-8')
+        self.conn.send_headers (stream_id, [
+            (':status', str (status)),
+            ('content-type', 'text/plain'),
+            ('content-length', str (len (content)))
+        ], end_stream=(method == "HEAD" or not content))
+        if method != "HEAD" and content:
+            self.pending[stream_id] = content
+
+    def send_pending (self):
+        for stream_id in list (self.pending):
+            content = self.pending[stream_id]
+            size = min (len (content),
+                        self.conn.local_flow_control_window (stream_id))
+            while size > 0:
+                chunk = min (size, self.conn.max_outbound_frame_size)
+                self.conn.send_data (stream_id, content[:chunk])
+                content = content[chunk:]
+                size -= chunk
+            if content:
+                self.pending[stream_id] = content
+            else:
+                self.conn.end_stream (stream_id)
+                del self.pending[stream_id]
+
+
+class H2Cd (threading.Thread):
+
+    def __init__ (self, addr=None):
+        threading.Thread.__init__ (self)
+        if addr is None:
+            addr = ('localhost', 0)
+        self.server_inst = H2CServer (addr, _H2CHandler)
+        self.server_address = self.server_inst.socket.getsockname()[:2]
+
+    def run (self):
+        self.server_inst.serve_forever ()
+
+    def server_conf (self, file_list, server_rules):
+        self.server_inst.server_conf (file_list, server_rules)
+
+# vim: set ts=4 sts=4 sw=4 tw=80 et :
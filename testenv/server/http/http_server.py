@@ -6,6 +6,7 @@ from base64 import b64encode
 from random import random
 from hashlib import md5
 import threading
+import select
 import socket
 import os
 
@@ -18,6 +19,8 @@ class StoppableHTTPServer (HTTPServer):
     method. """
 
     request_headers = list ()
+    pipelined_requests = list ()
+    connections = 0
 
     """ Define methods for configuring the Server. """
 
@@ -29,6 +32,12 @@ class StoppableHTTPServer (HTTPServer):
     def get_req_headers (self):
         return self.request_headers
 
+    def get_pipelined_requests (self):
+        return self.pipelined_requests
+
+    def get_connection_count (self):
+        return self.connections
+
 
 class HTTPSServer (StoppableHTTPServer):
     """ The HTTPSServer class extends the StoppableHTTPServer class with
@@ -68,6 +77,14 @@ class _Handler (BaseHTTPRequestHandler):
     # HTTP/1.0 which is the default with the http.server module.
     protocol_version = 'HTTP/1.1'
 
+    # Set when the next request on the connection had already arrived as
+    # the response to the current one was started.
+    next_pipelined = False
+
+    def setup (self):
+        BaseHTTPRequestHandler.setup (self)
+        self.server.connections += 1
+
     """ Define functions for various HTTP Requests. """
 
     def do_HEAD (self):
@@ -81,10 +98,12 @@ class _Handler (BaseHTTPRequestHandler):
 
         content, start = self.send_head ("GET")
         if content:
+            if isinstance (content, str):
+                content = content.encode ('utf-8')
             if start is None:
-                self.wfile.write (content.encode ('utf-8'))
+                self.wfile.write (content)
             else:
-                self.wfile.write (content.encode ('utf-8')[start:])
+                self.wfile.write (content[start:self.range_end + 1])
 
     def do_POST (self):
         """ According to RFC 7231 sec 4.3.3, if the resource requested in a POST
@@ -132,8 +151,27 @@ class _Handler (BaseHTTPRequestHandler):
 
     """ End of HTTP Request Method Handlers. """
 
+    def send_response (self, code, message=None):
+        """ Before starting the response, note whether the client has
+        already sent its next request, which it only does when pipelining
+        requests. """
+        self.next_pipelined = self.request_waiting ()
+        BaseHTTPRequestHandler.send_response (self, code, message)
+
     """ Helper functions for the Handlers. """
 
+    def request_waiting (self):
+        """ Return True if more data from the client is waiting on the
+        connection, without waiting for it. """
+        timeout = self.connection.gettimeout ()
+        self.connection.setblocking (False)
+        try:
+            return len (self.rfile.peek (1)) > 0
+        except OSError:
+            return False
+        finally:
+            self.connection.settimeout (timeout)
+
     def parse_range_header (self, header_line, length):
         import re
         if header_line is None:
@@ -141,10 +179,14 @@ class _Handler (BaseHTTPRequestHandler):
         if not header_line.startswith ("bytes="):
             raise ServerError ("Cannot parse header Range: %s" %
                                (header_line))
-        regex = re.match (r"^bytes=(\d*)\-$", header_line)
+        regex = re.match (r"^bytes=(\d*)\-(\d*)$", header_line)
         range_start = int (regex.group (1))
         if range_start >= length:
             raise ServerError ("Range Overflow")
+        if regex.group (2):
+            self.range_end = min (int (regex.group (2)), length - 1)
+        else:
+            self.range_end = length - 1
         return range_start
 
     def get_body_data (self):
@@ -321,6 +363,10 @@ class _Handler (BaseHTTPRequestHandler):
             raise ServerError ("Unable to Authenticate")
 
 
+    def WaitForNextRequest (self, wait_obj):
+        if not self.request_waiting ():
+            select.select ([self.connection], [], [], wait_obj.timeout)
+
     def ExpectHeader (self, header_obj):
         exp_headers = header_obj.headers
         for header_line in exp_headers:
@@ -343,6 +389,8 @@ class _Handler (BaseHTTPRequestHandler):
     def __log_request (self, method):
         req = method + " " + self.path
         self.server.request_headers.append (req)
+        if self.next_pipelined:
+            self.server.pipelined_requests.append (req)
 
     def send_head (self, method):
         """ Common code for GET and HEAD Commands.
@@ -395,9 +443,9 @@ class _Handler (BaseHTTPRequestHandler):
                 self.send_header ("Accept-Ranges", "bytes")
                 self.send_header ("Content-Range",
                                   "bytes %d-%d/%d" % (self.range_begin,
-                                                      content_length - 1,
+                                                      self.range_end,
                                                       content_length))
-                content_length -= self.range_begin
+                content_length = self.range_end + 1 - self.range_begin
             cont_type = self.guess_type (path)
             self.send_header ("Content-type", cont_type)
             self.send_header ("Content-Length", content_length)
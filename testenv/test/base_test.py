@@ -11,6 +11,10 @@ import conf
 
 HTTP = "HTTP"
 HTTPS = "HTTPS"
+H2C = "H2C"
+
+# The URL schemes of the protocols not named after theirs.
+SCHEMES = {H2C: "http"}
 
 
 class BaseTest:
@@ -120,7 +124,8 @@ class BaseTest:
             # 5 e
             # 3 c
             for url in urls:
-                cmd_line += '%s://%s/%s ' % (protocol.lower(), domain, url)
+                scheme = SCHEMES.get(protocol, protocol.lower())
+                cmd_line += '%s://%s/%s ' % (scheme, domain, url)
 
         print(cmd_line)
 
@@ -175,6 +180,8 @@ class BaseTest:
         self.hook_call(self.post_configs, 'Post Test Function')
 
     def _replace_substring (self, string):
+        if isinstance (string, bytes):
+            return string
         pattern = re.compile ('\{\{\w+\}\}')
         match_obj = pattern.search (string)
         if match_obj is not None:
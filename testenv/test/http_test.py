@@ -1,6 +1,6 @@
 from misc.colour_terminal import print_green
 from server.http.http_server import HTTPd, HTTPSd
-from test.base_test import BaseTest, HTTP, HTTPS
+from test.base_test import BaseTest, HTTP, HTTPS, H2C
 
 
 class HTTPTest(BaseTest):
@@ -30,8 +30,14 @@ class HTTPTest(BaseTest):
             print_green('Test Passed.')
 
     def instantiate_server_by(self, protocol):
-        server = {HTTP: HTTPd,
-                  HTTPS: HTTPSd}[protocol]()
+        if protocol == H2C:
+            # The h2c server needs the h2 package, which tests using it
+            # check for.
+            from server.http.h2c_server import H2Cd
+            server = H2Cd()
+        else:
+            server = {HTTP: HTTPd,
+                      HTTPS: HTTPSd}[protocol]()
         server.start()
 
         return server
@@ -40,6 +46,14 @@ class HTTPTest(BaseTest):
         return [s.server_inst.get_req_headers()
                 for s in self.servers]
 
+    def connection_counts(self):
+        return [s.server_inst.get_connection_count()
+                for s in self.servers]
+
+    def requests_pipelined(self):
+        return [s.server_inst.get_pipelined_requests()
+                for s in self.servers]
+
     def stop_server(self):
         for server in self.servers:
             server.server_inst.shutdown()